@@ -28,6 +28,11 @@
 #define BOOST_TEST_MODULE connection
 #include <boost/test/unit_test.hpp>
 
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
 #include "connection_tu2.hpp"
 
 // Include special debugging transport
@@ -228,6 +233,45 @@ BOOST_AUTO_TEST_CASE( basic_websocket_request ) {
     BOOST_CHECK(run_server_test(s,input) == output);
 }
 
+bool validate_select_chat(server * s, websocketpp::connection_hdl hdl) {
+    s->get_con_from_hdl(hdl)->select_subprotocol("chat");
+    return true;
+}
+
+void record_response_headers(server * s, std::vector<std::string> & headers,
+    websocketpp::connection_hdl hdl)
+{
+    server::connection_ptr con = s->get_con_from_hdl(hdl);
+
+    headers.push_back(con->get_response_header("Upgrade"));
+    headers.push_back(con->get_response_header("Connection"));
+    headers.push_back(con->get_response_header("Server"));
+    headers.push_back(con->get_response_header("Sec-WebSocket-Accept"));
+    headers.push_back(con->get_response_header("Sec-WebSocket-Protocol"));
+}
+
+BOOST_AUTO_TEST_CASE( templated_response_headers_in_open_handler ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Protocol: chat\r\n\r\n";
+    std::string output = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\nSec-WebSocket-Protocol: chat\r\nServer: foo\r\nUpgrade: websocket\r\n\r\n";
+
+    std::vector<std::string> headers;
+
+    server s;
+    s.set_user_agent("foo");
+    s.set_validate_handler(bind(&validate_select_chat,&s,::_1));
+    s.set_open_handler(bind(&record_response_headers,&s,
+        websocketpp::lib::ref(headers),::_1));
+
+    BOOST_CHECK_EQUAL(run_server_test(s,input), output);
+
+    BOOST_REQUIRE_EQUAL(headers.size(), 5);
+    BOOST_CHECK_EQUAL(headers[0], "websocket");
+    BOOST_CHECK_EQUAL(headers[1], "Upgrade");
+    BOOST_CHECK_EQUAL(headers[2], "foo");
+    BOOST_CHECK_EQUAL(headers[3], "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+    BOOST_CHECK_EQUAL(headers[4], "chat");
+}
+
 BOOST_AUTO_TEST_CASE( http_request ) {
     std::string input = "GET /foo/bar HTTP/1.1\r\nHost: www.example.com\r\nOrigin: http://www.example.com\r\n\r\n";
     std::string output = "HTTP/1.1 200 OK\r\nContent-Length: 8\r\nServer: ";
@@ -278,6 +322,351 @@ BOOST_AUTO_TEST_CASE( deferred_http_request ) {
     
 }
 
+BOOST_AUTO_TEST_CASE( http_keep_alive_pipelined ) {
+    std::string input = "GET /foo HTTP/1.1\r\nHost: www.example.com\r\n\r\n"
+                        "GET /bar/baz HTTP/1.1\r\nHost: www.example.com\r\n\r\n"
+                        "GET /end HTTP/1.1\r\nHost: www.example.com\r\nConnection: close\r\n\r\n"
+                        "GET /ignored HTTP/1.1\r\nHost: www.example.com\r\n\r\n";
+    std::string output = "HTTP/1.1 200 OK\r\nContent-Length: 4\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\n\r\n/fooHTTP/1.1 200 OK\r\nContent-Length: 8\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\n\r\n/bar/bazHTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 4\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\n\r\n/end";
+
+    server s;
+    s.set_http_keep_alive_timeout(5000);
+    s.set_http_handler(bind(&http_func,&s,::_1));
+
+    BOOST_CHECK_EQUAL(run_server_test(s,input), output);
+}
+
+BOOST_AUTO_TEST_CASE( http_keep_alive_split_reads ) {
+    std::string first = "GET /foo HTTP/1.1\r\nHost: www.example.com\r\n\r\nGET /b";
+    std::string second = "ar HTTP/1.1\r\nHost: www.example.com\r\n\r\n";
+    std::string output = "HTTP/1.1 200 OK\r\nContent-Length: 4\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\n\r\n/fooHTTP/1.1 200 OK\r\nContent-Length: 4\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\n\r\n/bar";
+
+    server s;
+    s.set_http_keep_alive_timeout(5000);
+    s.set_http_handler(bind(&http_func,&s,::_1));
+    s.clear_access_channels(websocketpp::log::alevel::all);
+    s.clear_error_channels(websocketpp::log::elevel::all);
+
+    std::stringstream ostream;
+    s.register_ostream(&ostream);
+
+    server::connection_ptr con = s.get_connection();
+    con->start();
+
+    con->read_some(first.data(),first.size());
+    con->read_some(second.data(),second.size());
+
+    BOOST_CHECK_EQUAL(ostream.str(), output);
+    BOOST_CHECK_EQUAL(con->get_state(), websocketpp::session::state::connecting);
+}
+
+BOOST_AUTO_TEST_CASE( http_keep_alive_http10 ) {
+    std::string input = "GET /foo HTTP/1.0\r\nHost: www.example.com\r\nConnection: keep-alive\r\n\r\n"
+                        "GET /bar HTTP/1.0\r\nHost: www.example.com\r\n\r\n"
+                        "GET /ignored HTTP/1.0\r\nHost: www.example.com\r\n\r\n";
+    std::string output = "HTTP/1.1 200 OK\r\nConnection: keep-alive\r\nContent-Length: 4\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\n\r\n/fooHTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 4\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\n\r\n/bar";
+
+    server s;
+    s.set_http_keep_alive_timeout(5000);
+    s.set_http_handler(bind(&http_func,&s,::_1));
+
+    BOOST_CHECK_EQUAL(run_server_test(s,input), output);
+}
+
+BOOST_AUTO_TEST_CASE( http_keep_alive_then_upgrade ) {
+    std::string input = "GET /foo HTTP/1.1\r\nHost: www.example.com\r\n\r\n"
+                        "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nOrigin: http://www.example.com\r\n\r\n";
+    std::string output = "HTTP/1.1 200 OK\r\nContent-Length: 4\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\n\r\n/fooHTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\nUpgrade: websocket\r\n\r\n";
+
+    server s;
+    s.set_http_keep_alive_timeout(5000);
+    s.set_http_handler(bind(&http_func,&s,::_1));
+    s.set_message_handler(bind(&echo_func,&s,::_1,::_2));
+
+    BOOST_CHECK_EQUAL(run_server_test(s,input), output);
+}
+
+void empty_http_func(server* s, websocketpp::connection_hdl hdl) {
+    s->get_con_from_hdl(hdl)->set_status(websocketpp::http::status_code::ok);
+}
+
+BOOST_AUTO_TEST_CASE( http_keep_alive_empty_body ) {
+    std::string input = "GET /foo HTTP/1.1\r\nHost: www.example.com\r\n\r\n";
+    std::string output = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\n\r\n";
+
+    server s;
+    s.set_http_keep_alive_timeout(5000);
+    s.set_http_handler(bind(&empty_http_func,&s,::_1));
+
+    BOOST_CHECK_EQUAL(run_server_test(s,input), output);
+}
+
+BOOST_AUTO_TEST_CASE( http_keep_alive_disabled ) {
+    std::string input = "GET /foo HTTP/1.1\r\nHost: www.example.com\r\n\r\n"
+                        "GET /bar HTTP/1.1\r\nHost: www.example.com\r\n\r\n";
+    std::string output = "HTTP/1.1 200 OK\r\nContent-Length: 4\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\n\r\n/foo";
+
+    server s;
+    s.set_http_handler(bind(&http_func,&s,::_1));
+
+    BOOST_CHECK_EQUAL(run_server_test(s,input), output);
+}
+
+void echo_body_http_func(server* s, websocketpp::connection_hdl hdl) {
+    server::connection_ptr con = s->get_con_from_hdl(hdl);
+    con->set_body(con->get_request_body());
+    con->set_status(websocketpp::http::status_code::ok);
+}
+
+BOOST_AUTO_TEST_CASE( http_chunked_request_keep_alive ) {
+    std::string input = "POST /foo HTTP/1.1\r\nHost: www.example.com\r\nTransfer-Encoding: chunked\r\n\r\n"
+                        "3\r\nabc\r\n2\r\nde\r\n0\r\n\r\n"
+                        "GET /end HTTP/1.1\r\nHost: www.example.com\r\nConnection: close\r\n\r\n";
+    std::string output = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\n\r\nabcdeHTTP/1.1 200 OK\r\nConnection: close\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\n\r\n";
+
+    server s;
+    s.set_http_keep_alive_timeout(5000);
+    s.set_http_handler(bind(&echo_body_http_func,&s,::_1));
+
+    BOOST_CHECK_EQUAL(run_server_test(s,input), output);
+}
+
+BOOST_AUTO_TEST_CASE( http_chunked_request_with_content_length ) {
+    // a front end framing by Content-Length would see the second request as
+    // part of the body
+    std::string input = "POST /foo HTTP/1.1\r\nHost: www.example.com\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n"
+                        "0\r\n\r\n"
+                        "GET /smuggled HTTP/1.1\r\nHost: www.example.com\r\n\r\n";
+    std::string output = "HTTP/1.1 400 \r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\n\r\n";
+
+    server s;
+    s.set_http_keep_alive_timeout(5000);
+    s.set_http_handler(bind(&echo_body_http_func,&s,::_1));
+
+    BOOST_CHECK_EQUAL(run_server_test(s,input), output);
+}
+
+void collect_body_func(std::vector<std::string>* pieces,
+    websocketpp::connection_hdl, std::string const & piece)
+{
+    pieces->push_back(piece);
+}
+
+BOOST_AUTO_TEST_CASE( http_body_handler ) {
+    std::string head = "POST / HTTP/1.1\r\nHost: www.example.com\r\nTransfer-Encoding: chunked\r\n\r\n";
+    std::string output = "HTTP/1.1 200 OK\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\n\r\n";
+
+    std::vector<std::string> pieces;
+
+    server s;
+    s.set_max_http_body_size(4);
+    s.set_http_body_handler(bind(&collect_body_func,&pieces,::_1,::_2));
+    s.set_http_handler(bind(&echo_body_http_func,&s,::_1));
+    s.clear_access_channels(websocketpp::log::alevel::all);
+    s.clear_error_channels(websocketpp::log::elevel::all);
+
+    std::stringstream ostream;
+    s.register_ostream(&ostream);
+
+    server::connection_ptr c = s.get_connection();
+    c->start();
+    c->read_some(head.data(),head.size());
+    c->read_some("6\r\nabc",6);
+    c->read_some("def\r\n5\r\nghijk\r\n",15);
+    BOOST_CHECK_EQUAL( ostream.str(), "" );
+    c->read_some("0\r\n\r\n",5);
+
+    BOOST_REQUIRE_EQUAL( pieces.size(), 2 );
+    BOOST_CHECK_EQUAL( pieces[0], "abc" );
+    BOOST_CHECK_EQUAL( pieces[1], "defghijk" );
+
+    // the body was handed to the body handler rather than buffered
+    BOOST_CHECK_EQUAL( ostream.str(), output );
+}
+
+void stream_http_func(server* s, websocketpp::connection_hdl hdl) {
+    server::connection_ptr con = s->get_con_from_hdl(hdl);
+
+    BOOST_CHECK( !con->begin_http_body() );
+    BOOST_CHECK( !con->send_http_body("abc") );
+    BOOST_CHECK( !con->send_http_body("") );
+    BOOST_CHECK( !con->send_http_body(con->get_resource()) );
+    BOOST_CHECK( !con->end_http_body() );
+    BOOST_CHECK_EQUAL( con->end_http_body(),
+        websocketpp::error::make_error_code(websocketpp::error::invalid_state) );
+}
+
+BOOST_AUTO_TEST_CASE( http_stream_chunked ) {
+    std::string input = "GET /foo/bar HTTP/1.1\r\nHost: www.example.com\r\n\r\n";
+    std::string output = "HTTP/1.1 200 OK\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n8\r\n/foo/bar\r\n0\r\n\r\n";
+
+    server s;
+    s.set_http_handler(bind(&stream_http_func,&s,::_1));
+
+    BOOST_CHECK_EQUAL(run_server_test(s,input), output);
+}
+
+BOOST_AUTO_TEST_CASE( http_stream_http10 ) {
+    std::string input = "GET /foo/bar HTTP/1.0\r\nHost: www.example.com\r\n\r\n";
+    std::string output = "HTTP/1.1 200 OK\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\n\r\nabc/foo/bar";
+
+    server s;
+    s.set_http_handler(bind(&stream_http_func,&s,::_1));
+
+    BOOST_CHECK_EQUAL(run_server_test(s,input), output);
+}
+
+BOOST_AUTO_TEST_CASE( http_stream_keep_alive ) {
+    std::string input = "GET /a HTTP/1.1\r\nHost: www.example.com\r\n\r\n"
+                        "GET /b HTTP/1.1\r\nHost: www.example.com\r\n\r\n";
+    std::string response = "HTTP/1.1 200 OK\r\nServer: ";
+    response+=websocketpp::user_agent;
+    response+="\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n2\r\n/";
+
+    server s;
+    s.set_http_keep_alive_timeout(5000);
+    s.set_http_handler(bind(&stream_http_func,&s,::_1));
+
+    BOOST_CHECK_EQUAL(run_server_test(s,input),
+        response+"a\r\n0\r\n\r\n"+response+"b\r\n0\r\n\r\n");
+}
+
+void stream_length_func(server* s, websocketpp::connection_hdl hdl) {
+    server::connection_ptr con = s->get_con_from_hdl(hdl);
+
+    con->replace_header("Content-Length","5");
+    BOOST_CHECK( !con->begin_http_body() );
+    BOOST_CHECK( !con->send_http_body("abc") );
+    BOOST_CHECK_EQUAL( con->send_http_body("def"),
+        websocketpp::error::make_error_code(
+            websocketpp::error::invalid_http_body_length) );
+    BOOST_CHECK( !con->send_http_body("de") );
+    BOOST_CHECK( !con->end_http_body() );
+}
+
+BOOST_AUTO_TEST_CASE( http_stream_content_length ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\n\r\n";
+    std::string output = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\n\r\nabcde";
+
+    server s;
+    s.set_http_handler(bind(&stream_length_func,&s,::_1));
+
+    BOOST_CHECK_EQUAL(run_server_test(s,input), output);
+}
+
+void stream_file_func(server* s, std::string path, websocketpp::connection_hdl hdl) {
+    server::connection_ptr con = s->get_con_from_hdl(hdl);
+
+    BOOST_CHECK( !con->begin_http_body() );
+    BOOST_CHECK( !con->send_http_file(path) );
+    BOOST_CHECK( !con->send_http_file(path,5,3) );
+    BOOST_CHECK_EQUAL( con->send_http_file(path+".missing"),
+        websocketpp::error::make_error_code(websocketpp::error::http_body_file) );
+    BOOST_CHECK( !con->end_http_body() );
+}
+
+BOOST_AUTO_TEST_CASE( http_stream_file ) {
+    // larger than the block size used to copy files through memory
+    std::string contents;
+    for (size_t i = 0; i < 100000; i++) {
+        contents.push_back(char('a' + i % 26));
+    }
+
+    std::string path = "http_stream_file.tmp";
+    {
+        std::ofstream f(path.c_str(), std::ios::binary);
+        f << contents;
+    }
+
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\n\r\n";
+    std::string output = "HTTP/1.1 200 OK\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\nTransfer-Encoding: chunked\r\n\r\n186a0\r\n"+contents+
+        "\r\n3\r\nfgh\r\n0\r\n\r\n";
+
+    server s;
+    s.set_http_handler(bind(&stream_file_func,&s,path,::_1));
+
+    BOOST_CHECK( run_server_test(s,input) == output );
+
+    std::remove(path.c_str());
+}
+
+void defer_stream_func(server* s, server::connection_ptr * out,
+    websocketpp::connection_hdl hdl)
+{
+    *out = s->get_con_from_hdl(hdl);
+    BOOST_CHECK( !(*out)->defer_http_response() );
+}
+
+BOOST_AUTO_TEST_CASE( http_stream_deferred ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\n\r\n";
+    std::string head = "HTTP/1.1 200 OK\r\nServer: ";
+    head+=websocketpp::user_agent;
+    head+="\r\nTransfer-Encoding: chunked\r\n\r\n";
+
+    server s;
+    server::connection_ptr con;
+    s.set_http_handler(bind(&defer_stream_func,&s,&con,::_1));
+    s.clear_access_channels(websocketpp::log::alevel::all);
+    s.clear_error_channels(websocketpp::log::elevel::all);
+
+    std::stringstream ostream;
+    s.register_ostream(&ostream);
+
+    server::connection_ptr c = s.get_connection();
+    c->start();
+    c->read_some(input.data(),input.size());
+    BOOST_REQUIRE( con );
+    BOOST_CHECK_EQUAL( ostream.str(), "" );
+
+    BOOST_CHECK_EQUAL( con->send_http_body("early"),
+        websocketpp::error::make_error_code(websocketpp::error::invalid_state) );
+    BOOST_CHECK( !con->begin_http_body() );
+    BOOST_CHECK_EQUAL( ostream.str(), head );
+    BOOST_CHECK( !con->send_http_body("event\n") );
+    BOOST_CHECK_EQUAL( ostream.str(), head+"6\r\nevent\n\r\n" );
+    BOOST_CHECK( !con->end_http_body() );
+    BOOST_CHECK_EQUAL( ostream.str(), head+"6\r\nevent\n\r\n0\r\n\r\n" );
+    BOOST_CHECK_EQUAL( con->get_state(), websocketpp::session::state::closed );
+}
+
 BOOST_AUTO_TEST_CASE( request_no_server_header ) {
     std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nOrigin: http://www.example.com\r\n\r\n";
     std::string output = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\nUpgrade: websocket\r\n\r\n";
@@ -348,6 +737,775 @@ BOOST_AUTO_TEST_CASE( set_max_message_size ) {
     BOOST_CHECK_EQUAL(run_server_test(s,input), output);
 }
 
+bool validate_defer(server::connection_ptr* out, bool accept, server* s,
+    websocketpp::connection_hdl hdl)
+{
+    server::connection_ptr con = s->get_con_from_hdl(hdl);
+    BOOST_CHECK( !con->defer_http_response() );
+    if (accept) {
+        BOOST_CHECK( !con->accept_handshake() );
+    }
+    *out = con;
+
+    // ignored once the handshake is deferred
+    return false;
+}
+
+BOOST_AUTO_TEST_CASE( validate_deferred_accept ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nOrigin: http://www.example.com\r\n\r\n";
+    // a masked text frame "hi" sent along with the handshake
+    char frame[8] = {char(0x81), char(0x82), 0x00, 0x00, 0x00, 0x00, 'h', 'i'};
+    input.append(frame, 8);
+
+    std::string output = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\nUpgrade: websocket\r\nX-Auth: ok\r\n\r\n";
+    output+="\x81\x02hi";
+
+    server s;
+    server::connection_ptr con;
+    s.set_validate_handler(bind(&validate_defer,&con,false,&s,::_1));
+    s.set_message_handler(bind(&echo_func,&s,::_1,::_2));
+    s.clear_access_channels(websocketpp::log::alevel::all);
+    s.clear_error_channels(websocketpp::log::elevel::all);
+
+    std::stringstream ostream;
+    s.register_ostream(&ostream);
+
+    server::connection_ptr c = s.get_connection();
+    c->start();
+    c->read_some(input.data(),input.size());
+    BOOST_REQUIRE( con );
+    BOOST_CHECK_EQUAL( ostream.str(), "" );
+    BOOST_CHECK_EQUAL( con->get_state(), websocketpp::session::state::connecting );
+
+    websocketpp::lib::error_code ec;
+    con->send_http_response(ec);
+    BOOST_CHECK_EQUAL( ec,
+        websocketpp::error::make_error_code(websocketpp::error::invalid_state) );
+
+    con->replace_header("X-Auth","ok");
+    BOOST_CHECK( !con->accept_handshake() );
+    BOOST_CHECK_EQUAL( ostream.str(), output );
+    BOOST_CHECK_EQUAL( con->get_state(), websocketpp::session::state::open );
+
+    BOOST_CHECK_EQUAL( con->accept_handshake(),
+        websocketpp::error::make_error_code(websocketpp::error::invalid_state) );
+    BOOST_CHECK_EQUAL(
+        con->reject_handshake(websocketpp::http::status_code::forbidden),
+        websocketpp::error::make_error_code(websocketpp::error::invalid_state) );
+}
+
+BOOST_AUTO_TEST_CASE( validate_deferred_reject ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nOrigin: http://www.example.com\r\n\r\n";
+    std::string output = "HTTP/1.1 401 Unauthorized\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\nWWW-Authenticate: Bearer\r\n\r\n";
+
+    server s;
+    server::connection_ptr con;
+    s.set_validate_handler(bind(&validate_defer,&con,false,&s,::_1));
+    s.clear_access_channels(websocketpp::log::alevel::all);
+    s.clear_error_channels(websocketpp::log::elevel::all);
+
+    std::stringstream ostream;
+    s.register_ostream(&ostream);
+
+    server::connection_ptr c = s.get_connection();
+    c->start();
+    c->read_some(input.data(),input.size());
+    BOOST_REQUIRE( con );
+    BOOST_CHECK_EQUAL( ostream.str(), "" );
+
+    con->replace_header("WWW-Authenticate","Bearer");
+    BOOST_CHECK( !con->reject_handshake(
+        websocketpp::http::status_code::unauthorized) );
+    BOOST_CHECK_EQUAL( ostream.str(), output );
+    BOOST_CHECK_EQUAL( con->get_state(), websocketpp::session::state::closed );
+    BOOST_CHECK_EQUAL( con->get_ec(),
+        websocketpp::error::make_error_code(websocketpp::error::rejected) );
+}
+
+BOOST_AUTO_TEST_CASE( validate_deferred_completed_in_handler ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nOrigin: http://www.example.com\r\n\r\n";
+    std::string output = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\nServer: ";
+    output+=websocketpp::user_agent;
+    output+="\r\nUpgrade: websocket\r\n\r\n";
+
+    server s;
+    server::connection_ptr con;
+    s.set_validate_handler(bind(&validate_defer,&con,true,&s,::_1));
+
+    BOOST_CHECK_EQUAL(run_server_test(s,input), output);
+    BOOST_CHECK_EQUAL( con->get_state(), websocketpp::session::state::open );
+}
+
+void stream_on_open(server* s, websocketpp::connection_hdl hdl) {
+    server::connection_ptr con = s->get_con_from_hdl(hdl);
+    websocketpp::lib::error_code invalid_state =
+        websocketpp::error::make_error_code(websocketpp::error::invalid_state);
+
+    BOOST_CHECK_EQUAL(con->send_fragment("x"), invalid_state);
+    BOOST_CHECK(!con->begin_message(websocketpp::frame::opcode::text));
+    BOOST_CHECK_EQUAL(con->begin_message(websocketpp::frame::opcode::text),
+        invalid_state);
+    BOOST_CHECK_EQUAL(con->send("y"), invalid_state);
+
+    // split a two byte code point across fragments
+    BOOST_CHECK(!con->send_fragment("a\xC3"));
+
+    // a rejected fragment does not disturb the code point in progress
+    BOOST_CHECK_EQUAL(con->send_fragment("\xFF"), make_error_code(
+        websocketpp::error::invalid_utf8));
+    BOOST_CHECK_EQUAL(con->send_fragment("",true), make_error_code(
+        websocketpp::error::invalid_utf8));
+
+    BOOST_CHECK(!con->send_fragment("\xA9"));
+    BOOST_CHECK(!con->end_message());
+
+    BOOST_CHECK_EQUAL(con->send_fragment("x"), invalid_state);
+    BOOST_CHECK(!con->begin_message(websocketpp::frame::opcode::binary));
+    BOOST_CHECK(!con->send_fragment("z",true));
+}
+
+void count_writable(size_t & count, websocketpp::connection_hdl) {
+    count++;
+}
+
+BOOST_AUTO_TEST_CASE( streamed_message ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n";
+
+    std::string output = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\nUpgrade: websocket\r\n\r\n";
+
+    // text fragment, continuation, empty final continuation
+    output.append("\x01\x02" "a\xC3",4);
+    output.append("\x00\x01" "\xA9",3);
+    output.append("\x80\x00",2);
+    // single final binary fragment
+    output.append("\x82\x01" "z",3);
+
+    size_t writable = 0;
+
+    server s;
+    s.set_user_agent("");
+    s.set_open_handler(bind(&stream_on_open,&s,::_1));
+    s.set_writable_handler(bind(&count_writable,websocketpp::lib::ref(writable),::_1));
+    s.set_send_buffer_watermark(1);
+
+    BOOST_CHECK_EQUAL(run_server_test(s,input), output);
+
+    // every non-empty fragment crossed the watermark of one byte and the
+    // iostream transport drains it synchronously.
+    BOOST_CHECK_EQUAL(writable, 3);
+}
+
+void fragment_on_open(server* s, websocketpp::connection_hdl hdl) {
+    BOOST_CHECK(!s->get_con_from_hdl(hdl)->send(std::string("abcdefghij"),
+        websocketpp::frame::opcode::binary));
+}
+
+websocketpp::lib::error_code record_and_ping(server* s, std::string & out,
+    websocketpp::connection_hdl hdl, char const * buf, size_t len)
+{
+    std::string data(buf,len);
+    out.append(data);
+
+    // queue a ping while the first fragment is being written
+    if (data == std::string("\x02\x05",2)) {
+        s->get_con_from_hdl(hdl)->ping("p");
+    }
+    return websocketpp::lib::error_code();
+}
+
+BOOST_AUTO_TEST_CASE( fragmented_send_interleaves_control_frames ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n";
+
+    std::string output = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\nUpgrade: websocket\r\n\r\n";
+    output.append("\x02\x05" "abcde",7);
+    output.append("\x89\x01" "p",3);
+    output.append("\x80\x05" "fghij",7);
+
+    std::string out;
+
+    server s;
+    s.set_user_agent("");
+    s.clear_access_channels(websocketpp::log::alevel::all);
+    s.clear_error_channels(websocketpp::log::elevel::all);
+    s.set_open_handler(bind(&fragment_on_open,&s,::_1));
+    s.set_max_outgoing_frame_size(5);
+
+    server::connection_ptr con = s.get_connection();
+    BOOST_CHECK_EQUAL(con->get_max_outgoing_frame_size(), 5);
+    con->set_write_handler(bind(&record_and_ping,&s,websocketpp::lib::ref(out),
+        ::_1,::_2,websocketpp::lib::placeholders::_3));
+    con->start();
+
+    std::stringstream channel;
+    channel << input;
+    channel >> *con;
+
+    BOOST_CHECK_EQUAL(out, output);
+}
+
+/// Random number generator that returns a different value on each call
+class counting_rng {
+public:
+    counting_rng() : m_next(0x01020304) {}
+
+    uint32_t operator()() {
+        return m_next++;
+    }
+private:
+    uint32_t m_next;
+};
+
+struct counting_rng_config : public websocketpp::config::core {
+    typedef counting_rng rng_type;
+};
+
+typedef websocketpp::client<counting_rng_config> counting_client;
+
+void masked_fragment_on_open(counting_client* c, websocketpp::connection_hdl hdl) {
+    BOOST_CHECK(!c->get_con_from_hdl(hdl)->send(std::string("abcdefghij"),
+        websocketpp::frame::opcode::binary));
+}
+
+BOOST_AUTO_TEST_CASE( fragmented_send_masks_each_fragment ) {
+    std::stringstream output;
+
+    counting_client c;
+    c.clear_access_channels(websocketpp::log::alevel::all);
+    c.clear_error_channels(websocketpp::log::elevel::all);
+    c.set_open_handler(bind(&masked_fragment_on_open,&c,::_1));
+    c.set_max_outgoing_frame_size(4);
+    c.register_ostream(&output);
+
+    websocketpp::lib::error_code ec;
+    counting_client::connection_ptr con = c.get_connection("ws://localhost", ec);
+    BOOST_CHECK(!ec);
+    c.connect(con);
+
+    // answer the handshake request with the matching accept key
+    std::string request = output.str();
+    std::string::size_type start = request.find("Sec-WebSocket-Key: ");
+    BOOST_REQUIRE(start != std::string::npos);
+    start += 19;
+    std::string key = request.substr(start,request.find("\r\n",start)-start);
+    key.append(websocketpp::processor::constants::handshake_guid);
+
+    unsigned char hash[20];
+    websocketpp::sha1::calc(key.c_str(),key.length(),hash);
+
+    std::stringstream channel;
+    channel << "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\n"
+            << "Sec-WebSocket-Accept: " << websocketpp::base64_encode(hash,20)
+            << "\r\nUpgrade: websocket\r\n\r\n";
+
+    output.str("");
+    channel >> *con;
+
+    // three masked fragments of four, four and two bytes
+    std::string frames = output.str();
+    BOOST_REQUIRE_EQUAL(frames.size(), 3*6+10);
+
+    char const opcodes[3] = {char(0x02), char(0x00), char(0x80)};
+    size_t const lengths[3] = {4,4,2};
+
+    std::string payload;
+    std::vector<std::string> keys;
+    size_t pos = 0;
+    for (size_t i = 0; i < 3; ++i) {
+        BOOST_CHECK_EQUAL(frames[pos], opcodes[i]);
+        BOOST_CHECK_EQUAL(frames[pos+1], char(0x80 | lengths[i]));
+
+        std::string mask = frames.substr(pos+2,4);
+        for (size_t j = 0; j < lengths[i]; ++j) {
+            payload.push_back(frames[pos+6+j] ^ mask[j % 4]);
+        }
+
+        BOOST_CHECK(std::find(keys.begin(),keys.end(),mask) == keys.end());
+        keys.push_back(mask);
+        pos += 6+lengths[i];
+    }
+
+    BOOST_CHECK_EQUAL(payload, "abcdefghij");
+}
+
+void priority_on_open(server* s, websocketpp::connection_hdl hdl) {
+    BOOST_CHECK(!s->get_con_from_hdl(hdl)->send("first"));
+}
+
+websocketpp::lib::error_code record_and_queue(server* s, std::string & out,
+    websocketpp::connection_hdl hdl, char const * buf, size_t len)
+{
+    namespace priority = websocketpp::message_buffer::priority;
+
+    out.append(buf,len);
+
+    // queue messages of each class while the first message is being written
+    if (std::string(buf,len) == "first") {
+        server::connection_ptr con = s->get_con_from_hdl(hdl);
+
+        BOOST_CHECK(!con->send("l1",websocketpp::frame::opcode::text,priority::low));
+        BOOST_CHECK(!con->send("n1",websocketpp::frame::opcode::text,priority::normal));
+        BOOST_CHECK(!con->send("h1",websocketpp::frame::opcode::text,priority::high));
+        BOOST_CHECK(!con->send("l2",websocketpp::frame::opcode::text,priority::low));
+        BOOST_CHECK(!con->send("h2",websocketpp::frame::opcode::text,priority::high));
+        con->ping("p");
+
+        BOOST_CHECK_EQUAL(con->get_buffered_amount(priority::control), 1);
+        BOOST_CHECK_EQUAL(con->get_buffered_amount(priority::high), 4);
+        BOOST_CHECK_EQUAL(con->get_buffered_amount(priority::normal), 2);
+        BOOST_CHECK_EQUAL(con->get_buffered_amount(priority::low), 4);
+        BOOST_CHECK_EQUAL(con->get_buffered_amount(), 11);
+    }
+    return websocketpp::lib::error_code();
+}
+
+BOOST_AUTO_TEST_CASE( send_priority_order ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n";
+
+    std::string output = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\nUpgrade: websocket\r\n\r\n";
+    output.append("\x81\x05" "first");
+    output.append("\x89\x01" "p");
+    output.append("\x81\x02" "h1" "\x81\x02" "h2");
+    output.append("\x81\x02" "n1");
+    output.append("\x81\x02" "l1" "\x81\x02" "l2");
+
+    std::string out;
+
+    server s;
+    s.set_user_agent("");
+    s.clear_access_channels(websocketpp::log::alevel::all);
+    s.clear_error_channels(websocketpp::log::elevel::all);
+    s.set_open_handler(bind(&priority_on_open,&s,::_1));
+
+    server::connection_ptr con = s.get_connection();
+    con->set_write_handler(bind(&record_and_queue,&s,websocketpp::lib::ref(out),
+        ::_1,::_2,websocketpp::lib::placeholders::_3));
+    con->start();
+
+    std::stringstream channel;
+    channel << input;
+    channel >> *con;
+
+    BOOST_CHECK_EQUAL(out, output);
+}
+
+void batch_on_open(server* s, websocketpp::connection_hdl hdl,
+    std::vector<std::string> & writes)
+{
+    server::connection_ptr con = s->get_con_from_hdl(hdl);
+
+    BOOST_CHECK(!con->cork());
+    BOOST_CHECK(!con->send("a"));
+    BOOST_CHECK(!con->send("b"));
+    BOOST_CHECK(!con->send("c"));
+    BOOST_CHECK(!con->send("d"));
+    BOOST_CHECK(!con->send("e"));
+    BOOST_CHECK_EQUAL(writes.size(), 1);
+    BOOST_CHECK(!con->uncork());
+}
+
+websocketpp::lib::error_code record_write(std::vector<std::string> & writes,
+    websocketpp::connection_hdl, char const * buf, size_t len)
+{
+    writes.push_back(std::string(buf,len));
+    return websocketpp::lib::error_code();
+}
+
+websocketpp::lib::error_code record_vector_write(
+    std::vector<std::string> & writes, websocketpp::connection_hdl,
+    std::vector<websocketpp::transport::buffer> const & bufs)
+{
+    std::string out;
+    for (size_t i = 0; i < bufs.size(); i++) {
+        out.append(bufs[i].buf,bufs[i].len);
+    }
+    writes.push_back(out);
+    return websocketpp::lib::error_code();
+}
+
+BOOST_AUTO_TEST_CASE( corked_writes_are_batched ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n";
+
+    std::vector<std::string> writes;
+
+    server s;
+    s.set_user_agent("");
+    s.clear_access_channels(websocketpp::log::alevel::all);
+    s.clear_error_channels(websocketpp::log::elevel::all);
+    s.set_open_handler(bind(&batch_on_open,&s,::_1,
+        websocketpp::lib::ref(writes)));
+    s.set_max_write_batch_buffers(4);
+
+    server::connection_ptr con = s.get_connection();
+    BOOST_CHECK_EQUAL(con->get_max_write_batch_buffers(), 4);
+    con->set_write_handler(bind(&record_write,websocketpp::lib::ref(writes),
+        ::_1,::_2,websocketpp::lib::placeholders::_3));
+    con->set_vector_write_handler(bind(&record_vector_write,
+        websocketpp::lib::ref(writes),::_1,::_2));
+    con->start();
+
+    std::stringstream channel;
+    channel << input;
+    channel >> *con;
+
+    // the handshake response followed by the five messages in batches of two
+    BOOST_REQUIRE_EQUAL(writes.size(), 4);
+    BOOST_CHECK_EQUAL(writes[1], "\x81\x01" "a" "\x81\x01" "b");
+    BOOST_CHECK_EQUAL(writes[2], "\x81\x01" "c" "\x81\x01" "d");
+    BOOST_CHECK_EQUAL(writes[3], "\x81\x01" "e");
+}
+
+void cork_control_on_open(server* s, websocketpp::connection_hdl hdl,
+    std::vector<std::string> & writes)
+{
+    server::connection_ptr con = s->get_con_from_hdl(hdl);
+
+    BOOST_CHECK(!con->cork());
+    BOOST_CHECK(!con->send("a"));
+    BOOST_CHECK_EQUAL(writes.size(), 1);
+
+    // pings are not held back by the cork
+    con->ping("p");
+    BOOST_REQUIRE_EQUAL(writes.size(), 2);
+    BOOST_CHECK_EQUAL(writes[1], "\x89\x01" "p");
+
+    // a close frame flushes everything held back ahead of it
+    con->close(websocketpp::close::status::normal,"");
+    BOOST_REQUIRE_EQUAL(writes.size(), 3);
+    BOOST_CHECK_EQUAL(writes[2], "\x81\x01" "a" "\x88\x02\x03\xe8");
+}
+
+BOOST_AUTO_TEST_CASE( corked_control_frames_are_written ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n";
+
+    std::vector<std::string> writes;
+
+    server s;
+    s.set_user_agent("");
+    s.clear_access_channels(websocketpp::log::alevel::all);
+    s.clear_error_channels(websocketpp::log::elevel::all);
+    s.set_open_handler(bind(&cork_control_on_open,&s,::_1,
+        websocketpp::lib::ref(writes)));
+
+    server::connection_ptr con = s.get_connection();
+    con->set_write_handler(bind(&record_write,websocketpp::lib::ref(writes),
+        ::_1,::_2,websocketpp::lib::placeholders::_3));
+    con->set_vector_write_handler(bind(&record_vector_write,
+        websocketpp::lib::ref(writes),::_1,::_2));
+    con->start();
+
+    std::stringstream channel;
+    channel << input;
+    channel >> *con;
+
+    BOOST_CHECK_EQUAL(writes.size(), 3);
+}
+
+void count_message(size_t & count, websocketpp::connection_hdl,
+    server::message_ptr)
+{
+    count++;
+}
+
+BOOST_AUTO_TEST_CASE( read_budget_yields ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n";
+
+    std::string frames;
+    frames.append("\x81\x81\x00\x00\x00\x00" "a",7);
+    frames.append("\x81\x81\x00\x00\x00\x00" "b",7);
+    frames.append("\x81\x81\x00\x00\x00\x00" "c",7);
+
+    size_t count = 0;
+    std::stringstream out;
+
+    server s;
+    s.set_user_agent("");
+    s.clear_access_channels(websocketpp::log::alevel::all);
+    s.clear_error_channels(websocketpp::log::elevel::all);
+    s.set_message_handler(bind(&count_message,websocketpp::lib::ref(count),
+        ::_1,::_2));
+    s.set_read_budget_messages(1);
+    s.register_ostream(&out);
+
+    server::connection_ptr con = s.get_connection();
+    BOOST_CHECK_EQUAL(con->get_read_budget_messages(), 1);
+    con->start();
+
+    std::stringstream channel;
+    channel << input;
+    channel >> *con;
+
+    con->read_some(frames.data(),frames.size());
+
+    BOOST_CHECK_EQUAL(count, 3);
+    BOOST_CHECK_EQUAL(con->get_read_message_budget_hits(), 2);
+    BOOST_CHECK_EQUAL(con->get_read_byte_budget_hits(), 0);
+}
+
+void record_batch(std::vector<std::string> & batches,
+    websocketpp::connection_hdl, server::message_batch const & batch)
+{
+    std::string out;
+    for (size_t i = 0; i < batch.size(); i++) {
+        out.append(batch[i]->get_payload());
+    }
+    batches.push_back(out);
+}
+
+BOOST_AUTO_TEST_CASE( message_batch_handler ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n";
+
+    std::string frames;
+    frames.append("\x81\x81\x00\x00\x00\x00" "a",7);
+    frames.append("\x81\x81\x00\x00\x00\x00" "b",7);
+    frames.append("\x89\x80\x00\x00\x00\x00",6);
+    frames.append("\x81\x81\x00\x00\x00\x00" "c",7);
+
+    std::vector<std::string> batches;
+    std::stringstream out;
+
+    server s;
+    s.set_user_agent("");
+    s.clear_access_channels(websocketpp::log::alevel::all);
+    s.clear_error_channels(websocketpp::log::elevel::all);
+    s.set_message_batch_handler(bind(&record_batch,
+        websocketpp::lib::ref(batches),::_1,::_2));
+    s.register_ostream(&out);
+
+    server::connection_ptr con = s.get_connection();
+    con->start();
+
+    std::stringstream channel;
+    channel << input;
+    channel >> *con;
+
+    con->read_some(frames.data(),frames.size());
+
+    // the ping ends the first batch
+    BOOST_REQUIRE_EQUAL(batches.size(), 2);
+    BOOST_CHECK_EQUAL(batches[0], "ab");
+    BOOST_CHECK_EQUAL(batches[1], "c");
+}
+
+void offload_on_open(server* s, websocketpp::connection_hdl hdl) {
+    server::connection_ptr con = s->get_con_from_hdl(hdl);
+
+    BOOST_CHECK(!con->send("0123456789"));
+    BOOST_CHECK(!con->send("a"));
+    BOOST_CHECK_EQUAL(con->send(std::string("\xFF")), make_error_code(
+        websocketpp::processor::error::invalid_payload));
+    BOOST_CHECK(!con->send("b"));
+}
+
+void store_job(std::vector<websocketpp::lib::function<void()> > & jobs,
+    websocketpp::lib::function<void()> job)
+{
+    jobs.push_back(job);
+}
+
+BOOST_AUTO_TEST_CASE( compression_offload_keeps_order ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n";
+
+    std::string output = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\nUpgrade: websocket\r\n\r\n";
+
+    std::vector<websocketpp::lib::function<void()> > jobs;
+    std::stringstream out;
+
+    server s;
+    s.set_user_agent("");
+    s.clear_access_channels(websocketpp::log::alevel::all);
+    s.clear_error_channels(websocketpp::log::elevel::all);
+    s.set_open_handler(bind(&offload_on_open,&s,::_1));
+    s.set_compression_executor(bind(&store_job,websocketpp::lib::ref(jobs),
+        ::_1));
+    s.set_compression_offload_threshold(10);
+    s.register_ostream(&out);
+
+    server::connection_ptr con = s.get_connection();
+    BOOST_CHECK_EQUAL(con->get_compression_offload_threshold(), 10);
+    con->start();
+
+    std::stringstream channel;
+    channel << input;
+    channel >> *con;
+
+    // nothing is written until the large message has been framed
+    BOOST_CHECK_EQUAL(out.str(), output);
+    BOOST_REQUIRE_EQUAL(jobs.size(), 1);
+
+    jobs[0]();
+
+    output.append("\x81\x0a" "0123456789" "\x81\x01" "a" "\x81\x01" "b");
+    BOOST_CHECK_EQUAL(out.str(), output);
+}
+
+void offload_stream_on_open(server* s, websocketpp::connection_hdl hdl) {
+    server::connection_ptr con = s->get_con_from_hdl(hdl);
+
+    BOOST_CHECK(!con->send("0123456789"));
+    BOOST_CHECK(!con->begin_message(websocketpp::frame::opcode::text));
+    BOOST_CHECK(!con->send_fragment(std::string("cd"),false));
+    BOOST_CHECK(!con->send_fragment(std::string("e"),true));
+}
+
+BOOST_AUTO_TEST_CASE( compression_offload_queues_stream ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n";
+
+    std::string output = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\nUpgrade: websocket\r\n\r\n";
+
+    std::vector<websocketpp::lib::function<void()> > jobs;
+    std::stringstream out;
+
+    server s;
+    s.set_user_agent("");
+    s.clear_access_channels(websocketpp::log::alevel::all);
+    s.clear_error_channels(websocketpp::log::elevel::all);
+    s.set_open_handler(bind(&offload_stream_on_open,&s,::_1));
+    s.set_compression_executor(bind(&store_job,websocketpp::lib::ref(jobs),
+        ::_1));
+    s.set_compression_offload_threshold(10);
+    s.register_ostream(&out);
+
+    server::connection_ptr con = s.get_connection();
+    con->start();
+
+    std::stringstream channel;
+    channel << input;
+    channel >> *con;
+
+    // the fragments are not framed while the executor owns the processor
+    BOOST_CHECK_EQUAL(out.str(), output);
+    BOOST_REQUIRE_EQUAL(jobs.size(), 1);
+
+    jobs[0]();
+
+    output.append("\x81\x0a" "0123456789" "\x01\x02" "cd" "\x80\x01" "e");
+    BOOST_CHECK_EQUAL(out.str(), output);
+}
+
+struct mpsc_config : public websocketpp::config::core {
+    static const bool enable_mpsc_send_queue = true;
+};
+
+typedef websocketpp::server<mpsc_config> mpsc_server;
+
+void mpsc_echo(mpsc_server* s, websocketpp::connection_hdl hdl,
+    mpsc_server::message_ptr msg)
+{
+    mpsc_server::connection_ptr con = s->get_con_from_hdl(hdl);
+
+    BOOST_CHECK_EQUAL(con->send(std::string("\xFF")), make_error_code(
+        websocketpp::processor::error::invalid_payload));
+    BOOST_CHECK(!con->send(msg->get_payload(), msg->get_opcode()));
+    BOOST_CHECK(!con->send(msg->get_payload(), msg->get_opcode()));
+}
+
+BOOST_AUTO_TEST_CASE( mpsc_send_queue ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n";
+    input.append("\x81\x82\x00\x00\x00\x00" "hi",8);
+
+    std::string output = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\nUpgrade: websocket\r\n\r\n";
+    output.append("\x81\x02" "hi" "\x81\x02" "hi");
+
+    std::stringstream out;
+
+    mpsc_server s;
+    s.set_user_agent("");
+    s.clear_access_channels(websocketpp::log::alevel::all);
+    s.clear_error_channels(websocketpp::log::elevel::all);
+    s.set_message_handler(bind(&mpsc_echo,&s,::_1,::_2));
+    s.register_ostream(&out);
+
+    mpsc_server::connection_ptr con = s.get_connection();
+    con->start();
+
+    std::stringstream channel;
+    channel << input;
+    channel >> *con;
+
+    BOOST_CHECK_EQUAL(out.str(), output);
+}
+
+void mpsc_stream_on_open(mpsc_server* s, websocketpp::connection_hdl hdl) {
+    mpsc_server::connection_ptr con = s->get_con_from_hdl(hdl);
+
+    BOOST_CHECK(!con->begin_message(websocketpp::frame::opcode::text));
+    BOOST_CHECK_EQUAL(con->send(std::string("x")), make_error_code(
+        websocketpp::error::invalid_state));
+    BOOST_CHECK(!con->send_fragment(std::string("ab"),true));
+    BOOST_CHECK(!con->send(std::string("y")));
+}
+
+BOOST_AUTO_TEST_CASE( mpsc_send_during_stream ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n";
+
+    std::string output = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\nUpgrade: websocket\r\n\r\n";
+    output.append("\x81\x02" "ab" "\x81\x01" "y");
+
+    std::stringstream out;
+
+    mpsc_server s;
+    s.set_user_agent("");
+    s.clear_access_channels(websocketpp::log::alevel::all);
+    s.clear_error_channels(websocketpp::log::elevel::all);
+    s.set_open_handler(bind(&mpsc_stream_on_open,&s,::_1));
+    s.register_ostream(&out);
+
+    mpsc_server::connection_ptr con = s.get_connection();
+    con->start();
+
+    std::stringstream channel;
+    channel << input;
+    channel >> *con;
+
+    BOOST_CHECK_EQUAL(out.str(), output);
+}
+
+void mpsc_offload_on_open(mpsc_server* s, websocketpp::connection_hdl hdl) {
+    mpsc_server::connection_ptr con = s->get_con_from_hdl(hdl);
+
+    BOOST_CHECK(!con->send("0123456789"));
+    BOOST_CHECK(!con->send("a"));
+}
+
+BOOST_AUTO_TEST_CASE( mpsc_send_queue_offloads ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n";
+
+    std::string output = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\nUpgrade: websocket\r\n\r\n";
+
+    std::vector<websocketpp::lib::function<void()> > jobs;
+    std::stringstream out;
+
+    mpsc_server s;
+    s.set_user_agent("");
+    s.clear_access_channels(websocketpp::log::alevel::all);
+    s.clear_error_channels(websocketpp::log::elevel::all);
+    s.set_open_handler(bind(&mpsc_offload_on_open,&s,::_1));
+    s.set_compression_executor(bind(&store_job,websocketpp::lib::ref(jobs),
+        ::_1));
+    s.set_compression_offload_threshold(10);
+    s.register_ostream(&out);
+
+    mpsc_server::connection_ptr con = s.get_connection();
+    con->start();
+
+    std::stringstream channel;
+    channel << input;
+    channel >> *con;
+
+    // the large message is framed on the executor, the small one waits
+    BOOST_CHECK_EQUAL(out.str(), output);
+    BOOST_REQUIRE_EQUAL(jobs.size(), 1);
+
+    jobs[0]();
+
+    output.append("\x81\x0a" "0123456789" "\x81\x01" "a");
+    BOOST_CHECK_EQUAL(out.str(), output);
+}
+
 BOOST_AUTO_TEST_CASE( websocket_fail_parse_error ) {
     std::string input = "asdf\r\n\r\n";
 
@@ -30,8 +30,131 @@
 
 #include <string>
 
+#include <websocketpp/extensions/chain.hpp>
 #include <websocketpp/extensions/extension.hpp>
+#include <websocketpp/http/parser.hpp>
 
-BOOST_AUTO_TEST_CASE( blank ) {
-    BOOST_CHECK( true );
+namespace ext = websocketpp::extensions;
+
+// Adds a fixed byte to every payload byte and records the order it ran in
+class add_ext : public ext::extension {
+public:
+    add_ext(std::string name, char delta, bool rsv, std::string & log)
+      : m_name(name), m_delta(delta), m_rsv(rsv), m_log(log) {}
+
+    std::string get_name() const {
+        return m_name;
+    }
+
+    bool needs_rsv_bit() const {
+        return m_rsv;
+    }
+
+    err_str_pair negotiate(websocketpp::http::attribute_list const & attr) {
+        err_str_pair ret;
+        if (attr.find("bad") != attr.end()) {
+            ret.first = ext::error::make_error_code(ext::error::general);
+        } else {
+            ret.second = m_name;
+        }
+        return ret;
+    }
+
+    websocketpp::lib::error_code encode(std::string & payload, size_t offset, bool) {
+        m_log += "e" + m_name;
+        for (size_t i = offset; i < payload.size(); i++) {
+            payload[i] = char(payload[i] + m_delta);
+        }
+        return websocketpp::lib::error_code();
+    }
+
+    websocketpp::lib::error_code decode(std::string & payload, size_t offset, bool) {
+        m_log += "d" + m_name;
+        for (size_t i = offset; i < payload.size(); i++) {
+            payload[i] = char(payload[i] - m_delta);
+        }
+        return websocketpp::lib::error_code();
+    }
+private:
+    std::string m_name;
+    char m_delta;
+    bool m_rsv;
+    std::string & m_log;
+};
+
+websocketpp::http::parameter_list parse(std::string const & header) {
+    websocketpp::http::parameter_list p;
+    websocketpp::http::parser::parser parser;
+    parser.replace_header("Sec-WebSocket-Extensions",header);
+    parser.get_header_as_plist("Sec-WebSocket-Extensions",p);
+    return p;
+}
+
+BOOST_AUTO_TEST_CASE( chain_offer ) {
+    std::string log;
+    ext::chain c;
+    BOOST_CHECK( c.empty() );
+
+    c.add(ext::extension::ptr(new add_ext("x-a",1,false,log)));
+    c.add(ext::extension::ptr(new add_ext("x-b",2,true,log)));
+
+    BOOST_CHECK( !c.empty() );
+    BOOST_CHECK( !c.is_enabled() );
+    BOOST_CHECK_EQUAL( c.generate_offer(), "x-a, x-b" );
+}
+
+BOOST_AUTO_TEST_CASE( chain_negotiate_server ) {
+    std::string log;
+    ext::chain c;
+    c.add(ext::extension::ptr(new add_ext("x-a",1,true,log)));
+    c.add(ext::extension::ptr(new add_ext("x-b",2,true,log)));
+    c.add(ext::extension::ptr(new add_ext("x-c",3,true,log)));
+    c.add(ext::extension::ptr(new add_ext("x-d",4,false,log)));
+
+    // client order wins, rejected and unknown offers are skipped, the third
+    // extension needing an RSV bit doesn't get one
+    ext::chain::err_str_pair ret = c.negotiate(
+        parse("x-z, x-b; bad, x-c, x-b, x-a, x-d"),true);
+
+    BOOST_CHECK( !ret.first );
+    BOOST_CHECK_EQUAL( ret.second, "x-c, x-b, x-d" );
+    BOOST_CHECK( c.is_enabled() );
+    BOOST_CHECK_EQUAL( c.get_rsv_bits(), websocketpp::frame::BHB0_RSV2 | websocketpp::frame::BHB0_RSV3 );
+}
+
+BOOST_AUTO_TEST_CASE( chain_negotiate_client_failure ) {
+    std::string log;
+    ext::chain c;
+    c.add(ext::extension::ptr(new add_ext("x-a",1,false,log)));
+
+    ext::chain::err_str_pair ret = c.negotiate(parse("x-a; bad"),false);
+    BOOST_CHECK( ret.first );
+    BOOST_CHECK( !c.is_enabled() );
+}
+
+BOOST_AUTO_TEST_CASE( chain_transform_order ) {
+    std::string log;
+    ext::chain c;
+    c.add(ext::extension::ptr(new add_ext("x-a",1,false,log)));
+    c.add(ext::extension::ptr(new add_ext("x-b",2,true,log)));
+
+    BOOST_CHECK( !c.negotiate(parse("x-b, x-a"),true).first );
+    BOOST_CHECK_EQUAL( c.get_rsv_bits(), websocketpp::frame::BHB0_RSV2 );
+
+    std::string payload = "ab";
+    BOOST_CHECK( !c.encode(payload,1,true) );
+    BOOST_CHECK_EQUAL( payload, "ae" );
+    BOOST_CHECK_EQUAL( log, "ex-bex-a" );
+
+    log.clear();
+    BOOST_CHECK( !c.decode(payload,1,true,websocketpp::frame::BHB0_RSV2) );
+    BOOST_CHECK_EQUAL( payload, "ab" );
+    BOOST_CHECK_EQUAL( log, "dx-adx-b" );
+
+    // a message without the RSV bit is only decoded by x-a
+    log.clear();
+    payload = "b";
+    BOOST_CHECK( !c.decode(payload,0,true,0) );
+    BOOST_CHECK_EQUAL( payload, "a" );
+    BOOST_CHECK_EQUAL( log, "dx-a" );
 }
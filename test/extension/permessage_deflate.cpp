@@ -31,6 +31,7 @@
 #include <websocketpp/error.hpp>
 
 #include <websocketpp/extensions/extension.hpp>
+#include <websocketpp/extensions/permessage_deflate/adaptive_policy.hpp>
 #include <websocketpp/extensions/permessage_deflate/disabled.hpp>
 #include <websocketpp/extensions/permessage_deflate/enabled.hpp>
 
@@ -703,6 +704,204 @@ BOOST_AUTO_TEST_CASE( compress_data_no_context_takeover ) {
     BOOST_CHECK_EQUAL( compress_out1, compress_out2 );
 }
 
+BOOST_AUTO_TEST_CASE( pooled_streams ) {
+    namespace pmd = websocketpp::extensions::permessage_deflate;
+
+    std::string compress_in(1000,'a');
+    std::string compress_out;
+    std::string decompress_out;
+
+    websocketpp::http::attribute_list alist;
+    alist["server_no_context_takeover"].clear();
+
+    // the server compresses without context takeover and the client
+    // decompresses with it, so both borrow streams from the pool
+    enabled_type server;
+    server.enable_server_no_context_takeover();
+    server.negotiate(alist);
+    BOOST_CHECK_EQUAL( server.init(true), websocketpp::lib::error_code() );
+
+    enabled_type client;
+    client.negotiate(alist);
+    BOOST_CHECK_EQUAL( client.init(false), websocketpp::lib::error_code() );
+
+    size_t idle = 0;
+    uint8_t trailer[4] = {0x00, 0x00, 0xff, 0xff};
+
+    for (int i = 0; i < 4; i++) {
+        compress_out.clear();
+        decompress_out.clear();
+
+        BOOST_CHECK( !server.compress(compress_in,compress_out) );
+
+        // strip the trailer like the processor does and add it back as the
+        // last input of the message
+        compress_out.resize(compress_out.size()-4);
+        BOOST_CHECK( !client.decompress(reinterpret_cast<const uint8_t *>(compress_out.data()),compress_out.size(),decompress_out) );
+        BOOST_CHECK( !client.decompress(trailer,4,decompress_out) );
+
+        // the inflate stream is held until the end of the message
+        if (i > 0) {
+            BOOST_CHECK_EQUAL( pmd::stream_pool<pmd::zlib_backend>::get().idle(), idle - 1 );
+        }
+        client.end_decompress();
+
+        BOOST_CHECK( compress_in == decompress_out );
+
+        // after the first message the same streams are reused
+        if (i == 0) {
+            idle = pmd::stream_pool<pmd::zlib_backend>::get().idle();
+        } else {
+            BOOST_CHECK_EQUAL( pmd::stream_pool<pmd::zlib_backend>::get().idle(), idle );
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE( shared_compression_key ) {
+    websocketpp::http::attribute_list alist;
+    uint32_t key;
+
+    // output depends on the previous messages, it can't be shared
+    enabled_type context;
+    context.negotiate(alist);
+    BOOST_CHECK_EQUAL( context.init(true), websocketpp::lib::error_code() );
+    BOOST_CHECK( !context.get_shared_compression_key(key) );
+
+    alist["server_no_context_takeover"].clear();
+
+    enabled_type a;
+    a.enable_server_no_context_takeover();
+    a.negotiate(alist);
+    BOOST_CHECK_EQUAL( a.init(true), websocketpp::lib::error_code() );
+
+    enabled_type b;
+    b.enable_server_no_context_takeover();
+    b.negotiate(alist);
+    BOOST_CHECK_EQUAL( b.init(true), websocketpp::lib::error_code() );
+
+    uint32_t key_a;
+    uint32_t key_b;
+    BOOST_CHECK( a.get_shared_compression_key(key_a) );
+    BOOST_CHECK( b.get_shared_compression_key(key_b) );
+    BOOST_CHECK_EQUAL( key_a, key_b );
+
+    // same key means same bytes
+    std::string in(1000,'a');
+    std::string out_a;
+    std::string out_b;
+    BOOST_CHECK( !a.compress(in,out_a) );
+    BOOST_CHECK( !b.compress(in,out_b) );
+    BOOST_CHECK( out_a == out_b );
+
+    // a different level is a different key
+    BOOST_CHECK( !b.set_compression_level(1) );
+    BOOST_CHECK( b.get_shared_compression_key(key_b) );
+    BOOST_CHECK( key_a != key_b );
+}
+
+// A backend that forwards to zlib and counts calls
+struct counting_backend : public websocketpp::extensions::permessage_deflate::zlib_backend {
+    typedef websocketpp::extensions::permessage_deflate::zlib_backend base;
+
+    static int compress_calls;
+    static int decompress_calls;
+
+    class deflater : public base::deflater {
+    public:
+        bool compress(uint8_t const * buf, size_t len, std::string & out, bool flush) {
+            compress_calls++;
+            return base::deflater::compress(buf,len,out,flush);
+        }
+    };
+
+    class inflater : public base::inflater {
+    public:
+        bool decompress(uint8_t const * buf, size_t len, std::string & out, size_t limit) {
+            decompress_calls++;
+            return base::inflater::decompress(buf,len,out,limit);
+        }
+    };
+};
+
+int counting_backend::compress_calls = 0;
+int counting_backend::decompress_calls = 0;
+
+BOOST_AUTO_TEST_CASE( custom_backend ) {
+    typedef websocketpp::extensions::permessage_deflate::enabled<config,counting_backend> counting_type;
+
+    std::string compress_in = "Hello";
+    std::string compress_out;
+    std::string decompress_out;
+
+    counting_type server;
+    counting_type client;
+    BOOST_CHECK_EQUAL( server.init(true), websocketpp::lib::error_code() );
+    BOOST_CHECK_EQUAL( client.init(false), websocketpp::lib::error_code() );
+
+    BOOST_CHECK( !server.compress(compress_in,compress_out) );
+    BOOST_CHECK( !client.decompress(reinterpret_cast<const uint8_t *>(compress_out.data()),compress_out.size(),decompress_out) );
+
+    BOOST_CHECK_EQUAL( compress_in, decompress_out );
+    BOOST_CHECK_EQUAL( counting_backend::compress_calls, 1 );
+    BOOST_CHECK_EQUAL( counting_backend::decompress_calls, 1 );
+}
+
+// A backend whose level changes fail until told otherwise
+struct stubborn_backend : public websocketpp::extensions::permessage_deflate::zlib_backend {
+    typedef websocketpp::extensions::permessage_deflate::zlib_backend base;
+
+    static bool allow_level_change;
+    static int set_level_calls;
+
+    class deflater : public base::deflater {
+    public:
+        bool set_level(int level, std::string & out) {
+            set_level_calls++;
+            if (!allow_level_change) {
+                return false;
+            }
+            return base::deflater::set_level(level,out);
+        }
+    };
+};
+
+bool stubborn_backend::allow_level_change = false;
+int stubborn_backend::set_level_calls = 0;
+
+BOOST_AUTO_TEST_CASE( failed_level_change_keeps_compressing ) {
+    typedef websocketpp::extensions::permessage_deflate::enabled<config,stubborn_backend> stubborn_type;
+
+    std::string compress_in = "Hello";
+    std::string compress_out;
+    std::string decompress_out;
+
+    stubborn_type server;
+    stubborn_type client;
+    BOOST_CHECK_EQUAL( server.init(true), websocketpp::lib::error_code() );
+    BOOST_CHECK_EQUAL( client.init(false), websocketpp::lib::error_code() );
+    BOOST_CHECK( !server.set_compression_level(1) );
+
+    // the message is compressed at the old level
+    BOOST_CHECK( !server.compress(compress_in,compress_out) );
+    BOOST_CHECK_EQUAL( stubborn_backend::set_level_calls, 1 );
+    BOOST_CHECK( !client.decompress(reinterpret_cast<const uint8_t *>(compress_out.data()),compress_out.size(),decompress_out) );
+    BOOST_CHECK_EQUAL( compress_in, decompress_out );
+
+    // and the change is retried with the next one
+    stubborn_backend::allow_level_change = true;
+    compress_out.clear();
+    decompress_out.clear();
+    BOOST_CHECK( !server.compress(compress_in,compress_out) );
+    BOOST_CHECK_EQUAL( stubborn_backend::set_level_calls, 2 );
+    BOOST_CHECK( !client.decompress(reinterpret_cast<const uint8_t *>(compress_out.data()),compress_out.size(),decompress_out) );
+    BOOST_CHECK_EQUAL( compress_in, decompress_out );
+
+    // once applied the level is not set again
+    compress_out.clear();
+    BOOST_CHECK( !server.compress(compress_in,compress_out) );
+    BOOST_CHECK_EQUAL( stubborn_backend::set_level_calls, 2 );
+}
+
 BOOST_AUTO_TEST_CASE( compress_empty ) {
     ext_vars v;
 
@@ -729,6 +928,127 @@ BOOST_AUTO_TEST_CASE( compress_empty ) {
     BOOST_CHECK_EQUAL( compress_in, decompress_out );
 }
 
+BOOST_AUTO_TEST_CASE( compress_large ) {
+    ext_vars v;
+
+    // poorly compressible input overflows the initial compress estimate
+    std::string random_in;
+    uint32_t x = 12345;
+    for (size_t i = 0; i < 1000000; i++) {
+        x = x * 1103515245 + 12345;
+        random_in.push_back(static_cast<char>(x >> 24));
+    }
+
+    // highly compressible input overflows the initial decompress estimate
+    std::string repeated_in(1000000,'a');
+
+    v.ec = v.exts.init(true);
+    BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+
+    for (int i = 0; i < 2; i++) {
+        std::string const & compress_in = (i == 0 ? random_in : repeated_in);
+
+        // output is appended to whatever is already in the string
+        std::string compress_out = "xx";
+        std::string decompress_out = "yy";
+
+        v.ec = v.exts.compress(compress_in,compress_out);
+        BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+        BOOST_CHECK_EQUAL( compress_out.substr(0,2), "xx" );
+
+        v.ec = v.exts.decompress(
+            reinterpret_cast<const uint8_t *>(compress_out.data())+2,
+            compress_out.size()-2,
+            decompress_out
+        );
+        BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+        BOOST_CHECK( decompress_out == "yy" + compress_in );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( compress_level ) {
+    ext_vars v;
+
+    std::string compress_in(10000,'a');
+    std::string compress_out;
+    std::string decompress_out;
+
+    v.ec = v.exts.init(true);
+    BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+
+    BOOST_CHECK_EQUAL( v.exts.set_compression_level(10), pmde::make_error_code(pmde::invalid_compression_level) );
+
+    // level changes between messages keep the stream decodable
+    for (int level = 9; level >= 0; level -= 3) {
+        BOOST_CHECK( !v.exts.set_compression_level(level) );
+        BOOST_CHECK_EQUAL( v.exts.get_compression_level(), level );
+
+        compress_out.clear();
+        decompress_out.clear();
+
+        v.ec = v.exts.compress(compress_in,compress_out);
+        BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+
+        v.ec = v.exts.decompress(reinterpret_cast<const uint8_t *>(compress_out.data()),compress_out.size(),decompress_out);
+        BOOST_CHECK_EQUAL( v.ec, websocketpp::lib::error_code() );
+        BOOST_CHECK( compress_in == decompress_out );
+    }
+
+    // level 0 stores the data uncompressed
+    BOOST_CHECK( compress_out.size() > compress_in.size() );
+}
+
+BOOST_AUTO_TEST_CASE( adaptive_policy_decisions ) {
+    websocketpp::extensions::permessage_deflate::adaptive_policy p(64,0);
+    int level = 0;
+
+    // too small
+    BOOST_CHECK( !p.decide(std::string(10,'a'),level) );
+
+    // text is compressed at the starting level
+    BOOST_CHECK( p.decide(std::string(1000,'a'),level) );
+    BOOST_CHECK_EQUAL( level, 6 );
+
+    // random looking data is not
+    std::string random_in;
+    uint32_t x = 12345;
+    for (size_t i = 0; i < 4096; i++) {
+        x = x * 1103515245 + 12345;
+        random_in.push_back(static_cast<char>(x >> 24));
+    }
+    BOOST_CHECK( !p.decide(random_in,level) );
+
+    // poor results skip one message, then two
+    std::string text(1000,'a');
+    p.record(1000,950,0);
+    BOOST_CHECK( !p.decide(text,level) );
+    BOOST_CHECK( p.decide(text,level) );
+    p.record(1000,950,0);
+    BOOST_CHECK( !p.decide(text,level) );
+    BOOST_CHECK( !p.decide(text,level) );
+    BOOST_CHECK( p.decide(text,level) );
+
+    // a good result resets the back off
+    p.record(1000,100,0);
+    BOOST_CHECK( p.decide(text,level) );
+}
+
+BOOST_AUTO_TEST_CASE( adaptive_policy_level ) {
+    websocketpp::extensions::permessage_deflate::adaptive_policy p(64,10);
+
+    // 20ns per byte is over the 10ns budget
+    for (int i = 0; i < 16; i++) {
+        p.record(1000,100,20000);
+    }
+    BOOST_CHECK_EQUAL( p.get_level(), 5 );
+
+    // 1ns per byte is well under
+    for (int i = 0; i < 64; i++) {
+        p.record(1000,100,1000);
+    }
+    BOOST_CHECK_EQUAL( p.get_level(), 6 );
+}
+
 /// @todo: more compression tests
 /**
  * - compress at different compression levels
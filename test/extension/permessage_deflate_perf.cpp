@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2020, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+// Compares permessage-deflate compression backends across window sizes,
+// memory levels and payload types. Each message is compressed and
+// decompressed with a freshly reset stream, as with no_context_takeover.
+//
+// Usage: perf_permessage_deflate [file ...]
+// Files given on the command line are added to the built in corpus.
+
+#include <websocketpp/common/chrono.hpp>
+#include <websocketpp/common/stdint.hpp>
+#include <websocketpp/extensions/permessage_deflate/zlib_backend.hpp>
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace pmd = websocketpp::extensions::permessage_deflate;
+namespace chrono = websocketpp::lib::chrono;
+
+typedef std::pair<std::string,std::string> sample;
+
+// Small deterministic generator so runs are comparable
+class xorshift {
+public:
+    xorshift() : m_state(2463534242u) {}
+
+    uint32_t operator()() {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 17;
+        m_state ^= m_state << 5;
+        return m_state;
+    }
+private:
+    uint32_t m_state;
+};
+
+std::string make_json(size_t size) {
+    static char const * names[] = {"alpha","bravo","charlie","delta","echo"};
+    xorshift rng;
+    std::ostringstream s;
+
+    s << "[";
+    for (int i = 0; s.tellp() < std::streamoff(size); i++) {
+        s << (i ? "," : "") << "{\"id\":" << i << ",\"name\":\""
+          << names[rng() % 5] << "\",\"price\":" << rng() % 100000 / 100.0
+          << ",\"active\":" << (rng() % 2 ? "true" : "false")
+          << ",\"tags\":[\"" << names[rng() % 5] << "\",\"" << names[rng() % 5]
+          << "\"]}";
+    }
+    s << "]";
+    return s.str();
+}
+
+std::string make_text(size_t size) {
+    static char const * words[] = {"the","quick","brown","fox","jumps","over",
+        "lazy","dog","and","then","runs","away","from","a","very","small",
+        "message","queue","server","client"};
+    xorshift rng;
+    std::string s;
+
+    while (s.size() < size) {
+        s += words[rng() % 20];
+        s += (rng() % 12 == 0) ? ".\n" : " ";
+    }
+    return s;
+}
+
+std::string make_binary(size_t size) {
+    xorshift rng;
+    std::string s;
+
+    // a mix of small integers, as in packed telemetry, and noise
+    while (s.size() < size) {
+        uint32_t v = rng();
+        if (v % 4 == 0) {
+            s.append(4,char(v >> 8));
+        } else {
+            s.push_back(char(v % 16));
+            s.push_back(char(v >> 24));
+        }
+    }
+    s.resize(size);
+    return s;
+}
+
+template <typename backend>
+void run(std::string const & backend_name, std::vector<sample> const & corpus,
+    uint8_t window_bits, int mem_level)
+{
+    typename backend::deflater d;
+    typename backend::inflater i;
+
+    if (!d.init(window_bits, backend::default_level, mem_level) ||
+        !i.init(window_bits))
+    {
+        std::cout << backend_name << ": init failed" << std::endl;
+        return;
+    }
+
+    for (size_t n = 0; n < corpus.size(); n++) {
+        std::string const & payload = corpus[n].second;
+        uint8_t const * in = reinterpret_cast<uint8_t const *>(payload.data());
+
+        // repeat small payloads so each measurement covers at least 16MB
+        size_t rounds = 16*1024*1024 / (payload.size() + 1) + 1;
+
+        std::string compressed;
+        std::string decompressed;
+        size_t out_size = 0;
+        bool ok = true;
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds && ok; r++) {
+            compressed.clear();
+            ok = d.reset() && d.compress(in, payload.size(), compressed, true);
+        }
+        chrono::nanoseconds c_time = chrono::steady_clock::now() - start;
+        out_size = compressed.size();
+
+        start = chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds && ok; r++) {
+            decompressed.clear();
+            ok = i.reset() && i.decompress(
+                reinterpret_cast<uint8_t const *>(compressed.data()),
+                compressed.size(), decompressed, payload.size());
+        }
+        chrono::nanoseconds d_time = chrono::steady_clock::now() - start;
+
+        if (!ok || decompressed != payload) {
+            std::cout << backend_name << " " << corpus[n].first
+                      << ": round trip failed" << std::endl;
+            continue;
+        }
+
+        double mb = double(payload.size()) * rounds / (1024 * 1024);
+
+        std::cout << std::left << std::setw(8) << backend_name
+                  << std::setw(16) << corpus[n].first
+                  << std::right << std::setw(4) << int(window_bits)
+                  << std::setw(4) << mem_level
+                  << std::fixed << std::setprecision(3)
+                  << std::setw(10) << double(out_size) / payload.size()
+                  << std::setprecision(1)
+                  << std::setw(12) << mb / (c_time.count() / 1e9)
+                  << std::setw(12) << mb / (d_time.count() / 1e9)
+                  << std::endl;
+    }
+}
+
+int main(int argc, char ** argv) {
+    std::vector<sample> corpus;
+
+    corpus.push_back(sample("json-256",make_json(256)));
+    corpus.push_back(sample("json-64k",make_json(64*1024)));
+    corpus.push_back(sample("text-256",make_text(256)));
+    corpus.push_back(sample("text-64k",make_text(64*1024)));
+    corpus.push_back(sample("binary-256",make_binary(256)));
+    corpus.push_back(sample("binary-64k",make_binary(64*1024)));
+
+    for (int i = 1; i < argc; i++) {
+        std::ifstream f(argv[i], std::ios::binary);
+        if (!f) {
+            std::cout << "could not read " << argv[i] << std::endl;
+            return 1;
+        }
+        std::ostringstream s;
+        s << f.rdbuf();
+        corpus.push_back(sample(argv[i],s.str()));
+    }
+
+    uint8_t const window_bits[] = {9, 12, 15};
+    int const mem_levels[] = {1, 4, 8};
+
+    std::cout << std::left << std::setw(8) << "backend"
+              << std::setw(16) << "payload"
+              << std::right << std::setw(4) << "wb"
+              << std::setw(4) << "ml"
+              << std::setw(10) << "ratio"
+              << std::setw(12) << "comp MB/s"
+              << std::setw(12) << "decomp MB/s" << std::endl;
+
+    for (size_t w = 0; w < sizeof(window_bits); w++) {
+        for (size_t m = 0; m < sizeof(mem_levels)/sizeof(int); m++) {
+            run<pmd::zlib_backend>("zlib",corpus,window_bits[w],mem_levels[m]);
+        }
+    }
+
+    return 0;
+}
@@ -548,6 +548,97 @@ BOOST_AUTO_TEST_CASE( basic_request_with_body_split ) {
     BOOST_CHECK_EQUAL( r.get_body(), "abcdef" );
 }
 
+BOOST_AUTO_TEST_CASE( chunked_request_body ) {
+    websocketpp::http::parser::request r;
+
+    std::string raw = "POST / HTTP/1.1\r\nHost: www.example.com\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\nA;foo=bar\r\n0123456789\r\n0\r\n\r\nGET";
+
+    size_t pos = 0;
+    BOOST_CHECK_NO_THROW( pos = r.consume(raw.c_str(),raw.size()) );
+
+    BOOST_CHECK_EQUAL( pos, raw.size() - 3 );
+    BOOST_CHECK( r.ready() );
+    BOOST_CHECK_EQUAL( r.get_body(), "abc0123456789" );
+}
+
+BOOST_AUTO_TEST_CASE( chunked_request_body_bytewise ) {
+    websocketpp::http::parser::request r;
+    r.set_indexed_headers(true);
+
+    std::string raw = "POST / HTTP/1.1\r\nHost: www.example.com\r\nTransfer-Encoding: gzip, Chunked\r\n\r\n1a \r\nabcdefghijklmnopqrstuvwxyz\r\n1\r\n!\r\n0\r\nX-Trailer: foo\r\n\r\n";
+
+    size_t pos = 0;
+    for (size_t i = 0; i < raw.size(); i++) {
+        BOOST_CHECK( !r.ready() );
+        pos += r.consume(raw.data()+i,1);
+    }
+
+    BOOST_CHECK_EQUAL( pos, raw.size() );
+    BOOST_CHECK( r.ready() );
+    BOOST_CHECK_EQUAL( r.get_body(), "abcdefghijklmnopqrstuvwxyz!" );
+    BOOST_CHECK_EQUAL( r.get_header("X-Trailer"), "" );
+}
+
+BOOST_AUTO_TEST_CASE( chunked_request_errors ) {
+    std::string head = "POST / HTTP/1.1\r\nHost: www.example.com\r\nTransfer-Encoding: chunked\r\n\r\n";
+
+    std::string inputs[] = {
+        head + "x\r\n",
+        head + "\r\n",
+        head + "3\r\nabcd\r\n",
+        head + "3\n",
+        head + "ffffffffffffffffff\r\n",
+        head + "6\r\n",
+        "POST / HTTP/1.1\r\nHost: www.example.com\r\nTransfer-Encoding: chunked, gzip\r\n\r\n",
+        "POST / HTTP/1.1\r\nHost: www.example.com\r\nTransfer-Encoding: chunked\r\nContent-Length: 3\r\n\r\n",
+        "POST / HTTP/1.0\r\nHost: www.example.com\r\nTransfer-Encoding: chunked\r\n\r\n"
+    };
+    websocketpp::http::status_code::value codes[] = {
+        websocketpp::http::status_code::bad_request,
+        websocketpp::http::status_code::bad_request,
+        websocketpp::http::status_code::bad_request,
+        websocketpp::http::status_code::bad_request,
+        websocketpp::http::status_code::request_entity_too_large,
+        websocketpp::http::status_code::request_entity_too_large,
+        websocketpp::http::status_code::bad_request,
+        websocketpp::http::status_code::bad_request,
+        websocketpp::http::status_code::bad_request
+    };
+
+    for (size_t i = 0; i < 9; i++) {
+        websocketpp::http::parser::request r;
+        r.set_max_body_size(5);
+
+        bool exception = false;
+        try {
+            r.consume(inputs[i].c_str(),inputs[i].size());
+        } catch (websocketpp::http::exception const & e) {
+            exception = true;
+            BOOST_CHECK_EQUAL( e.m_error_code, codes[i] );
+        }
+        BOOST_CHECK( exception );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( stream_body ) {
+    websocketpp::http::parser::request r;
+    r.set_max_body_size(5);
+    r.set_stream_body(true);
+
+    std::string raw = "POST / HTTP/1.1\r\nHost: www.example.com\r\nContent-Length: 8\r\n\r\nabc";
+    std::string raw2 = "defgh";
+
+    BOOST_CHECK_EQUAL( r.consume(raw.c_str(),raw.size()), raw.size() );
+    BOOST_CHECK( !r.ready() );
+    BOOST_CHECK_EQUAL( r.get_body(), "abc" );
+    r.clear_body();
+
+    BOOST_CHECK_EQUAL( r.consume(raw2.c_str(),raw2.size()), raw2.size() );
+    BOOST_CHECK( r.ready() );
+    BOOST_CHECK_EQUAL( r.get_body(), "defgh" );
+    BOOST_CHECK_EQUAL( r.get_header("Content-Length"), "8" );
+}
+
 
 
 BOOST_AUTO_TEST_CASE( trailing_body_characters ) {
@@ -1139,3 +1230,177 @@ BOOST_AUTO_TEST_CASE( write_request_with_body ) {
 
     BOOST_CHECK_EQUAL( r.raw(), raw );
 }
+
+BOOST_AUTO_TEST_CASE( indexed_firefox_request_byte_by_byte ) {
+    websocketpp::http::parser::request r;
+    r.set_indexed_headers(true);
+
+    std::string raw = "GET / HTTP/1.1\r\nHost: localhost:5000\r\nUser-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10.7; rv:10.0) Gecko/20100101 Firefox/10.0\r\nAccept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\nAccept-Language: en-us,en;q=0.5\r\nAccept-Encoding: gzip, deflate\r\nConnection: keep-alive, Upgrade\r\nSec-WebSocket-Version: 8\r\nSec-WebSocket-Origin: http://zaphoyd.com\r\nSec-WebSocket-Key: pFik//FxwFk0riN4ZiPFjQ==\r\nPragma: no-cache\r\nCache-Control: no-cache\r\nUpgrade: websocket\r\n\r\n";
+
+    size_t pos = 0;
+    for (size_t i = 0; i < raw.size() && !r.ready(); i++) {
+        pos += r.consume(raw.c_str()+i,1);
+    }
+
+    BOOST_CHECK_EQUAL( pos, 482 );
+    BOOST_CHECK( r.ready() == true );
+    BOOST_CHECK_EQUAL( r.get_method(), "GET" );
+    BOOST_CHECK_EQUAL( r.get_uri(), "/" );
+    BOOST_CHECK_EQUAL( r.get_version(), "HTTP/1.1" );
+    BOOST_CHECK_EQUAL( r.get_header("Host"), "localhost:5000" );
+    BOOST_CHECK_EQUAL( r.get_header("host"), "localhost:5000" );
+    BOOST_CHECK_EQUAL( r.get_header("SEC-WEBSOCKET-KEY"), "pFik//FxwFk0riN4ZiPFjQ==" );
+    BOOST_CHECK_EQUAL( r.get_header("Connection"), "keep-alive, Upgrade" );
+    BOOST_CHECK_EQUAL( r.get_header("Upgrade"), "websocket" );
+    BOOST_CHECK_EQUAL( r.get_header("Missing"), "" );
+    BOOST_CHECK_EQUAL( r.get_headers().size(), 12 );
+}
+
+BOOST_AUTO_TEST_CASE( indexed_matches_header_list ) {
+    std::string raw = "GET /chat HTTP/1.1\r\nHost:www.example.com\r\nFoo: bar\r\nfoo:  bat \r\nEmpty:\r\nX-Extra: \t1\t\r\nSec-WebSocket-Extensions: foo; bar=1\r\n\r\nbody";
+
+    websocketpp::http::parser::request a;
+    websocketpp::http::parser::request b;
+    b.set_indexed_headers(true);
+
+    BOOST_CHECK_EQUAL( a.consume(raw.c_str(),raw.size()), raw.size() - 4 );
+    BOOST_CHECK_EQUAL( b.consume(raw.c_str(),raw.size()), raw.size() - 4 );
+
+    BOOST_CHECK_EQUAL( b.get_header("Foo"), "bar, bat" );
+    BOOST_CHECK_EQUAL( b.get_header("Empty"), "" );
+    BOOST_CHECK_EQUAL( b.get_header("x-extra"), "1" );
+
+    websocketpp::http::parameter_list plist;
+    BOOST_CHECK( !b.get_header_as_plist("sec-websocket-extensions",plist) );
+    BOOST_CHECK_EQUAL( plist.size(), 1 );
+
+    BOOST_CHECK( a.get_headers() == b.get_headers() );
+    BOOST_CHECK_EQUAL( a.raw(), b.raw() );
+}
+
+BOOST_AUTO_TEST_CASE( indexed_loaded_when_complete ) {
+    websocketpp::http::parser::request r;
+    r.set_indexed_headers(true);
+
+    std::string raw = "GET / HTTP/1.1\r\nHost: www.example.com\r\nFoo: bar\r\n\r\n";
+
+    r.consume(raw.c_str(),raw.size());
+    BOOST_REQUIRE( r.ready() );
+
+    // the header list is filled while parsing, not on first const access
+    websocketpp::http::parser::request const & c = r;
+    websocketpp::http::parser::header_list const & headers = c.get_headers();
+
+    BOOST_CHECK_EQUAL( headers.size(), 2 );
+    BOOST_CHECK_EQUAL( c.get_header("Foo"), "bar" );
+
+    // loading again changes nothing
+    r.load_header_index();
+    BOOST_CHECK_EQUAL( &c.get_headers(), &headers );
+    BOOST_CHECK_EQUAL( headers.size(), 2 );
+}
+
+BOOST_AUTO_TEST_CASE( indexed_modify_after_parse ) {
+    websocketpp::http::parser::request r;
+    r.set_indexed_headers(true);
+
+    std::string raw = "GET / HTTP/1.1\r\nHost: www.example.com\r\nFoo: bar\r\n\r\n";
+
+    r.consume(raw.c_str(),raw.size());
+
+    r.replace_header("Foo","baz");
+    r.append_header("Foo","bat");
+    r.remove_header("host");
+
+    BOOST_CHECK_EQUAL( r.get_header("Foo"), "baz, bat" );
+    BOOST_CHECK_EQUAL( r.get_header("Host"), "" );
+    BOOST_CHECK_EQUAL( r.get_headers().size(), 1 );
+}
+
+BOOST_AUTO_TEST_CASE( indexed_split_delimiter_and_body ) {
+    websocketpp::http::parser::request r;
+    r.set_indexed_headers(true);
+
+    std::string raw1 = "POST / HTTP/1.1\r\nHost: www.example.com\r";
+    std::string raw2 = "\nContent-Length: 5\r\n\r";
+    std::string raw3 = "\nabcdeXYZ";
+
+    BOOST_CHECK_EQUAL( r.consume(raw1.c_str(),raw1.size()), raw1.size() );
+    BOOST_CHECK_EQUAL( r.consume(raw2.c_str(),raw2.size()), raw2.size() );
+    BOOST_CHECK( !r.ready() );
+    BOOST_CHECK_EQUAL( r.consume(raw3.c_str(),raw3.size()), 6 );
+    BOOST_CHECK( r.ready() );
+    BOOST_CHECK_EQUAL( r.get_header("Host"), "www.example.com" );
+    BOOST_CHECK_EQUAL( r.get_body(), "abcde" );
+}
+
+BOOST_AUTO_TEST_CASE( indexed_errors ) {
+    std::string bad_name = "GET / HTTP/1.1\r\nHost: www.example.com\r\nFo]o: bar\r\n\r\n";
+    std::string no_host = "GET / HTTP/1.1\r\nFoo: bar\r\n\r\n";
+    std::string too_long = "GET / HTTP/1.1\r\nHost: www.example.com\r\nFoo: " +
+        std::string(websocketpp::http::max_header_size,'a');
+
+    std::string const * inputs[] = {&bad_name, &no_host, &too_long};
+    websocketpp::http::status_code::value codes[] = {
+        websocketpp::http::status_code::bad_request,
+        websocketpp::http::status_code::bad_request,
+        websocketpp::http::status_code::request_header_fields_too_large
+    };
+
+    for (size_t i = 0; i < 3; i++) {
+        websocketpp::http::parser::request r;
+        r.set_indexed_headers(true);
+
+        bool exception = false;
+        try {
+            r.consume(inputs[i]->c_str(),inputs[i]->size());
+        } catch (websocketpp::http::exception const & e) {
+            exception = true;
+            BOOST_CHECK_EQUAL( e.m_error_code, codes[i] );
+        }
+        BOOST_CHECK( exception );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( scanner_matches_scalar ) {
+    namespace scanner = websocketpp::http::parser::scanner;
+
+    // every byte value, at every offset of ranges long enough to use the
+    // vector loop and its scalar tail
+    for (size_t len = 0; len < 70; len += 7) {
+        for (size_t pos = 0; pos < len; pos++) {
+            for (int c = 0; c < 256; c++) {
+                std::string s(len,'a');
+                s[pos] = static_cast<char>(c);
+
+                char const * b = s.data();
+                char const * e = s.data() + s.size();
+
+                BOOST_CHECK( scanner::find_char(b,e,static_cast<char>(c)) ==
+                    std::find(b,e,static_cast<char>(c)) );
+                BOOST_CHECK( scanner::find_non_token(b,e) ==
+                    std::find_if(b,e,websocketpp::http::is_not_token_char) );
+            }
+        }
+    }
+
+    // CRLF at every offset, including split across the vector boundary, and
+    // CR or LF on their own
+    char const crlf[] = "\r\n";
+    for (size_t len = 0; len < 70; len++) {
+        for (size_t pos = 0; pos + 1 < len; pos++) {
+            std::string s(len,'a');
+            s[pos] = '\r';
+
+            char const * b = s.data();
+            char const * e = s.data() + s.size();
+
+            BOOST_CHECK( scanner::find_crlf(b,e) == e );
+            s[pos+1] = '\n';
+            BOOST_CHECK( scanner::find_crlf(b,e) == std::search(b,e,crlf,crlf+2) );
+            BOOST_CHECK( scanner::find_crlf(b,e) == b + pos );
+        }
+        std::string s(len,'\r');
+        BOOST_CHECK( scanner::find_crlf(s.data(),s.data()+len) == s.data()+len );
+    }
+}
@@ -26,8 +26,12 @@
  */
 
 #include <websocketpp/http/parser.hpp>
+#include <websocketpp/http/request.hpp>
 
+#include <algorithm>
 #include <chrono>
+#include <iostream>
+#include <string>
 
 class scoped_timer {
 public:
@@ -81,12 +85,13 @@ int main() {
     }
 
     {
-        scoped_timer timer("FireFox, 1 chop, consume old");
+        scoped_timer timer("FireFox, 1 chop, indexed");
         for (int i = 0; i < 1000; i++) {
             websocketpp::http::parser::request r;
+            r.set_indexed_headers(true);
 
             try {
-                r.consume2(firefox.c_str(),firefox.size());
+                r.consume(firefox.c_str(),firefox.size());
             } catch (...) {
                 std::cout << "exception" << std::endl;
             }
@@ -137,5 +142,65 @@ int main() {
         }
     }
 
+    // Line scanning on its own: find every CRLF in the Firefox request
+    char const * fx_begin = firefox.data();
+    char const * fx_end = firefox.data() + firefox.size();
+    char const crlf[] = "\r\n";
+    size_t lines = 0;
+
+    {
+        scoped_timer timer("FireFox CRLF, std::search");
+        for (int i = 0; i < 1000; i++) {
+            char const * it = fx_begin;
+            while ((it = std::search(it,fx_end,crlf,crlf+2)) != fx_end) {
+                it += 2;
+                lines++;
+            }
+        }
+    }
+
+    {
+        scoped_timer timer("FireFox CRLF, scanner");
+        for (int i = 0; i < 1000; i++) {
+            char const * it = fx_begin;
+            while ((it = websocketpp::http::parser::scanner::find_crlf(it,
+                fx_end)) != fx_end)
+            {
+                it += 2;
+                lines--;
+            }
+        }
+    }
+
+    if (lines != 0) {
+        std::cout << "scanner mismatch" << std::endl;
+    }
+
+    // Token validation of a long header name
+    std::string name = "Sec-WebSocket-Extensions-Sec-WebSocket-Protocol";
+    char const * n_begin = name.data();
+    char const * n_end = name.data() + name.size();
+    size_t tokens = 0;
+
+    {
+        scoped_timer timer("Token check, std::find_if");
+        for (int i = 0; i < 1000; i++) {
+            tokens += (std::find_if(n_begin,n_end,
+                websocketpp::http::is_not_token_char) == n_end);
+        }
+    }
+
+    {
+        scoped_timer timer("Token check, scanner");
+        for (int i = 0; i < 1000; i++) {
+            tokens -= (websocketpp::http::parser::scanner::find_non_token(
+                n_begin,n_end) == n_end);
+        }
+    }
+
+    if (tokens != 0) {
+        std::cout << "scanner mismatch" << std::endl;
+    }
+
     return 0;
 }
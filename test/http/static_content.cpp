@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2011, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+//#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE static_content
+#include <boost/test/unit_test.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <sys/stat.h>
+
+#include <websocketpp/config/core.hpp>
+#include <websocketpp/server.hpp>
+#include <websocketpp/http/static_content.hpp>
+
+typedef websocketpp::server<websocketpp::config::core> server;
+typedef websocketpp::http::parser::response response;
+
+using websocketpp::lib::placeholders::_1;
+using websocketpp::lib::bind;
+
+void static_func(server * s, websocketpp::http::static_content * files,
+    websocketpp::connection_hdl hdl)
+{
+    server::connection_ptr con = s->get_con_from_hdl(hdl);
+    if (!files->serve(con)) {
+        con->set_status(websocketpp::http::status_code::not_found);
+    }
+}
+
+std::string run_request(websocketpp::http::static_content & files,
+    std::string const & input, long keep_alive = 0)
+{
+    server s;
+    s.clear_access_channels(websocketpp::log::alevel::all);
+    s.clear_error_channels(websocketpp::log::elevel::all);
+    s.set_http_keep_alive_timeout(keep_alive);
+    s.set_http_handler(bind(&static_func,&s,&files,::_1));
+
+    std::stringstream output;
+    s.register_ostream(&output);
+
+    server::connection_ptr con = s.get_connection();
+    con->start();
+
+    std::stringstream channel;
+    channel << input;
+    channel >> *con;
+
+    return output.str();
+}
+
+response parse(std::string const & raw) {
+    response r;
+    r.consume(raw.data(),raw.size());
+    return r;
+}
+
+std::string gunzip(std::string const & in) {
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.avail_in = 0;
+    strm.next_in = Z_NULL;
+    BOOST_REQUIRE( inflateInit2(&strm,15+16) == Z_OK );
+
+    std::string out(in.size()*100,'\0');
+    strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+    strm.avail_in = static_cast<uInt>(in.size());
+    strm.next_out = reinterpret_cast<Bytef *>(&out[0]);
+    strm.avail_out = static_cast<uInt>(out.size());
+    BOOST_CHECK( inflate(&strm,Z_FINISH) == Z_STREAM_END );
+    out.resize(out.size()-strm.avail_out);
+    inflateEnd(&strm);
+    return out;
+}
+
+std::string get(std::string const & path, std::string const & extra = "") {
+    return "GET " + path + " HTTP/1.1\r\nHost: www.example.com\r\n" + extra +
+        "\r\n";
+}
+
+BOOST_AUTO_TEST_CASE( serve_file ) {
+    websocketpp::http::static_content files;
+    files.add("/app/index.html","<html></html>","text/html");
+    BOOST_CHECK_EQUAL( files.size(), 2 );
+
+    std::string paths[] = {"/app/index.html","/app/","/app/?v=1"};
+    for (size_t i = 0; i < 3; i++) {
+        response r = parse(run_request(files,get(paths[i])));
+        BOOST_CHECK_EQUAL( r.get_status_code(),
+            websocketpp::http::status_code::ok );
+        BOOST_CHECK_EQUAL( r.get_header("Content-Type"), "text/html" );
+        BOOST_CHECK_EQUAL( r.get_header("Content-Length"), "13" );
+        BOOST_CHECK_EQUAL( r.get_header("ETag").size(), 18 );
+        BOOST_CHECK_EQUAL( r.get_header("Content-Encoding"), "" );
+        BOOST_CHECK_EQUAL( r.get_header("Vary"), "" );
+        BOOST_CHECK_EQUAL( r.get_body(), "<html></html>" );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( not_found ) {
+    websocketpp::http::static_content files;
+    files.add("/app.js","var a;","application/javascript");
+
+    std::string inputs[] = {
+        get("/missing.js"),
+        get("/app"),
+        "POST /app.js HTTP/1.1\r\nHost: www.example.com\r\n\r\n"
+    };
+    for (size_t i = 0; i < 3; i++) {
+        BOOST_CHECK_EQUAL( parse(run_request(files,inputs[i])).get_status_code(),
+            websocketpp::http::status_code::not_found );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( gzip_variant ) {
+    websocketpp::http::static_content files;
+    files.set_cache_control("max-age=60");
+
+    std::string js;
+    for (size_t i = 0; i < 200; i++) {
+        js += "function f() { return 42; }\n";
+    }
+    files.add("/app.js",js,"application/javascript");
+
+    response plain = parse(run_request(files,get("/app.js")));
+    BOOST_CHECK_EQUAL( plain.get_body(), js );
+    BOOST_CHECK_EQUAL( plain.get_header("Vary"), "Accept-Encoding" );
+    BOOST_CHECK_EQUAL( plain.get_header("Cache-Control"), "max-age=60" );
+    BOOST_CHECK_EQUAL( plain.get_header("Content-Encoding"), "" );
+
+    response gz = parse(run_request(files,
+        get("/app.js","Accept-Encoding: deflate, gzip;q=0.5\r\n")));
+    BOOST_CHECK_EQUAL( gz.get_header("Content-Encoding"), "gzip" );
+    BOOST_CHECK_EQUAL( gz.get_header("Vary"), "Accept-Encoding" );
+    BOOST_CHECK( gz.get_body().size() < js.size() );
+    BOOST_CHECK( gz.get_header("ETag") != plain.get_header("ETag") );
+    BOOST_CHECK_EQUAL( gunzip(gz.get_body()), js );
+
+    response refused = parse(run_request(files,
+        get("/app.js","Accept-Encoding: gzip;q=0, *\r\n")));
+    BOOST_CHECK_EQUAL( refused.get_header("Content-Encoding"), "" );
+    BOOST_CHECK_EQUAL( refused.get_body(), js );
+
+    // small and incompressible files are only stored once
+    files.add("/small.js","var a;","application/javascript");
+    files.add("/big.png",js,"image/png");
+    std::string small = run_request(files,get("/small.js","Accept-Encoding: gzip\r\n"));
+    std::string png = run_request(files,get("/big.png","Accept-Encoding: gzip\r\n"));
+    BOOST_CHECK_EQUAL( parse(small).get_header("Content-Encoding"), "" );
+    BOOST_CHECK_EQUAL( parse(png).get_header("Content-Encoding"), "" );
+}
+
+BOOST_AUTO_TEST_CASE( conditional_request ) {
+    websocketpp::http::static_content files;
+    files.add("/a.txt","hello","text/plain");
+
+    std::string etag = parse(run_request(files,get("/a.txt"))).get_header("ETag");
+
+    std::string matching[] = {etag, "W/" + etag, "\"x\", " + etag, "*"};
+    for (size_t i = 0; i < 4; i++) {
+        std::string raw = run_request(files,
+            get("/a.txt","If-None-Match: " + matching[i] + "\r\n"));
+        response r = parse(raw);
+        BOOST_CHECK_EQUAL( r.get_status_code(),
+            websocketpp::http::status_code::not_modified );
+        BOOST_CHECK_EQUAL( r.get_header("ETag"), etag );
+        BOOST_CHECK_EQUAL( raw.substr(raw.size()-4), "\r\n\r\n" );
+    }
+
+    response r = parse(run_request(files,
+        get("/a.txt","If-None-Match: \"other\"\r\n")));
+    BOOST_CHECK_EQUAL( r.get_status_code(), websocketpp::http::status_code::ok );
+    BOOST_CHECK_EQUAL( r.get_body(), "hello" );
+}
+
+BOOST_AUTO_TEST_CASE( head_request ) {
+    websocketpp::http::static_content files;
+    files.add("/a.txt","hello","text/plain");
+
+    std::string raw = run_request(files,
+        "HEAD /a.txt HTTP/1.1\r\nHost: www.example.com\r\n\r\n");
+    response r = parse(raw);
+    BOOST_CHECK_EQUAL( r.get_status_code(), websocketpp::http::status_code::ok );
+    BOOST_CHECK_EQUAL( r.get_header("Content-Length"), "5" );
+    BOOST_CHECK_EQUAL( raw.substr(raw.size()-4), "\r\n\r\n" );
+}
+
+BOOST_AUTO_TEST_CASE( keep_alive ) {
+    websocketpp::http::static_content files;
+    files.add("/a.txt","hello","text/plain");
+    files.add("/b.txt","world","text/plain");
+
+    std::string raw = run_request(files,get("/a.txt") + get("/b.txt") +
+        get("/a.txt","Connection: close\r\n"), 5000);
+
+    std::string::size_type first = raw.find("hello");
+    std::string::size_type second = raw.find("world");
+    BOOST_CHECK( first != std::string::npos );
+    BOOST_CHECK( second != std::string::npos && second > first );
+    BOOST_CHECK_EQUAL( raw.substr(raw.size()-5), "hello" );
+}
+
+BOOST_AUTO_TEST_CASE( load_directory ) {
+    char dir_template[] = "/tmp/wspp_static_XXXXXX";
+    char * dir = mkdtemp(dir_template);
+    BOOST_REQUIRE( dir );
+
+    std::string root = dir;
+    BOOST_REQUIRE( mkdir((root + "/css").c_str(),0700) == 0 );
+    std::ofstream((root + "/index.html").c_str()) << "<html></html>";
+    std::ofstream((root + "/css/site.CSS").c_str()) << "body {}";
+    std::ofstream((root + "/data.bin").c_str()) << "xyz";
+    std::ofstream((root + "/.hidden").c_str()) << "secret";
+
+    websocketpp::http::static_content files;
+    BOOST_CHECK( !files.add_directory("/static",root) );
+    BOOST_CHECK_EQUAL( files.size(), 4 );
+
+    response css = parse(run_request(files,get("/static/css/site.CSS")));
+    BOOST_CHECK_EQUAL( css.get_header("Content-Type"), "text/css" );
+    BOOST_CHECK_EQUAL( css.get_body(), "body {}" );
+
+    response bin = parse(run_request(files,get("/static/data.bin")));
+    BOOST_CHECK_EQUAL( bin.get_header("Content-Type"),
+        "application/octet-stream" );
+
+    BOOST_CHECK_EQUAL( parse(run_request(files,get("/static/"))).get_body(),
+        "<html></html>" );
+    BOOST_CHECK_EQUAL( parse(run_request(files,get("/static/.hidden")))
+        .get_status_code(), websocketpp::http::status_code::not_found );
+
+    BOOST_CHECK_EQUAL( files.add_directory("/",root + "/missing"),
+        websocketpp::error::make_error_code(websocketpp::error::http_body_file) );
+    BOOST_CHECK_EQUAL( files.add_file("/x",root + "/missing"),
+        websocketpp::error::make_error_code(websocketpp::error::http_body_file) );
+
+    std::remove((root + "/index.html").c_str());
+    std::remove((root + "/css/site.CSS").c_str());
+    std::remove((root + "/data.bin").c_str());
+    std::remove((root + "/.hidden").c_str());
+    std::remove((root + "/css").c_str());
+    std::remove(root.c_str());
+}
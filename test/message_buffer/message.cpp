@@ -70,3 +70,47 @@ BOOST_AUTO_TEST_CASE( recycle ) {
     BOOST_CHECK(s->recycled == true);
 }
 
+BOOST_AUTO_TEST_CASE( priority ) {
+    typedef websocketpp::message_buffer::message<stub> message_type;
+    typedef stub<message_type> stub_type;
+
+    stub_type::ptr s(new stub_type());
+    message_type::ptr msg(new message_type(s,websocketpp::frame::opcode::TEXT,500));
+
+    BOOST_CHECK_EQUAL(msg->get_priority(), websocketpp::message_buffer::priority::normal);
+    msg->set_priority(websocketpp::message_buffer::priority::high);
+    BOOST_CHECK_EQUAL(msg->get_priority(), websocketpp::message_buffer::priority::high);
+}
+
+BOOST_AUTO_TEST_CASE( compressed_cache ) {
+    typedef websocketpp::message_buffer::message<stub> message_type;
+    typedef stub<message_type> stub_type;
+
+    stub_type::ptr s(new stub_type());
+    message_type::ptr msg(new message_type(s,websocketpp::frame::opcode::TEXT,500));
+    msg->set_payload("foo");
+
+    std::string out;
+    BOOST_CHECK(!msg->get_compressed_cache(1,out));
+
+    msg->set_compressed_cache(1,"abc");
+    msg->set_compressed_cache(2,"def");
+    BOOST_CHECK(msg->get_compressed_cache(1,out));
+    BOOST_CHECK_EQUAL(out, "abc");
+
+    out.clear();
+    BOOST_CHECK(msg->get_compressed_cache(2,out));
+    BOOST_CHECK_EQUAL(out, "def");
+
+    // messages stay copyable, an unchanged copy keeps the cache
+    message_type copy(*msg);
+
+    // changing the payload invalidates the cache
+    msg->append_payload("bar");
+    out.clear();
+    BOOST_CHECK(!msg->get_compressed_cache(1,out));
+    BOOST_CHECK(out.empty());
+
+    BOOST_CHECK(copy.get_compressed_cache(1,out));
+    BOOST_CHECK_EQUAL(out, "abc");
+}
@@ -54,6 +54,9 @@ struct stub_config {
 
     /// Extension related config
     static const bool enable_extensions = false;
+    static const bool enable_adaptive_compression = false;
+    static const size_t adaptive_compression_min_size = 64;
+    static const long adaptive_compression_time_budget = 20;
 
     /// Extension specific config
 
@@ -62,6 +62,9 @@ struct stub_config {
 
     static const size_t max_message_size = 16000000;
     static const bool enable_extensions = false;
+    static const bool enable_adaptive_compression = false;
+    static const size_t adaptive_compression_min_size = 64;
+    static const long adaptive_compression_time_budget = 20;
 };
 
 struct stub_config_ext {
@@ -84,6 +87,9 @@ struct stub_config_ext {
 
     static const size_t max_message_size = 16000000;
     static const bool enable_extensions = true;
+    static const bool enable_adaptive_compression = false;
+    static const size_t adaptive_compression_min_size = 64;
+    static const long adaptive_compression_time_budget = 20;
 };
 
 typedef stub_config::con_msg_manager_type con_msg_manager_type;
@@ -144,6 +150,57 @@ BOOST_AUTO_TEST_CASE( exact_match ) {
     BOOST_CHECK_EQUAL(env.res.get_header("Sec-WebSocket-Accept"), "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
 }
 
+BOOST_AUTO_TEST_CASE( response_template_matches_raw ) {
+    processor_setup env(true);
+
+    std::string handshake = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n";
+
+    env.req.consume(handshake.c_str(),handshake.size());
+
+    char const * servers[] = {"", "test"};
+    char const * extensions[] = {"", "permessage-deflate; server_no_context_takeover"};
+    char const * subprotocols[] = {"", "chat"};
+
+    for (int i = 0; i < 8; i++) {
+        websocketpp::processor::response_template tmpl(servers[i & 1]);
+
+        stub_config::response_type res;
+        res.set_status(websocketpp::http::status_code::switching_protocols);
+        res.set_version("HTTP/1.1");
+        if (i & 1) {
+            res.replace_header("Server",servers[1]);
+        }
+        if (i & 2) {
+            res.replace_header("Sec-WebSocket-Extensions",extensions[1]);
+        }
+        BOOST_CHECK( !env.p.process_handshake(env.req,subprotocols[(i >> 2) & 1],res) );
+
+        std::string out = "stale";
+        stub_config::response_type tmpl_res;
+        BOOST_CHECK( !env.p.write_handshake_response(env.req,
+            subprotocols[(i >> 2) & 1],extensions[(i >> 1) & 1],tmpl,out,
+            tmpl_res) );
+        BOOST_CHECK_EQUAL( out, env.p.get_raw(res) );
+
+        // the headers are recorded for later inspection
+        BOOST_CHECK_EQUAL( tmpl_res.get_header("Sec-WebSocket-Accept"), res.get_header("Sec-WebSocket-Accept") );
+        BOOST_CHECK_EQUAL( tmpl_res.get_header("Upgrade"), res.get_header("Upgrade") );
+        BOOST_CHECK_EQUAL( tmpl_res.get_header("Connection"), res.get_header("Connection") );
+        BOOST_CHECK_EQUAL( tmpl_res.get_header("Sec-WebSocket-Protocol"), res.get_header("Sec-WebSocket-Protocol") );
+    }
+
+    // a bad key is reported the same way process_handshake reports it
+    stub_config::request_type bad;
+    std::string bad_handshake = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    bad.consume(bad_handshake.c_str(),bad_handshake.size());
+
+    std::string out;
+    websocketpp::processor::response_template tmpl("test");
+    stub_config::response_type tmpl_res;
+    BOOST_CHECK_EQUAL( env.p.write_handshake_response(bad,"","",tmpl,out,tmpl_res),
+        env.p.process_handshake(bad,"",env.res) );
+}
+
 BOOST_AUTO_TEST_CASE( non_get_method ) {
     processor_setup env(true);
 
@@ -491,6 +548,26 @@ BOOST_AUTO_TEST_CASE( prepare_data_frame ) {
 
 }
 
+BOOST_AUTO_TEST_CASE( prepare_data_frame_with_key ) {
+    processor_setup env(false);
+
+    message_ptr in = env.msg_manager->get_message();
+    message_ptr out = env.msg_manager->get_message();
+
+    in->set_opcode(websocketpp::frame::opcode::text);
+    in->set_payload("ab");
+
+    websocketpp::frame::masking_key_type key;
+    key.c[0] = 0x01;
+    key.c[1] = 0x02;
+    key.c[2] = 0x03;
+    key.c[3] = 0x04;
+
+    BOOST_CHECK( !env.p.prepare_data_frame(in,out,key) );
+    BOOST_CHECK_EQUAL( out->get_header(), std::string("\x81\x82\x01\x02\x03\x04") );
+    BOOST_CHECK_EQUAL( out->get_payload(), "\x60\x60" );
+}
+
 BOOST_AUTO_TEST_CASE( single_frame_message_too_large ) {
     processor_setup env(true);
     
@@ -691,3 +768,156 @@ BOOST_AUTO_TEST_CASE( extension_negotiation_permessage_deflate ) {
     BOOST_CHECK_EQUAL( neg_results.second, "permessage-deflate" );
 }
 
+
+BOOST_AUTO_TEST_CASE( compressed_message_too_large ) {
+    processor_setup_ext env(true);
+
+    env.req.replace_header("Sec-WebSocket-Extensions","permessage-deflate");
+    BOOST_CHECK( !env.p.negotiate_extensions(env.req).first );
+
+    env.p.set_max_message_size(100);
+
+    // 10000 bytes of 'a' compress to a frame far below the limit
+    websocketpp::extensions::permessage_deflate::zlib_backend::deflater d;
+    BOOST_REQUIRE( d.init(15,-1,4) );
+
+    std::string payload(10000,'a');
+    std::string compressed;
+    BOOST_REQUIRE( d.compress(reinterpret_cast<uint8_t const *>(payload.data()),payload.size(),compressed,true) );
+    compressed.resize(compressed.size()-4);
+    BOOST_REQUIRE( compressed.size() < 100 );
+
+    std::string frame;
+    frame.push_back(char(0xC2));
+    frame.push_back(char(0x80 | compressed.size()));
+    frame.append(4,char(0x00));
+    frame.append(compressed);
+
+    env.p.consume(reinterpret_cast<uint8_t *>(&frame[0]),frame.size(),env.ec);
+    BOOST_CHECK_EQUAL( env.ec, websocketpp::processor::error::message_too_big );
+}
+
+// Flips the case of ASCII letters
+class flip_extension : public websocketpp::extensions::extension {
+public:
+    std::string get_name() const {
+        return "x-flip";
+    }
+
+    bool needs_rsv_bit() const {
+        return true;
+    }
+
+    err_str_pair negotiate(websocketpp::http::attribute_list const &) {
+        return err_str_pair(websocketpp::lib::error_code(),"x-flip");
+    }
+
+    websocketpp::lib::error_code encode(std::string & payload, size_t offset, bool) {
+        flip(payload,offset);
+        return websocketpp::lib::error_code();
+    }
+
+    websocketpp::lib::error_code decode(std::string & payload, size_t offset, bool) {
+        flip(payload,offset);
+        return websocketpp::lib::error_code();
+    }
+private:
+    void flip(std::string & payload, size_t offset) {
+        for (size_t i = offset; i < payload.size(); i++) {
+            if (isalpha(static_cast<unsigned char>(payload[i]))) {
+                payload[i] ^= 0x20;
+            }
+        }
+    }
+};
+
+BOOST_AUTO_TEST_CASE( extension_chain_round_trip ) {
+    processor_setup_ext server(true);
+    processor_setup_ext client(false);
+
+    server.p.add_extension(websocketpp::extensions::extension::ptr(new flip_extension()));
+    client.p.add_extension(websocketpp::extensions::extension::ptr(new flip_extension()));
+
+    server.req.replace_header("Sec-WebSocket-Extensions","x-flip");
+    std::pair<websocketpp::lib::error_code,std::string> neg_results;
+    neg_results = server.p.negotiate_extensions(server.req);
+    BOOST_CHECK( !neg_results.first );
+    BOOST_CHECK_EQUAL( neg_results.second, "x-flip" );
+
+    client.res.replace_header("Sec-WebSocket-Extensions",neg_results.second);
+    BOOST_CHECK( !client.p.negotiate_extensions(client.res).first );
+
+    message_ptr in = server.msg_manager->get_message(websocketpp::frame::opcode::TEXT,5);
+    message_ptr out = server.msg_manager->get_message();
+    in->set_payload("Hello");
+
+    BOOST_CHECK( !server.p.prepare_data_frame(in,out) );
+    BOOST_CHECK_EQUAL( in->get_payload(), "Hello" );
+    BOOST_CHECK_EQUAL( out->get_payload(), "hELLO" );
+    BOOST_CHECK_EQUAL( uint8_t(out->get_header()[0]), 0xA1 );
+
+    std::string frame = out->get_header() + out->get_payload();
+    client.p.consume(reinterpret_cast<uint8_t *>(&frame[0]),frame.size(),client.ec);
+    BOOST_CHECK( !client.ec );
+    BOOST_REQUIRE( client.p.ready() );
+    BOOST_CHECK_EQUAL( client.p.get_message()->get_payload(), "Hello" );
+
+    // RSV2 is not valid on a connection that didn't negotiate it
+    processor_setup_ext plain(false);
+    plain.p.consume(reinterpret_cast<uint8_t *>(&frame[0]),frame.size(),plain.ec);
+    BOOST_CHECK_EQUAL( plain.ec, websocketpp::processor::error::invalid_rsv_bit );
+}
+
+BOOST_AUTO_TEST_CASE( extension_chain_unexpected_extension ) {
+    processor_setup_ext client(false);
+    client.p.add_extension(websocketpp::extensions::extension::ptr(new flip_extension()));
+
+    // the server accepted an extension the client never offered
+    client.res.replace_header("Sec-WebSocket-Extensions","x-flip, x-other");
+    BOOST_CHECK_EQUAL( client.p.negotiate_extensions(client.res).first,
+        websocketpp::extensions::error::make_error_code(
+            websocketpp::extensions::error::unexpected_extension) );
+
+    // servers ignore offers they don't know
+    processor_setup_ext server(true);
+    server.p.add_extension(websocketpp::extensions::extension::ptr(new flip_extension()));
+
+    server.req.replace_header("Sec-WebSocket-Extensions","x-other, x-flip");
+    std::pair<websocketpp::lib::error_code,std::string> neg_results;
+    neg_results = server.p.negotiate_extensions(server.req);
+    BOOST_CHECK( !neg_results.first );
+    BOOST_CHECK_EQUAL( neg_results.second, "x-flip" );
+}
+
+BOOST_AUTO_TEST_CASE( extension_chain_with_permessage_deflate ) {
+    processor_setup_ext server(true);
+    processor_setup_ext client(false);
+
+    server.p.add_extension(websocketpp::extensions::extension::ptr(new flip_extension()));
+    client.p.add_extension(websocketpp::extensions::extension::ptr(new flip_extension()));
+
+    server.req.replace_header("Sec-WebSocket-Extensions","x-flip, permessage-deflate");
+    std::pair<websocketpp::lib::error_code,std::string> neg_results;
+    neg_results = server.p.negotiate_extensions(server.req);
+    BOOST_CHECK( !neg_results.first );
+    BOOST_CHECK_EQUAL( neg_results.second, "x-flip, permessage-deflate" );
+
+    client.res.replace_header("Sec-WebSocket-Extensions",neg_results.second);
+    BOOST_CHECK( !client.p.negotiate_extensions(client.res).first );
+
+    std::string payload(1000,'a');
+    message_ptr in = server.msg_manager->get_message(websocketpp::frame::opcode::TEXT,1000);
+    message_ptr out = server.msg_manager->get_message();
+    in->set_payload(payload);
+    in->set_compressed(true);
+
+    BOOST_CHECK( !server.p.prepare_data_frame(in,out) );
+    BOOST_CHECK( out->get_payload().size() < payload.size() );
+    BOOST_CHECK_EQUAL( uint8_t(out->get_header()[0]), 0xE1 );
+
+    std::string frame = out->get_header() + out->get_payload();
+    client.p.consume(reinterpret_cast<uint8_t *>(&frame[0]),frame.size(),client.ec);
+    BOOST_CHECK( !client.ec );
+    BOOST_REQUIRE( client.p.ready() );
+    BOOST_CHECK_EQUAL( client.p.get_message()->get_payload(), payload );
+}
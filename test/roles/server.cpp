@@ -236,6 +236,32 @@ BOOST_AUTO_TEST_CASE( accept_subprotocol_two ) {
     BOOST_CHECK_EQUAL(open, "bar");
 }
 
+bool validate_func_add_header(server* s, websocketpp::connection_hdl hdl) {
+    s->get_con_from_hdl(hdl)->append_header("X-Custom","1");
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE( validate_adds_response_header ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nOrigin: http://www.example.com\r\n\r\n";
+    std::string output = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\nServer: test\r\nUpgrade: websocket\r\nX-Custom: 1\r\n\r\n";
+
+    server s;
+    s.set_user_agent("test");
+    s.set_validate_handler(bind(&validate_func_add_header,&s,::_1));
+
+    BOOST_CHECK_EQUAL(run_server_test(s,input), output);
+}
+
+BOOST_AUTO_TEST_CASE( empty_user_agent ) {
+    std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nOrigin: http://www.example.com\r\n\r\n";
+    std::string output = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\nUpgrade: websocket\r\n\r\n";
+
+    server s;
+    s.set_user_agent("");
+
+    BOOST_CHECK_EQUAL(run_server_test(s,input), output);
+}
+
 /*BOOST_AUTO_TEST_CASE( user_reject_origin ) {
     std::string input = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nOrigin: http://www.example2.com\r\n\r\n";
     std::string output = "HTTP/1.1 403 Forbidden\r\nServer: test\r\n\r\n";
@@ -28,6 +28,11 @@
 #define BOOST_TEST_MODULE transport_integration
 #include <boost/test/unit_test.hpp>
 
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
 #include <websocketpp/common/thread.hpp>
 
 #include <websocketpp/config/core.hpp>
@@ -122,9 +127,15 @@ struct config_tls : public websocketpp::config::asio_tls_client {
     static const long timeout_pong = 500;
 };
 
+struct config_mpsc : public config {
+    static const bool enable_mpsc_send_queue = true;
+};
+
 typedef websocketpp::server<config> server;
 typedef websocketpp::client<config> client;
 
+typedef websocketpp::server<config_mpsc> mpsc_server;
+
 typedef websocketpp::server<config_tls> server_tls;
 typedef websocketpp::client<config_tls> client_tls;
 
@@ -472,6 +483,154 @@ BOOST_AUTO_TEST_CASE( server_open_handshake_timeout ) {
     sthread.join();
 }
 
+bool defer_validation(server * s, websocketpp::connection_hdl hdl) {
+    server::connection_ptr con = s->get_con_from_hdl(hdl);
+    BOOST_CHECK( !con->defer_http_response() );
+    return true;
+}
+
+void accept_later(server::connection_ptr con) {
+    websocketpp::lib::error_code ec = con->accept_handshake();
+    BOOST_CHECK_MESSAGE( !ec, ec.message() );
+}
+
+bool defer_and_accept_later(server * s,
+    websocketpp::lib::shared_ptr<websocketpp::lib::thread> * t,
+    websocketpp::connection_hdl hdl)
+{
+    server::connection_ptr con = s->get_con_from_hdl(hdl);
+    BOOST_CHECK( !con->defer_http_response() );
+
+    // complete the handshake from a thread outside of the event loop
+    *t = websocketpp::lib::make_shared<websocketpp::lib::thread>(
+        websocketpp::lib::bind(&accept_later,con));
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE( server_deferred_validation_accept_from_thread ) {
+    server s;
+    client c;
+
+    websocketpp::lib::shared_ptr<websocketpp::lib::thread> accept_thread;
+
+    s.set_validate_handler(bind(&defer_and_accept_later,&s,&accept_thread,::_1));
+    s.set_close_handler(bind(&stop_on_close,&s,::_1));
+
+    c.set_open_handler(bind(&close<client>,&c,::_1));
+
+    websocketpp::lib::thread sthread(websocketpp::lib::bind(&run_server,&s,9005,false));
+
+    test_deadline_timer deadline(10);
+
+    sleep(1); // give the server thread some time to start
+
+    run_client(c, "http://localhost:9005");
+
+    sthread.join();
+    BOOST_REQUIRE( accept_thread );
+    accept_thread->join();
+}
+
+BOOST_AUTO_TEST_CASE( server_deferred_validation_timeout ) {
+    server s;
+    client c;
+
+    // the validation never completes, the handshake timer still fires
+    s.set_open_handshake_timeout(500);
+    s.set_validate_handler(bind(&defer_validation,&s,::_1));
+    s.set_open_handler(bind(&fail_on_open,::_1));
+    s.set_fail_handler(bind(&check_ec_and_stop<server>,&s,
+        websocketpp::error::open_handshake_timeout,::_1));
+
+    c.set_open_handler(bind(&fail_on_open,::_1));
+
+    websocketpp::lib::thread sthread(websocketpp::lib::bind(&run_server,&s,9005,false));
+
+    test_deadline_timer deadline(10);
+
+    sleep(1); // give the server thread some time to start
+
+    run_client(c, "http://localhost:9005");
+
+    sthread.join();
+}
+
+static const int mpsc_producers = 4;
+static const int mpsc_messages = 100;
+
+void mpsc_produce(mpsc_server::connection_ptr con, int producer) {
+    for (int i = 0; i < mpsc_messages; i++) {
+        std::stringstream s;
+        s << producer << " " << i;
+        BOOST_CHECK(!con->send(s.str()));
+    }
+}
+
+void mpsc_send_and_close(mpsc_server * s, websocketpp::connection_hdl hdl) {
+    mpsc_server::connection_ptr con = s->get_con_from_hdl(hdl);
+
+    // The event loop is busy running this handler so none of the messages
+    // can be framed before the close below is started.
+    std::vector<websocketpp::lib::shared_ptr<websocketpp::lib::thread> > threads;
+    for (int i = 0; i < mpsc_producers; i++) {
+        threads.push_back(websocketpp::lib::make_shared<websocketpp::lib::thread>(
+            websocketpp::lib::bind(&mpsc_produce,con,i)));
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i]->join();
+    }
+
+    con->close(websocketpp::close::status::normal,"");
+}
+
+void mpsc_stop_on_close(mpsc_server * s, websocketpp::connection_hdl) {
+    s->stop();
+}
+
+void record_mpsc_message(std::vector<int> * next, websocketpp::connection_hdl,
+    client::message_ptr msg)
+{
+    std::stringstream s(msg->get_payload());
+    int producer = -1;
+    int i = -1;
+    s >> producer >> i;
+
+    BOOST_REQUIRE(producer >= 0 && producer < mpsc_producers);
+    BOOST_CHECK_EQUAL(i, (*next)[producer]);
+    (*next)[producer] = i+1;
+}
+
+BOOST_AUTO_TEST_CASE( mpsc_send_before_close ) {
+    mpsc_server s;
+    client c;
+
+    std::vector<int> next(mpsc_producers,0);
+
+    s.set_open_handler(bind(&mpsc_send_and_close,&s,::_1));
+    s.set_close_handler(bind(&mpsc_stop_on_close,&s,::_1));
+    s.clear_access_channels(websocketpp::log::alevel::all);
+    s.clear_error_channels(websocketpp::log::elevel::all);
+    s.init_asio();
+    s.set_reuse_addr(true);
+    s.listen(9005);
+    s.start_accept();
+
+    c.set_message_handler(bind(&record_mpsc_message,&next,::_1,::_2));
+
+    websocketpp::lib::thread sthread(websocketpp::lib::bind(&mpsc_server::run,&s));
+
+    test_deadline_timer deadline(10);
+
+    run_client(c, "http://localhost:9005");
+
+    sthread.join();
+
+    // every message accepted by send arrived ahead of the close frame
+    for (int i = 0; i < mpsc_producers; i++) {
+        BOOST_CHECK_EQUAL(next[i], mpsc_messages);
+    }
+}
+
 BOOST_AUTO_TEST_CASE( client_self_initiated_close_handshake_timeout ) {
     server s;
     client c;
@@ -608,6 +767,144 @@ BOOST_AUTO_TEST_CASE( stop_listening ) {
     sthread.join();
 }
 
+void stream_file(server * s, std::string path, websocketpp::connection_hdl hdl) {
+    server::connection_ptr con = s->get_con_from_hdl(hdl);
+
+    con->replace_header("Content-Length","1048576");
+    BOOST_CHECK( !con->begin_http_body() );
+    BOOST_CHECK( !con->send_http_file(path) );
+    BOOST_CHECK( !con->end_http_body() );
+}
+
+BOOST_AUTO_TEST_CASE( http_file_body ) {
+    using boost::asio::ip::tcp;
+
+    std::string contents;
+    for (size_t i = 0; i < 1048576; i++) {
+        contents.push_back(char(i * 7));
+    }
+
+    std::string path = "http_file_body.tmp";
+    {
+        std::ofstream f(path.c_str(), std::ios::binary);
+        f << contents;
+    }
+
+    server s;
+    s.set_http_handler(bind(&stream_file,&s,path,::_1));
+
+    websocketpp::lib::thread sthread(websocketpp::lib::bind(&run_server,&s,9005,false));
+    test_deadline_timer deadline(10);
+
+    sleep(1); // give the server thread some time to start
+
+    boost::asio::io_service io_service;
+    tcp::resolver resolver(io_service);
+    tcp::resolver::query query("localhost", "9005");
+    tcp::socket socket(io_service);
+    boost::asio::connect(socket, resolver.resolve(query));
+
+    std::string request = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    boost::asio::write(socket, boost::asio::buffer(request));
+
+    std::string response;
+    for (;;) {
+        char data[65536];
+        boost::system::error_code ec;
+        size_t n = socket.read_some(boost::asio::buffer(data), ec);
+        response.append(data, n);
+        if (ec) {
+            break;
+        }
+    }
+
+    size_t body = response.find("\r\n\r\n");
+    BOOST_REQUIRE( body != std::string::npos );
+    BOOST_CHECK( response.substr(body+4) == contents );
+
+    s.stop();
+    sthread.join();
+
+    std::remove(path.c_str());
+}
+
+void stream_body_later(server::connection_ptr con, std::string path) {
+    con->replace_header("Content-Length","1048581");
+    BOOST_CHECK( !con->begin_http_body() );
+    BOOST_CHECK( !con->send_http_body(std::string("hello")) );
+    BOOST_CHECK( !con->send_http_file(path) );
+    BOOST_CHECK( !con->end_http_body() );
+}
+
+void defer_and_stream_later(server * s, std::string path,
+    websocketpp::lib::shared_ptr<websocketpp::lib::thread> * t,
+    websocketpp::connection_hdl hdl)
+{
+    server::connection_ptr con = s->get_con_from_hdl(hdl);
+    BOOST_CHECK( !con->defer_http_response() );
+
+    // stream the body from a thread outside of the event loop
+    *t = websocketpp::lib::make_shared<websocketpp::lib::thread>(
+        websocketpp::lib::bind(&stream_body_later,con,path));
+}
+
+BOOST_AUTO_TEST_CASE( http_body_from_other_thread ) {
+    using boost::asio::ip::tcp;
+
+    std::string contents;
+    for (size_t i = 0; i < 1048576; i++) {
+        contents.push_back(char(i * 7));
+    }
+
+    std::string path = "http_body_from_other_thread.tmp";
+    {
+        std::ofstream f(path.c_str(), std::ios::binary);
+        f << contents;
+    }
+
+    websocketpp::lib::shared_ptr<websocketpp::lib::thread> stream_thread;
+
+    server s;
+    s.set_http_handler(bind(&defer_and_stream_later,&s,path,&stream_thread,
+        ::_1));
+
+    websocketpp::lib::thread sthread(websocketpp::lib::bind(&run_server,&s,9005,false));
+    test_deadline_timer deadline(10);
+
+    sleep(1); // give the server thread some time to start
+
+    boost::asio::io_service io_service;
+    tcp::resolver resolver(io_service);
+    tcp::resolver::query query("localhost", "9005");
+    tcp::socket socket(io_service);
+    boost::asio::connect(socket, resolver.resolve(query));
+
+    std::string request = "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    boost::asio::write(socket, boost::asio::buffer(request));
+
+    std::string response;
+    for (;;) {
+        char data[65536];
+        boost::system::error_code ec;
+        size_t n = socket.read_some(boost::asio::buffer(data), ec);
+        response.append(data, n);
+        if (ec) {
+            break;
+        }
+    }
+
+    size_t body = response.find("\r\n\r\n");
+    BOOST_REQUIRE( body != std::string::npos );
+    BOOST_CHECK( response.substr(body+4) == "hello" + contents );
+
+    s.stop();
+    sthread.join();
+    BOOST_REQUIRE( stream_thread );
+    stream_thread->join();
+
+    std::remove(path.c_str());
+}
+
 BOOST_AUTO_TEST_CASE( pause_reading ) {
     iostream_server s;
     std::string handshake = "GET / HTTP/1.1\r\nHost: www.example.com\r\nConnection: Upgrade\r\nUpgrade: websocket\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n";
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2020, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+//#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE base64
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+
+#include <websocketpp/base64/base64.hpp>
+#include <websocketpp/sha1/sha1.hpp>
+
+BOOST_AUTO_TEST_SUITE ( base64 )
+
+// RFC 4648 section 10
+BOOST_AUTO_TEST_CASE( encode_vectors ) {
+    BOOST_CHECK_EQUAL( websocketpp::base64_encode(""), "" );
+    BOOST_CHECK_EQUAL( websocketpp::base64_encode("f"), "Zg==" );
+    BOOST_CHECK_EQUAL( websocketpp::base64_encode("fo"), "Zm8=" );
+    BOOST_CHECK_EQUAL( websocketpp::base64_encode("foo"), "Zm9v" );
+    BOOST_CHECK_EQUAL( websocketpp::base64_encode("foob"), "Zm9vYg==" );
+    BOOST_CHECK_EQUAL( websocketpp::base64_encode("fooba"), "Zm9vYmE=" );
+    BOOST_CHECK_EQUAL( websocketpp::base64_encode("foobar"), "Zm9vYmFy" );
+}
+
+BOOST_AUTO_TEST_CASE( decode_vectors ) {
+    BOOST_CHECK_EQUAL( websocketpp::base64_decode(""), "" );
+    BOOST_CHECK_EQUAL( websocketpp::base64_decode("Zg=="), "f" );
+    BOOST_CHECK_EQUAL( websocketpp::base64_decode("Zm8="), "fo" );
+    BOOST_CHECK_EQUAL( websocketpp::base64_decode("Zm9v"), "foo" );
+    BOOST_CHECK_EQUAL( websocketpp::base64_decode("Zm9vYg=="), "foob" );
+    BOOST_CHECK_EQUAL( websocketpp::base64_decode("Zm9vYmE="), "fooba" );
+    BOOST_CHECK_EQUAL( websocketpp::base64_decode("Zm9vYmFy"), "foobar" );
+}
+
+BOOST_AUTO_TEST_CASE( decode_stops_at_invalid ) {
+    BOOST_CHECK_EQUAL( websocketpp::base64_decode("Zm9v YmFy"), "foo" );
+    BOOST_CHECK_EQUAL( websocketpp::base64_decode("Zm9vY!mFy"), "foo" );
+    BOOST_CHECK_EQUAL( websocketpp::base64_decode("Zm9vYm!Fy"), "foob" );
+    BOOST_CHECK_EQUAL( websocketpp::base64_decode("Zm8=Zm8="), "fo" );
+    BOOST_CHECK_EQUAL( websocketpp::base64_decode("Zm9"), "fo" );
+}
+
+BOOST_AUTO_TEST_CASE( round_trip ) {
+    std::string data;
+    for (int i = 0; i < 300; i++) {
+        data.push_back(char(i * 7 + 3));
+
+        std::string encoded = websocketpp::base64_encode(data);
+        BOOST_CHECK_EQUAL( encoded.size(),
+            websocketpp::base64_encoded_size(data.size()) );
+        BOOST_CHECK( websocketpp::base64_decode(encoded) == data );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( buffer_interface ) {
+    unsigned char const input[5] = {0x00, 0xff, 0x10, 0x80, 0x7f};
+    char encoded[8];
+
+    BOOST_CHECK_EQUAL( websocketpp::base64_encode(input, 5, encoded), 8u );
+    BOOST_CHECK_EQUAL( std::string(encoded, 8), "AP8QgH8=" );
+
+    unsigned char decoded[6];
+    BOOST_CHECK_EQUAL( websocketpp::base64_decoded_max_size(8), 6u );
+    BOOST_CHECK_EQUAL( websocketpp::base64_decode(encoded, 8, decoded), 5u );
+    BOOST_CHECK_EQUAL_COLLECTIONS(decoded, decoded+5, input, input+5);
+}
+
+BOOST_AUTO_TEST_CASE( sha1_fast_path ) {
+    // RFC 6455 section 1.3
+    std::string key = "dGhlIHNhbXBsZSBub25jZQ==258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    unsigned char digest[20];
+    websocketpp::sha1::calc(key.data(), key.size(), digest);
+
+    char accept[28];
+    websocketpp::base64_encode_sha1(digest, accept);
+    BOOST_CHECK_EQUAL( std::string(accept, 28), "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=" );
+
+    for (int i = 0; i < 256; i++) {
+        for (int j = 0; j < 20; j++) {
+            digest[j] = static_cast<unsigned char>(i * 31 + j * 17);
+        }
+        websocketpp::base64_encode_sha1(digest, accept);
+        BOOST_CHECK_EQUAL( std::string(accept, 28),
+            websocketpp::base64_encode(digest, 20) );
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
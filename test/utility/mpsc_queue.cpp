@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2020, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+//#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE mpsc_queue
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+#include <vector>
+
+#include <websocketpp/concurrency/mpsc_queue.hpp>
+
+BOOST_AUTO_TEST_CASE( empty_transition ) {
+    websocketpp::concurrency::mpsc_queue<int> q;
+
+    BOOST_CHECK( q.empty() );
+    BOOST_CHECK( q.push(1) );
+    BOOST_CHECK( !q.push(2) );
+    BOOST_CHECK( !q.empty() );
+
+    std::vector<int> out;
+    q.pop_all(out);
+
+    BOOST_CHECK( q.empty() );
+    BOOST_CHECK( q.push(3) );
+}
+
+BOOST_AUTO_TEST_CASE( fifo_order ) {
+    websocketpp::concurrency::mpsc_queue<std::string> q;
+
+    q.push("a");
+    q.push("b");
+    q.push("c");
+
+    std::vector<std::string> out;
+    q.pop_all(out);
+
+    BOOST_REQUIRE_EQUAL( out.size(), 3 );
+    BOOST_CHECK_EQUAL( out[0], "a" );
+    BOOST_CHECK_EQUAL( out[1], "b" );
+    BOOST_CHECK_EQUAL( out[2], "c" );
+
+    q.push("d");
+    q.pop_all(out);
+
+    BOOST_REQUIRE_EQUAL( out.size(), 4 );
+    BOOST_CHECK_EQUAL( out[3], "d" );
+}
+
+BOOST_AUTO_TEST_CASE( pop_empty ) {
+    websocketpp::concurrency::mpsc_queue<int> q;
+
+    std::vector<int> out;
+    q.pop_all(out);
+
+    BOOST_CHECK( out.empty() );
+}
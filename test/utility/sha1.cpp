@@ -78,4 +78,44 @@ BOOST_AUTO_TEST_CASE( sha1_test_c ) {
     BOOST_CHECK_EQUAL_COLLECTIONS(hash, hash+20, reference, reference+20);
 }
 
+BOOST_AUTO_TEST_CASE( dispatch_matches_portable ) {
+    std::string input;
+    unsigned char hash[20];
+    unsigned char reference[20];
+
+    // every padding case, including inputs that end exactly on and just
+    // around block boundaries
+    for (size_t len = 0; len < 300; len++) {
+        input.push_back(static_cast<char>(len * 7 + 3));
+
+        websocketpp::sha1::calc_portable(input.data(),len,reference);
+        websocketpp::sha1::calc(input.data(),len,hash);
+        BOOST_CHECK_EQUAL_COLLECTIONS(hash, hash+20, reference, reference+20);
+
+#ifdef _WEBSOCKETPP_SHA_NI_
+        if (websocketpp::sha1::shani::supported()) {
+            websocketpp::sha1::shani::calc(input.data(),len,hash);
+            BOOST_CHECK_EQUAL_COLLECTIONS(hash, hash+20, reference,
+                reference+20);
+        }
+#endif
+    }
+}
+
+BOOST_AUTO_TEST_CASE( calc_60_matches_portable ) {
+    std::string input = "dGhlIHNhbXBsZSBub25jZQ==258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    unsigned char hash[20];
+    unsigned char reference[20];
+
+    BOOST_REQUIRE_EQUAL( input.size(), 60 );
+
+    for (int i = 0; i < 60; i++) {
+        input[i] = static_cast<char>(input[i] ^ i);
+
+        websocketpp::sha1::calc_portable(input.data(),60,reference);
+        websocketpp::sha1::calc_60(input.data(),hash);
+        BOOST_CHECK_EQUAL_COLLECTIONS(hash, hash+20, reference, reference+20);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
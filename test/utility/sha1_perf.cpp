@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2020, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+// Times the server side of the handshake key exchange: hashing the client key
+// and GUID and base64 encoding the result. Compares the portable SHA-1, the
+// dispatching calc and the 60 byte fast path used by the hybi13 processor,
+// then the string and fixed buffer base64 encoders on their own.
+//
+// Usage: perf_sha1
+
+#include <websocketpp/base64/base64.hpp>
+#include <websocketpp/common/chrono.hpp>
+#include <websocketpp/sha1/sha1.hpp>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+namespace chrono = websocketpp::lib::chrono;
+
+typedef void (*hash_function)(std::string const &, unsigned char *);
+
+void hash_portable(std::string const & in, unsigned char * out) {
+    websocketpp::sha1::calc_portable(in.data(),in.size(),out);
+}
+
+void hash_dispatch(std::string const & in, unsigned char * out) {
+    websocketpp::sha1::calc(in.data(),in.size(),out);
+}
+
+void hash_60(std::string const & in, unsigned char * out) {
+    websocketpp::sha1::calc_60(in.data(),out);
+}
+
+void run(char const * name, hash_function f) {
+    static size_t const rounds = 1000000;
+
+    std::string key = "dGhlIHNhbXBsZSBub25jZQ==258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    unsigned char digest[20];
+    std::string accept;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; i++) {
+        // vary the key so nothing can be hoisted out of the loop
+        key[i % 24] = static_cast<char>('A' + i % 26);
+        f(key,digest);
+        accept = websocketpp::base64_encode(digest,20);
+    }
+    chrono::nanoseconds t = chrono::steady_clock::now() - start;
+
+    // check the last result against the portable implementation
+    websocketpp::sha1::calc_portable(key.data(),key.size(),digest);
+    bool ok = (accept == websocketpp::base64_encode(digest,20));
+
+    std::cout << std::left << std::setw(12) << name << std::right
+              << std::fixed << std::setprecision(1) << std::setw(10)
+              << double(t.count()) / rounds << " ns/key"
+              << (ok ? "" : "  MISMATCH") << std::endl;
+}
+
+void run_base64() {
+    static size_t const rounds = 10000000;
+
+    unsigned char digest[20];
+    websocketpp::sha1::calc_portable("abc",3,digest);
+
+    std::string accept;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; i++) {
+        digest[i % 20] ^= static_cast<unsigned char>(i);
+        accept = websocketpp::base64_encode(digest,20);
+    }
+    chrono::nanoseconds t_string = chrono::steady_clock::now() - start;
+
+    char buf[28];
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; i++) {
+        digest[i % 20] ^= static_cast<unsigned char>(i);
+        websocketpp::base64_encode_sha1(digest,buf);
+    }
+    chrono::nanoseconds t_fixed = chrono::steady_clock::now() - start;
+
+    bool ok = (std::string(buf,28) == websocketpp::base64_encode(digest,20));
+
+    std::cout << std::left << std::setw(12) << "b64 string" << std::right
+              << std::fixed << std::setprecision(1) << std::setw(10)
+              << double(t_string.count()) / rounds << " ns/key" << std::endl;
+    std::cout << std::left << std::setw(12) << "b64 sha1" << std::right
+              << std::fixed << std::setprecision(1) << std::setw(10)
+              << double(t_fixed.count()) / rounds << " ns/key"
+              << (ok ? "" : "  MISMATCH") << std::endl;
+}
+
+int main() {
+    std::cout << "SHA extensions: "
+              << (websocketpp::sha1::shani::supported() ? "yes" : "no")
+              << std::endl;
+
+    run("portable",hash_portable);
+    run("calc",hash_dispatch);
+    run("calc_60",hash_60);
+    run_base64();
+
+    return 0;
+}
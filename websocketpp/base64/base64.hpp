@@ -36,6 +36,7 @@
 #ifndef _BASE64_HPP_
 #define _BASE64_HPP_
 
+#include <cstddef>
 #include <string>
 
 namespace websocketpp {
@@ -57,57 +58,128 @@ static inline bool is_base64(unsigned char c) {
            (c >= 97 && c <= 122)); // a-z
 }
 
-/// Encode a char buffer into a base64 string
+namespace base64_detail {
+
+/// Encoding alphabet
+static char const encode_table[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/// Value of each base64 character, or 0xff for characters outside the alphabet
+static unsigned char const decode_table[256] = {
+    0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff, // 00..0f
+    0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff, // 10..1f
+    0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,  62,0xff,0xff,0xff,  63, // 20..2f
+      52,  53,  54,  55,  56,  57,  58,  59,  60,  61,0xff,0xff,0xff,0xff,0xff,0xff, // 30..3f
+    0xff,   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14, // 40..4f
+      15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25,0xff,0xff,0xff,0xff,0xff, // 50..5f
+    0xff,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40, // 60..6f
+      41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51,0xff,0xff,0xff,0xff,0xff, // 70..7f
+    0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff, // 80..8f
+    0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff, // 90..9f
+    0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff, // a0..af
+    0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff, // b0..bf
+    0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff, // c0..cf
+    0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff, // d0..df
+    0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff, // e0..ef
+    0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff  // f0..ff
+};
+
+/// Encode three bytes as four characters
+inline void encode_group(unsigned char const * in, char * out) {
+    out[0] = encode_table[in[0] >> 2];
+    out[1] = encode_table[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+    out[2] = encode_table[((in[1] & 0x0f) << 2) | (in[2] >> 6)];
+    out[3] = encode_table[in[2] & 0x3f];
+}
+
+} // namespace base64_detail
+
+/// Number of characters needed to base64 encode len bytes
 /**
+ * @since 0.9.0
+ *
+ * @param len The length of the input in bytes
+ * @return The length of the encoded output, including padding
+ */
+inline size_t base64_encoded_size(size_t len) {
+    return (len + 2) / 3 * 4;
+}
+
+/// Base64 encode a byte buffer into a caller provided buffer
+/**
+ * @since 0.9.0
+ *
  * @param input The input data
  * @param len The length of input in bytes
- * @return A base64 encoded string representing input
+ * @param [out] out Buffer of at least base64_encoded_size(len) characters
+ * @return The number of characters written
  */
-inline std::string base64_encode(unsigned char const * input, size_t len) {
-    std::string ret;
-    int i = 0;
-    int j = 0;
-    unsigned char char_array_3[3];
-    unsigned char char_array_4[4];
-
-    while (len--) {
-        char_array_3[i++] = *(input++);
-        if (i == 3) {
-            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) +
-                              ((char_array_3[1] & 0xf0) >> 4);
-            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) +
-                              ((char_array_3[2] & 0xc0) >> 6);
-            char_array_4[3] = char_array_3[2] & 0x3f;
-
-            for(i = 0; (i <4) ; i++) {
-                ret += base64_chars[char_array_4[i]];
-            }
-            i = 0;
-        }
-    }
+inline size_t base64_encode(unsigned char const * input, size_t len,
+    char * out)
+{
+    char * const begin = out;
 
-    if (i) {
-        for(j = i; j < 3; j++) {
-            char_array_3[j] = '\0';
-        }
-
-        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) +
-                          ((char_array_3[1] & 0xf0) >> 4);
-        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) +
-                          ((char_array_3[2] & 0xc0) >> 6);
-        char_array_4[3] = char_array_3[2] & 0x3f;
+    for (; len >= 3; len -= 3, input += 3, out += 4) {
+        base64_detail::encode_group(input, out);
+    }
 
-        for (j = 0; (j < i + 1); j++) {
-            ret += base64_chars[char_array_4[j]];
+    if (len) {
+        unsigned char last[3] = {0, 0, 0};
+        last[0] = input[0];
+        if (len == 2) {
+            last[1] = input[1];
         }
 
-        while((i++ < 3)) {
-            ret += '=';
+        base64_detail::encode_group(last, out);
+        out[3] = '=';
+        if (len == 1) {
+            out[2] = '=';
         }
+        out += 4;
     }
 
+    return static_cast<size_t>(out - begin);
+}
+
+/// Base64 encode a 20 byte SHA-1 digest
+/**
+ * The fixed size case used for Sec-WebSocket-Accept. Twenty bytes are six
+ * full groups and a two byte remainder, so the output is always 28
+ * characters ending in one '='.
+ *
+ * @since 0.9.0
+ *
+ * @param digest The 20 byte digest
+ * @param [out] out Buffer of at least 28 characters
+ */
+inline void base64_encode_sha1(unsigned char const * digest, char * out) {
+    using base64_detail::encode_group;
+    using base64_detail::encode_table;
+
+    encode_group(digest, out);
+    encode_group(digest + 3, out + 4);
+    encode_group(digest + 6, out + 8);
+    encode_group(digest + 9, out + 12);
+    encode_group(digest + 12, out + 16);
+    encode_group(digest + 15, out + 20);
+
+    out[24] = encode_table[digest[18] >> 2];
+    out[25] = encode_table[((digest[18] & 0x03) << 4) | (digest[19] >> 4)];
+    out[26] = encode_table[(digest[19] & 0x0f) << 2];
+    out[27] = '=';
+}
+
+/// Encode a char buffer into a base64 string
+/**
+ * @param input The input data
+ * @param len The length of input in bytes
+ * @return A base64 encoded string representing input
+ */
+inline std::string base64_encode(unsigned char const * input, size_t len) {
+    std::string ret(base64_encoded_size(len), '\0');
+    if (!ret.empty()) {
+        base64_encode(input, len, &ret[0]);
+    }
     return ret;
 }
 
@@ -123,53 +195,88 @@ inline std::string base64_encode(std::string const & input) {
     );
 }
 
-/// Decode a base64 encoded string into a string of raw bytes
+/// Upper bound on the number of bytes decoded from len base64 characters
 /**
+ * @since 0.9.0
+ *
+ * @param len The length of the encoded input
+ * @return The largest number of bytes base64_decode can write
+ */
+inline size_t base64_decoded_max_size(size_t len) {
+    return len / 4 * 3 + (len % 4 ? 3 : 0);
+}
+
+/// Decode base64 characters into a caller provided buffer
+/**
+ * Decoding stops at the first '=' or the first character outside the base64
+ * alphabet.
+ *
+ * @since 0.9.0
+ *
  * @param input The base64 encoded input data
- * @return A string representing the decoded raw bytes
+ * @param len The length of input in characters
+ * @param [out] out Buffer of at least base64_decoded_max_size(len) bytes
+ * @return The number of bytes written
  */
-inline std::string base64_decode(std::string const & input) {
-    size_t in_len = input.size();
-    int i = 0;
-    int j = 0;
-    int in_ = 0;
-    unsigned char char_array_4[4], char_array_3[3];
-    std::string ret;
-
-    while (in_len-- && ( input[in_] != '=') && is_base64(input[in_])) {
-        char_array_4[i++] = input[in_]; in_++;
-        if (i ==4) {
-            for (i = 0; i <4; i++) {
-                char_array_4[i] = static_cast<unsigned char>(base64_chars.find(char_array_4[i]));
-            }
-
-            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-            for (i = 0; (i < 3); i++) {
-                ret += char_array_3[i];
-            }
-            i = 0;
+inline size_t base64_decode(char const * input, size_t len,
+    unsigned char * out)
+{
+    using base64_detail::decode_table;
+
+    unsigned char const * in = reinterpret_cast<unsigned char const *>(input);
+    unsigned char * const begin = out;
+    size_t i = 0;
+
+    // whole groups of four valid characters
+    for (; i + 4 <= len; i += 4, out += 3) {
+        unsigned char const a = decode_table[in[i]];
+        unsigned char const b = decode_table[in[i+1]];
+        unsigned char const c = decode_table[in[i+2]];
+        unsigned char const d = decode_table[in[i+3]];
+
+        if ((a | b | c | d) == 0xff) {
+            break;
         }
+
+        out[0] = static_cast<unsigned char>((a << 2) | (b >> 4));
+        out[1] = static_cast<unsigned char>((b << 4) | (c >> 2));
+        out[2] = static_cast<unsigned char>((c << 6) | d);
     }
 
-    if (i) {
-        for (j = i; j <4; j++)
-            char_array_4[j] = 0;
+    // a final partial group, ended by padding, an invalid character or the
+    // end of the input
+    unsigned char v[4] = {0, 0, 0, 0};
+    size_t n = 0;
+    for (; i < len && n < 4; i++, n++) {
+        v[n] = decode_table[in[i]];
+        if (v[n] == 0xff) {
+            break;
+        }
+    }
 
-        for (j = 0; j <4; j++)
-            char_array_4[j] = static_cast<unsigned char>(base64_chars.find(char_array_4[j]));
+    if (n > 1) {
+        out[0] = static_cast<unsigned char>((v[0] << 2) | (v[1] >> 4));
+        ++out;
+    }
+    if (n > 2) {
+        out[0] = static_cast<unsigned char>((v[1] << 4) | (v[2] >> 2));
+        ++out;
+    }
 
-        char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-        char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-        char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+    return static_cast<size_t>(out - begin);
+}
 
-        for (j = 0; (j < i - 1); j++) {
-            ret += static_cast<std::string::value_type>(char_array_3[j]);
-        }
+/// Decode a base64 encoded string into a string of raw bytes
+/**
+ * @param input The base64 encoded input data
+ * @return A string representing the decoded raw bytes
+ */
+inline std::string base64_decode(std::string const & input) {
+    std::string ret(base64_decoded_max_size(input.size()), '\0');
+    if (!ret.empty()) {
+        ret.resize(base64_decode(input.data(), input.size(),
+            reinterpret_cast<unsigned char *>(&ret[0])));
     }
-
     return ret;
 }
 
@@ -69,6 +69,8 @@ namespace lib {
     using std::static_pointer_cast;
     using std::make_shared;
     using std::unique_ptr;
+    using std::atomic_load;
+    using std::atomic_compare_exchange_strong;
 
     typedef std::unique_ptr<unsigned char[]> unique_ptr_uchar_array;
 #else
@@ -78,6 +80,14 @@ namespace lib {
     using boost::enable_shared_from_this;
     using boost::static_pointer_cast;
     using boost::make_shared;
+    using boost::atomic_load;
+
+    template <typename T>
+    bool atomic_compare_exchange_strong(shared_ptr<T> * p, shared_ptr<T> * v,
+        shared_ptr<T> w)
+    {
+        return boost::atomic_compare_exchange(p,v,w);
+    }
 
     typedef boost::scoped_array<unsigned char> unique_ptr_uchar_array;
 #endif
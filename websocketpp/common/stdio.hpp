@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2020, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef WEBSOCKETPP_COMMON_STDIO_HPP
+#define WEBSOCKETPP_COMMON_STDIO_HPP
+
+#include <websocketpp/common/stdint.hpp>
+
+#include <cstdio>
+#include <limits>
+
+#if !defined(_WIN32)
+    #include <sys/types.h>
+#endif
+
+namespace websocketpp {
+namespace lib {
+
+// std::fseek and std::ftell use long offsets, which are 32 bits wide on
+// Windows and on 32 bit POSIX systems.
+
+/// Cross platform fseek with 64 bit offsets
+/**
+ * @param f The file to seek
+ * @param offset Offset from the start of the file
+ * @return Zero on success, non-zero otherwise
+ */
+inline int fseek64(std::FILE * f, uint64_t offset) {
+#if defined(_WIN32)
+    if (offset > static_cast<uint64_t>((std::numeric_limits<__int64>::max)())) {
+        return -1;
+    }
+    return _fseeki64(f,static_cast<__int64>(offset),SEEK_SET);
+#elif defined(__GLIBC__) && defined(_LARGEFILE64_SOURCE)
+    if (offset > static_cast<uint64_t>((std::numeric_limits<off64_t>::max)())) {
+        return -1;
+    }
+    return fseeko64(f,static_cast<off64_t>(offset),SEEK_SET);
+#else
+    if (offset > static_cast<uint64_t>((std::numeric_limits<off_t>::max)())) {
+        return -1;
+    }
+    return fseeko(f,static_cast<off_t>(offset),SEEK_SET);
+#endif
+}
+
+/// Cross platform file size with 64 bit offsets
+/**
+ * Moves the file position to the end of the file.
+ *
+ * @param f The file to measure
+ * @param size Set to the size of the file in bytes on success
+ * @return Zero on success, non-zero otherwise
+ */
+inline int fsize64(std::FILE * f, uint64_t & size) {
+#if defined(_WIN32)
+    if (_fseeki64(f,0,SEEK_END) != 0) {
+        return -1;
+    }
+    __int64 pos = _ftelli64(f);
+#elif defined(__GLIBC__) && defined(_LARGEFILE64_SOURCE)
+    if (fseeko64(f,0,SEEK_END) != 0) {
+        return -1;
+    }
+    off64_t pos = ftello64(f);
+#else
+    if (fseeko(f,0,SEEK_END) != 0) {
+        return -1;
+    }
+    off_t pos = ftello(f);
+#endif
+    if (pos < 0) {
+        return -1;
+    }
+    size = static_cast<uint64_t>(pos);
+    return 0;
+}
+
+} // lib
+} // websocketpp
+
+#endif // WEBSOCKETPP_COMMON_STDIO_HPP
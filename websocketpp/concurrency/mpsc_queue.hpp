@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2020, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef WEBSOCKETPP_CONCURRENCY_MPSC_QUEUE_HPP
+#define WEBSOCKETPP_CONCURRENCY_MPSC_QUEUE_HPP
+
+#include <websocketpp/common/atomic.hpp>
+
+#include <cstddef>
+
+namespace websocketpp {
+namespace concurrency {
+
+/// Lock free multi-producer, single-consumer queue
+/**
+ * Any number of threads may push values concurrently. A single consumer
+ * removes everything that has been pushed so far in one call to `pop_all`.
+ * Neither operation takes a lock.
+ *
+ * `push` reports whether the queue was empty beforehand. This lets producers
+ * schedule the consumer only on the empty to non-empty transition: exactly one
+ * push after each `pop_all` sees an empty queue.
+ */
+template <typename value_type>
+class mpsc_queue {
+public:
+    mpsc_queue() : m_head(NULL) {}
+
+    ~mpsc_queue() {
+        node * n = m_head.load(lib::memory_order_acquire);
+        while (n) {
+            node * next = n->next;
+            delete n;
+            n = next;
+        }
+    }
+
+    /// Add a value to the queue
+    /**
+     * Safe to call from any thread.
+     *
+     * @param value The value to add
+     * @return Whether or not the queue was empty before this value was added
+     */
+    bool push(value_type const & value) {
+        node * n = new node(value);
+        node * head = m_head.load(lib::memory_order_relaxed);
+
+        do {
+            n->next = head;
+        } while (!m_head.compare_exchange_weak(head,n,
+            lib::memory_order_release,lib::memory_order_relaxed));
+
+        return head == NULL;
+    }
+
+    /// Remove all values from the queue
+    /**
+     * Appends every value pushed so far to `out` in the order in which they
+     * were pushed. Must only be called from one thread at a time.
+     *
+     * @param out A container with a push_back method to append values to
+     */
+    template <typename container_type>
+    void pop_all(container_type & out) {
+        node * n = m_head.exchange(NULL,lib::memory_order_acquire);
+
+        // values are linked newest first, reverse them into push order
+        node * reversed = NULL;
+        while (n) {
+            node * next = n->next;
+            n->next = reversed;
+            reversed = n;
+            n = next;
+        }
+
+        while (reversed) {
+            node * next = reversed->next;
+            out.push_back(reversed->value);
+            delete reversed;
+            reversed = next;
+        }
+    }
+
+    /// Check whether the queue is empty
+    /**
+     * The result may be out of date by the time it is returned if other
+     * threads are pushing concurrently.
+     */
+    bool empty() const {
+        return m_head.load(lib::memory_order_acquire) == NULL;
+    }
+private:
+    // not copyable
+    mpsc_queue(mpsc_queue const &);
+    mpsc_queue & operator=(mpsc_queue const &);
+
+    struct node {
+        explicit node(value_type const & v) : value(v), next(NULL) {}
+
+        value_type value;
+        node * next;
+    };
+
+    lib::atomic<node *> m_head;
+};
+
+} // namespace concurrency
+} // namespace websocketpp
+
+#endif // WEBSOCKETPP_CONCURRENCY_MPSC_QUEUE_HPP
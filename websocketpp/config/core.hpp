@@ -154,6 +154,9 @@ struct core {
     static const long timeout_close_handshake = 5000;
     /// Length of time to wait for a pong after a ping
     static const long timeout_pong = 5000;
+    /// Length of time an idle HTTP/1.1 connection is kept open between
+    /// requests. 0 closes the connection after every HTTP response.
+    static const long timeout_http_keep_alive = 0;
 
     /// WebSocket Protocol version to use as a client
     /**
@@ -251,6 +254,137 @@ struct core {
      */
     static const size_t max_http_body_size = 32000000;
 
+    /// Default send buffer watermark
+    /**
+     * Number of outgoing payload bytes that may be queued on a connection
+     * before it stops reporting itself as writable. Once the queue has grown
+     * past this point the writable handler will be called after it drains
+     * back below it. Used to apply backpressure to streaming producers.
+     *
+     * The default is 1MB
+     *
+     * @since 0.9.0
+     */
+    static const size_t send_buffer_watermark = 1000000;
+
+    /// Default maximum outgoing frame size
+    /**
+     * Outgoing data messages with payloads larger than this will be split
+     * into multiple frames as they are written. Control frames queued behind
+     * such a message are sent between its fragments rather than waiting for
+     * the whole message. Zero disables fragmentation.
+     *
+     * The default is 0 (disabled)
+     *
+     * @since 0.9.0
+     */
+    static const size_t max_outgoing_frame_size = 0;
+
+    /// Use a lock free queue for messages sent from other threads
+    /**
+     * When enabled, `connection::send` pushes messages onto a lock free
+     * multi-producer queue instead of taking the connection's write lock. The
+     * queue is drained, and the messages framed, from within the transport's
+     * event loop. Only the send that finds the queue empty schedules a drain,
+     * so many concurrent sends cost a single dispatch.
+     *
+     * In this mode errors that can only be detected while framing (such as
+     * running out of message buffers) are logged rather than returned.
+     *
+     * @since 0.9.0
+     */
+    static const bool enable_mpsc_send_queue = false;
+
+    /// Default maximum number of bytes per transport write
+    /**
+     * Limits how many queued messages are gathered into a single transport
+     * write. A single message larger than the limit is still written on its
+     * own. Zero means no limit.
+     *
+     * @since 0.9.0
+     */
+    static const size_t max_write_batch_bytes = 0;
+
+    /// Default maximum number of buffers per transport write
+    /**
+     * Limits how many buffers (two per message) are gathered into a single
+     * scatter/gather transport write. Zero means no limit.
+     *
+     * @since 0.9.0
+     */
+    static const size_t max_write_batch_buffers = 0;
+
+    /// Default write corking delay (in microseconds)
+    /**
+     * When non-zero, a write that could start immediately is held back for up
+     * to this long so that more messages can be gathered into it. The delay is
+     * implemented with transport timers and is rounded up to the timer
+     * resolution (milliseconds for the bundled transports). Transports without
+     * timers write immediately. Zero disables the delay.
+     *
+     * @since 0.9.0
+     */
+    static const long write_cork_delay = 0;
+
+    /// Default per turn read budget (in bytes)
+    /**
+     * The number of bytes of already read data a connection will process
+     * before yielding the transport thread to other work and resuming from a
+     * posted handler. Zero means no limit.
+     *
+     * @since 0.9.0
+     */
+    static const size_t read_budget_bytes = 0;
+
+    /// Default per turn read budget (in messages)
+    /**
+     * The number of complete messages a connection will deliver from already
+     * read data before yielding the transport thread to other work and
+     * resuming from a posted handler. Zero means no limit.
+     *
+     * @since 0.9.0
+     */
+    static const size_t read_budget_messages = 0;
+
+    /// Enable adaptive per message compression
+    /**
+     * When permessage-deflate is in use, decide for each outgoing message
+     * whether to compress it and at what zlib level based on its size, an
+     * entropy estimate of its contents, and the compression ratio and CPU
+     * time measured for earlier messages on the same connection. When false
+     * every message is compressed at the zlib default level.
+     *
+     * @since 0.9.0
+     */
+    static const bool enable_adaptive_compression = false;
+
+    /// Minimum payload size compressed by adaptive compression (in bytes)
+    /**
+     * @since 0.9.0
+     */
+    static const size_t adaptive_compression_min_size = 64;
+
+    /// Adaptive compression CPU budget (in nanoseconds per payload byte)
+    /**
+     * The zlib level is lowered while compression takes longer than this on
+     * average and raised again when it takes less than half. Zero disables
+     * level adjustment.
+     *
+     * @since 0.9.0
+     */
+    static const long adaptive_compression_time_budget = 20;
+
+    /// Default minimum payload size framed on the compression executor
+    /**
+     * When a compression executor has been set, outgoing messages flagged for
+     * compression with at least this many payload bytes are compressed and
+     * framed on the executor instead of in the thread that sent them. Zero
+     * disables offloading.
+     *
+     * @since 0.9.0
+     */
+    static const size_t compression_offload_threshold = 1048576;
+
     /// Global flag for enabling/disabling extensions
     static const bool enable_extensions = true;
 
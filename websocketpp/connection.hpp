@@ -31,17 +31,24 @@
 #include <websocketpp/close.hpp>
 #include <websocketpp/error.hpp>
 #include <websocketpp/frame.hpp>
+#include <websocketpp/utf8_validator.hpp>
 
 #include <websocketpp/logger/levels.hpp>
+#include <websocketpp/message_buffer/message.hpp>
 #include <websocketpp/processors/processor.hpp>
 #include <websocketpp/transport/base/connection.hpp>
 #include <websocketpp/http/constants.hpp>
 
+#include <websocketpp/concurrency/mpsc_queue.hpp>
+
+#include <websocketpp/common/atomic.hpp>
 #include <websocketpp/common/connection_hdl.hpp>
 #include <websocketpp/common/cpp11.hpp>
 #include <websocketpp/common/functional.hpp>
 
-#include <queue>
+#include <algorithm>
+#include <cstdio>
+#include <deque>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -125,6 +132,11 @@ typedef lib::function<void(connection_hdl,std::string)> pong_timeout_handler;
  * The validate handler return value indicates whether or not the connection
  * should be accepted. Additional methods may be called during the function to
  * set response headers, set HTTP return/error codes, etc.
+ *
+ * A handler that can't decide right away, for example because it has to ask
+ * another service, may call `defer_http_response` and return. The return value
+ * is then ignored and the handshake stays pending until `accept_handshake` or
+ * `reject_handshake` is called.
  */
 typedef lib::function<bool(connection_hdl)> validate_handler;
 
@@ -150,6 +162,43 @@ typedef lib::function<bool(connection_hdl)> validate_handler;
  */
 typedef lib::function<void(connection_hdl)> http_handler;
 
+/// The type and function signature of a http body handler
+/**
+ * The http body handler is called with each piece of an HTTP request body as
+ * it is read, with Content-Length and chunked bodies alike. Chunked bodies are
+ * decoded before they are delivered. When a body handler is set the body is
+ * not buffered in the request, so `max_http_body_size` does not apply, and the
+ * http handler is called once the whole body has been delivered.
+ */
+typedef lib::function<void(connection_hdl,std::string const &)>
+    http_body_handler;
+
+/// The type and function signature of a writable handler
+/**
+ * The writable handler is called when the outgoing send buffer of a connection
+ * that previously grew past its send buffer watermark has drained back below
+ * it. Producers that stream large or open ended messages should stop pushing
+ * data once `is_writable` returns false and resume from this handler.
+ */
+typedef lib::function<void(connection_hdl)> writable_handler;
+
+/// The type and function signature of a compression executor
+/**
+ * A compression executor runs the function it is given at some later point,
+ * typically on a worker thread from a pool owned by the application. It is
+ * used to compress and frame large outgoing messages away from the thread
+ * running the transport's event loop. The function must be run exactly once.
+ */
+typedef lib::function<void(lib::function<void()>)> compression_executor;
+
+/// The type and function signature of an extension factory
+/**
+ * An extension factory creates the object that negotiates and runs one
+ * extension for a single connection. It is called once for every new
+ * connection. See extensions::extension.
+ */
+typedef lib::function<extensions::extension::ptr()> extension_factory;
+
 //
 typedef lib::function<void(lib::error_code const & ec, size_t bytes_transferred)> read_handler;
 typedef lib::function<void(lib::error_code const & ec)> write_frame_handler;
@@ -280,6 +329,17 @@ public:
     // Message handler (needs to know message type)
     typedef lib::function<void(connection_hdl,message_ptr)> message_handler;
 
+    /// Type of a batch of messages delivered to a message_batch_handler
+    typedef std::vector<message_ptr> message_batch;
+
+    /// The type and function signature of a message batch handler
+    /**
+     * The message batch handler is called with all of the data messages that
+     * were completed while processing the data from a single read.
+     */
+    typedef lib::function<void(connection_hdl,message_batch const &)>
+        message_batch_handler;
+
     /// Type of a pointer to a transport timer handle
     typedef typename transport_con_type::timer_ptr timer_ptr;
 
@@ -312,13 +372,33 @@ public:
       , m_open_handshake_timeout_dur(config::timeout_open_handshake)
       , m_close_handshake_timeout_dur(config::timeout_close_handshake)
       , m_pong_timeout_dur(config::timeout_pong)
+      , m_http_keep_alive_timeout_dur(config::timeout_http_keep_alive)
       , m_max_message_size(config::max_message_size)
+      , m_send_buffer_watermark(config::send_buffer_watermark)
+      , m_max_outgoing_frame_size(config::max_outgoing_frame_size)
+      , m_max_write_batch_bytes(config::max_write_batch_bytes)
+      , m_max_write_batch_buffers(config::max_write_batch_buffers)
+      , m_write_cork_delay(config::write_cork_delay)
+      , m_read_budget_bytes(config::read_budget_bytes)
+      , m_read_budget_messages(config::read_budget_messages)
+      , m_compression_offload_threshold(config::compression_offload_threshold)
       , m_state(session::state::connecting)
       , m_internal_state(session::internal_state::USER_INIT)
       , m_msg_manager(new con_msg_manager_type())
       , m_send_buffer_size(0)
+      , m_offload_running(false)
+      , m_fragment_offset(0)
       , m_write_flag(false)
+      , m_corked(false)
+      , m_cork_pending(false)
+      , m_cork_expired(false)
+      , m_send_blocked(false)
+      , m_stream_open(false)
+      , m_stream_started(false)
+      , m_stream_opcode(frame::opcode::binary)
       , m_read_flag(true)
+      , m_read_byte_budget_hits(0)
+      , m_read_message_budget_hits(0)
       , m_is_server(p_is_server)
       , m_alog(alog)
       , m_elog(elog)
@@ -327,8 +407,18 @@ public:
       , m_remote_close_code(close::status::abnormal_close)
       , m_is_http(false)
       , m_http_state(session::http_state::init)
+      , m_http_keep_alive(false)
+      , m_http_body_writing(false)
+      , m_http_body_ended(false)
+      , m_http_body_chunked(false)
+      , m_http_body_remaining(-1)
+      , m_http_request_count(0)
       , m_was_clean(false)
+      , m_response_modified(false)
+      , m_raw_response_ready(false)
     {
+        std::fill_n(m_send_class_size,message_buffer::priority::count,0);
+
         m_alog->write(log::alevel::devel,"connection constructor");
     }
 
@@ -448,6 +538,25 @@ public:
         m_http_handler = h;
     }
 
+    /// Set http body handler
+    /**
+     * The http body handler receives the body of an HTTP request in pieces
+     * as it is read, instead of the body being buffered in the request until
+     * it is complete. This allows large uploads to be processed without
+     * holding them in memory. The http handler is called after the last
+     * piece, at which point `get_request_body` returns an empty string.
+     *
+     * Must be set before the request headers have been read.
+     *
+     * @since 0.9.0
+     *
+     * @param h The new http_body_handler
+     */
+    void set_http_body_handler(http_body_handler h) {
+        m_http_body_handler = h;
+        m_request.set_stream_body(h ? true : false);
+    }
+
     /// Set validate handler
     /**
      * The validate handler is called after a WebSocket handshake has been
@@ -474,6 +583,96 @@ public:
         m_message_handler = h;
     }
 
+    /// Set message batch handler
+    /**
+     * The message batch handler is called once with every data message that
+     * was completed while processing the data from a single transport read,
+     * in the order they were received. This allows applications that receive
+     * many small messages to amortize the cost of handing them off. A batch is
+     * cut short before any control frame or when a read budget runs out.
+     *
+     * When a message batch handler is set the message handler is not called.
+     * The batch is only valid for the duration of the call; the message_ptrs
+     * in it may be copied and kept.
+     *
+     * @since 0.9.0
+     *
+     * @param h The new message_batch_handler
+     */
+    void set_message_batch_handler(message_batch_handler h) {
+        m_message_batch_handler = h;
+    }
+
+    /// Set writable handler
+    /**
+     * The writable handler is called after the outgoing send buffer has grown
+     * past the send buffer watermark and then drained back below it. It is
+     * intended to be used by producers of streamed messages to resume pushing
+     * data after backing off.
+     *
+     * @since 0.9.0
+     *
+     * @param h The new writable_handler
+     */
+    void set_writable_handler(writable_handler h) {
+        m_writable_handler = h;
+    }
+
+    /// Set compression executor
+    /**
+     * Outgoing messages flagged for compression with payloads of at least the
+     * compression offload threshold are compressed and framed by a function
+     * handed to this executor rather than inline. The result is queued for
+     * writing from within the transport's event loop. Messages sent after an
+     * offloaded message, including close frames, wait behind it so that the
+     * order of messages on the connection is unchanged.
+     *
+     * Messages handed over through the lock free send queue are offloaded
+     * the same way once they are drained in the event loop.
+     *
+     * @since 0.9.0
+     *
+     * @param e The new compression_executor
+     */
+    void set_compression_executor(compression_executor e) {
+        m_compression_executor = e;
+    }
+
+    /// Add an extension to negotiate for this connection
+    /**
+     * Extensions are offered (clients) or accepted (servers) in addition to
+     * permessage-deflate. Extensions must be added before the opening
+     * handshake starts. The object must not be shared with other connections.
+     *
+     * @since 0.9.0
+     *
+     * @param ext The extension to add
+     */
+    void add_extension(extensions::extension::ptr ext) {
+        m_extensions.push_back(ext);
+    }
+
+    /// Set the template used to write successful handshake responses
+    /**
+     * Endpoints set this on the connections they create. A server connection
+     * with a template writes its 101 response by patching the per-connection
+     * headers into the template instead of serializing m_response, unless the
+     * application changed the response headers or body while validating the
+     * request. In that case, and with protocol versions that don't support
+     * templates, the response is built as before.
+     *
+     * When the template is used, m_response only carries the status and the
+     * negotiated Sec-WebSocket-Extensions header. The generated headers are
+     * written directly to the wire.
+     *
+     * @since 0.9.0
+     *
+     * @param t The template, or a null pointer to always build responses
+     */
+    void set_response_template(processor::response_template::ptr t) {
+        m_response_template = t;
+    }
+
     //////////////////////////////////////////
     // Connection timeouts and other limits //
     //////////////////////////////////////////
@@ -547,6 +746,37 @@ public:
         m_pong_timeout_dur = dur;
     }
 
+    /// Set HTTP keep-alive timeout
+    /**
+     * Sets the length of time a connection that is serving plain HTTP
+     * requests through the http handler stays open waiting for its next
+     * request. While the timeout is non-zero, HTTP/1.1 requests keep the
+     * connection open unless either side sends `Connection: close`, and
+     * HTTP/1.0 requests do so if they send `Connection: keep-alive`. Requests
+     * are handled one at a time, so pipelined requests are answered in the
+     * order they arrived. The timer runs from the end of one response until
+     * the next response is written. A connection that reaches it is closed
+     * without calling the fail handler.
+     *
+     * A request whose body length is not given by Content-Length, or whose
+     * response ended with an error, always closes the connection.
+     *
+     * The default value is specified via the compile time config value
+     * 'timeout_http_keep_alive'. The default value in the core config
+     * is 0, which closes the connection after every response.
+     *
+     * To be effective, the transport you are using must support timers. See
+     * the documentation for your transport policy for details about its
+     * timer support.
+     *
+     * @since 0.9.0
+     *
+     * @param dur The length of the HTTP keep-alive timeout in ms
+     */
+    void set_http_keep_alive_timeout(long dur) {
+        m_http_keep_alive_timeout_dur = dur;
+    }
+
     /// Get maximum message size
     /**
      * Get maximum message size. Maximum message size determines the point at 
@@ -611,6 +841,281 @@ public:
         m_request.set_max_body_size(new_value);
     }
 
+    /// Get send buffer watermark
+    /**
+     * Get the send buffer watermark. The send buffer watermark is the number
+     * of outgoing payload bytes that may be queued before the connection stops
+     * reporting itself as writable.
+     *
+     * The default is set by the endpoint that creates the connection.
+     *
+     * @since 0.9.0
+     */
+    size_t get_send_buffer_watermark() const {
+        return m_send_buffer_watermark;
+    }
+
+    /// Set send buffer watermark
+    /**
+     * Set the send buffer watermark. The send buffer watermark is the number
+     * of outgoing payload bytes that may be queued before the connection stops
+     * reporting itself as writable. Once the queue has grown past this point
+     * the writable handler will be called after it drains back below it.
+     *
+     * The default is set by the endpoint that creates the connection.
+     *
+     * @since 0.9.0
+     *
+     * @param new_value The value to set as the send buffer watermark.
+     */
+    void set_send_buffer_watermark(size_t new_value) {
+        m_send_buffer_watermark = new_value;
+    }
+
+    /// Get maximum outgoing frame size
+    /**
+     * Get the maximum outgoing frame size. Outgoing data messages with
+     * payloads larger than this are split into multiple frames as they are
+     * written so that control frames can be sent between the fragments. Zero
+     * means that outgoing messages are never split.
+     *
+     * The default is set by the endpoint that creates the connection.
+     *
+     * @since 0.9.0
+     */
+    size_t get_max_outgoing_frame_size() const {
+        return m_max_outgoing_frame_size;
+    }
+
+    /// Set maximum outgoing frame size
+    /**
+     * Set the maximum outgoing frame size. Outgoing data messages with
+     * payloads larger than this are split into multiple frames as they are
+     * written so that control frames can be sent between the fragments. Zero
+     * means that outgoing messages are never split.
+     *
+     * Fragments of masked messages are each masked with a new masking key.
+     *
+     * The default is set by the endpoint that creates the connection.
+     *
+     * @since 0.9.0
+     *
+     * @param new_value The value to set as the maximum outgoing frame size.
+     */
+    void set_max_outgoing_frame_size(size_t new_value) {
+        m_max_outgoing_frame_size = new_value;
+    }
+
+    /// Get maximum bytes per write
+    /**
+     * Get the maximum number of bytes that queued messages will be gathered
+     * into for a single transport write. Zero means no limit.
+     *
+     * The default is set by the endpoint that creates the connection.
+     *
+     * @since 0.9.0
+     */
+    size_t get_max_write_batch_bytes() const {
+        return m_max_write_batch_bytes;
+    }
+
+    /// Set maximum bytes per write
+    /**
+     * Set the maximum number of bytes that queued messages will be gathered
+     * into for a single transport write. A single message larger than the
+     * limit is still written on its own. Zero means no limit.
+     *
+     * The default is set by the endpoint that creates the connection.
+     *
+     * @since 0.9.0
+     *
+     * @param new_value The value to set as the maximum bytes per write.
+     */
+    void set_max_write_batch_bytes(size_t new_value) {
+        m_max_write_batch_bytes = new_value;
+    }
+
+    /// Get maximum buffers per write
+    /**
+     * Get the maximum number of buffers (two per message) that will be
+     * gathered into a single scatter/gather transport write. Zero means no
+     * limit.
+     *
+     * The default is set by the endpoint that creates the connection.
+     *
+     * @since 0.9.0
+     */
+    size_t get_max_write_batch_buffers() const {
+        return m_max_write_batch_buffers;
+    }
+
+    /// Set maximum buffers per write
+    /**
+     * Set the maximum number of buffers (two per message) that will be
+     * gathered into a single scatter/gather transport write. At least one
+     * message is always written. Zero means no limit.
+     *
+     * The default is set by the endpoint that creates the connection.
+     *
+     * @since 0.9.0
+     *
+     * @param new_value The value to set as the maximum buffers per write.
+     */
+    void set_max_write_batch_buffers(size_t new_value) {
+        m_max_write_batch_buffers = new_value;
+    }
+
+    /// Get write corking delay
+    /**
+     * Get the length of time, in microseconds, that a write is held back to
+     * gather more messages. Zero means writes start immediately.
+     *
+     * The default is set by the endpoint that creates the connection.
+     *
+     * @since 0.9.0
+     */
+    long get_write_cork_delay() const {
+        return m_write_cork_delay;
+    }
+
+    /// Set write corking delay
+    /**
+     * Set the length of time, in microseconds, that a write is held back to
+     * gather more messages. The delay ends early once the queued messages
+     * fill a batch. Ping, pong and close frames are not held back.
+     *
+     * The delay is rounded up to the resolution of the transport's timers.
+     * The bundled transports use millisecond timers, so a delay of 50
+     * microseconds holds writes back for a full millisecond. Transports
+     * without timers write immediately. Zero means writes start immediately.
+     *
+     * The default is set by the endpoint that creates the connection.
+     *
+     * @since 0.9.0
+     *
+     * @param new_value The write corking delay in microseconds.
+     */
+    void set_write_cork_delay(long new_value) {
+        m_write_cork_delay = new_value;
+    }
+
+    /// Get per turn read budget in bytes
+    /**
+     * Get the number of bytes of already read data that this connection will
+     * process before yielding the transport thread to other connections.
+     * Zero means no limit.
+     *
+     * The default is set by the endpoint that creates the connection.
+     *
+     * @since 0.9.0
+     */
+    size_t get_read_budget_bytes() const {
+        return m_read_budget_bytes;
+    }
+
+    /// Set per turn read budget in bytes
+    /**
+     * Set the number of bytes of already read data that this connection will
+     * process before yielding the transport thread to other connections. When
+     * the budget runs out the rest of the data is processed from a handler
+     * posted to the transport rather than inline. Zero means no limit.
+     *
+     * The default is set by the endpoint that creates the connection.
+     *
+     * @since 0.9.0
+     *
+     * @param new_value The read budget in bytes.
+     */
+    void set_read_budget_bytes(size_t new_value) {
+        m_read_budget_bytes = new_value;
+    }
+
+    /// Get per turn read budget in messages
+    /**
+     * Get the number of messages that this connection will deliver from
+     * already read data before yielding the transport thread to other
+     * connections. Zero means no limit.
+     *
+     * The default is set by the endpoint that creates the connection.
+     *
+     * @since 0.9.0
+     */
+    size_t get_read_budget_messages() const {
+        return m_read_budget_messages;
+    }
+
+    /// Set per turn read budget in messages
+    /**
+     * Set the number of messages that this connection will deliver from
+     * already read data before yielding the transport thread to other
+     * connections. When the budget runs out the rest of the data is processed
+     * from a handler posted to the transport rather than inline. Zero means
+     * no limit.
+     *
+     * The default is set by the endpoint that creates the connection.
+     *
+     * @since 0.9.0
+     *
+     * @param new_value The read budget in messages.
+     */
+    void set_read_budget_messages(size_t new_value) {
+        m_read_budget_messages = new_value;
+    }
+
+    /// Get the number of times reading yielded on the byte budget
+    /**
+     * Counts how often processing of read data stopped because the per turn
+     * read byte budget ran out. Should be called from the transport thread.
+     *
+     * @since 0.9.0
+     *
+     * @return The number of times the read byte budget was hit.
+     */
+    size_t get_read_byte_budget_hits() const {
+        return m_read_byte_budget_hits;
+    }
+
+    /// Get the number of times reading yielded on the message budget
+    /**
+     * Counts how often processing of read data stopped because the per turn
+     * read message budget ran out. Should be called from the transport thread.
+     *
+     * @since 0.9.0
+     *
+     * @return The number of times the read message budget was hit.
+     */
+    size_t get_read_message_budget_hits() const {
+        return m_read_message_budget_hits;
+    }
+
+    /// Get compression offload threshold
+    /**
+     * Get the payload size from which outgoing messages are compressed on the
+     * compression executor, if one is set. Zero means never.
+     *
+     * The default is set by the endpoint that creates the connection.
+     *
+     * @since 0.9.0
+     */
+    size_t get_compression_offload_threshold() const {
+        return m_compression_offload_threshold;
+    }
+
+    /// Set compression offload threshold
+    /**
+     * Set the payload size from which outgoing messages are compressed on the
+     * compression executor, if one is set. Zero means never.
+     *
+     * The default is set by the endpoint that creates the connection.
+     *
+     * @since 0.9.0
+     *
+     * @param new_value The compression offload threshold in bytes.
+     */
+    void set_compression_offload_threshold(size_t new_value) {
+        m_compression_offload_threshold = new_value;
+    }
+
     //////////////////////////////////
     // Uncategorized public methods //
     //////////////////////////////////
@@ -628,6 +1133,20 @@ public:
      */
     size_t get_buffered_amount() const;
 
+    /// Get the size of the outgoing write buffer for one priority class
+    /**
+     * Retrieves the number of payload bytes queued in the given priority
+     * class that have not already been dispatched to the transport layer.
+     *
+     * This method invokes the m_write_lock mutex
+     *
+     * @since 0.9.0
+     *
+     * @param priority The priority class to report on
+     * @return The current number of bytes queued in that class.
+     */
+    size_t get_buffered_amount(message_buffer::priority::value priority) const;
+
     /// Get the size of the outgoing write buffer (in payload bytes)
     /**
      * @deprecated use `get_buffered_amount` instead
@@ -636,6 +1155,21 @@ public:
         return get_buffered_amount();
     }
 
+    /// Check whether the connection is accepting more outgoing data
+    /**
+     * Returns true if the outgoing send buffer is below the send buffer
+     * watermark. Producers should stop sending when this returns false and
+     * wait for the writable handler before continuing. This is advisory only,
+     * sends are never rejected because the buffer is above the watermark.
+     *
+     * This method invokes the m_write_lock mutex
+     *
+     * @since 0.9.0
+     *
+     * @return Whether or not the send buffer is below the watermark
+     */
+    bool is_writable() const;
+
     ////////////////////
     // Action Methods //
     ////////////////////
@@ -651,9 +1185,13 @@ public:
      *
      * @param op The opcode to generated the message with. Default is
      * frame::opcode::text
+     *
+     * @param priority The priority class to queue the message in. Default is
+     * message_buffer::priority::normal
      */
     lib::error_code send(std::string const & payload, frame::opcode::value op =
-        frame::opcode::text);
+        frame::opcode::text, message_buffer::priority::value priority =
+        message_buffer::priority::normal);
 
     /// Send a message (raw array overload)
     /**
@@ -668,9 +1206,13 @@ public:
      *
      * @param op The opcode to generated the message with. Default is
      * frame::opcode::binary
+     *
+     * @param priority The priority class to queue the message in. Default is
+     * message_buffer::priority::normal
      */
     lib::error_code send(void const * payload, size_t len, frame::opcode::value
-        op = frame::opcode::binary);
+        op = frame::opcode::binary, message_buffer::priority::value priority =
+        message_buffer::priority::normal);
 
     /// Add a message to the outgoing send queue
     /**
@@ -678,6 +1220,17 @@ public:
      * framing. If presented with an unprepared message it is validated, framed,
      * and then added
      *
+     * The message is queued according to its priority. Queued messages with a
+     * higher priority are written first, messages of the same priority are
+     * written in the order they were sent. Ping and pong frames are always
+     * written ahead of data messages. A close frame is always written after
+     * everything queued before it.
+     *
+     * If the config enables `enable_mpsc_send_queue` the message is handed to
+     * the transport's event loop through a lock free queue and framed there.
+     * Opcode and UTF-8 errors are still reported here, later errors are
+     * logged.
+     *
      * Errors are returned via an exception
      * \todo make exception system_error rather than error_code
      *
@@ -687,6 +1240,103 @@ public:
      */
     lib::error_code send(message_ptr msg);
 
+    /// Start a streamed outgoing message
+    /**
+     * Begins a message whose payload will be supplied incrementally via
+     * `send_fragment`. Each fragment is written to the wire as its own frame;
+     * the first with the opcode given here and the rest as continuation
+     * frames. The message is completed by sending a fragment with the fin flag
+     * set or by calling `end_message`.
+     *
+     * Only one streamed message may be in progress at a time. While one is in
+     * progress other data messages may not be sent. Control frames (ping,
+     * pong, close) may still be sent and will be interleaved between the
+     * fragments. Streamed messages are never compressed.
+     *
+     * This method locks the m_write_lock mutex
+     *
+     * @since 0.9.0
+     *
+     * @param op The opcode of the message. Must be a non-control opcode other
+     * than continuation.
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code begin_message(frame::opcode::value op);
+
+    /// Send the next fragment of a streamed message
+    /**
+     * Frames and queues the next fragment of the message started with
+     * `begin_message`. Fragments of text messages are checked for UTF-8
+     * validity incrementally, a code point may be split between fragments.
+     * A fragment that is rejected is not sent and leaves the message as it
+     * was, so the stream may continue with a different fragment.
+     *
+     * This method locks the m_write_lock mutex
+     *
+     * @since 0.9.0
+     *
+     * @param payload A pointer to the bytes to send.
+     * @param len Length of the payload.
+     * @param fin Whether or not this is the last fragment of the message.
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code send_fragment(void const * payload, size_t len,
+        bool fin);
+
+    /// Send the next fragment of a streamed message (string overload)
+    /**
+     * @since 0.9.0
+     *
+     * @param payload The payload string to send.
+     * @param fin Whether or not this is the last fragment of the message.
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code send_fragment(std::string const & payload,
+        bool fin = false);
+
+    /// Finish a streamed message
+    /**
+     * Sends an empty final fragment completing the message started with
+     * `begin_message`.
+     *
+     * This method locks the m_write_lock mutex
+     *
+     * @since 0.9.0
+     *
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code end_message();
+
+    /// Hold back outgoing writes
+    /**
+     * While corked, sent data messages are queued but no transport writes
+     * are started for them. Call `uncork` to write everything queued in as
+     * few writes as the batch limits allow. Ping and pong frames are still
+     * written, and queueing a close frame writes everything held back ahead
+     * of it. If the transport supports it the socket is corked as well
+     * (TCP_CORK), from within the transport's event loop, so that writes
+     * already in flight are coalesced with the ones that follow.
+     *
+     * This method locks the m_write_lock mutex
+     *
+     * @since 0.9.0
+     *
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code cork();
+
+    /// Resume outgoing writes
+    /**
+     * Ends a `cork` and starts writing any messages queued in the mean time.
+     *
+     * This method locks the m_write_lock mutex
+     *
+     * @since 0.9.0
+     *
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code uncork();
+
     /// Asyncronously invoke handler::on_inturrupt
     /**
      * Signals to the connection to asyncronously invoke the on_inturrupt
@@ -1131,6 +1781,11 @@ public:
      * Warning: deferred connections won't time out and as a result can tie up
      * resources.
      *
+     * Since 0.9.0 this may also be called from the validate handler to defer
+     * the decision on a WebSocket handshake, which is then completed with
+     * `accept_handshake` or `reject_handshake`. In that case the handshake
+     * timer keeps running and the connection fails if it expires first.
+     *
      * @since 0.6.0
      *
      * @return A status code, zero on success, non-zero otherwise
@@ -1151,22 +1806,136 @@ public:
     
     /// Send deferred HTTP Response
     void send_http_response();
-    
-    // TODO HTTPNBIO: write_headers
-    // function that processes headers + status so far and writes it to the wire
-    // beginning the HTTP response body state. This method will ignore anything
-    // in the response body.
-    
-    // TODO HTTPNBIO: write_body_message
-    // queues the specified message_buffer for async writing
-    
-    // TODO HTTPNBIO: finish connection
-    //
-    
-    // TODO HTTPNBIO: write_response
-    // Writes the whole response, headers + body and closes the connection
-    
-    
+
+    /// Accept a deferred WebSocket handshake
+    /**
+     * Completes a handshake deferred by the validate handler as if the handler
+     * had returned true. Response headers and the subprotocol may be set
+     * before calling this. May be called from any thread, the response is
+     * written from within the transport's event loop.
+     *
+     * @since 0.9.0
+     *
+     * @return A status code, zero on success, non-zero otherwise. Fails with
+     * `invalid_state` if the handshake wasn't deferred or has already been
+     * completed, or if the connection has timed out or closed in the meantime.
+     */
+    lib::error_code accept_handshake();
+
+    /// Reject a deferred WebSocket handshake
+    /**
+     * Completes a handshake deferred by the validate handler as if the handler
+     * had returned false, responding with the given status. Response headers
+     * and a body may be set before calling this. May be called from any
+     * thread, the response is written from within the transport's event
+     * loop.
+     *
+     * @since 0.9.0
+     *
+     * @param code The HTTP status code to respond with
+     * @return A status code, zero on success, non-zero otherwise. Fails with
+     * `invalid_state` if the handshake wasn't deferred or has already been
+     * completed, or if the connection has timed out or closed in the meantime.
+     */
+    lib::error_code reject_handshake(http::status_code::value code);
+
+    /// Start a streamed HTTP response body
+    /**
+     * Writes the status line and headers set so far and puts the connection
+     * in the streaming state. The body is then sent in pieces with
+     * `send_http_body` and `send_http_file` and finished with
+     * `end_http_body`. May be called from the http handler or, after
+     * `defer_http_response`, from any thread. The body is written from within
+     * the transport's event loop. Handshake timers are cancelled, so the
+     * stream may stay open indefinitely.
+     *
+     * If the response has a Content-Length header the body is sent as is and
+     * must be exactly that long. Otherwise HTTP/1.1 clients get
+     * `Transfer-Encoding: chunked` and each piece is sent as one chunk, while
+     * HTTP/1.0 clients get a body that ends when the connection closes.
+     *
+     * Body pieces count towards the send buffer like outgoing messages do.
+     * Producers should stop once `is_writable` returns false and resume from
+     * the writable handler. A response status that was not set defaults to
+     * 200 OK. A response that already has a body can't be streamed.
+     *
+     * @since 0.9.0
+     *
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code begin_http_body();
+
+    /// Queue a piece of a streamed HTTP response body
+    /**
+     * @since 0.9.0
+     *
+     * @param data The bytes to send
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code send_http_body(std::string const & data);
+
+    /// Queue a piece of a streamed HTTP response body
+    /**
+     * @since 0.9.0
+     *
+     * @param data Pointer to the bytes to send
+     * @param len Number of bytes to send
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code send_http_body(void const * data, size_t len);
+
+    /// Queue a shared buffer as a piece of a streamed HTTP response body
+    /**
+     * The buffer is written as is, without being copied, and is kept alive
+     * until it has been written. It must not be modified in the meantime.
+     * This allows one buffer to be sent on many connections at once.
+     *
+     * @since 0.9.0
+     *
+     * @param data The buffer to send
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code send_http_body(lib::shared_ptr<std::string const> data);
+
+    /// Queue part of a file as a piece of a streamed HTTP response body
+    /**
+     * The file is opened now and read as it is written. Where the transport
+     * supports it (plain TCP on Linux with the asio transport) the bytes go
+     * straight from the file to the socket with sendfile. Otherwise they are
+     * read and written in blocks, so a large file is never held in memory.
+     * File pieces do not count towards the send buffer.
+     *
+     * @since 0.9.0
+     *
+     * @param path The file to send
+     * @param offset Offset of the first byte to send
+     * @param len Number of bytes to send
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code send_http_file(std::string const & path, uint64_t offset,
+        uint64_t len);
+
+    /// Queue a whole file as a piece of a streamed HTTP response body
+    /**
+     * @since 0.9.0
+     *
+     * @param path The file to send
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code send_http_file(std::string const & path);
+
+    /// Finish a streamed HTTP response body
+    /**
+     * Once all queued pieces have been written the connection is either kept
+     * open for the next request or closed, following the same rules as other
+     * HTTP responses.
+     *
+     * @since 0.9.0
+     *
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code end_http_body();
+
 
     /////////////////////////////////////////////////////////////
     // Pass-through access to the other connection information //
@@ -1301,8 +2070,11 @@ public:
 
     void handle_open_handshake_timeout(lib::error_code const & ec);
     void handle_close_handshake_timeout(lib::error_code const & ec);
+    void handle_http_keep_alive_timeout(lib::error_code const & ec);
 
     void handle_read_frame(lib::error_code const & ec, size_t bytes_transferred);
+    void process_read_frame(size_t offset, size_t bytes_transferred);
+    void deliver_message_batch();
     void read_frame();
 
     /// Get array of WebSocket protocol versions that this connection supports.
@@ -1367,6 +2139,22 @@ protected:
     /// Perform WebSocket handshake validation of m_request using m_processor.
     /// set m_response and return an error code indicating status.
     lib::error_code process_handshake_request();
+
+    /// Set up m_response to accept a validated WebSocket handshake
+    lib::error_code process_handshake_accept();
+
+    /// Set up m_response to reject a WebSocket handshake
+    lib::error_code process_handshake_reject();
+
+    /// Finish a deferred WebSocket handshake
+    /**
+     * Runs within the transport's event loop so that the response is not
+     * written concurrently with the handshake timer or a termination.
+     *
+     * @param accept Whether to accept or reject the handshake
+     * @param code The HTTP status code to reject with
+     */
+    void handle_deferred_handshake(bool accept, http::status_code::value code);
 private:
     
 
@@ -1379,6 +2167,49 @@ private:
     /// Alternate path for write_http_response in error conditions
     void write_http_response_error(lib::error_code const & ec);
 
+    /// Whether the connection may stay open after the current HTTP response
+    bool http_keep_alive_allowed() const;
+
+    /// Reset the HTTP request state and read the next request
+    void read_next_http_request();
+
+    /// Add keep-alive related headers to an HTTP response
+    /**
+     * @param framed Whether the client can find the end of the response body
+     * without the connection closing
+     */
+    void set_http_connection_headers(bool framed);
+
+    /// Queue a piece of a streamed HTTP body, framing it if needed
+    /**
+     * If `shared` holds the bytes and no framing is needed the piece refers
+     * to it rather than copying the bytes.
+     */
+    lib::error_code queue_http_body(void const * data, size_t len,
+        lib::shared_ptr<std::string const> const & shared);
+
+    /// Write the next queued HTTP body piece
+    void write_http_body();
+
+    /// Process the result of writing an HTTP body piece
+    void handle_write_http_body(lib::error_code const & ec);
+
+    /// Keep the connection open or close it after a streamed HTTP body
+    void finish_http_body();
+
+    /// Cancel the handshake timer and start writing a streamed HTTP body
+    /**
+     * Runs within the transport's event loop.
+     */
+    void handle_begin_http_body();
+
+    /// Finish a streamed HTTP body from within the transport's event loop
+    /**
+     * @param done Whether everything had been written when end_http_body was
+     * called. If not, the handler of the last write finishes the body.
+     */
+    void handle_end_http_body(bool done);
+
     /// Process control message
     /**
      *
@@ -1444,16 +2275,136 @@ private:
 
     /// Pop a message from the write queue
     /**
-     * Removes and returns a message from the write queue and updates any
-     * associated shared state.
+     * Removes and returns the oldest message of the highest priority class
+     * that has one queued and updates any associated shared state.
      *
      * Must be called while holding m_write_lock
      *
      * @todo unit tests
      *
-     * @return the message_ptr at the front of the queue
+     * @param lowest The lowest priority class to consider
+     * @return the message_ptr at the front of the queue or a null ptr if
+     * no messages at or above `lowest` are queued.
+     */
+    message_ptr write_pop(message_buffer::priority::value lowest =
+        message_buffer::priority::low);
+
+    /// Check whether the queued messages fill a write batch
+    /**
+     * Must be called while holding m_write_lock
      */
-    message_ptr write_pop();
+    bool write_batch_full() const;
+
+    /// Write messages held back by the write corking delay
+    void handle_cork_timeout(lib::error_code const & ec);
+
+    /// Cork or uncork the transport from within its event loop
+    void handle_set_cork(bool value);
+
+    /// Frame and queue messages sent through the lock free send queue
+    /**
+     * Runs within the transport's event loop. Drains m_pending_sends, frames
+     * each message, adds it to the write queues, and starts a write.
+     */
+    void handle_pending_sends();
+
+    /// Frame the messages in m_pending_sends and add them to the write queues
+    /**
+     * Must be called while holding m_write_lock
+     *
+     * Does nothing while a streamed message is in progress. Messages that
+     * need the compression executor are moved to the offload queue.
+     *
+     * @return Whether process_offload_queue must be scheduled once the lock
+     * has been released.
+     */
+    bool drain_pending_sends();
+
+    /// Check a data message for errors that prepare_data_frame would report
+    lib::error_code validate_data_message(message_ptr const & msg) const;
+
+    /// Whether a message is big enough to be framed on the executor
+    /**
+     * Must be called while holding m_write_lock
+     */
+    bool needs_offload(message_ptr const & msg) const;
+
+    /// Move messages from the offload queue to the write queues
+    /**
+     * Runs within the transport's event loop. Messages are taken in order.
+     * Small ones are framed inline; the first large one is handed to the
+     * compression executor and stays at the front until it comes back.
+     */
+    void process_offload_queue();
+
+    /// Frame a message on the compression executor
+    void offload_prepare(message_ptr msg);
+
+    /// Queue a message framed by offload_prepare for writing
+    void handle_offload_prepared(message_ptr outgoing_msg,
+        lib::error_code const & ec);
+
+    /// Get the message that the next call to write_pop would return
+    /**
+     * Must be called while holding m_write_lock
+     *
+     * @return the message_ptr at the front of the queue without removing it
+     */
+    message_ptr write_peek() const;
+
+    /// Check whether all of the write queues are empty
+    /**
+     * Must be called while holding m_write_lock
+     */
+    bool send_queue_empty() const;
+
+    /// Check whether a close frame is waiting in the write queues
+    /**
+     * Must be called while holding m_write_lock
+     */
+    bool close_queued() const;
+
+    /// Determine which write queue a message belongs in
+    /**
+     * Ping and pong frames use the control class, close frames use the lowest
+     * class so that they are never written ahead of data, and data messages
+     * use their own priority (limited to high).
+     *
+     * @param msg The message to classify
+     * @return The index of the write queue for the message
+     */
+    unsigned int send_queue_index(message_ptr msg) const;
+
+    /// Check whether a queued message should be written in fragments
+    /**
+     * Must be called while holding m_write_lock
+     *
+     * @param msg The prepared message to check
+     * @return Whether or not the message is larger than the maximum outgoing
+     * frame size and may be split.
+     */
+    bool needs_fragmenting(message_ptr msg) const;
+
+    /// Build the frame header for one fragment of a large outgoing message
+    /**
+     * Must be called while holding m_write_lock
+     *
+     * The header is derived from the header of the prepared message. The first
+     * fragment keeps its opcode and RSV bits, later ones are continuation
+     * frames and only the last keeps its FIN bit.
+     *
+     * Masked fragments get a new masking key. Their payload is unmasked with
+     * the key of the prepared message and masked again into
+     * m_fragment_payload.
+     *
+     * @param msg The prepared message being fragmented
+     * @param offset The payload offset that the fragment starts at
+     * @param len The number of payload bytes in the fragment
+     * @param payload Set to the payload bytes to write for the fragment
+     * @return The serialized frame header for the fragment
+     */
+    std::string prepare_fragment_header(message_ptr msg, size_t offset,
+        size_t len, char const *& payload);
 
     /// Prints information about the incoming connection to the access log
     /**
@@ -1508,14 +2459,33 @@ private:
     pong_timeout_handler    m_pong_timeout_handler;
     interrupt_handler       m_interrupt_handler;
     http_handler            m_http_handler;
+    http_body_handler       m_http_body_handler;
     validate_handler        m_validate_handler;
     message_handler         m_message_handler;
+    message_batch_handler   m_message_batch_handler;
+    writable_handler        m_writable_handler;
+    compression_executor    m_compression_executor;
+
+    /// Extensions to be negotiated in addition to permessage-deflate
+    std::vector<extensions::extension::ptr> m_extensions;
+
+    /// Fixed parts of a successful handshake response
+    processor::response_template::ptr m_response_template;
 
     /// constant values
     long                    m_open_handshake_timeout_dur;
     long                    m_close_handshake_timeout_dur;
     long                    m_pong_timeout_dur;
+    long                    m_http_keep_alive_timeout_dur;
     size_t                  m_max_message_size;
+    size_t                  m_send_buffer_watermark;
+    size_t                  m_max_outgoing_frame_size;
+    size_t                  m_max_write_batch_bytes;
+    size_t                  m_max_write_batch_buffers;
+    long                    m_write_cork_delay;
+    size_t                  m_read_budget_bytes;
+    size_t                  m_read_budget_messages;
+    size_t                  m_compression_offload_threshold;
 
     /// External connection state
     /**
@@ -1536,7 +2506,16 @@ private:
      * Serializes access to the write queue as well as shared state within the
      * processor.
      */
-    mutex_type              m_write_lock;
+    mutable mutex_type      m_write_lock;
+
+    /// The lock used to protect masking key generation
+    /**
+     * Held while the processor masks frames on clients. Messages framed on
+     * the compression executor are masked outside of m_write_lock and would
+     * otherwise use m_rng concurrently with control frames and fragments
+     * prepared on the transport thread.
+     */
+    mutable mutex_type      m_rng_lock;
 
     // connection resources
     char                    m_buf[config::connection_read_buffer_size];
@@ -1561,18 +2540,47 @@ private:
      */
     processor_ptr           m_processor;
 
-    /// Queue of unsent outgoing messages
+    /// Queues of unsent outgoing messages, one per priority class
     /**
      * Lock: m_write_lock
      */
-    std::queue<message_ptr> m_send_queue;
+    std::deque<message_ptr> m_send_queue[message_buffer::priority::count];
 
-    /// Size in bytes of the outstanding payloads in the write queue
+    /// Size in bytes of the outstanding payloads in the write queues
     /**
      * Lock: m_write_lock
      */
     size_t m_send_buffer_size;
 
+    /// Size in bytes of the outstanding payloads in each write queue
+    /**
+     * Lock: m_write_lock
+     */
+    size_t m_send_class_size[message_buffer::priority::count];
+
+    /// Messages sent but not yet framed when using the lock free send queue
+    /**
+     * Lock: none for pushing, drained while holding m_write_lock
+     */
+    concurrency::mpsc_queue<message_ptr> m_pending_sends;
+
+    /// Reused storage for messages drained from m_pending_sends
+    std::vector<message_ptr> m_pending_batch;
+
+    /// Messages waiting for, or queued behind, a message being framed on the
+    /// compression executor
+    /**
+     * Lock: m_write_lock
+     */
+    std::deque<message_ptr> m_offload_queue;
+
+    /// True while process_offload_queue is scheduled or a message is out on
+    /// the compression executor
+    /**
+     * Lock: m_write_lock
+     */
+    bool m_offload_running;
+
     /// buffer holding the various parts of the current message being writen
     /**
      * Lock m_write_lock
@@ -1583,15 +2591,98 @@ private:
     /// from going out of scope before the write is complete.
     std::vector<message_ptr> m_current_msgs;
 
+    /// Large message currently being written in fragments
+    /**
+     * Lock m_write_lock
+     */
+    message_ptr m_fragment_msg;
+
+    /// Number of payload bytes of m_fragment_msg that have been written
+    /**
+     * Lock m_write_lock
+     */
+    size_t m_fragment_offset;
+
+    /// Frame header for the fragment of m_fragment_msg currently being written
+    std::string m_fragment_header;
+
+    /// Masked payload of the fragment of m_fragment_msg being written
+    std::string m_fragment_payload;
+
     /// True if there is currently an outstanding transport write
     /**
      * Lock m_write_lock
      */
     bool m_write_flag;
 
+    /// True if writes are being held back by `cork`
+    /**
+     * Lock m_write_lock
+     */
+    bool m_corked;
+
+    /// True while a write is being held back by the write corking delay
+    /**
+     * Lock m_write_lock
+     */
+    bool m_cork_pending;
+
+    /// True once the write corking delay has run out and the next write may
+    /// start immediately
+    /**
+     * Lock m_write_lock
+     */
+    bool m_cork_expired;
+
+    /// Timer for the write corking delay
+    timer_ptr m_cork_timer;
+
+    /// True if the send buffer has grown past the watermark since the last
+    /// time the writable handler was called
+    /**
+     * Lock m_write_lock
+     */
+    bool m_send_blocked;
+
+    /// True if a streamed message has been started but not finished
+    /**
+     * Lock m_write_lock for writing, send reads it without a lock when using
+     * the lock free send queue
+     */
+    lib::atomic<bool> m_stream_open;
+
+    /// True if at least one fragment of the current streamed message has been
+    /// sent
+    /**
+     * Lock m_write_lock
+     */
+    bool m_stream_started;
+
+    /// Opcode of the current streamed message
+    /**
+     * Lock m_write_lock
+     */
+    frame::opcode::value m_stream_opcode;
+
+    /// Incremental UTF-8 validator for streamed text messages
+    /**
+     * Lock m_write_lock
+     */
+    utf8_validator::validator m_stream_validator;
+
     /// True if this connection is presently reading new data
     bool m_read_flag;
 
+    /// Data messages completed during the current read waiting to be passed
+    /// to the message batch handler
+    message_batch m_read_batch;
+
+    /// Number of times processing of read data yielded on the byte budget
+    size_t m_read_byte_budget_hits;
+
+    /// Number of times processing of read data yielded on the message budget
+    size_t m_read_message_budget_hits;
+
     // connection data
     request_type            m_request;
     response_type           m_response;
@@ -1632,7 +2723,58 @@ private:
     /// deferred until later.
     session::http_state::value m_http_state;
 
+    /// Set when the HTTP response being written leaves the connection open
+    /// for another request.
+    bool m_http_keep_alive;
+
+    /// One piece of a streamed HTTP response body
+    /**
+     * Either bytes held in memory or a range of an open file. File pieces are
+     * read into `data` one block at a time if the transport cannot write
+     * them directly. Shared buffers are written from `shared` instead of
+     * `data`.
+     */
+    struct http_body_piece {
+        http_body_piece() : offset(0), length(0), buffered(0), copy(false) {}
+
+        std::string data;
+        lib::shared_ptr<std::string const> shared;
+        lib::shared_ptr<std::FILE> file;
+        uint64_t offset;
+        uint64_t length;
+        size_t buffered;
+        bool copy;
+    };
+
+    /// Streamed HTTP body pieces waiting to be written. Guarded by
+    /// m_write_lock.
+    std::deque<http_body_piece> m_http_body_queue;
+
+    /// Whether a streamed HTTP body piece is being written
+    bool m_http_body_writing;
+
+    /// Whether end_http_body has been called
+    bool m_http_body_ended;
+
+    /// Whether streamed HTTP body pieces are sent as chunks
+    bool m_http_body_chunked;
+
+    /// Body bytes still expected by the Content-Length of a streamed body,
+    /// or -1 if the response has none.
+    int64_t m_http_body_remaining;
+
+    /// Number of HTTP requests answered on this connection before the
+    /// current one
+    size_t m_http_request_count;
+
     bool m_was_clean;
+
+    /// Set when the application adds, replaces or removes response headers
+    /// or sets a response body, which rules out the response template.
+    bool m_response_modified;
+
+    /// Set when m_handshake_buffer already holds the serialized response
+    bool m_raw_response_ready;
 };
 
 } // namespace websocketpp
@@ -34,6 +34,7 @@
 #include <websocketpp/version.hpp>
 
 #include <string>
+#include <vector>
 
 namespace websocketpp {
 
@@ -66,6 +67,11 @@ public:
 
     /// Type of message_handler
     typedef typename connection_type::message_handler message_handler;
+    /// Type of a batch of messages delivered to a message_batch_handler
+    typedef typename connection_type::message_batch message_batch;
+    /// Type of message_batch_handler
+    typedef typename connection_type::message_batch_handler
+        message_batch_handler;
     /// Type of message pointers that this endpoint uses
     typedef typename connection_type::message_ptr message_ptr;
 
@@ -92,11 +98,23 @@ public:
       : m_alog(new alog_type(config::alog_level, log::channel_type_hint::access))
       , m_elog(new elog_type(config::elog_level, log::channel_type_hint::error))
       , m_user_agent(::websocketpp::user_agent)
+      , m_response_template(p_is_server ?
+            lib::make_shared<processor::response_template>(m_user_agent) :
+            processor::response_template::ptr())
       , m_open_handshake_timeout_dur(config::timeout_open_handshake)
       , m_close_handshake_timeout_dur(config::timeout_close_handshake)
       , m_pong_timeout_dur(config::timeout_pong)
+      , m_http_keep_alive_timeout_dur(config::timeout_http_keep_alive)
       , m_max_message_size(config::max_message_size)
       , m_max_http_body_size(config::max_http_body_size)
+      , m_send_buffer_watermark(config::send_buffer_watermark)
+      , m_max_outgoing_frame_size(config::max_outgoing_frame_size)
+      , m_max_write_batch_bytes(config::max_write_batch_bytes)
+      , m_max_write_batch_buffers(config::max_write_batch_buffers)
+      , m_write_cork_delay(config::write_cork_delay)
+      , m_read_budget_bytes(config::read_budget_bytes)
+      , m_read_budget_messages(config::read_budget_messages)
+      , m_compression_offload_threshold(config::compression_offload_threshold)
       , m_is_server(p_is_server)
     {
         m_alog->set_channels(config::alog_level);
@@ -127,6 +145,7 @@ public:
          , m_alog(std::move(o.m_alog))
          , m_elog(std::move(o.m_elog))
          , m_user_agent(std::move(o.m_user_agent))
+         , m_response_template(std::move(o.m_response_template))
          , m_open_handler(std::move(o.m_open_handler))
          
          , m_close_handler(std::move(o.m_close_handler))
@@ -136,14 +155,28 @@ public:
          , m_pong_timeout_handler(std::move(o.m_pong_timeout_handler))
          , m_interrupt_handler(std::move(o.m_interrupt_handler))
          , m_http_handler(std::move(o.m_http_handler))
+         , m_http_body_handler(std::move(o.m_http_body_handler))
          , m_validate_handler(std::move(o.m_validate_handler))
          , m_message_handler(std::move(o.m_message_handler))
+         , m_message_batch_handler(std::move(o.m_message_batch_handler))
+         , m_writable_handler(std::move(o.m_writable_handler))
+         , m_compression_executor(std::move(o.m_compression_executor))
+         , m_extension_factories(std::move(o.m_extension_factories))
 
          , m_open_handshake_timeout_dur(o.m_open_handshake_timeout_dur)
          , m_close_handshake_timeout_dur(o.m_close_handshake_timeout_dur)
          , m_pong_timeout_dur(o.m_pong_timeout_dur)
+         , m_http_keep_alive_timeout_dur(o.m_http_keep_alive_timeout_dur)
          , m_max_message_size(o.m_max_message_size)
          , m_max_http_body_size(o.m_max_http_body_size)
+         , m_send_buffer_watermark(o.m_send_buffer_watermark)
+         , m_max_outgoing_frame_size(o.m_max_outgoing_frame_size)
+         , m_max_write_batch_bytes(o.m_max_write_batch_bytes)
+         , m_max_write_batch_buffers(o.m_max_write_batch_buffers)
+         , m_write_cork_delay(o.m_write_cork_delay)
+         , m_read_budget_bytes(o.m_read_budget_bytes)
+         , m_read_budget_messages(o.m_read_budget_messages)
+         , m_compression_offload_threshold(o.m_compression_offload_threshold)
 
          , m_rng(std::move(o.m_rng))
          , m_is_server(o.m_is_server)         
@@ -196,6 +229,10 @@ public:
     void set_user_agent(std::string const & ua) {
         scoped_lock_type guard(m_mutex);
         m_user_agent = ua;
+        if (m_is_server) {
+            m_response_template =
+                lib::make_shared<processor::response_template>(ua);
+        }
     }
 
     /// Returns whether or not this endpoint is a server.
@@ -314,6 +351,11 @@ public:
         scoped_lock_type guard(m_mutex);
         m_http_handler = h;
     }
+    void set_http_body_handler(http_body_handler h) {
+        m_alog->write(log::alevel::devel,"set_http_body_handler");
+        scoped_lock_type guard(m_mutex);
+        m_http_body_handler = h;
+    }
     void set_validate_handler(validate_handler h) {
         m_alog->write(log::alevel::devel,"set_validate_handler");
         scoped_lock_type guard(m_mutex);
@@ -324,6 +366,37 @@ public:
         scoped_lock_type guard(m_mutex);
         m_message_handler = h;
     }
+    void set_message_batch_handler(message_batch_handler h) {
+        m_alog->write(log::alevel::devel,"set_message_batch_handler");
+        scoped_lock_type guard(m_mutex);
+        m_message_batch_handler = h;
+    }
+    void set_writable_handler(writable_handler h) {
+        m_alog->write(log::alevel::devel,"set_writable_handler");
+        scoped_lock_type guard(m_mutex);
+        m_writable_handler = h;
+    }
+    void set_compression_executor(compression_executor e) {
+        m_alog->write(log::alevel::devel,"set_compression_executor");
+        scoped_lock_type guard(m_mutex);
+        m_compression_executor = e;
+    }
+
+    /// Add an extension to negotiate on new connections
+    /**
+     * The factory is called for every connection created after this call and
+     * the extension it returns is added to that connection. Extensions are
+     * negotiated in addition to permessage-deflate.
+     *
+     * @since 0.9.0
+     *
+     * @param f A function returning a new extension object
+     */
+    void add_extension(extension_factory f) {
+        m_alog->write(log::alevel::devel,"add_extension");
+        scoped_lock_type guard(m_mutex);
+        m_extension_factories.push_back(f);
+    }
 
     //////////////////////////////////////////
     // Connection timeouts and other limits //
@@ -401,6 +474,30 @@ public:
         m_pong_timeout_dur = dur;
     }
 
+    /// Set HTTP keep-alive timeout
+    /**
+     * Sets the length of time a connection serving plain HTTP requests
+     * through the http handler stays open waiting for its next request. See
+     * connection::set_http_keep_alive_timeout for the rules that decide
+     * whether a connection is kept open.
+     *
+     * The default value is specified via the compile time config value
+     * 'timeout_http_keep_alive'. The default value in the core config
+     * is 0, which closes the connection after every response.
+     *
+     * To be effective, the transport you are using must support timers. See
+     * the documentation for your transport policy for details about its
+     * timer support.
+     *
+     * @since 0.9.0
+     *
+     * @param dur The length of the HTTP keep-alive timeout in ms
+     */
+    void set_http_keep_alive_timeout(long dur) {
+        scoped_lock_type guard(m_mutex);
+        m_http_keep_alive_timeout_dur = dur;
+    }
+
     /// Get default maximum message size
     /**
      * Get the default maximum message size that will be used for new 
@@ -467,6 +564,264 @@ public:
         m_max_http_body_size = new_value;
     }
 
+    /// Get default send buffer watermark
+    /**
+     * Get the default send buffer watermark that will be used for new
+     * connections created by this endpoint. The send buffer watermark is the
+     * number of outgoing payload bytes that may be queued before a connection
+     * stops reporting itself as writable.
+     *
+     * The default is set by the send_buffer_watermark value from the template
+     * config
+     *
+     * @since 0.9.0
+     */
+    size_t get_send_buffer_watermark() const {
+        return m_send_buffer_watermark;
+    }
+
+    /// Set default send buffer watermark
+    /**
+     * Set the default send buffer watermark that will be used for new
+     * connections created by this endpoint. The send buffer watermark is the
+     * number of outgoing payload bytes that may be queued before a connection
+     * stops reporting itself as writable.
+     *
+     * The default is set by the send_buffer_watermark value from the template
+     * config
+     *
+     * @since 0.9.0
+     *
+     * @param new_value The value to set as the send buffer watermark.
+     */
+    void set_send_buffer_watermark(size_t new_value) {
+        m_send_buffer_watermark = new_value;
+    }
+
+    /// Get default maximum outgoing frame size
+    /**
+     * Get the default maximum outgoing frame size that will be used for new
+     * connections created by this endpoint. Outgoing data messages with
+     * payloads larger than this are split into multiple frames so that
+     * control frames can be sent between the fragments.
+     *
+     * The default is set by the max_outgoing_frame_size value from the
+     * template config
+     *
+     * @since 0.9.0
+     */
+    size_t get_max_outgoing_frame_size() const {
+        return m_max_outgoing_frame_size;
+    }
+
+    /// Set default maximum outgoing frame size
+    /**
+     * Set the default maximum outgoing frame size that will be used for new
+     * connections created by this endpoint. Outgoing data messages with
+     * payloads larger than this are split into multiple frames so that
+     * control frames can be sent between the fragments. Zero disables
+     * fragmentation.
+     *
+     * The default is set by the max_outgoing_frame_size value from the
+     * template config
+     *
+     * @since 0.9.0
+     *
+     * @param new_value The value to set as the maximum outgoing frame size.
+     */
+    void set_max_outgoing_frame_size(size_t new_value) {
+        m_max_outgoing_frame_size = new_value;
+    }
+
+    /// Get default maximum write batch size in bytes
+    /**
+     * Get the default limit on the number of bytes gathered into a single
+     * transport write for new connections created by this endpoint.
+     *
+     * The default is set by the max_write_batch_bytes value from the template
+     * config
+     *
+     * @since 0.9.0
+     */
+    size_t get_max_write_batch_bytes() const {
+        return m_max_write_batch_bytes;
+    }
+
+    /// Set default maximum write batch size in bytes
+    /**
+     * Set the default limit on the number of bytes gathered into a single
+     * transport write for new connections created by this endpoint. Zero
+     * means no limit.
+     *
+     * The default is set by the max_write_batch_bytes value from the template
+     * config
+     *
+     * @since 0.9.0
+     *
+     * @param new_value The value to set as the maximum write batch size.
+     */
+    void set_max_write_batch_bytes(size_t new_value) {
+        m_max_write_batch_bytes = new_value;
+    }
+
+    /// Get default maximum write batch size in buffers
+    /**
+     * Get the default limit on the number of buffers gathered into a single
+     * transport write for new connections created by this endpoint.
+     *
+     * The default is set by the max_write_batch_buffers value from the
+     * template config
+     *
+     * @since 0.9.0
+     */
+    size_t get_max_write_batch_buffers() const {
+        return m_max_write_batch_buffers;
+    }
+
+    /// Set default maximum write batch size in buffers
+    /**
+     * Set the default limit on the number of buffers gathered into a single
+     * transport write for new connections created by this endpoint. Each
+     * message uses two buffers. Zero means no limit.
+     *
+     * The default is set by the max_write_batch_buffers value from the
+     * template config
+     *
+     * @since 0.9.0
+     *
+     * @param new_value The value to set as the maximum write batch buffers.
+     */
+    void set_max_write_batch_buffers(size_t new_value) {
+        m_max_write_batch_buffers = new_value;
+    }
+
+    /// Get default write corking delay
+    /**
+     * Get the default time in microseconds that new connections created by
+     * this endpoint wait to gather more messages before writing.
+     *
+     * The default is set by the write_cork_delay value from the template
+     * config
+     *
+     * @since 0.9.0
+     */
+    long get_write_cork_delay() const {
+        return m_write_cork_delay;
+    }
+
+    /// Set default write corking delay
+    /**
+     * Set the default time in microseconds that new connections created by
+     * this endpoint wait to gather more messages before writing. Zero writes
+     * as soon as possible.
+     *
+     * The default is set by the write_cork_delay value from the template
+     * config
+     *
+     * @since 0.9.0
+     *
+     * @param new_value The value to set as the write corking delay.
+     */
+    void set_write_cork_delay(long new_value) {
+        m_write_cork_delay = new_value;
+    }
+
+    /// Get default per turn read budget in bytes
+    /**
+     * Get the default number of bytes of already read data that new
+     * connections created by this endpoint will process before yielding the
+     * transport thread to other connections.
+     *
+     * The default is set by the read_budget_bytes value from the template
+     * config
+     *
+     * @since 0.9.0
+     */
+    size_t get_read_budget_bytes() const {
+        return m_read_budget_bytes;
+    }
+
+    /// Set default per turn read budget in bytes
+    /**
+     * Set the default number of bytes of already read data that new
+     * connections created by this endpoint will process before yielding the
+     * transport thread to other connections. Zero means no limit.
+     *
+     * The default is set by the read_budget_bytes value from the template
+     * config
+     *
+     * @since 0.9.0
+     *
+     * @param new_value The value to set as the read budget in bytes.
+     */
+    void set_read_budget_bytes(size_t new_value) {
+        m_read_budget_bytes = new_value;
+    }
+
+    /// Get default per turn read budget in messages
+    /**
+     * Get the default number of messages that new connections created by this
+     * endpoint will deliver from already read data before yielding the
+     * transport thread to other connections.
+     *
+     * The default is set by the read_budget_messages value from the template
+     * config
+     *
+     * @since 0.9.0
+     */
+    size_t get_read_budget_messages() const {
+        return m_read_budget_messages;
+    }
+
+    /// Set default per turn read budget in messages
+    /**
+     * Set the default number of messages that new connections created by this
+     * endpoint will deliver from already read data before yielding the
+     * transport thread to other connections. Zero means no limit.
+     *
+     * The default is set by the read_budget_messages value from the template
+     * config
+     *
+     * @since 0.9.0
+     *
+     * @param new_value The value to set as the read budget in messages.
+     */
+    void set_read_budget_messages(size_t new_value) {
+        m_read_budget_messages = new_value;
+    }
+
+    /// Get default compression offload threshold
+    /**
+     * Get the default payload size from which outgoing messages sent on new
+     * connections created by this endpoint are compressed on the compression
+     * executor, if one is set.
+     *
+     * The default is set by the compression_offload_threshold value from the
+     * template config
+     *
+     * @since 0.9.0
+     */
+    size_t get_compression_offload_threshold() const {
+        return m_compression_offload_threshold;
+    }
+
+    /// Set default compression offload threshold
+    /**
+     * Set the default payload size from which outgoing messages sent on new
+     * connections created by this endpoint are compressed on the compression
+     * executor, if one is set. Zero means never.
+     *
+     * The default is set by the compression_offload_threshold value from the
+     * template config
+     *
+     * @since 0.9.0
+     *
+     * @param new_value The value to set as the compression offload threshold.
+     */
+    void set_compression_offload_threshold(size_t new_value) {
+        m_compression_offload_threshold = new_value;
+    }
+
     /*************************************/
     /* Connection pass through functions */
     /*************************************/
@@ -666,6 +1021,8 @@ protected:
 private:
     // dynamic settings
     std::string                 m_user_agent;
+    /// Fixed parts of the handshake response, rebuilt when m_user_agent changes
+    processor::response_template::ptr m_response_template;
 
     open_handler                m_open_handler;
     close_handler               m_close_handler;
@@ -675,14 +1032,28 @@ private:
     pong_timeout_handler        m_pong_timeout_handler;
     interrupt_handler           m_interrupt_handler;
     http_handler                m_http_handler;
+    http_body_handler           m_http_body_handler;
     validate_handler            m_validate_handler;
     message_handler             m_message_handler;
+    message_batch_handler       m_message_batch_handler;
+    writable_handler            m_writable_handler;
+    compression_executor        m_compression_executor;
+    std::vector<extension_factory> m_extension_factories;
 
     long                        m_open_handshake_timeout_dur;
     long                        m_close_handshake_timeout_dur;
     long                        m_pong_timeout_dur;
+    long                        m_http_keep_alive_timeout_dur;
     size_t                      m_max_message_size;
     size_t                      m_max_http_body_size;
+    size_t                      m_send_buffer_watermark;
+    size_t                      m_max_outgoing_frame_size;
+    size_t                      m_max_write_batch_bytes;
+    size_t                      m_max_write_batch_buffers;
+    long                        m_write_cork_delay;
+    size_t                      m_read_budget_bytes;
+    size_t                      m_read_budget_messages;
+    size_t                      m_compression_offload_threshold;
 
     rng_type m_rng;
 
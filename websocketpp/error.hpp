@@ -143,7 +143,13 @@ enum value {
     http_parse_error,
     
     /// Extension negotiation failed
-    extension_neg_failed
+    extension_neg_failed,
+
+    /// A streamed HTTP body did not match the Content-Length of the response
+    invalid_http_body_length,
+
+    /// A file could not be opened or read for an HTTP response body
+    http_body_file
 }; // enum value
 
 
@@ -221,6 +227,10 @@ public:
                 return "HTTP parse error";
             case error::extension_neg_failed:
                 return "Extension negotiation failed";
+            case error::invalid_http_body_length:
+                return "HTTP body length does not match Content-Length";
+            case error::http_body_file:
+                return "Unable to read file for HTTP body";
             default:
                 return "Unknown";
         }
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2020, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef WEBSOCKETPP_EXTENSION_CHAIN_HPP
+#define WEBSOCKETPP_EXTENSION_CHAIN_HPP
+
+#include <websocketpp/common/stdint.hpp>
+#include <websocketpp/common/system_error.hpp>
+#include <websocketpp/extensions/extension.hpp>
+#include <websocketpp/frame.hpp>
+#include <websocketpp/http/constants.hpp>
+
+#include <string>
+#include <vector>
+
+namespace websocketpp {
+namespace extensions {
+
+/// An ordered list of extensions negotiated for one connection
+/**
+ * Extensions are added before the opening handshake. Negotiation enables the
+ * ones the remote endpoint agrees to, in the order they appear in the
+ * Sec-WebSocket-Extensions header, and gives each extension that asks for one
+ * the next free RSV bit. RSV1 belongs to permessage-deflate so RSV2 and RSV3
+ * are available.
+ *
+ * Outgoing payloads pass through the enabled extensions in negotiated order,
+ * before permessage-deflate compresses them. Incoming payloads pass through
+ * them in reverse order after permessage-deflate has inflated them. All
+ * transforms run in place on the message buffer.
+ *
+ * @since 0.9.0
+ */
+class chain {
+public:
+    typedef std::pair<lib::error_code,std::string> err_str_pair;
+
+    chain() : m_free_rsv(frame::BHB0_RSV2 | frame::BHB0_RSV3) {}
+
+    /// Add an extension that may be negotiated
+    void add(extension::ptr ext) {
+        m_entries.push_back(entry(ext));
+    }
+
+    /// Whether any extensions have been added
+    bool empty() const {
+        return m_entries.empty();
+    }
+
+    /// Whether any extensions were negotiated
+    bool is_enabled() const {
+        return !m_active.empty();
+    }
+
+    /// Get the RSV bits used by the negotiated extensions
+    /**
+     * @return A mask of frame::BHB0_RSV2 and frame::BHB0_RSV3
+     */
+    uint8_t get_rsv_bits() const {
+        return uint8_t((frame::BHB0_RSV2 | frame::BHB0_RSV3) & ~m_free_rsv);
+    }
+
+    /// Generate the offers for all extensions
+    /**
+     * @return Comma separated offers, in the order the extensions were added
+     */
+    std::string generate_offer() const {
+        std::string offer;
+        for (size_t i = 0; i < m_entries.size(); i++) {
+            std::string ext_offer = m_entries[i].ext->generate_offer();
+            if (ext_offer.empty()) {
+                continue;
+            }
+            if (!offer.empty()) {
+                offer += ", ";
+            }
+            offer += ext_offer;
+        }
+        return offer;
+    }
+
+    /// Negotiate the extensions listed in a Sec-WebSocket-Extensions header
+    /**
+     * A server considers the client's offers in order and accepts the first
+     * acceptable offer for each extension. Offers it doesn't recognize are
+     * ignored. A client enables every extension in the server's response,
+     * and fails if one of them rejects its parameters or was never added.
+     * permessage-deflate is negotiated by the processor and skipped here.
+     *
+     * @param params Parsed Sec-WebSocket-Extensions header
+     * @param is_server Whether params is a client offer
+     * @return Status code and, for servers, the response elements
+     */
+    err_str_pair negotiate(http::parameter_list const & params,
+        bool is_server)
+    {
+        err_str_pair ret;
+
+        http::parameter_list::const_iterator it;
+        for (it = params.begin(); it != params.end(); ++it) {
+            entry * e = find(it->first);
+
+            if (!e) {
+                // a server may not accept what the client did not offer
+                if (!is_server && it->first != "permessage-deflate") {
+                    ret.first = make_error_code(error::unexpected_extension);
+                    return ret;
+                }
+                continue;
+            }
+
+            // already negotiated
+            if (e->enabled) {
+                continue;
+            }
+
+            if (e->ext->needs_rsv_bit() && m_free_rsv == 0) {
+                if (is_server) {
+                    continue;
+                }
+                ret.first = make_error_code(error::no_rsv_bit);
+                return ret;
+            }
+
+            err_str_pair neg_ret = e->ext->negotiate(it->second);
+
+            if (neg_ret.first) {
+                if (is_server) {
+                    continue;
+                }
+                ret.first = neg_ret.first;
+                return ret;
+            }
+
+            if (e->ext->needs_rsv_bit()) {
+                // take RSV2 before RSV3
+                e->rsv = (m_free_rsv & frame::BHB0_RSV2) ? frame::BHB0_RSV2 :
+                    frame::BHB0_RSV3;
+                m_free_rsv &= uint8_t(~e->rsv);
+            }
+
+            e->enabled = true;
+            m_active.push_back(e - &m_entries[0]);
+
+            if (is_server) {
+                if (!ret.second.empty()) {
+                    ret.second += ", ";
+                }
+                ret.second += neg_ret.second;
+            }
+        }
+
+        return ret;
+    }
+
+    /// Run outgoing payload bytes through the enabled extensions
+    /**
+     * @param payload Message buffer to transform in place
+     * @param offset Start of the new bytes in payload
+     * @param fin Whether these are the last bytes of the message
+     * @return Status code
+     */
+    lib::error_code encode(std::string & payload, size_t offset, bool fin) {
+        for (size_t i = 0; i < m_active.size(); i++) {
+            lib::error_code ec = m_entries[m_active[i]].ext->encode(payload,
+                offset, fin);
+            if (ec) {
+                return ec;
+            }
+        }
+        return lib::error_code();
+    }
+
+    /// Run incoming payload bytes through the enabled extensions
+    /**
+     * @param payload Message buffer to transform in place
+     * @param offset Start of the new bytes in payload
+     * @param fin Whether these are the last bytes of the message
+     * @param rsv RSV bits from the first frame of the message
+     * @return Status code
+     */
+    lib::error_code decode(std::string & payload, size_t offset, bool fin,
+        uint8_t rsv)
+    {
+        for (size_t i = m_active.size(); i > 0; i--) {
+            entry & e = m_entries[m_active[i-1]];
+
+            // extensions with an RSV bit only decode messages marked with it
+            if (e.rsv && !(rsv & e.rsv)) {
+                continue;
+            }
+
+            lib::error_code ec = e.ext->decode(payload, offset, fin);
+            if (ec) {
+                return ec;
+            }
+        }
+        return lib::error_code();
+    }
+private:
+    struct entry {
+        explicit entry(extension::ptr e) : ext(e), rsv(0), enabled(false) {}
+
+        extension::ptr ext;
+        uint8_t rsv;
+        bool enabled;
+    };
+
+    entry * find(std::string const & name) {
+        for (size_t i = 0; i < m_entries.size(); i++) {
+            if (m_entries[i].ext->get_name() == name) {
+                return &m_entries[i];
+            }
+        }
+        return NULL;
+    }
+
+    std::vector<entry>  m_entries;
+    std::vector<size_t> m_active;
+    uint8_t             m_free_rsv;
+};
+
+} // namespace extensions
+} // namespace websocketpp
+
+#endif // WEBSOCKETPP_EXTENSION_CHAIN_HPP
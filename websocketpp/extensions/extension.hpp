@@ -29,9 +29,14 @@
 #define WEBSOCKETPP_EXTENSION_HPP
 
 #include <websocketpp/common/cpp11.hpp>
+#include <websocketpp/common/memory.hpp>
+#include <websocketpp/common/stdint.hpp>
 #include <websocketpp/common/system_error.hpp>
 
+#include <websocketpp/http/constants.hpp>
+
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace websocketpp {
@@ -55,7 +60,13 @@ enum value {
     general = 1,
 
     /// Extension disabled
-    disabled
+    disabled,
+
+    /// No free RSV bit was left for an extension that needs one
+    no_rsv_bit,
+
+    /// The remote endpoint accepted an extension that was not offered
+    unexpected_extension
 };
 
 class category : public lib::error_category {
@@ -72,6 +83,10 @@ public:
                 return "Generic extension error";
             case disabled:
                 return "Use of methods from disabled extension";
+            case no_rsv_bit:
+                return "No RSV bit available for extension";
+            case unexpected_extension:
+                return "Remote endpoint accepted an extension that was not offered";
             default:
                 return "Unknown permessage-compress error";
         }
@@ -88,6 +103,71 @@ inline lib::error_code make_error_code(error::value e) {
 }
 
 } // namespace error
+
+/// Base class for extensions run by an extension chain
+/**
+ * Extensions other than permessage-deflate are implemented by deriving from
+ * this class and adding an instance to each connection, usually through
+ * endpoint::add_extension. The processor negotiates them in the order the
+ * remote endpoint lists them and, if accepted, runs their transforms on the
+ * payload of every data message. See extensions::chain.
+ *
+ * Transforms work in place on the message buffer. On entry the bytes from
+ * `offset` to the end of `payload` are new input for the transform, on return
+ * they must have been replaced by its output. Payloads are delivered in
+ * pieces as they are sent or received, `fin` marks the last piece of a
+ * message. A transform that needs more input before it can produce output may
+ * hold bytes back in its own state.
+ *
+ * @since 0.9.0
+ */
+class extension {
+public:
+    typedef lib::shared_ptr<extension> ptr;
+    typedef std::pair<lib::error_code,std::string> err_str_pair;
+
+    virtual ~extension() {}
+
+    /// Get the extension token used in Sec-WebSocket-Extensions
+    virtual std::string get_name() const = 0;
+
+    /// Whether this extension marks its messages with an RSV bit
+    /**
+     * If true the chain will only enable the extension if one of RSV2 or RSV3
+     * is free. Messages sent while the extension is enabled carry the bit on
+     * their first frame and only received messages carrying it are decoded.
+     * If false the transform is applied to every data message.
+     */
+    virtual bool needs_rsv_bit() const {
+        return false;
+    }
+
+    /// Generate the offer sent by a client
+    virtual std::string generate_offer() const {
+        return get_name();
+    }
+
+    /// Negotiate extension parameters
+    /**
+     * Called on a server with the attributes of a client offer and on a
+     * client with the attributes of the server's response.
+     *
+     * @param attributes Attributes of the offer or response
+     * @return Status code and, for servers, the full response element for
+     * this extension
+     */
+    virtual err_str_pair negotiate(http::attribute_list const & attributes)
+        = 0;
+
+    /// Transform outgoing payload bytes
+    virtual lib::error_code encode(std::string & payload, size_t offset,
+        bool fin) = 0;
+
+    /// Transform incoming payload bytes
+    virtual lib::error_code decode(std::string & payload, size_t offset,
+        bool fin) = 0;
+};
+
 } // namespace extensions
 } // namespace websocketpp
 
@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2020, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef WEBSOCKETPP_EXTENSION_PERMESSAGE_DEFLATE_ADAPTIVE_POLICY_HPP
+#define WEBSOCKETPP_EXTENSION_PERMESSAGE_DEFLATE_ADAPTIVE_POLICY_HPP
+
+#include <websocketpp/common/stdint.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <string>
+
+namespace websocketpp {
+namespace extensions {
+namespace permessage_deflate {
+
+/// Decides per message whether and how hard to compress
+/**
+ * Compressing every outgoing message wastes CPU on payloads that are too
+ * small to benefit or that are already compressed. This policy is consulted
+ * before each message is compressed and is told the result afterwards so that
+ * it can adjust to the traffic on a single connection:
+ *
+ * - Payloads smaller than the minimum size are never compressed.
+ * - A sample of the payload is checked for byte entropy. Data that looks
+ *   random (already compressed or encrypted) is sent uncompressed.
+ * - When a compressed message saves less than one eighth of its size the
+ *   next messages skip compression, backing off exponentially while the
+ *   results stay poor.
+ * - The CPU time spent per input byte is averaged and the zlib level is
+ *   lowered while it exceeds the time budget and raised again, up to zlib's
+ *   default level, when there is plenty of headroom.
+ *
+ * One policy instance belongs to one connection and is not thread safe.
+ */
+class adaptive_policy {
+public:
+    /// Number of payload bytes examined by the entropy estimate
+    static size_t const sample_size = 1024;
+
+    /// Number of compressed messages between compression level adjustments
+    static size_t const adjust_interval = 16;
+
+    /// Longest run of messages to skip after poor compression
+    static size_t const max_backoff = 64;
+
+    /// Highest zlib level the policy will select
+    static int const max_level = 6;
+
+    /**
+     * @param min_size Payloads smaller than this are never compressed.
+     * @param time_budget Target compression time in nanoseconds per input
+     *        byte. Zero disables level adjustment.
+     */
+    adaptive_policy(size_t min_size, long time_budget)
+      : m_min_size(min_size)
+      , m_time_budget(time_budget)
+      , m_level(max_level)
+      , m_skip(0)
+      , m_backoff(1)
+      , m_cost(0)
+      , m_samples(0)
+    {}
+
+    /// Decide whether to compress a payload
+    /**
+     * @param [in] payload The uncompressed message payload
+     * @param [out] level The zlib level to compress at, if compressing
+     * @return Whether the payload should be compressed
+     */
+    bool decide(std::string const & payload, int & level) {
+        if (payload.size() < m_min_size) {
+            return false;
+        }
+
+        if (m_skip > 0) {
+            --m_skip;
+            return false;
+        }
+
+        if (looks_random(payload)) {
+            return false;
+        }
+
+        level = m_level;
+        return true;
+    }
+
+    /// Feed back the result of compressing a message
+    /**
+     * @param in_size The number of uncompressed bytes
+     * @param out_size The number of compressed bytes
+     * @param nanoseconds The time spent compressing
+     */
+    void record(size_t in_size, size_t out_size, uint64_t nanoseconds) {
+        if (in_size == 0) {
+            return;
+        }
+
+        // Back off when less than an eighth of the payload was saved
+        if (out_size > in_size - in_size / 8) {
+            m_skip = m_backoff;
+            m_backoff = m_backoff * 2 < max_backoff ? m_backoff * 2
+                : max_backoff;
+        } else {
+            m_backoff = 1;
+        }
+
+        if (m_time_budget <= 0) {
+            return;
+        }
+
+        // exponentially weighted average of the cost, in 1/16ns per byte
+        uint64_t cost = nanoseconds * 16 / in_size;
+        m_cost = m_samples == 0 ? cost : (m_cost * 7 + cost) / 8;
+
+        if (++m_samples % adjust_interval != 0) {
+            return;
+        }
+
+        uint64_t budget = static_cast<uint64_t>(m_time_budget) * 16;
+        if (m_cost > budget && m_level > 1) {
+            --m_level;
+        } else if (m_cost * 2 < budget && m_level < max_level) {
+            ++m_level;
+        }
+    }
+
+    /// Get the zlib level that will be used for the next message
+    int get_level() const {
+        return m_level;
+    }
+
+    /// Estimate whether a payload is already compressed or encrypted
+    /**
+     * Computes the order-0 byte entropy of up to sample_size bytes spread over
+     * the payload. Compressed and encrypted data come out close to 8 bits per
+     * byte while text and most structured binary formats are well below.
+     *
+     * @param payload The payload to examine
+     * @return Whether the sample has near maximal entropy
+     */
+    static bool looks_random(std::string const & payload) {
+        size_t n = payload.size() < sample_size ? payload.size()
+            : sample_size;
+        if (n < 256) {
+            // too small a sample to tell, let the ratio feedback decide
+            return false;
+        }
+
+        size_t counts[256] = {0};
+        size_t stride = payload.size() / n;
+        for (size_t i = 0; i < n; i++) {
+            counts[static_cast<unsigned char>(payload[i * stride])]++;
+        }
+
+        double entropy = 0.0;
+        for (size_t i = 0; i < 256; i++) {
+            if (counts[i] > 0) {
+                double p = static_cast<double>(counts[i]) / n;
+                entropy -= p * std::log(p);
+            }
+        }
+
+        // 7.5 bits per byte, in nats
+        return entropy > 7.5 * std::log(2.0);
+    }
+private:
+    size_t const    m_min_size;
+    long const      m_time_budget;
+    int             m_level;
+    size_t          m_skip;
+    size_t          m_backoff;
+    uint64_t        m_cost;
+    size_t          m_samples;
+};
+
+} // namespace permessage_deflate
+} // namespace extensions
+} // namespace websocketpp
+
+#endif // WEBSOCKETPP_EXTENSION_PERMESSAGE_DEFLATE_ADAPTIVE_POLICY_HPP
@@ -110,16 +110,36 @@ public:
         return make_error_code(error::disabled);
     }
 
+    /// Set the zlib compression level
+    /**
+     * @param level A zlib compression level
+     * @return Error or status code
+     */
+    lib::error_code set_compression_level(int) {
+        return make_error_code(error::disabled);
+    }
+
+    /// Compressed output is never shared
+    bool get_shared_compression_key(uint32_t &) const {
+        return false;
+    }
+
     /// Decompress bytes
     /**
      * @param buf Byte buffer to decompress
      * @param len Length of buf
      * @param out String to append decompressed bytes to
+     * @param max_size Length of `out` after which to stop
      * @return Error or status code
      */
-    lib::error_code decompress(uint8_t const *, size_t, std::string &) {
+    lib::error_code decompress(uint8_t const *, size_t, std::string &,
+        size_t = 0)
+    {
         return make_error_code(error::disabled);
     }
+
+    /// Signal that the last bytes of a message have been decompressed
+    void end_decompress() {}
 };
 
 } // namespace permessage_deflate
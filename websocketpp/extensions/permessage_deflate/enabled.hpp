@@ -37,10 +37,10 @@
 #include <websocketpp/error.hpp>
 
 #include <websocketpp/extensions/extension.hpp>
+#include <websocketpp/extensions/permessage_deflate/stream_pool.hpp>
+#include <websocketpp/extensions/permessage_deflate/zlib_backend.hpp>
 
-#include "zlib.h"
-
-#include <algorithm>
+#include <limits>
 #include <string>
 #include <vector>
 
@@ -82,8 +82,12 @@ namespace extensions {
  *
  * **decompress**\n
  * `lib::error_code decompress(uint8_t const * buf, size_t len, std::string &
- * out)`\n
- * Decompress `len` bytes from `buf` and append them to string `out`
+ * out, size_t max_size)`\n
+ * Decompress `len` bytes from `buf` and append them to string `out`, stopping
+ * once `out` grows past `max_size` bytes
+ *
+ * The DEFLATE implementation is supplied by a compression backend, see
+ * permessage_deflate::zlib_backend.
  */
 namespace permessage_deflate {
 
@@ -113,6 +117,9 @@ enum value {
 
     /// Uninitialized
     uninitialized,
+
+    /// Invalid zlib compression level
+    invalid_compression_level
 };
 
 /// Permessage-deflate error category
@@ -139,9 +146,11 @@ public:
             case invalid_max_window_bits:
                 return "Invalid value for max_window_bits";
             case zlib_error:
-                return "A zlib function returned an error";
+                return "The compression backend returned an error";
             case uninitialized:
                 return "Deflate extension must be initialized before use";
+            case invalid_compression_level:
+                return "Invalid zlib compression level";
             default:
                 return "Unknown permessage-compress error";
         }
@@ -214,9 +223,12 @@ enum value {
 };
 } // namespace mode
 
-template <typename config>
+template <typename config, typename backend = zlib_backend>
 class enabled {
 public:
+    typedef stream_pool<backend> stream_pool_type;
+    typedef typename stream_pool_type::pooled_inflater pooled_inflater;
+
     enabled()
       : m_enabled(false)
       , m_server_no_context_takeover(false)
@@ -226,44 +238,25 @@ public:
       , m_server_max_window_bits_mode(mode::accept)
       , m_client_max_window_bits_mode(mode::accept)
       , m_initialized(false)
-      , m_compress_buffer_size(8192)
-    {
-        m_dstate.zalloc = Z_NULL;
-        m_dstate.zfree = Z_NULL;
-        m_dstate.opaque = Z_NULL;
-
-        m_istate.zalloc = Z_NULL;
-        m_istate.zfree = Z_NULL;
-        m_istate.opaque = Z_NULL;
-        m_istate.avail_in = 0;
-        m_istate.next_in = Z_NULL;
-    }
+      , m_compress_level(backend::default_level)
+      , m_applied_level(backend::default_level)
+      , m_pool_deflate(false)
+      , m_pool_inflate(false)
+      , m_deflate_bits(15)
+      , m_inflate_bits(15)
+      , m_inflate_stream(NULL)
+    {}
 
     ~enabled() {
-        if (!m_initialized) {
-            return;
-        }
-
-        int ret = deflateEnd(&m_dstate);
-
-        if (ret != Z_OK) {
-            //std::cout << "error cleaning up zlib compression state"
-            //          << std::endl;
-        }
-
-        ret = inflateEnd(&m_istate);
-
-        if (ret != Z_OK) {
-            //std::cout << "error cleaning up zlib decompression state"
-            //          << std::endl;
-        }
+        // a message may have been abandoned partway through
+        end_decompress();
     }
 
-    /// Initialize zlib state
+    /// Initialize compression state
     /**
      * Note: this should be called *after* the negotiation methods. It will use
-     * information from the negotiation to determine how to initialize the zlib
-     * data structures.
+     * information from the negotiation to determine how to initialize the
+     * compression backend.
      *
      * @todo memory level, strategy, etc are hardcoded
      *
@@ -282,37 +275,30 @@ public:
             inflate_bits = m_server_max_window_bits;
         }
 
-        int ret = deflateInit2(
-            &m_dstate,
-            Z_DEFAULT_COMPRESSION,
-            Z_DEFLATED,
-            -1*deflate_bits,
-            4, // memory level 1-9
-            Z_DEFAULT_STRATEGY
-        );
-
-        if (ret != Z_OK) {
-            return make_error_code(error::zlib_error);
+        // Directions where the context is reset after every message don't need
+        // a zlib stream of their own between messages. They borrow one from
+        // the stream pool instead.
+        m_pool_deflate = (m_server_no_context_takeover && is_server) ||
+                         (m_client_no_context_takeover && !is_server);
+        m_pool_inflate = (m_client_no_context_takeover && is_server) ||
+                         (m_server_no_context_takeover && !is_server);
+        m_deflate_bits = deflate_bits;
+        m_inflate_bits = inflate_bits;
+
+        if (!m_pool_deflate) {
+            if (!m_deflater.init(deflate_bits, backend::default_level,
+                backend::default_mem_level))
+            {
+                return make_error_code(error::zlib_error);
+            }
         }
 
-        ret = inflateInit2(
-            &m_istate,
-            -1*inflate_bits
-        );
-
-        if (ret != Z_OK) {
-            return make_error_code(error::zlib_error);
+        if (!m_pool_inflate) {
+            if (!m_inflater.init(inflate_bits)) {
+                return make_error_code(error::zlib_error);
+            }
         }
 
-        m_compress_buffer.reset(new unsigned char[m_compress_buffer_size]);
-        m_decompress_buffer.reset(new unsigned char[m_compress_buffer_size]);
-        if ((m_server_no_context_takeover && is_server) ||
-            (m_client_no_context_takeover && !is_server))
-        {
-            m_flush = Z_FULL_FLUSH;
-        } else {
-            m_flush = Z_SYNC_FLUSH;
-        }
         m_initialized = true;
         return lib::error_code();
     }
@@ -538,8 +524,8 @@ public:
 
     /// Compress bytes
     /**
-     * @todo: avail_in/out is 32 bit, need to fix for cases of >32 bit frames
-     * on 64 bit machines.
+     * If our compression context is reset after every message the deflater is
+     * borrowed from the stream_pool for the duration of this call.
      *
      * @param [in] in String to compress
      * @param [out] out String to append compressed bytes to
@@ -550,69 +536,150 @@ public:
             return make_error_code(error::uninitialized);
         }
 
-        size_t output;
-
         if (in.empty()) {
             uint8_t buf[6] = {0x02, 0x00, 0x00, 0x00, 0xff, 0xff};
             out.append((char *)(buf),6);
             return lib::error_code();
         }
 
-        m_dstate.avail_in = in.size();
-        m_dstate.next_in = (unsigned char *)(const_cast<char *>(in.data()));
+        uint8_t const * buf = reinterpret_cast<uint8_t const *>(in.data());
 
-        do {
-            // Output to local buffer
-            m_dstate.avail_out = m_compress_buffer_size;
-            m_dstate.next_out = m_compress_buffer.get();
+        if (m_pool_deflate) {
+            stream_pool_type & pool = stream_pool_type::get();
 
-            deflate(&m_dstate, m_flush);
+            // a pooled stream starts out reset so it has no context to flush
+            typename stream_pool_type::pooled_deflater * s =
+                pool.acquire_deflate(m_deflate_bits, m_compress_level);
+            if (!s) {
+                return make_error_code(error::zlib_error);
+            }
 
-            output = m_compress_buffer_size - m_dstate.avail_out;
+            bool ok = s->stream.compress(buf, in.size(), out, true);
+            pool.release_deflate(s);
+            return ok ? lib::error_code() : make_error_code(error::zlib_error);
+        }
 
-            out.append((char *)(m_compress_buffer.get()),output);
-        } while (m_dstate.avail_out == 0);
+        if (m_compress_level != m_applied_level) {
+            // Switch levels between messages, while there is no pending input.
+            // Any output produced by the switch belongs to this message. If
+            // the switch fails the stream is still usable at the old level,
+            // so compress this message with it and try again next time.
+            if (m_deflater.set_level(m_compress_level, out)) {
+                m_applied_level = m_compress_level;
+            }
+        }
+
+        if (!m_deflater.compress(buf, in.size(), out, true)) {
+            return make_error_code(error::zlib_error);
+        }
+        return lib::error_code();
+    }
 
+    /// Set the zlib compression level
+    /**
+     * Sets the level used to compress subsequent messages. The change takes
+     * effect at the start of the next call to compress.
+     *
+     * @since 0.9.0
+     *
+     * @param level A compression level from 0 to 9 or -1 for the backend
+     * default.
+     * @return Error or status code
+     */
+    lib::error_code set_compression_level(int level) {
+        if (level < backend::min_level || level > backend::max_level) {
+            return make_error_code(error::invalid_compression_level);
+        }
+        m_compress_level = level;
         return lib::error_code();
     }
 
+    /// Get the zlib compression level
+    /**
+     * @since 0.9.0
+     *
+     * @return The level that the next message will be compressed at
+     */
+    int get_compression_level() const {
+        return m_compress_level;
+    }
+
+    /// Get a key identifying output that may be shared between connections
+    /**
+     * If this endpoint resets its compression context after every message
+     * the output of compress depends only on the payload, window size and
+     * compression level. Any two connections that return the same key will
+     * produce identical bytes for the same payload.
+     *
+     * @since 0.9.0
+     *
+     * @param key Set to the sharing key if there is one
+     * @return Whether compressed output may be shared
+     */
+    bool get_shared_compression_key(uint32_t & key) const {
+        if (!m_pool_deflate) {
+            return false;
+        }
+        key = (uint32_t(m_deflate_bits) << 8) | uint32_t(m_compress_level & 0xff);
+        return true;
+    }
+
     /// Decompress bytes
     /**
+     * If the remote endpoint resets its compression context after every
+     * message the inflater is borrowed from the stream_pool on the first
+     * call for a message and returned by end_decompress.
+     *
+     * Decompression stops as soon as `out` is longer than `max_size`. This is
+     * not reported as an error, callers enforcing a size limit must check the
+     * length of `out` afterwards. The rest of the input is not consumed and
+     * the decompression context should not be used again.
+     *
      * @param buf Byte buffer to decompress
      * @param len Length of buf
      * @param out String to append decompressed bytes to
+     * @param max_size Length of `out` after which to stop (since 0.9.0)
      * @return Error or status code
      */
     lib::error_code decompress(uint8_t const * buf, size_t len, std::string &
-        out)
+        out, size_t max_size = (std::numeric_limits<size_t>::max)())
     {
         if (!m_initialized) {
             return make_error_code(error::uninitialized);
         }
 
-        int ret;
-
-        m_istate.avail_in = len;
-        m_istate.next_in = const_cast<unsigned char *>(buf);
+        typename backend::inflater * inflater = &m_inflater;
 
-        do {
-            m_istate.avail_out = m_compress_buffer_size;
-            m_istate.next_out = m_decompress_buffer.get();
-
-            ret = inflate(&m_istate, Z_SYNC_FLUSH);
-
-            if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR) {
-                return make_error_code(error::zlib_error);
+        if (m_pool_inflate) {
+            if (!m_inflate_stream) {
+                m_inflate_stream = stream_pool_type::get().acquire_inflate(
+                    m_inflate_bits);
+                if (!m_inflate_stream) {
+                    return make_error_code(error::zlib_error);
+                }
             }
+            inflater = &m_inflate_stream->stream;
+        }
 
-            out.append(
-                reinterpret_cast<char *>(m_decompress_buffer.get()),
-                m_compress_buffer_size - m_istate.avail_out
-            );
-        } while (m_istate.avail_out == 0);
-
+        if (!inflater->decompress(buf, len, out, max_size)) {
+            return make_error_code(error::zlib_error);
+        }
         return lib::error_code();
     }
+
+    /// Signal that the last bytes of a message have been decompressed
+    /**
+     * Returns a borrowed inflate stream to the stream_pool. Does nothing when
+     * the decompression context is kept between messages.
+     *
+     * @since 0.9.0
+     */
+    void end_decompress() {
+        if (m_inflate_stream) {
+            stream_pool_type::get().release_inflate(m_inflate_stream);
+            m_inflate_stream = NULL;
+        }
+    }
 private:
     /// Generate negotiation response
     /**
@@ -802,12 +869,15 @@ private:
     mode::value m_client_max_window_bits_mode;
 
     bool m_initialized;
-    int m_flush;
-    size_t m_compress_buffer_size;
-    lib::unique_ptr_uchar_array m_compress_buffer;
-    lib::unique_ptr_uchar_array m_decompress_buffer;
-    z_stream m_dstate;
-    z_stream m_istate;
+    int m_compress_level;
+    int m_applied_level;
+    bool m_pool_deflate;
+    bool m_pool_inflate;
+    uint8_t m_deflate_bits;
+    uint8_t m_inflate_bits;
+    pooled_inflater * m_inflate_stream;
+    typename backend::deflater m_deflater;
+    typename backend::inflater m_inflater;
 };
 
 } // namespace permessage_deflate
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2020, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef WEBSOCKETPP_EXTENSION_PERMESSAGE_DEFLATE_STREAM_POOL_HPP
+#define WEBSOCKETPP_EXTENSION_PERMESSAGE_DEFLATE_STREAM_POOL_HPP
+
+#include <websocketpp/common/stdint.hpp>
+#include <websocketpp/common/thread.hpp>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace websocketpp {
+namespace extensions {
+namespace permessage_deflate {
+
+/// Process wide pool of idle compression streams
+/**
+ * A deflate stream with a full size window needs a few hundred KB of memory.
+ * Connections that reset their compression context after every message have
+ * no reason to keep that memory between messages, so they borrow a stream
+ * from this pool for the duration of one message and return it afterwards.
+ * Memory use then scales with the number of messages being processed at once
+ * rather than with the number of open connections.
+ *
+ * Idle streams are kept separately per window size and are reset as they are
+ * handed out. At most `max_idle` streams of each kind and window size are
+ * kept; extra streams are freed when they are returned.
+ *
+ * There is one pool per compression backend. It is shared by all threads and
+ * its lock is held only while a pointer is taken from or put back on an idle
+ * list.
+ */
+template <typename backend>
+class stream_pool {
+public:
+    /// A deflater borrowed from the pool
+    struct pooled_deflater {
+        typename backend::deflater stream;
+        /// LZ77 window size the stream was initialized with
+        uint8_t window_bits;
+        /// Compression level the stream is set to
+        int level;
+    };
+
+    /// An inflater borrowed from the pool
+    struct pooled_inflater {
+        typename backend::inflater stream;
+        /// LZ77 window size the stream was initialized with
+        uint8_t window_bits;
+    };
+
+    /// Default number of idle streams kept for each kind and window size
+    static size_t const default_max_idle = 64;
+
+    stream_pool() : m_max_idle(default_max_idle) {}
+
+    ~stream_pool() {
+        for (size_t i = 0; i < window_sizes; i++) {
+            for (size_t j = 0; j < m_deflate[i].size(); j++) {
+                delete m_deflate[i][j];
+            }
+            for (size_t j = 0; j < m_inflate[i].size(); j++) {
+                delete m_inflate[i][j];
+            }
+        }
+    }
+
+    /// Get the process wide pool
+    /**
+     * The pool is never destroyed, so connections that are torn down during
+     * static destruction, after the pool would otherwise be gone, can still
+     * return their streams. The idle streams are released by the operating
+     * system at exit.
+     *
+     * The pool is created during static initialization, before any threads
+     * are started, because local statics are not initialized thread safely
+     * by C++03 compilers and Visual Studio before 2015.
+     */
+    static stream_pool & get() {
+        static stream_pool * instance = new stream_pool();
+
+        // referring to s_instance makes sure it is defined, which calls get
+        // during static initialization
+        (void)&s_instance;
+
+        return *instance;
+    }
+
+    /// Set the number of idle streams kept for each kind and window size
+    void set_max_idle(size_t value) {
+        lib::lock_guard<lib::mutex> guard(m_lock);
+        m_max_idle = value;
+    }
+
+    /// Borrow a deflate stream
+    /**
+     * @param window_bits LZ77 window size, 8 to 15
+     * @param level Compression level
+     * @return A freshly reset stream or NULL if one could not be allocated
+     */
+    pooled_deflater * acquire_deflate(uint8_t window_bits, int level) {
+        pooled_deflater * s = take(m_deflate, window_bits);
+
+        if (s) {
+            if (!s->stream.reset()) {
+                delete s;
+                return NULL;
+            }
+        } else {
+            s = new pooled_deflater();
+            s->window_bits = window_bits;
+            s->level = level;
+
+            if (!s->stream.init(window_bits, level,
+                backend::default_mem_level))
+            {
+                delete s;
+                return NULL;
+            }
+        }
+
+        if (s->level != level) {
+            // Nothing is pending right after a reset, so this produces no
+            // output. If the switch fails the stream keeps its old level and
+            // the next acquire tries again.
+            std::string unused;
+            if (s->stream.set_level(level, unused)) {
+                s->level = level;
+            }
+        }
+
+        return s;
+    }
+
+    /// Return a deflate stream borrowed with acquire_deflate
+    void release_deflate(pooled_deflater * s) {
+        if (!give(m_deflate, s)) {
+            delete s;
+        }
+    }
+
+    /// Borrow an inflate stream
+    /**
+     * @param window_bits LZ77 window size, 8 to 15
+     * @return A freshly reset stream or NULL if one could not be allocated
+     */
+    pooled_inflater * acquire_inflate(uint8_t window_bits) {
+        pooled_inflater * s = take(m_inflate, window_bits);
+
+        if (s) {
+            if (!s->stream.reset()) {
+                delete s;
+                return NULL;
+            }
+        } else {
+            s = new pooled_inflater();
+            s->window_bits = window_bits;
+
+            if (!s->stream.init(window_bits)) {
+                delete s;
+                return NULL;
+            }
+        }
+
+        return s;
+    }
+
+    /// Return an inflate stream borrowed with acquire_inflate
+    void release_inflate(pooled_inflater * s) {
+        if (!give(m_inflate, s)) {
+            delete s;
+        }
+    }
+
+    /// Get the number of idle streams currently held
+    size_t idle() {
+        lib::lock_guard<lib::mutex> guard(m_lock);
+        size_t count = 0;
+        for (size_t i = 0; i < window_sizes; i++) {
+            count += m_deflate[i].size() + m_inflate[i].size();
+        }
+        return count;
+    }
+private:
+    static size_t const window_sizes = 8;
+
+    /// The process wide pool, set during static initialization
+    static stream_pool & s_instance;
+
+    template <typename stream>
+    stream * take(std::vector<stream *> * lists, uint8_t window_bits) {
+        lib::lock_guard<lib::mutex> guard(m_lock);
+        std::vector<stream *> & list = lists[window_bits - 8];
+        if (list.empty()) {
+            return NULL;
+        }
+        stream * s = list.back();
+        list.pop_back();
+        return s;
+    }
+
+    template <typename stream>
+    bool give(std::vector<stream *> * lists, stream * s) {
+        lib::lock_guard<lib::mutex> guard(m_lock);
+        std::vector<stream *> & list = lists[s->window_bits - 8];
+        if (list.size() >= m_max_idle) {
+            return false;
+        }
+        list.push_back(s);
+        return true;
+    }
+
+    lib::mutex                      m_lock;
+    size_t                          m_max_idle;
+    std::vector<pooled_deflater *>  m_deflate[window_sizes];
+    std::vector<pooled_inflater *>  m_inflate[window_sizes];
+};
+
+template <typename backend>
+stream_pool<backend> & stream_pool<backend>::s_instance =
+    stream_pool<backend>::get();
+
+} // namespace permessage_deflate
+} // namespace extensions
+} // namespace websocketpp
+
+#endif // WEBSOCKETPP_EXTENSION_PERMESSAGE_DEFLATE_STREAM_POOL_HPP
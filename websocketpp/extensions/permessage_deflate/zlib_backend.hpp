@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2020, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef WEBSOCKETPP_EXTENSION_PERMESSAGE_DEFLATE_ZLIB_BACKEND_HPP
+#define WEBSOCKETPP_EXTENSION_PERMESSAGE_DEFLATE_ZLIB_BACKEND_HPP
+
+#include <websocketpp/common/stdint.hpp>
+
+#include "zlib.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <string>
+
+namespace websocketpp {
+namespace extensions {
+namespace permessage_deflate {
+
+/// Compression backend built on zlib
+/**
+ * The permessage-deflate extension does not call a DEFLATE library directly.
+ * It uses a backend class, passed as the second template parameter of
+ * `permessage_deflate::enabled`, so that other DEFLATE implementations can be
+ * used as long as they produce and accept raw DEFLATE streams compatible with
+ * zlib. This class is the reference backend and the default.
+ *
+ * ### Compression backend concept
+ *
+ * **Constants**\n
+ * `static int const default_level`\n
+ * `static int const min_level`\n
+ * `static int const max_level`\n
+ * Compression levels follow zlib numbering. `default_mem_level` is the
+ * memory level the extension initializes deflaters with.
+ *
+ * **deflater**\n
+ * A default constructible, non-copyable raw DEFLATE compressor that frees its
+ * resources when destroyed.
+ * - `bool init(uint8_t window_bits, int level, int mem_level)`
+ * - `bool reset()` discards the LZ77 window
+ * - `bool set_level(int level, std::string & out)` changes the level between
+ *   messages, appending any output this produces to `out`. If the level can
+ *   not be changed right now it returns false and the stream keeps working
+ *   at its previous level, the extension tries again before a later message.
+ * - `bool compress(uint8_t const * buf, size_t len, std::string & out,
+ *   bool flush)` compresses `len` bytes and appends the output to `out`. If
+ *   `flush` is true all pending output is flushed and ends with the four byte
+ *   empty stored block `0x00 0x00 0xff 0xff`.
+ *
+ * **inflater**\n
+ * A default constructible, non-copyable raw DEFLATE decompressor that frees
+ * its resources when destroyed.
+ * - `bool init(uint8_t window_bits)`
+ * - `bool reset()` discards the LZ77 window
+ * - `bool decompress(uint8_t const * buf, size_t len, std::string & out,
+ *   size_t limit)` decompresses `len` bytes and appends all output available
+ *   so far to `out`. It stops early, without an error, once `out` grows
+ *   past `limit` bytes.
+ *
+ * Every function returns false if the underlying library reported an error.
+ */
+class zlib_backend {
+public:
+    static int const default_level = Z_DEFAULT_COMPRESSION;
+    static int const min_level = Z_DEFAULT_COMPRESSION;
+    static int const max_level = Z_BEST_COMPRESSION;
+    static int const default_mem_level = 4;
+
+    /// Raw DEFLATE compressor
+    /**
+     * Compressed bytes are written directly into space reserved at the end of
+     * the output string, which is grown geometrically if the initial estimate
+     * turns out to be too small. Input and output larger than zlib's 32 bit
+     * length fields are processed in chunks.
+     */
+    class deflater {
+    public:
+        deflater() : m_initialized(false) {
+            m_strm.zalloc = Z_NULL;
+            m_strm.zfree = Z_NULL;
+            m_strm.opaque = Z_NULL;
+        }
+
+        ~deflater() {
+            if (m_initialized) {
+                deflateEnd(&m_strm);
+            }
+        }
+
+        bool init(uint8_t window_bits, int level, int mem_level) {
+            if (m_initialized) {
+                deflateEnd(&m_strm);
+            }
+            m_initialized = (deflateInit2(&m_strm, level, Z_DEFLATED,
+                -1*window_bits, mem_level, Z_DEFAULT_STRATEGY) == Z_OK);
+            return m_initialized;
+        }
+
+        bool reset() {
+            return deflateReset(&m_strm) == Z_OK;
+        }
+
+        bool set_level(int level, std::string & out) {
+            // Between messages nothing is pending, so this normally produces
+            // no output. If it does and the space runs out try again with
+            // more.
+            size_t capacity = 64;
+            int ret;
+
+            do {
+                size_t const start = out.size();
+                out.resize(start + capacity);
+
+                m_strm.avail_in = 0;
+                m_strm.next_out = reinterpret_cast<unsigned char *>(
+                    &out[start]);
+                m_strm.avail_out = static_cast<uInt>(capacity);
+
+                ret = deflateParams(&m_strm, level, Z_DEFAULT_STRATEGY);
+
+                out.resize(start + capacity - m_strm.avail_out);
+                capacity *= 2;
+            } while (ret == Z_BUF_ERROR && m_strm.avail_out == 0);
+
+            return ret == Z_OK;
+        }
+
+        bool compress(uint8_t const * buf, size_t len, std::string & out,
+            bool flush)
+        {
+            unsigned char * next_in = const_cast<unsigned char *>(buf);
+            size_t in_left = len;
+
+            size_t const start = out.size();
+            size_t written = 0;
+            size_t capacity = len / compress_ratio_estimate + 64;
+
+            m_strm.avail_in = 0;
+
+            while (true) {
+                if (m_strm.avail_in == 0 && in_left > 0) {
+                    m_strm.next_in = next_in;
+                    m_strm.avail_in = chunk(in_left);
+                    next_in += m_strm.avail_in;
+                    in_left -= m_strm.avail_in;
+                }
+
+                if (written == capacity) {
+                    capacity *= 2;
+                }
+                if (out.size() < start + capacity) {
+                    out.resize(start + capacity);
+                }
+
+                uInt avail = chunk(capacity - written);
+                m_strm.next_out = reinterpret_cast<unsigned char *>(
+                    &out[start + written]);
+                m_strm.avail_out = avail;
+
+                // Only flush once the last chunk of input has been handed over
+                int ret = deflate(&m_strm, (in_left > 0 || !flush) ?
+                    Z_NO_FLUSH : Z_SYNC_FLUSH);
+
+                written += avail - m_strm.avail_out;
+
+                if (ret == Z_STREAM_ERROR) {
+                    out.resize(start + written);
+                    return false;
+                }
+
+                if (in_left == 0 && m_strm.avail_in == 0 &&
+                    m_strm.avail_out != 0)
+                {
+                    break;
+                }
+            }
+
+            out.resize(start + written);
+
+            return true;
+        }
+    private:
+        deflater(deflater const &);
+        deflater & operator=(deflater const &);
+
+        z_stream m_strm;
+        bool m_initialized;
+    };
+
+    /// Raw DEFLATE decompressor
+    /**
+     * Output space is added in steps of at most `max_output_step` bytes and
+     * never more than one byte past the limit, so a small input that expands
+     * to a huge output is caught before the memory is committed.
+     */
+    class inflater {
+    public:
+        inflater() : m_initialized(false) {
+            m_strm.zalloc = Z_NULL;
+            m_strm.zfree = Z_NULL;
+            m_strm.opaque = Z_NULL;
+            m_strm.avail_in = 0;
+            m_strm.next_in = Z_NULL;
+        }
+
+        ~inflater() {
+            if (m_initialized) {
+                inflateEnd(&m_strm);
+            }
+        }
+
+        bool init(uint8_t window_bits) {
+            if (m_initialized) {
+                inflateEnd(&m_strm);
+            }
+            m_initialized = (inflateInit2(&m_strm, -1*window_bits) == Z_OK);
+            return m_initialized;
+        }
+
+        bool reset() {
+            return inflateReset(&m_strm) == Z_OK;
+        }
+
+        bool decompress(uint8_t const * buf, size_t len, std::string & out,
+            size_t limit)
+        {
+            unsigned char * next_in = const_cast<unsigned char *>(buf);
+            size_t in_left = len;
+
+            size_t const start = out.size();
+            if (start > limit) {
+                return true;
+            }
+
+            // Leave room for one byte past the limit so that the caller can
+            // tell that it was crossed
+            size_t const room = limit - start +
+                (limit < (std::numeric_limits<size_t>::max)() ? 1 : 0);
+
+            size_t written = 0;
+            size_t capacity = len * compress_ratio_estimate + 64;
+            if (capacity > max_output_step) {
+                capacity = max_output_step;
+            }
+            if (capacity > room) {
+                capacity = room;
+            }
+
+            m_strm.avail_in = 0;
+
+            while (true) {
+                if (m_strm.avail_in == 0 && in_left > 0) {
+                    m_strm.next_in = next_in;
+                    m_strm.avail_in = chunk(in_left);
+                    next_in += m_strm.avail_in;
+                    in_left -= m_strm.avail_in;
+                }
+
+                if (written == capacity) {
+                    if (capacity == room) {
+                        break;
+                    }
+                    size_t step = capacity < max_output_step ? capacity :
+                        max_output_step;
+                    capacity += (step < room - capacity ? step :
+                        room - capacity);
+                }
+                if (out.size() < start + capacity) {
+                    out.resize(start + capacity);
+                }
+
+                uInt avail = chunk(capacity - written);
+                m_strm.next_out = reinterpret_cast<unsigned char *>(
+                    &out[start + written]);
+                m_strm.avail_out = avail;
+
+                int ret = inflate(&m_strm, Z_SYNC_FLUSH);
+
+                written += avail - m_strm.avail_out;
+
+                if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR ||
+                    ret == Z_MEM_ERROR)
+                {
+                    out.resize(start + written);
+                    return false;
+                }
+
+                // Z_BUF_ERROR means no progress was possible and Z_STREAM_END
+                // means no more input will be accepted; either way we are done.
+                if (ret == Z_BUF_ERROR || ret == Z_STREAM_END ||
+                    (in_left == 0 && m_strm.avail_in == 0 &&
+                     m_strm.avail_out != 0))
+                {
+                    break;
+                }
+            }
+
+            out.resize(start + written);
+
+            return true;
+        }
+    private:
+        inflater(inflater const &);
+        inflater & operator=(inflater const &);
+
+        z_stream m_strm;
+        bool m_initialized;
+    };
+private:
+    /// Assumed compression ratio used to size output buffers up front
+    static size_t const compress_ratio_estimate = 4;
+
+    /// Largest amount of output space the inflater adds at once
+    static size_t const max_output_step = 1048576;
+
+    /// Clamp a length to what fits in zlib's 32 bit avail_in/avail_out
+    static uInt chunk(size_t len) {
+        return static_cast<uInt>((std::min)(len,
+            static_cast<size_t>((std::numeric_limits<uInt>::max)())));
+    }
+};
+
+} // namespace permessage_deflate
+} // namespace extensions
+} // namespace websocketpp
+
+#endif // WEBSOCKETPP_EXTENSION_PERMESSAGE_DEFLATE_ZLIB_BACKEND_HPP
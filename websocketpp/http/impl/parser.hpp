@@ -29,8 +29,10 @@
 #define HTTP_PARSER_IMPL_HPP
 
 #include <algorithm>
+#include <cctype>
 #include <cstdlib>
 #include <istream>
+#include <limits>
 #include <sstream>
 #include <string>
 
@@ -43,6 +45,11 @@ inline void parser::set_version(std::string const & version) {
 }
 
 inline std::string const & parser::get_header(std::string const & key) const {
+    if (m_header_index_active) {
+        indexed_header const * ih = find_indexed_header(key.data(),key.size());
+        return ih ? get_indexed_value(*ih) : empty_header;
+    }
+
     header_list::const_iterator h = m_headers.find(key);
 
     if (h == m_headers.end()) {
@@ -55,22 +62,25 @@ inline std::string const & parser::get_header(std::string const & key) const {
 inline bool parser::get_header_as_plist(std::string const & key,
     parameter_list & out) const
 {
-    header_list::const_iterator it = m_headers.find(key);
+    std::string const & value = this->get_header(key);
 
-    if (it == m_headers.end() || it->second.size() == 0) {
+    if (value.size() == 0) {
         return false;
     }
 
-    return this->parse_parameter_list(it->second,out);
+    return this->parse_parameter_list(value,out);
 }
 
 inline void parser::append_header(std::string const & key, std::string const &
     val)
 {
-    if (std::find_if(key.begin(),key.end(),is_not_token_char) != key.end()) {
+    char const * key_end = key.data() + key.size();
+    if (scanner::find_non_token(key.data(),key_end) != key_end) {
         throw exception("Invalid header name",status_code::bad_request);
     }
 
+    release_header_index();
+
     if (this->get_header(key).empty()) {
         m_headers[key] = val;
     } else {
@@ -81,10 +91,12 @@ inline void parser::append_header(std::string const & key, std::string const &
 inline void parser::replace_header(std::string const & key, std::string const &
     val)
 {
+    release_header_index();
     m_headers[key] = val;
 }
 
 inline void parser::remove_header(std::string const & key) {
+    release_header_index();
     m_headers.erase(key);
 }
 
@@ -117,7 +129,38 @@ inline bool parser::parse_parameter_list(std::string const & in,
 }
 
 inline bool parser::prepare_body() {
-    if (!get_header("Content-Length").empty()) {
+    std::string const & te_header = get_header("Transfer-Encoding");
+
+    if (!te_header.empty()) {
+        // An intermediary that frames the body by Content-Length, or that
+        // doesn't know chunked coding (HTTP/1.0), sees a different end of the
+        // message than we do. That is how requests are smuggled, so refuse
+        // ambiguous framing.
+        if (!get_header("Content-Length").empty()) {
+            throw exception("Both Transfer-Encoding and Content-Length",
+                status_code::bad_request);
+        }
+        if (m_version == "HTTP/1.0") {
+            throw exception("Transfer-Encoding in an HTTP/1.0 message",
+                status_code::bad_request);
+        }
+
+        // Only a body whose final coding is chunked has a known end
+        std::string codings = strip_lws(te_header);
+        std::string::size_type pos = codings.find_last_of(", \t");
+        if (utility::to_lower(codings.substr(pos == std::string::npos ?
+            0 : pos+1)) != "chunked")
+        {
+            throw exception("Unsupported transfer coding",
+                status_code::bad_request);
+        }
+
+        m_body_bytes_needed = 0;
+        m_chunk_state = chunk_state::size;
+        m_chunk_line.clear();
+        m_body_encoding = body_encoding::chunked;
+        return true;
+    } else if (!get_header("Content-Length").empty()) {
         std::string const & cl_header = get_header("Content-Length");
         char * end;
         
@@ -126,17 +169,13 @@ inline bool parser::prepare_body() {
         // > 4GiB HTTP payloads?
         m_body_bytes_needed = std::strtoul(cl_header.c_str(),&end,10);
         
-        if (m_body_bytes_needed > m_body_bytes_max) {
+        if (!m_stream_body && m_body_bytes_needed > m_body_bytes_max) {
             throw exception("HTTP message body too large",
                 status_code::request_entity_too_large);
         }
         
         m_body_encoding = body_encoding::plain;
         return true;
-    } else if (get_header("Transfer-Encoding") == "chunked") {
-        // TODO
-        //m_body_encoding = body_encoding::chunked;
-        return false;
     } else {
         return false;
     }
@@ -149,24 +188,134 @@ inline size_t parser::process_body(char const * buf, size_t len) {
         m_body_bytes_needed -= processed;
         return processed;
     } else if (m_body_encoding == body_encoding::chunked) {
-        // TODO: 
-        throw exception("Unexpected body encoding",
-            status_code::internal_server_error);
+        return process_chunked_body(buf,len);
     } else {
         throw exception("Unexpected body encoding",
             status_code::internal_server_error);
     }
 }
 
+inline size_t parser::process_chunked_body(char const * buf, size_t len) {
+    size_t processed = 0;
+
+    while (processed < len && m_chunk_state != chunk_state::done) {
+        if (m_chunk_state == chunk_state::data) {
+            size_t bytes = (std::min)(m_body_bytes_needed,len-processed);
+            m_body.append(buf+processed,bytes);
+            m_body_bytes_needed -= bytes;
+            processed += bytes;
+
+            if (m_body_bytes_needed == 0) {
+                m_chunk_state = chunk_state::data_end;
+            }
+            continue;
+        }
+
+        // Every other state reads a line. A line may be split between reads
+        // so it is collected in m_chunk_line until the LF arrives.
+        char const * begin = buf + processed;
+        char const * lf = scanner::find_char(begin,buf+len,'\n');
+
+        m_chunk_line.append(begin,lf);
+        processed += static_cast<size_t>(lf - begin);
+
+        if (m_chunk_line.size() > max_header_size) {
+            throw exception("Chunk line too long",status_code::bad_request);
+        }
+
+        if (lf == buf+len) {
+            break;
+        }
+
+        // skip the LF
+        ++processed;
+
+        if (m_chunk_line.empty() ||
+            m_chunk_line[m_chunk_line.size()-1] != '\r')
+        {
+            throw exception("Invalid chunk delimiter",status_code::bad_request);
+        }
+        m_chunk_line.resize(m_chunk_line.size()-1);
+
+        process_chunk_line();
+        m_chunk_line.clear();
+    }
+
+    return processed;
+}
+
+inline void parser::process_chunk_line() {
+    if (m_chunk_state == chunk_state::data_end) {
+        if (!m_chunk_line.empty()) {
+            throw exception("Invalid chunk delimiter",status_code::bad_request);
+        }
+        m_chunk_state = chunk_state::size;
+    } else if (m_chunk_state == chunk_state::trailer) {
+        if (m_chunk_line.empty()) {
+            m_chunk_state = chunk_state::done;
+            return;
+        }
+
+        // Trailer fields are discarded but still count against the header
+        // size limit.
+        m_header_bytes += m_chunk_line.size() + sizeof(header_delimiter) - 1;
+        if (m_header_bytes > max_header_size) {
+            throw exception("Maximum header size exceeded.",
+                status_code::request_header_fields_too_large);
+        }
+    } else {
+        // chunk-size [ chunk-ext ]
+        size_t size = 0;
+        std::string::const_iterator it = m_chunk_line.begin();
+
+        for (; it != m_chunk_line.end(); ++it) {
+            int digit;
+            if (*it >= '0' && *it <= '9') {
+                digit = *it - '0';
+            } else if (*it >= 'a' && *it <= 'f') {
+                digit = *it - 'a' + 10;
+            } else if (*it >= 'A' && *it <= 'F') {
+                digit = *it - 'A' + 10;
+            } else {
+                break;
+            }
+
+            if (size > ((std::numeric_limits<size_t>::max)() >> 4)) {
+                throw exception("HTTP message body too large",
+                    status_code::request_entity_too_large);
+            }
+            size = (size << 4) | static_cast<size_t>(digit);
+        }
+
+        if (it == m_chunk_line.begin() || (it != m_chunk_line.end() &&
+            *it != ';' && *it != ' ' && *it != '\t'))
+        {
+            throw exception("Invalid chunk size",status_code::bad_request);
+        }
+
+        if (size == 0) {
+            m_chunk_state = chunk_state::trailer;
+            return;
+        }
+
+        if (!m_stream_body && (m_body.size() > m_body_bytes_max ||
+            size > m_body_bytes_max - m_body.size()))
+        {
+            throw exception("HTTP message body too large",
+                status_code::request_entity_too_large);
+        }
+
+        m_body_bytes_needed = size;
+        m_chunk_state = chunk_state::data;
+    }
+}
+
 inline void parser::process_header(std::string::iterator begin,
     std::string::iterator end)
 {
-    std::string::iterator cursor = std::search(
-        begin,
-        end,
-        header_separator,
-        header_separator + sizeof(header_separator) - 1
-    );
+    char const * data = &*begin;
+    std::string::iterator cursor = begin + (scanner::find_char(data,
+        data + (end - begin), header_separator[0]) - data);
 
     if (cursor == end) {
         throw exception("Invalid header line",status_code::bad_request);
@@ -177,12 +326,15 @@ inline void parser::process_header(std::string::iterator begin,
 }
 
 inline header_list const & parser::get_headers() const {
+    fill_header_list();
     return m_headers;
 }
 
 inline std::string parser::raw_headers() const {
     std::stringstream raw;
 
+    fill_header_list();
+
     header_list::const_iterator it;
     for (it = m_headers.begin(); it != m_headers.end(); it++) {
         raw << it->first << ": " << it->second << "\r\n";
@@ -191,6 +343,165 @@ inline std::string parser::raw_headers() const {
     return raw.str();
 }
 
+inline void parser::index_header(size_t begin, size_t end) {
+    char const * line = m_header_buffer.data();
+
+    char const * cursor = scanner::find_char(line + begin, line + end,
+        header_separator[0]);
+
+    if (cursor == line + end) {
+        throw exception("Invalid header line",status_code::bad_request);
+    }
+
+    // trim linear whitespace around the name and the value
+    size_t name_begin = begin;
+    size_t name_end = static_cast<size_t>(cursor - line);
+    size_t value_begin = name_end + sizeof(header_separator) - 1;
+    size_t value_end = end;
+
+    while (name_begin < name_end && is_whitespace_char(
+        static_cast<unsigned char>(line[name_begin]))) {++name_begin;}
+    while (name_end > name_begin && is_whitespace_char(
+        static_cast<unsigned char>(line[name_end-1]))) {--name_end;}
+    while (value_begin < value_end && is_whitespace_char(
+        static_cast<unsigned char>(line[value_begin]))) {++value_begin;}
+    while (value_end > value_begin && is_whitespace_char(
+        static_cast<unsigned char>(line[value_end-1]))) {--value_end;}
+
+    if (!m_header_index_active) {
+        append_header(std::string(line+name_begin,line+name_end),
+                      std::string(line+value_begin,line+value_end));
+        return;
+    }
+
+    if (scanner::find_non_token(line+name_begin,line+name_end) !=
+        line+name_end)
+    {
+        throw exception("Invalid header name",status_code::bad_request);
+    }
+
+    indexed_header const * existing = find_indexed_header(line+name_begin,
+        name_end-name_begin);
+
+    if (existing) {
+        // repeated headers are joined the same way append_header joins them
+        std::string const & value = get_indexed_value(*existing);
+        if (value.empty()) {
+            existing->value.assign(line+value_begin,line+value_end);
+        } else {
+            existing->value.append(", ");
+            existing->value.append(line+value_begin,line+value_end);
+        }
+        m_header_list_filled = false;
+        return;
+    }
+
+    m_header_index.push_back(indexed_header());
+    indexed_header & h = m_header_index.back();
+
+    h.hash = hash_header_name(line+name_begin,name_end-name_begin);
+    h.name_offset = name_begin;
+    h.name_length = name_end-name_begin;
+    h.value_offset = value_begin;
+    h.value_length = value_end-value_begin;
+
+    m_header_list_filled = false;
+}
+
+inline uint32_t parser::hash_header_name(char const * name, size_t len) {
+    // 32 bit FNV-1a over the ASCII lower case name
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = static_cast<unsigned char>(name[i]);
+        if (c >= 'A' && c <= 'Z') {
+            c = static_cast<unsigned char>(c + ('a' - 'A'));
+        }
+        hash ^= c;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+inline parser::indexed_header const * parser::find_indexed_header(
+    char const * name, size_t len) const
+{
+    uint32_t const hash = hash_header_name(name,len);
+
+    for (size_t i = 0; i < m_header_index.size(); i++) {
+        indexed_header const & h = m_header_index[i];
+
+        if (h.hash != hash || h.name_length != len) {
+            continue;
+        }
+
+        // confirm the match in case of a hash collision
+        char const * candidate = m_header_buffer.data() + h.name_offset;
+        size_t j = 0;
+        for (; j < len; j++) {
+            if (std::tolower(static_cast<unsigned char>(candidate[j])) !=
+                std::tolower(static_cast<unsigned char>(name[j])))
+            {
+                break;
+            }
+        }
+        if (j == len) {
+            return &h;
+        }
+    }
+
+    return NULL;
+}
+
+inline std::string const & parser::get_indexed_value(indexed_header const & h)
+    const
+{
+    if (!h.loaded) {
+        h.value.assign(m_header_buffer,h.value_offset,h.value_length);
+        h.loaded = true;
+    }
+    return h.value;
+}
+
+inline void parser::fill_header_list() const {
+    if (!m_header_index_active || m_header_list_filled) {
+        return;
+    }
+
+    m_headers.clear();
+    for (size_t i = 0; i < m_header_index.size(); i++) {
+        indexed_header const & h = m_header_index[i];
+        m_headers[m_header_buffer.substr(h.name_offset,h.name_length)] =
+            get_indexed_value(h);
+    }
+
+    m_header_list_filled = true;
+}
+
+inline void parser::load_header_index() {
+    if (!m_header_index_active) {
+        return;
+    }
+
+    for (size_t i = 0; i < m_header_index.size(); i++) {
+        get_indexed_value(m_header_index[i]);
+    }
+
+    fill_header_list();
+}
+
+inline void parser::release_header_index() {
+    if (!m_header_index_active) {
+        return;
+    }
+
+    fill_header_list();
+
+    m_header_index_active = false;
+    std::vector<indexed_header>().swap(m_header_index);
+}
+
 
 
 } // namespace parser
@@ -43,7 +43,7 @@ inline size_t request::consume(char const * buf, size_t len) {
     
     if (m_ready) {return 0;}
     
-    if (m_body_bytes_needed > 0) {
+    if (m_body_encoding != body_encoding::unknown) {
         bytes_processed = process_body(buf,len);
         if (body_ready()) {
             m_ready = true;
@@ -51,6 +51,10 @@ inline size_t request::consume(char const * buf, size_t len) {
         return bytes_processed;
     }
 
+    if (m_indexed_headers) {
+        return consume_indexed(buf,len);
+    }
+
     // copy new header bytes into buffer
     m_buf->append(buf,len);
 
@@ -60,12 +64,11 @@ inline size_t request::consume(char const * buf, size_t len) {
 
     for (;;) {
         // search for line delimiter
-        end = std::search(
-            begin,
-            m_buf->end(),
-            header_delimiter,
-            header_delimiter+sizeof(header_delimiter)-1
-        );
+        char const * data = m_buf->data();
+        end = m_buf->begin() + (scanner::find_crlf(
+            data + (begin - m_buf->begin()),
+            data + m_buf->size()
+        ) - data);
         
         m_header_bytes += (end-begin+sizeof(header_delimiter));
         
@@ -88,10 +91,6 @@ inline size_t request::consume(char const * buf, size_t len) {
         //the range [begin,end) now represents a line to be processed.
         if (end-begin == 0) {
             // we got a blank line
-            if (m_method.empty() || get_header("Host").empty()) {
-                throw exception("Incomplete Request",status_code::bad_request);
-            }
-
             bytes_processed = (
                 len - static_cast<std::string::size_type>(m_buf->end()-end)
                     + sizeof(header_delimiter) - 1
@@ -100,22 +99,7 @@ inline size_t request::consume(char const * buf, size_t len) {
             // frees memory used temporarily during request parsing
             m_buf.reset();
 
-            // if this was not an upgrade request and has a content length
-            // continue capturing content-length bytes and expose them as a 
-            // request body.
-            
-            if (prepare_body()) {
-                bytes_processed += process_body(buf+bytes_processed,len-bytes_processed);
-                if (body_ready()) {
-                    m_ready = true;
-                }
-                return bytes_processed;
-            } else {
-                m_ready = true;
-
-                // return number of bytes processed (starting bytes - bytes left)
-                return bytes_processed;
-            }
+            return complete_headers(buf,len,bytes_processed);
         } else {
             if (m_method.empty()) {
                 this->process(begin,end);
@@ -128,6 +112,91 @@ inline size_t request::consume(char const * buf, size_t len) {
     }
 }
 
+inline size_t request::consume_indexed(char const * buf, size_t len) {
+    // Bytes stay in m_header_buffer until the request is destroyed because the
+    // index refers to them. Each call only scans the bytes it added, plus one
+    // in case a delimiter was split between reads.
+    m_header_buffer.append(buf,len);
+
+    for (;;) {
+        char const * data = m_header_buffer.data();
+        size_t end = static_cast<size_t>(scanner::find_crlf(data + m_scan_pos,
+            data + m_header_buffer.size()) - data);
+
+        if (end == m_header_buffer.size()) {
+            if (m_header_buffer.size() > max_header_size) {
+                throw exception("Maximum header size exceeded.",
+                    status_code::request_header_fields_too_large);
+            }
+
+            m_scan_pos = m_header_buffer.size() > m_line_start ?
+                m_header_buffer.size() - 1 : m_line_start;
+            return len;
+        }
+
+        m_header_bytes = end + sizeof(header_delimiter) - 1;
+
+        if (m_header_bytes > max_header_size) {
+            throw exception("Maximum header size exceeded.",
+                status_code::request_header_fields_too_large);
+        }
+
+        if (end == m_line_start) {
+            // we got a blank line. Anything after it was read directly from
+            // buf and does not need to stay in the buffer.
+            size_t bytes_processed = len - (m_header_buffer.size() -
+                m_header_bytes);
+
+            if (m_header_index_active) {
+                m_header_buffer.resize(m_header_bytes);
+            } else {
+                std::string().swap(m_header_buffer);
+            }
+
+            return complete_headers(buf,len,bytes_processed);
+        }
+
+        if (m_method.empty()) {
+            this->process(m_header_buffer.begin()+m_line_start,
+                m_header_buffer.begin()+end);
+        } else {
+            this->index_header(m_line_start,end);
+        }
+
+        m_line_start = m_header_bytes;
+        m_scan_pos = m_header_bytes;
+    }
+}
+
+inline size_t request::complete_headers(char const * buf, size_t len,
+    size_t bytes_processed)
+{
+    if (m_method.empty() || get_header("Host").empty()) {
+        throw exception("Incomplete Request",status_code::bad_request);
+    }
+
+    // Handlers may read the request from other threads, which is only safe
+    // once nothing is left to copy out of the index lazily.
+    load_header_index();
+
+    // if this was not an upgrade request and has a content length
+    // continue capturing content-length bytes and expose them as a 
+    // request body.
+    
+    if (prepare_body()) {
+        bytes_processed += process_body(buf+bytes_processed,len-bytes_processed);
+        if (body_ready()) {
+            m_ready = true;
+        }
+        return bytes_processed;
+    } else {
+        m_ready = true;
+
+        // return number of bytes processed (starting bytes - bytes left)
+        return bytes_processed;
+    }
+}
+
 inline std::string request::raw() const {
     // TODO: validation. Make sure all required fields have been set?
     std::stringstream ret;
@@ -149,7 +218,8 @@ inline std::string request::raw_head() const {
 }
 
 inline void request::set_method(std::string const & method) {
-    if (std::find_if(method.begin(),method.end(),is_not_token_char) != method.end()) {
+    char const * end = method.data() + method.size();
+    if (scanner::find_non_token(method.data(),end) != end) {
         throw exception("Invalid method token.",status_code::bad_request);
     }
 
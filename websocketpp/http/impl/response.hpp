@@ -56,12 +56,11 @@ inline size_t response::consume(char const * buf, size_t len) {
 
     for (;;) {
         // search for delimiter
-        end = std::search(
-            begin,
-            m_buf->end(),
-            header_delimiter,
-            header_delimiter + sizeof(header_delimiter) - 1
-        );
+        char const * data = m_buf->data();
+        end = m_buf->begin() + (scanner::find_crlf(
+            data + (begin - m_buf->begin()),
+            data + m_buf->size()
+        ) - data);
 
         m_header_bytes += (end-begin+sizeof(header_delimiter));
         
@@ -32,9 +32,12 @@
 #include <map>
 #include <string>
 #include <utility>
+#include <vector>
 
+#include <websocketpp/common/stdint.hpp>
 #include <websocketpp/utilities.hpp>
 #include <websocketpp/http/constants.hpp>
+#include <websocketpp/http/scanner.hpp>
 
 namespace websocketpp {
 namespace http {
@@ -57,6 +60,16 @@ namespace body_encoding {
     };
 }
 
+namespace chunk_state {
+    enum value {
+        size,
+        data,
+        data_end,
+        trailer,
+        done
+    };
+}
+
 typedef std::map<std::string, std::string, utility::ci_less > header_list;
 
 /// Read and return the next token in the stream
@@ -401,8 +414,60 @@ public:
       : m_header_bytes(0)
       , m_body_bytes_needed(0)
       , m_body_bytes_max(max_body_size)
-      , m_body_encoding(body_encoding::unknown) {}
+      , m_body_encoding(body_encoding::unknown)
+      , m_chunk_state(chunk_state::size)
+      , m_stream_body(false)
+      , m_indexed_headers(false)
+      , m_header_index_active(false)
+      , m_header_list_filled(false) {}
     
+    /// Parse headers into a flat index over the raw header bytes
+    /**
+     * By default each parsed header is copied into a map of strings. With the
+     * index enabled the raw header bytes are kept in a single buffer owned by
+     * the parser and each header is recorded as offsets into it, together with
+     * a hash of its lower case name. Lookups compare hashes before comparing
+     * names and copy a header value out of the buffer only the first time it
+     * is requested.
+     *
+     * The index is read only. Adding, replacing or removing a header copies
+     * all headers into the regular header list first. Lookups copy values
+     * out of the buffer, so const access to an indexed parser is not thread
+     * safe until load_header_index has been called. Requests call it once
+     * their headers are complete, before they can be handed to any handler.
+     *
+     * Must be called before any bytes are consumed or headers are added.
+     *
+     * @since 0.9.0
+     *
+     * @param value Whether or not to index headers
+     */
+    void set_indexed_headers(bool value) {
+        m_indexed_headers = value;
+        m_header_index_active = value;
+    }
+
+    /// Get whether headers are parsed into a flat index
+    /**
+     * @since 0.9.0
+     *
+     * @return Whether or not headers are indexed
+     * @see set_indexed_headers
+     */
+    bool get_indexed_headers() const {
+        return m_indexed_headers;
+    }
+
+    /// Copy every indexed header value and fill the header list
+    /**
+     * Afterwards const access no longer writes to the parser, so it may be
+     * read from several threads at once as long as it is not modified. Does
+     * nothing if headers are not indexed.
+     *
+     * @since 0.9.0
+     */
+    void load_header_index();
+
     /// Get the HTTP version string
     /**
      * @return The version string for this parser
@@ -543,6 +608,44 @@ public:
         m_body_bytes_max = value;
     }
 
+    /// Get whether the body is streamed rather than buffered
+    /**
+     * @since 0.9.0
+     *
+     * @return Whether body streaming is enabled.
+     */
+    bool get_stream_body() const {
+        return m_stream_body;
+    }
+
+    /// Stream the body rather than buffer it
+    /**
+     * With streaming enabled the body size limit is not applied. Body bytes
+     * still collect in the body as they are parsed, and the caller is expected
+     * to hand them off and call `clear_body` after each read so that the body
+     * never holds more than the bytes of one read.
+     *
+     * Must be set before the headers are complete.
+     *
+     * @since 0.9.0
+     *
+     * @param value Whether to stream the body.
+     */
+    void set_stream_body(bool value) {
+        m_stream_body = value;
+    }
+
+    /// Discard the body bytes parsed so far
+    /**
+     * Unlike `set_body` this leaves the headers alone, which makes it suitable
+     * for draining a streamed body while it is being parsed.
+     *
+     * @since 0.9.0
+     */
+    void clear_body() {
+        m_body.clear();
+    }
+
     /// Extract an HTTP parameter list from a string.
     /**
      * @param [in] in The input string.
@@ -564,7 +667,9 @@ protected:
     /// Prepare the parser to begin parsing body data
     /**
      * Inspects headers to determine if the message has a body that needs to be
-     * read. If so, sets up the necessary state, otherwise returns false. If
+     * read. If so, sets up the necessary state, otherwise returns false. A
+     * Transfer-Encoding header takes precedence over Content-Length and must
+     * end with the chunked coding. If
      * this method returns true and loading the message body is desired call
      * `process_body` until it returns zero bytes or an error.
      *
@@ -578,7 +683,8 @@ protected:
 
     /// Process body data
     /**
-     * Parses body data.
+     * Parses body data. Chunked bodies are decoded as they are parsed, chunk
+     * extensions and trailer fields are discarded.
      *
      * @since 0.5.0
      *
@@ -588,6 +694,12 @@ protected:
      */
     size_t process_body(char const * buf, size_t len);
 
+    /// Process chunked body data
+    size_t process_chunked_body(char const * buf, size_t len);
+
+    /// Process one complete chunk size, chunk end or trailer line
+    void process_chunk_line();
+
     /// Check if the parser is done parsing the body
     /**
      * Behavior before a call to `prepare_body` is undefined.
@@ -597,6 +709,9 @@ protected:
      * @return True if the message body has been completed loaded.
      */
     bool body_ready() const {
+        if (m_body_encoding == body_encoding::chunked) {
+            return (m_chunk_state == chunk_state::done);
+        }
         return (m_body_bytes_needed == 0);
     }
 
@@ -609,8 +724,59 @@ protected:
      */
     std::string raw_headers() const;
 
+    /// Process a header line stored in m_header_buffer
+    /**
+     * Records the header in the index or, if the index is no longer active,
+     * appends it to the header list.
+     *
+     * @since 0.9.0
+     *
+     * @param [in] begin Offset of the start of the line
+     * @param [in] end Offset of the end of the line
+     */
+    void index_header(size_t begin, size_t end);
+
+    /// Position of one header within m_header_buffer
+    struct indexed_header {
+        indexed_header()
+          : hash(0)
+          , name_offset(0)
+          , name_length(0)
+          , value_offset(0)
+          , value_length(0)
+          , loaded(false) {}
+
+        uint32_t    hash;
+        size_t      name_offset;
+        size_t      name_length;
+        size_t      value_offset;
+        size_t      value_length;
+
+        /// Value copied out of the buffer on first lookup
+        mutable std::string value;
+        mutable bool        loaded;
+    };
+
+    /// Case insensitive hash of a header name
+    static uint32_t hash_header_name(char const * name, size_t len);
+
+    /// Find a header in the index
+    indexed_header const * find_indexed_header(char const * name, size_t len)
+        const;
+
+    /// Get the value of an indexed header, copying it out of the buffer
+    std::string const & get_indexed_value(indexed_header const & h) const;
+
+    /// Copy indexed headers into m_headers for callers that need the map
+    void fill_header_list() const;
+
+    /// Switch from the index to m_headers before headers are modified
+    void release_header_index();
+
     std::string m_version;
-    header_list m_headers;
+
+    /// Filled lazily from the index when the index is active
+    mutable header_list m_headers;
     
     size_t                  m_header_bytes;
     
@@ -618,6 +784,15 @@ protected:
     size_t                  m_body_bytes_needed;
     size_t                  m_body_bytes_max;
     body_encoding::value    m_body_encoding;
+    chunk_state::value      m_chunk_state;
+    std::string             m_chunk_line;
+    bool                    m_stream_body;
+
+    bool                    m_indexed_headers;
+    bool                    m_header_index_active;
+    mutable bool            m_header_list_filled;
+    std::string             m_header_buffer;
+    std::vector<indexed_header> m_header_index;
 };
 
 } // namespace parser
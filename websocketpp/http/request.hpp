@@ -54,6 +54,8 @@ public:
 
     request()
       : m_buf(lib::make_shared<std::string>())
+      , m_line_start(0)
+      , m_scan_pos(0)
       , m_ready(false) {}
 
     /// Process bytes in the input buffer
@@ -109,9 +111,21 @@ private:
     /// Helper function for message::consume. Process request line
     void process(std::string::iterator begin, std::string::iterator end);
 
+    /// Helper function for message::consume. Parse headers into the index
+    size_t consume_indexed(char const * buf, size_t len);
+
+    /// Helper function for message::consume. Validate headers and start body
+    size_t complete_headers(char const * buf, size_t len,
+        size_t bytes_processed);
+
     lib::shared_ptr<std::string>    m_buf;
     std::string                     m_method;
     std::string                     m_uri;
+
+    /// Offset in m_header_buffer of the first byte of the unparsed line
+    size_t                          m_line_start;
+    /// Offset in m_header_buffer to resume the delimiter search from
+    size_t                          m_scan_pos;
     bool                            m_ready;
 };
 
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2020, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef HTTP_SCANNER_HPP
+#define HTTP_SCANNER_HPP
+
+#include <websocketpp/http/constants.hpp>
+
+#include <cstddef>
+
+// SSE2 is part of the x86-64 baseline so it is used whenever the compiler
+// targets it. Define _WEBSOCKETPP_NO_SSE2_ to force the portable byte at a
+// time scanner.
+#if !defined(_WEBSOCKETPP_NO_SSE2_) && (defined(__SSE2__) || \
+    defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+    #ifndef _WEBSOCKETPP_SSE2_
+        #define _WEBSOCKETPP_SSE2_
+    #endif
+#endif
+
+#ifdef _WEBSOCKETPP_SSE2_
+    #include <emmintrin.h>
+#endif
+
+#if defined(_WEBSOCKETPP_SSE2_) && defined(__AVX2__)
+    #include <immintrin.h>
+#endif
+
+namespace websocketpp {
+namespace http {
+namespace parser {
+
+/// Vectorized byte scanners used by the HTTP parser
+/**
+ * Each function examines 16 bytes at a time with SSE2, or 32 at a time for
+ * the single character searches when AVX2 is enabled at compile time, and
+ * falls back to the scalar helpers in constants.hpp for the tail and on other
+ * platforms. All of them take a half open range of bytes and return a pointer
+ * to the first match, or `end` if there is none.
+ *
+ * @since 0.9.0
+ */
+namespace scanner {
+
+#ifdef _WEBSOCKETPP_SSE2_
+/// Mask of the bytes of v in the range [lo,hi], for lo and hi below 0x80
+inline __m128i in_range(__m128i v, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(char(lo - 1))),
+                         _mm_cmplt_epi8(v, _mm_set1_epi8(char(hi + 1))));
+}
+
+/// Index of the lowest set bit of a non-zero movemask result
+inline unsigned int first_bit(unsigned int mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned int>(__builtin_ctz(mask));
+#else
+    unsigned int i = 0;
+    while (!(mask & 1u)) {
+        mask >>= 1;
+        ++i;
+    }
+    return i;
+#endif
+}
+
+/// Load 16 bytes without alignment requirements
+inline __m128i load16(char const * p) {
+    return _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+}
+#endif
+
+/// Find the first occurrence of a byte
+/**
+ * @param begin Start of the range
+ * @param end End of the range
+ * @param c Byte to look for
+ * @return Pointer to the first `c` in the range, or `end`
+ */
+inline char const * find_char(char const * begin, char const * end, char c) {
+#ifdef _WEBSOCKETPP_SSE2_
+#ifdef __AVX2__
+    __m256i const c32 = _mm256_set1_epi8(c);
+    while (end - begin >= 32) {
+        __m256i const v = _mm256_loadu_si256(
+            reinterpret_cast<__m256i const *>(begin));
+        unsigned int mask = static_cast<unsigned int>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, c32)));
+        if (mask) {
+            return begin + first_bit(mask);
+        }
+        begin += 32;
+    }
+#endif
+    __m128i const c16 = _mm_set1_epi8(c);
+    while (end - begin >= 16) {
+        unsigned int mask = static_cast<unsigned int>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(load16(begin), c16)));
+        if (mask) {
+            return begin + first_bit(mask);
+        }
+        begin += 16;
+    }
+#endif
+    while (begin != end && *begin != c) {
+        ++begin;
+    }
+    return begin;
+}
+
+/// Find the first CRLF sequence
+/**
+ * Candidates are found by scanning for CR and confirmed by checking the
+ * following byte, so a CR that is the last byte of the range is never a
+ * match.
+ *
+ * @param begin Start of the range
+ * @param end End of the range
+ * @return Pointer to the CR of the first CRLF in the range, or `end`
+ */
+inline char const * find_crlf(char const * begin, char const * end) {
+    if (end - begin < 2) {
+        return end;
+    }
+
+    // stop one byte early so the LF check never reads past end
+    char const * const last = end - 1;
+
+#ifdef _WEBSOCKETPP_SSE2_
+    __m128i const cr = _mm_set1_epi8('\r');
+    __m128i const lf = _mm_set1_epi8('\n');
+    while (last - begin >= 16) {
+        // compare each byte with CR and the byte after it with LF
+        unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(load16(begin), cr),
+                          _mm_cmpeq_epi8(load16(begin + 1), lf))));
+        if (mask) {
+            return begin + first_bit(mask);
+        }
+        begin += 16;
+    }
+#endif
+    for (; begin != last; ++begin) {
+        if (begin[0] == '\r' && begin[1] == '\n') {
+            return begin;
+        }
+    }
+    return end;
+}
+
+/// Find the first byte that may not appear in an HTTP token
+/**
+ * Equivalent to `std::find_if(begin, end, is_not_token_char)`.
+ *
+ * @param begin Start of the range
+ * @param end End of the range
+ * @return Pointer to the first non-token byte in the range, or `end`
+ */
+inline char const * find_non_token(char const * begin, char const * end) {
+#ifdef _WEBSOCKETPP_SSE2_
+    while (end - begin >= 16) {
+        __m128i const v = load16(begin);
+
+        // Controls, space and bytes with the high bit set. Signed comparison
+        // puts 0x80..0xff below 0x21.
+        __m128i bad = _mm_cmplt_epi8(v, _mm_set1_epi8(0x21));
+
+        // The separators ( ) : ; < = > ? @ [ \ ] form three ranges, the rest
+        // are checked one at a time along with DEL.
+        bad = _mm_or_si128(bad, in_range(v, '(', ')'));
+        bad = _mm_or_si128(bad, in_range(v, ':', '@'));
+        bad = _mm_or_si128(bad, in_range(v, '[', ']'));
+        bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+        bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+        bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+        bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8('{')));
+        bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8('}')));
+        bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+
+        unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(bad));
+        if (mask) {
+            return begin + first_bit(mask);
+        }
+        begin += 16;
+    }
+#endif
+    while (begin != end && is_token_char(static_cast<unsigned char>(*begin))) {
+        ++begin;
+    }
+    return begin;
+}
+
+} // namespace scanner
+} // namespace parser
+} // namespace http
+} // namespace websocketpp
+
+#endif // HTTP_SCANNER_HPP
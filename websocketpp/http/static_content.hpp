@@ -0,0 +1,513 @@
+/*
+ * Copyright (c) 2020, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef HTTP_STATIC_CONTENT_HPP
+#define HTTP_STATIC_CONTENT_HPP
+
+#include <websocketpp/common/memory.hpp>
+#include <websocketpp/common/system_error.hpp>
+#include <websocketpp/error.hpp>
+#include <websocketpp/http/constants.hpp>
+#include <websocketpp/http/request.hpp>
+#include <websocketpp/sha1/sha1.hpp>
+#include <websocketpp/utilities.hpp>
+
+#include "zlib.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <dirent.h>
+    #include <sys/stat.h>
+#endif
+
+namespace websocketpp {
+namespace http {
+
+/// In memory responder for static files
+/**
+ * Serves a fixed set of files, such as the HTML and JavaScript of a web app,
+ * from the http handler. Files are loaded once. Their content type,
+ * Content-Length and a strong ETag are computed when they are loaded, along
+ * with a gzip encoded variant when the content type is compressible and
+ * compression makes it smaller. Clients that accept gzip get the compressed
+ * variant. Requests with an If-None-Match header that matches the ETag get
+ * 304 Not Modified.
+ *
+ * Bodies are kept in shared immutable buffers that are queued on connections
+ * without being copied, so one copy of each file serves every request.
+ *
+ * Adding files is not thread safe. Once all files have been added `serve` may
+ * be called from any number of threads.
+ *
+ * ```
+ * void on_http(server * s, http::static_content * files, connection_hdl hdl) {
+ *     server::connection_ptr con = s->get_con_from_hdl(hdl);
+ *     if (!files->serve(con)) {
+ *         con->set_status(http::status_code::not_found);
+ *     }
+ * }
+ * ```
+ *
+ * @since 0.9.0
+ */
+class static_content {
+public:
+    static_content() : m_gzip_min_size(256) {
+        static char const * const types[][2] = {
+            {"css", "text/css"},
+            {"gif", "image/gif"},
+            {"htm", "text/html"},
+            {"html", "text/html"},
+            {"ico", "image/x-icon"},
+            {"jpeg", "image/jpeg"},
+            {"jpg", "image/jpeg"},
+            {"js", "application/javascript"},
+            {"json", "application/json"},
+            {"map", "application/json"},
+            {"mjs", "application/javascript"},
+            {"png", "image/png"},
+            {"svg", "image/svg+xml"},
+            {"txt", "text/plain"},
+            {"wasm", "application/wasm"},
+            {"webp", "image/webp"},
+            {"woff", "font/woff"},
+            {"woff2", "font/woff2"},
+            {"xml", "application/xml"}
+        };
+
+        for (size_t i = 0; i < sizeof(types)/sizeof(types[0]); i++) {
+            m_mime_types[types[i][0]] = types[i][1];
+        }
+    }
+
+    /// Set the content type used for a file extension
+    /**
+     * Applies to files added afterwards. Extensions are matched without
+     * regard to case. Files with an unknown extension are served as
+     * application/octet-stream.
+     *
+     * @param extension The extension, without the leading dot
+     * @param type The content type
+     */
+    void set_mime_type(std::string const & extension, std::string const & type)
+    {
+        m_mime_types[utility::to_lower(extension)] = type;
+    }
+
+    /// Set the Cache-Control header sent with every response
+    /**
+     * By default no Cache-Control header is sent.
+     *
+     * @param value The header value, or an empty string for none
+     */
+    void set_cache_control(std::string const & value) {
+        m_cache_control = value;
+    }
+
+    /// Set the size below which files are not compressed
+    /**
+     * Applies to files added afterwards. The default is 256 bytes.
+     *
+     * @param value The minimum size in bytes
+     */
+    void set_gzip_min_size(size_t value) {
+        m_gzip_min_size = value;
+    }
+
+    /// Get the number of paths that can be served
+    size_t size() const {
+        return m_files.size();
+    }
+
+    /// Add a file from memory
+    /**
+     * A path that ends in /index.html is also served for the directory,
+     * e.g. /app/index.html is served for /app/ as well.
+     *
+     * @param path The request path to serve the file at, e.g. /app/main.js
+     * @param content The file contents
+     * @param content_type The content type
+     */
+    void add(std::string const & path, std::string const & content,
+        std::string const & content_type)
+    {
+        lib::shared_ptr<entry> e = lib::make_shared<entry>();
+
+        e->body = lib::make_shared<std::string>(content);
+        e->content_type = content_type;
+        e->length = to_decimal(content.size());
+
+        unsigned char hash[20];
+        sha1::calc(content.data(),content.size(),hash);
+        std::string tag = to_hex(hash,8);
+        e->etag = "\"" + tag + "\"";
+
+        std::string compressed;
+        if (content.size() >= m_gzip_min_size && is_compressible(content_type)
+            && gzip(content,compressed) && compressed.size() < content.size())
+        {
+            e->gzip_length = to_decimal(compressed.size());
+            e->gzip_etag = "\"" + tag + "-gz\"";
+            e->gzip_body = lib::make_shared<std::string>(compressed);
+        }
+
+        m_files[path] = e;
+
+        std::string const index = "/index.html";
+        if (path.size() >= index.size() &&
+            path.compare(path.size()-index.size(),index.size(),index) == 0)
+        {
+            m_files[path.substr(0,path.size()-index.size()+1)] = e;
+        }
+    }
+
+    /// Load a file from disk
+    /**
+     * The content type is chosen from the file extension.
+     *
+     * @param path The request path to serve the file at
+     * @param file The file to load
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code add_file(std::string const & path, std::string const & file)
+    {
+        std::string content;
+        if (!read_file(file,content)) {
+            return error::make_error_code(error::http_body_file);
+        }
+
+        add(path,content,mime_type(file));
+        return lib::error_code();
+    }
+
+    /// Load a directory and its subdirectories from disk
+    /**
+     * Each file is served at the prefix followed by its path relative to the
+     * directory. Files and directories whose name starts with a dot are
+     * skipped.
+     *
+     * @param prefix The request path of the directory, e.g. / or /static
+     * @param dir The directory to load
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    lib::error_code add_directory(std::string const & prefix,
+        std::string const & dir)
+    {
+        std::string base = prefix;
+        if (base.empty() || base[base.size()-1] != '/') {
+            base += '/';
+        }
+
+#ifdef _WIN32
+        WIN32_FIND_DATAA data;
+        HANDLE h = FindFirstFileA((dir + "\\*").c_str(),&data);
+        if (h == INVALID_HANDLE_VALUE) {
+            return error::make_error_code(error::http_body_file);
+        }
+
+        lib::error_code ec;
+        do {
+            std::string name = data.cFileName;
+            if (name[0] == '.') {
+                continue;
+            }
+            if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+                ec = add_directory(base + name,dir + "\\" + name);
+            } else {
+                ec = add_file(base + name,dir + "\\" + name);
+            }
+        } while (!ec && FindNextFileA(h,&data));
+
+        FindClose(h);
+        return ec;
+#else
+        DIR * d = opendir(dir.c_str());
+        if (!d) {
+            return error::make_error_code(error::http_body_file);
+        }
+
+        lib::error_code ec;
+        struct dirent * ent;
+        while (!ec && (ent = readdir(d)) != NULL) {
+            std::string name = ent->d_name;
+            if (name[0] == '.') {
+                continue;
+            }
+
+            std::string file = dir + "/" + name;
+            struct stat st;
+            if (stat(file.c_str(),&st) != 0) {
+                continue;
+            }
+
+            if (S_ISDIR(st.st_mode)) {
+                ec = add_directory(base + name,file);
+            } else if (S_ISREG(st.st_mode)) {
+                ec = add_file(base + name,file);
+            }
+        }
+
+        closedir(d);
+        return ec;
+#endif
+    }
+
+    /// Answer a request for a static file
+    /**
+     * Call from the http handler, or after deferring the response. GET and
+     * HEAD requests for a known path, ignoring any query string, are
+     * answered. Other requests are left alone so the application can respond
+     * to them itself.
+     *
+     * @param con The connection to respond on
+     * @return Whether the request was answered
+     */
+    template <typename connection_ptr>
+    bool serve(connection_ptr con) const {
+        parser::request const & req = con->get_request();
+
+        std::string const & method = req.get_method();
+        if (method != "GET" && method != "HEAD") {
+            return false;
+        }
+
+        std::string const & uri = req.get_uri();
+        std::string::size_type end = uri.find_first_of("?#");
+        entry_map::const_iterator it = (end == std::string::npos ?
+            m_files.find(uri) : m_files.find(uri.substr(0,end)));
+        if (it == m_files.end()) {
+            return false;
+        }
+        entry const & e = *it->second;
+
+        bool use_gzip = e.gzip_body &&
+            accepts_gzip(req.get_header("Accept-Encoding"));
+        std::string const & etag = use_gzip ? e.gzip_etag : e.etag;
+
+        con->replace_header("ETag",etag);
+        if (e.gzip_body) {
+            con->replace_header("Vary","Accept-Encoding");
+        }
+        if (!m_cache_control.empty()) {
+            con->replace_header("Cache-Control",m_cache_control);
+        }
+
+        if (etag_matches(req.get_header("If-None-Match"),etag)) {
+            con->set_status(status_code::not_modified);
+            return true;
+        }
+
+        con->set_status(status_code::ok);
+        con->replace_header("Content-Type",e.content_type);
+        con->replace_header("Content-Length",
+            use_gzip ? e.gzip_length : e.length);
+        if (use_gzip) {
+            con->replace_header("Content-Encoding","gzip");
+        }
+
+        // HEAD responses are written with the headers alone
+        if (method == "HEAD") {
+            return true;
+        }
+
+        lib::error_code ec = con->begin_http_body();
+        if (!ec) {
+            ec = con->send_http_body(use_gzip ? e.gzip_body : e.body);
+        }
+        if (!ec) {
+            ec = con->end_http_body();
+        }
+        return !ec;
+    }
+private:
+    struct entry {
+        lib::shared_ptr<std::string const> body;
+        lib::shared_ptr<std::string const> gzip_body;
+        std::string content_type;
+        std::string length;
+        std::string gzip_length;
+        std::string etag;
+        std::string gzip_etag;
+    };
+
+    typedef std::map<std::string,lib::shared_ptr<entry const> > entry_map;
+
+    std::string mime_type(std::string const & file) const {
+        std::string::size_type dot = file.find_last_of("./\\");
+        if (dot != std::string::npos && file[dot] == '.') {
+            std::map<std::string,std::string>::const_iterator it =
+                m_mime_types.find(utility::to_lower(file.substr(dot+1)));
+            if (it != m_mime_types.end()) {
+                return it->second;
+            }
+        }
+        return "application/octet-stream";
+    }
+
+    static bool is_compressible(std::string const & type) {
+        return type.compare(0,5,"text/") == 0 ||
+            type == "application/javascript" || type == "application/json" ||
+            type == "application/wasm" || type == "application/xml" ||
+            type == "image/svg+xml";
+    }
+
+    static bool read_file(std::string const & file, std::string & out) {
+        std::FILE * f = std::fopen(file.c_str(),"rb");
+        if (!f) {
+            return false;
+        }
+
+        char buf[65536];
+        size_t n;
+        while ((n = std::fread(buf,1,sizeof(buf),f)) > 0) {
+            out.append(buf,n);
+        }
+
+        bool ok = !std::ferror(f);
+        std::fclose(f);
+        return ok;
+    }
+
+    static bool gzip(std::string const & in, std::string & out) {
+        if (in.size() > (std::numeric_limits<uInt>::max)()) {
+            return false;
+        }
+
+        z_stream strm;
+        strm.zalloc = Z_NULL;
+        strm.zfree = Z_NULL;
+        strm.opaque = Z_NULL;
+
+        // window bits above 15 select the gzip wrapper
+        if (deflateInit2(&strm,Z_BEST_COMPRESSION,Z_DEFLATED,15+16,8,
+            Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            return false;
+        }
+
+        out.resize(deflateBound(&strm,static_cast<uLong>(in.size())));
+
+        strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(
+            in.data()));
+        strm.avail_in = static_cast<uInt>(in.size());
+        strm.next_out = reinterpret_cast<Bytef *>(&out[0]);
+        strm.avail_out = static_cast<uInt>(out.size());
+
+        int ret = deflate(&strm,Z_FINISH);
+        out.resize(out.size() - strm.avail_out);
+        deflateEnd(&strm);
+
+        return ret == Z_STREAM_END;
+    }
+
+    /// Whether an Accept-Encoding header allows gzip
+    static bool accepts_gzip(std::string const & header) {
+        std::string::size_type pos = 0;
+        while (pos < header.size()) {
+            std::string::size_type end = header.find(',',pos);
+            if (end == std::string::npos) {
+                end = header.size();
+            }
+            std::string item = header.substr(pos,end-pos);
+            pos = end + 1;
+
+            std::string::size_type semi = item.find(';');
+            std::string coding = utility::to_lower(
+                parser::strip_lws(item.substr(0,semi)));
+            if (coding != "gzip" && coding != "x-gzip" && coding != "*") {
+                continue;
+            }
+
+            if (semi == std::string::npos) {
+                return true;
+            }
+            std::string::size_type q = item.find("q=",semi);
+            return q == std::string::npos ||
+                std::strtod(item.c_str()+q+2,NULL) > 0;
+        }
+        return false;
+    }
+
+    /// Whether an If-None-Match header matches an ETag
+    static bool etag_matches(std::string const & header,
+        std::string const & etag)
+    {
+        std::string::size_type pos = 0;
+        while (pos < header.size()) {
+            std::string::size_type end = header.find(',',pos);
+            if (end == std::string::npos) {
+                end = header.size();
+            }
+            std::string tag = parser::strip_lws(header.substr(pos,end-pos));
+            pos = end + 1;
+
+            // If-None-Match uses the weak comparison
+            if (tag.compare(0,2,"W/") == 0) {
+                tag.erase(0,2);
+            }
+            if (tag == "*" || tag == etag) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static std::string to_hex(unsigned char const * data, size_t len) {
+        static char const digits[] = "0123456789abcdef";
+        std::string ret(len*2,'0');
+        for (size_t i = 0; i < len; i++) {
+            ret[i*2] = digits[data[i] >> 4];
+            ret[i*2+1] = digits[data[i] & 0x0f];
+        }
+        return ret;
+    }
+
+    static std::string to_decimal(size_t value) {
+        std::stringstream s;
+        s << value;
+        return s.str();
+    }
+
+    entry_map                           m_files;
+    std::map<std::string,std::string>   m_mime_types;
+    std::string                         m_cache_control;
+    size_t                              m_gzip_min_size;
+};
+
+} // namespace http
+} // namespace websocketpp
+
+#endif // HTTP_STATIC_CONTENT_HPP
@@ -36,6 +36,7 @@
 #include <websocketpp/processors/processor.hpp>
 
 #include <websocketpp/common/platforms.hpp>
+#include <websocketpp/common/stdio.hpp>
 #include <websocketpp/common/system_error.hpp>
 
 #include <algorithm>
@@ -73,6 +74,23 @@ size_t connection<config>::get_buffered_amount() const {
     return m_send_buffer_size;
 }
 
+template <typename config>
+size_t connection<config>::get_buffered_amount(
+    message_buffer::priority::value priority) const
+{
+    scoped_lock_type lock(m_write_lock);
+    if (priority >= message_buffer::priority::count) {
+        return 0;
+    }
+    return m_send_class_size[priority];
+}
+
+template <typename config>
+bool connection<config>::is_writable() const {
+    scoped_lock_type lock(m_write_lock);
+    return m_send_buffer_size < m_send_buffer_watermark;
+}
+
 template <typename config>
 session::state::value connection<config>::get_state() const {
     //scoped_lock_type lock(m_connection_state_lock);
@@ -81,21 +99,23 @@ session::state::value connection<config>::get_state() const {
 
 template <typename config>
 lib::error_code connection<config>::send(std::string const & payload,
-    frame::opcode::value op)
+    frame::opcode::value op, message_buffer::priority::value priority)
 {
     message_ptr msg = m_msg_manager->get_message(op,payload.size());
     msg->append_payload(payload);
     msg->set_compressed(true);
+    msg->set_priority(priority);
 
     return send(msg);
 }
 
 template <typename config>
 lib::error_code connection<config>::send(void const * payload, size_t len,
-    frame::opcode::value op)
+    frame::opcode::value op, message_buffer::priority::value priority)
 {
     message_ptr msg = m_msg_manager->get_message(op,len);
     msg->append_payload(payload,len);
+    msg->set_priority(priority);
 
     return send(msg);
 }
@@ -114,6 +134,68 @@ lib::error_code connection<config>::send(typename config::message_type::ptr msg)
         }
     }
 
+    if (config::enable_mpsc_send_queue) {
+        // Check what can be checked without the processor so that these
+        // errors still reach the caller. Framing happens in the event loop.
+        if (m_stream_open) {
+            return error::make_error_code(error::invalid_state);
+        }
+
+        if (!msg->get_prepared()) {
+            lib::error_code ec = validate_data_message(msg);
+            if (ec) {
+                return ec;
+            }
+        }
+
+        // only the send that finds the queue empty needs to schedule a drain
+        if (m_pending_sends.push(msg)) {
+            transport_con_type::dispatch(lib::bind(
+                &type::handle_pending_sends,
+                type::get_shared()
+            ));
+        }
+
+        return lib::error_code();
+    }
+
+    if (m_compression_executor) {
+        // Large messages are framed on the compression executor. Once one is
+        // waiting there everything sent after it queues up behind it.
+        bool offloaded = false;
+        bool start = false;
+        {
+            scoped_lock_type lock(m_write_lock);
+            if (m_stream_open) {
+                return error::make_error_code(error::invalid_state);
+            }
+
+            if (!m_offload_queue.empty() || needs_offload(msg)) {
+                if (!msg->get_prepared()) {
+                    lib::error_code ec = validate_data_message(msg);
+                    if (ec) {
+                        return ec;
+                    }
+                }
+
+                m_offload_queue.push_back(msg);
+                offloaded = true;
+                start = !m_offload_running;
+                m_offload_running = true;
+            }
+        }
+
+        if (offloaded) {
+            if (start) {
+                transport_con_type::dispatch(lib::bind(
+                    &type::process_offload_queue,
+                    type::get_shared()
+                ));
+            }
+            return lib::error_code();
+        }
+    }
+
     message_ptr outgoing_msg;
     bool needs_writing = false;
 
@@ -121,8 +203,11 @@ lib::error_code connection<config>::send(typename config::message_type::ptr msg)
         outgoing_msg = msg;
 
         scoped_lock_type lock(m_write_lock);
+        if (m_stream_open) {
+            return error::make_error_code(error::invalid_state);
+        }
         write_push(outgoing_msg);
-        needs_writing = !m_write_flag && !m_send_queue.empty();
+        needs_writing = !m_write_flag && !send_queue_empty();
     } else {
         outgoing_msg = m_msg_manager->get_message();
 
@@ -131,14 +216,432 @@ lib::error_code connection<config>::send(typename config::message_type::ptr msg)
         }
 
         scoped_lock_type lock(m_write_lock);
+        if (m_stream_open) {
+            return error::make_error_code(error::invalid_state);
+        }
+
         lib::error_code ec = m_processor->prepare_data_frame(msg,outgoing_msg);
 
         if (ec) {
             return ec;
         }
 
+        outgoing_msg->set_priority(msg->get_priority());
+        write_push(outgoing_msg);
+        needs_writing = !m_write_flag && !send_queue_empty();
+    }
+
+    if (needs_writing) {
+        transport_con_type::dispatch(lib::bind(
+            &type::write_frame,
+            type::get_shared()
+        ));
+    }
+
+    return lib::error_code();
+}
+
+template <typename config>
+void connection<config>::handle_pending_sends() {
+    if (m_alog->static_test(log::alevel::devel)) {
+        m_alog->write(log::alevel::devel,"connection handle_pending_sends");
+    }
+
+    bool start_offload = false;
+    {
+        scoped_lock_type state_lock(m_connection_state_lock);
+        scoped_lock_type lock(m_write_lock);
+
+        if (m_state != session::state::open) {
+            // Everything sent before the close frame was queued has been
+            // drained by send_close_frame. Only messages that lost the race
+            // with it are left and nothing may be written after a close.
+            m_pending_batch.clear();
+            m_pending_sends.pop_all(m_pending_batch);
+            if (!m_pending_batch.empty()) {
+                m_alog->write(log::alevel::devel,
+                    "handle_pending_sends: connection no longer open");
+            }
+            m_pending_batch.clear();
+            return;
+        }
+
+        start_offload = drain_pending_sends();
+    }
+
+    if (start_offload) {
+        process_offload_queue();
+    }
+
+    write_frame();
+}
+
+template <typename config>
+bool connection<config>::drain_pending_sends() {
+    // Messages that lost the race with begin_message stay queued until the
+    // streamed message has been finished.
+    if (m_stream_open) {
+        return false;
+    }
+
+    bool start_offload = false;
+
+    m_pending_batch.clear();
+    m_pending_sends.pop_all(m_pending_batch);
+
+    typename std::vector<message_ptr>::iterator it;
+    for (it = m_pending_batch.begin(); it != m_pending_batch.end(); ++it) {
+        if (m_compression_executor &&
+            (!m_offload_queue.empty() || needs_offload(*it)))
+        {
+            // large messages go to the compression executor as they would
+            // have from send, everything after them waits in order
+            m_offload_queue.push_back(*it);
+            if (!m_offload_running) {
+                m_offload_running = true;
+                start_offload = true;
+            }
+            continue;
+        }
+
+        if ((*it)->get_prepared()) {
+            write_push(*it);
+            continue;
+        }
+
+        message_ptr outgoing_msg = m_msg_manager->get_message();
+
+        if (!outgoing_msg) {
+            log_err(log::elevel::rerror,"drain_pending_sends",
+                error::make_error_code(error::no_outgoing_buffers));
+            continue;
+        }
+
+        lib::error_code ec = m_processor->prepare_data_frame(*it,
+            outgoing_msg);
+
+        if (ec) {
+            log_err(log::elevel::rerror,"drain_pending_sends",ec);
+            continue;
+        }
+
+        outgoing_msg->set_priority((*it)->get_priority());
         write_push(outgoing_msg);
-        needs_writing = !m_write_flag && !m_send_queue.empty();
+    }
+
+    m_pending_batch.clear();
+
+    return start_offload;
+}
+
+template <typename config>
+lib::error_code connection<config>::validate_data_message(
+    message_ptr const & msg) const
+{
+    frame::opcode::value op = msg->get_opcode();
+
+    if (frame::opcode::is_control(op)) {
+        return processor::error::make_error_code(
+            processor::error::invalid_opcode);
+    }
+
+    if (op == frame::opcode::text &&
+        !utf8_validator::validate(msg->get_payload()))
+    {
+        return processor::error::make_error_code(
+            processor::error::invalid_payload);
+    }
+
+    return lib::error_code();
+}
+
+template <typename config>
+bool connection<config>::needs_offload(message_ptr const & msg) const {
+    return !msg->get_prepared() && msg->get_compressed() &&
+        m_compression_offload_threshold > 0 &&
+        msg->get_payload().size() >= m_compression_offload_threshold;
+}
+
+template <typename config>
+void connection<config>::process_offload_queue() {
+    if (m_alog->static_test(log::alevel::devel)) {
+        m_alog->write(log::alevel::devel,"connection process_offload_queue");
+    }
+
+    message_ptr offload_msg;
+    bool needs_writing = false;
+
+    {
+        scoped_lock_type lock(m_write_lock);
+
+        while (!m_offload_queue.empty()) {
+            message_ptr msg = m_offload_queue.front();
+
+            if (needs_offload(msg)) {
+                // stays at the front until it has been framed
+                offload_msg = msg;
+                break;
+            }
+
+            m_offload_queue.pop_front();
+
+            if (msg->get_prepared()) {
+                write_push(msg);
+                continue;
+            }
+
+            message_ptr outgoing_msg = m_msg_manager->get_message();
+
+            if (!outgoing_msg) {
+                log_err(log::elevel::rerror,"process_offload_queue",
+                    error::make_error_code(error::no_outgoing_buffers));
+                continue;
+            }
+
+            lib::error_code ec = m_processor->prepare_data_frame(msg,
+                outgoing_msg);
+
+            if (ec) {
+                log_err(log::elevel::rerror,"process_offload_queue",ec);
+                continue;
+            }
+
+            outgoing_msg->set_priority(msg->get_priority());
+            write_push(outgoing_msg);
+        }
+
+        if (!offload_msg) {
+            m_offload_running = false;
+        }
+
+        needs_writing = !m_write_flag && !send_queue_empty();
+    }
+
+    if (offload_msg) {
+        m_compression_executor(lib::bind(
+            &type::offload_prepare,
+            type::get_shared(),
+            offload_msg
+        ));
+    }
+
+    if (needs_writing) {
+        write_frame();
+    }
+}
+
+template <typename config>
+void connection<config>::offload_prepare(message_ptr msg) {
+    // While this runs no other message is framed by the processor, everything
+    // sent in the meantime waits in the offload queue.
+    message_ptr outgoing_msg = m_msg_manager->get_message();
+    lib::error_code ec;
+
+    if (!outgoing_msg) {
+        ec = error::make_error_code(error::no_outgoing_buffers);
+    } else {
+        // The random number generator is shared with the event loop. Only
+        // drawing the masking key needs the lock, not the compression.
+        frame::masking_key_type key;
+        key.i = 0;
+        if (!m_is_server) {
+            scoped_lock_type lock(m_rng_lock);
+            key.i = m_rng();
+        }
+
+        ec = m_processor->prepare_data_frame(msg,outgoing_msg,key);
+        outgoing_msg->set_priority(msg->get_priority());
+    }
+
+    lib::error_code dispatch_ec = transport_con_type::dispatch(lib::bind(
+        &type::handle_offload_prepared,
+        type::get_shared(),
+        outgoing_msg,
+        ec
+    ));
+
+    if (dispatch_ec) {
+        log_err(log::elevel::rerror,"offload_prepare",dispatch_ec);
+    }
+}
+
+template <typename config>
+void connection<config>::handle_offload_prepared(message_ptr outgoing_msg,
+    lib::error_code const & ec)
+{
+    {
+        scoped_lock_type lock(m_connection_state_lock);
+        if (m_state == session::state::closed) {
+            m_alog->write(log::alevel::devel,
+                "handle_offload_prepared: connection already closed");
+
+            scoped_lock_type write_lock(m_write_lock);
+            m_offload_queue.clear();
+            m_offload_running = false;
+            return;
+        }
+    }
+
+    {
+        scoped_lock_type lock(m_write_lock);
+
+        m_offload_queue.pop_front();
+
+        if (ec) {
+            log_err(log::elevel::rerror,"handle_offload_prepared",ec);
+        } else {
+            write_push(outgoing_msg);
+        }
+    }
+
+    process_offload_queue();
+}
+
+template <typename config>
+lib::error_code connection<config>::begin_message(frame::opcode::value op)
+{
+    if (m_alog->static_test(log::alevel::devel)) {
+        m_alog->write(log::alevel::devel,"connection begin_message");
+    }
+
+    if (frame::opcode::is_control(op) || frame::opcode::reserved(op) ||
+        op == frame::opcode::continuation)
+    {
+        return processor::error::make_error_code(
+            processor::error::invalid_opcode);
+    }
+
+    {
+        scoped_lock_type lock(m_connection_state_lock);
+        if (m_state != session::state::open) {
+           return error::make_error_code(error::invalid_state);
+        }
+    }
+
+    bool start_offload = false;
+    {
+        scoped_lock_type lock(m_write_lock);
+
+        if (m_stream_open) {
+            return error::make_error_code(error::invalid_state);
+        }
+
+        // messages sent before the stream was started are framed ahead of it
+        if (config::enable_mpsc_send_queue) {
+            start_offload = drain_pending_sends();
+        }
+
+        m_stream_open = true;
+        m_stream_started = false;
+        m_stream_opcode = op;
+        m_stream_validator.reset();
+    }
+
+    if (start_offload) {
+        transport_con_type::dispatch(lib::bind(
+            &type::process_offload_queue,
+            type::get_shared()
+        ));
+    }
+
+    return lib::error_code();
+}
+
+template <typename config>
+lib::error_code connection<config>::send_fragment(std::string const & payload,
+    bool fin)
+{
+    return send_fragment(payload.data(),payload.size(),fin);
+}
+
+template <typename config>
+lib::error_code connection<config>::send_fragment(void const * payload,
+    size_t len, bool fin)
+{
+    if (m_alog->static_test(log::alevel::devel)) {
+        m_alog->write(log::alevel::devel,"connection send_fragment");
+    }
+
+    {
+        scoped_lock_type lock(m_connection_state_lock);
+        if (m_state != session::state::open) {
+           return error::make_error_code(error::invalid_state);
+        }
+    }
+
+    message_ptr msg = m_msg_manager->get_message(frame::opcode::continuation,
+        len);
+    message_ptr outgoing_msg = m_msg_manager->get_message();
+
+    if (!msg || !outgoing_msg) {
+        return error::make_error_code(error::no_outgoing_buffers);
+    }
+
+    msg->append_payload(payload,len);
+    msg->set_fin(fin);
+
+    bool needs_writing = false;
+    bool start_offload = false;
+    {
+        scoped_lock_type lock(m_write_lock);
+
+        if (!m_stream_open) {
+            return error::make_error_code(error::invalid_state);
+        }
+
+        // Text messages are validated across fragment boundaries here, the
+        // processor only sees one fragment at a time. The copy is kept only
+        // once the fragment has been queued, so a rejected fragment leaves
+        // the stream as it was.
+        utf8_validator::validator validator = m_stream_validator;
+        if (m_stream_opcode == frame::opcode::text) {
+            char const * begin = static_cast<char const *>(payload);
+            if (!validator.decode(begin,begin+len) ||
+                (fin && !validator.complete()))
+            {
+                return error::make_error_code(error::invalid_utf8);
+            }
+        }
+
+        if (!m_stream_started) {
+            msg->set_opcode(m_stream_opcode);
+        }
+
+        if (!m_offload_queue.empty()) {
+            // Keep behind messages still being compressed. The processor may
+            // be in use on the compression executor so the fragment is
+            // framed once it reaches the front of the offload queue.
+            m_offload_queue.push_back(msg);
+        } else {
+            lib::error_code ec = m_processor->prepare_data_frame(msg,
+                outgoing_msg);
+
+            if (ec) {
+                return ec;
+            }
+
+            write_push(outgoing_msg);
+        }
+
+        m_stream_validator = validator;
+        m_stream_started = true;
+
+        if (fin) {
+            m_stream_open = false;
+
+            // frame messages that were sent while the stream was open
+            if (config::enable_mpsc_send_queue) {
+                start_offload = drain_pending_sends();
+            }
+        }
+        needs_writing = !m_write_flag && !send_queue_empty();
+    }
+
+    if (start_offload) {
+        transport_con_type::dispatch(lib::bind(
+            &type::process_offload_queue,
+            type::get_shared()
+        ));
     }
 
     if (needs_writing) {
@@ -151,6 +654,67 @@ lib::error_code connection<config>::send(typename config::message_type::ptr msg)
     return lib::error_code();
 }
 
+template <typename config>
+lib::error_code connection<config>::end_message() {
+    return send_fragment(std::string(),true);
+}
+
+template <typename config>
+lib::error_code connection<config>::cork() {
+    if (m_alog->static_test(log::alevel::devel)) {
+        m_alog->write(log::alevel::devel,"connection cork");
+    }
+
+    {
+        scoped_lock_type lock(m_write_lock);
+        m_corked = true;
+    }
+
+    return transport_con_type::dispatch(lib::bind(
+        &type::handle_set_cork,
+        type::get_shared(),
+        true
+    ));
+}
+
+template <typename config>
+lib::error_code connection<config>::uncork() {
+    if (m_alog->static_test(log::alevel::devel)) {
+        m_alog->write(log::alevel::devel,"connection uncork");
+    }
+
+    bool needs_writing = false;
+    {
+        scoped_lock_type lock(m_write_lock);
+        m_corked = false;
+        m_cork_expired = true;
+        needs_writing = !m_write_flag && (!send_queue_empty() ||
+            m_fragment_msg);
+    }
+
+    if (needs_writing) {
+        transport_con_type::dispatch(lib::bind(
+            &type::write_frame,
+            type::get_shared()
+        ));
+    }
+
+    return transport_con_type::dispatch(lib::bind(
+        &type::handle_set_cork,
+        type::get_shared(),
+        false
+    ));
+}
+
+template <typename config>
+void connection<config>::handle_set_cork(bool value) {
+    // Corking the socket as well is only an optimization
+    lib::error_code ec = transport_con_type::set_cork(value);
+    if (ec && ec != transport::error::operation_not_supported) {
+        log_err(log::elevel::info,"handle_set_cork",ec);
+    }
+}
+
 template <typename config>
 void connection<config>::ping(std::string const& payload, lib::error_code& ec) {
     if (m_alog->static_test(log::alevel::devel)) {
@@ -174,7 +738,10 @@ void connection<config>::ping(std::string const& payload, lib::error_code& ec) {
         return;
     }
 
-    ec = m_processor->prepare_ping(payload,msg);
+    {
+        scoped_lock_type lock(m_rng_lock);
+        ec = m_processor->prepare_ping(payload,msg);
+    }
     if (ec) {return;}
 
     // set ping timer if we are listening for one
@@ -207,7 +774,7 @@ void connection<config>::ping(std::string const& payload, lib::error_code& ec) {
     {
         scoped_lock_type lock(m_write_lock);
         write_push(msg);
-        needs_writing = !m_write_flag && !m_send_queue.empty();
+        needs_writing = !m_write_flag && !send_queue_empty();
     }
 
     if (needs_writing) {
@@ -271,14 +838,17 @@ void connection<config>::pong(std::string const& payload, lib::error_code& ec) {
         return;
     }
 
-    ec = m_processor->prepare_pong(payload,msg);
+    {
+        scoped_lock_type lock(m_rng_lock);
+        ec = m_processor->prepare_pong(payload,msg);
+    }
     if (ec) {return;}
 
     bool needs_writing = false;
     {
         scoped_lock_type lock(m_write_lock);
         write_push(msg);
-        needs_writing = !m_write_flag && !m_send_queue.empty();
+        needs_writing = !m_write_flag && !send_queue_empty();
     }
 
     if (needs_writing) {
@@ -572,6 +1142,7 @@ void connection<config>::set_body(std::string const & value) {
                       error::make_error_code(error::invalid_state));
     }
 
+    m_response_modified = true;
     m_response.set_body(value);
 }
 
@@ -583,6 +1154,7 @@ void connection<config>::append_header(std::string const & key,
     if (m_is_server) {
         if (m_internal_state == istate::PROCESS_HTTP_REQUEST) {
             // we are setting response headers for an incoming server connection
+            m_response_modified = true;
             m_response.append_header(key,val);
         } else {
             throw exception("Call to append_header from invalid state",
@@ -599,112 +1171,464 @@ void connection<config>::append_header(std::string const & key,
     }
 }
 
-// TODO: EXCEPTION_FREE
+// TODO: EXCEPTION_FREE
+template <typename config>
+void connection<config>::replace_header(std::string const & key,
+    std::string const & val)
+{
+    if (m_is_server) {
+        if (m_internal_state == istate::PROCESS_HTTP_REQUEST) {
+            // we are setting response headers for an incoming server connection
+            m_response_modified = true;
+            m_response.replace_header(key,val);
+        } else {
+            throw exception("Call to replace_header from invalid state",
+                        error::make_error_code(error::invalid_state));
+        }
+    } else {
+        if (m_internal_state == istate::USER_INIT) {
+            // we are setting initial headers for an outgoing client connection
+            m_request.replace_header(key,val);
+        } else {
+            throw exception("Call to replace_header from invalid state",
+                        error::make_error_code(error::invalid_state));
+        }
+    }
+}
+
+// TODO: EXCEPTION_FREE
+template <typename config>
+void connection<config>::remove_header(std::string const & key)
+{
+    if (m_is_server) {
+        if (m_internal_state == istate::PROCESS_HTTP_REQUEST) {
+            // we are setting response headers for an incoming server connection
+            m_response_modified = true;
+            m_response.remove_header(key);
+        } else {
+            throw exception("Call to remove_header from invalid state",
+                        error::make_error_code(error::invalid_state));
+        }
+    } else {
+        if (m_internal_state == istate::USER_INIT) {
+            // we are setting initial headers for an outgoing client connection
+            m_request.remove_header(key);
+        } else {
+            throw exception("Call to remove_header from invalid state",
+                        error::make_error_code(error::invalid_state));
+        }
+    }
+}
+
+/// Defer HTTP Response until later
+/**
+ * Used in the http handler to defer the HTTP response for this connection
+ * until later. Handshake timers will be canceled and the connection will be
+ * left open until `send_http_response` or an equivalent is called.
+ *
+ * Warning: deferred connections won't time out and as a result can tie up
+ * resources.
+ *
+ * @return A status code, zero on success, non-zero otherwise
+ */
+template <typename config>
+lib::error_code connection<config>::defer_http_response() {
+    // Cancel handshake timer, otherwise the connection will time out and we'll
+    // close the connection before the app has a chance to send a response.
+    // A deferred WebSocket handshake keeps its timer so that a validation
+    // that never completes still times out.
+    if (m_is_http && m_handshake_timer) {
+        m_handshake_timer->cancel();
+        m_handshake_timer.reset();
+    }
+    
+    // Do something to signal deferral
+    m_http_state = session::http_state::deferred;
+    
+    return lib::error_code();
+}
+
+/// Send deferred HTTP Response (exception free)
+/**
+ * Sends an http response to an HTTP connection that was deferred. This will
+ * send a complete response including all headers, status line, and body
+ * text. The connection will be closed afterwards.
+ *
+ * @since 0.6.0
+ *
+ * @param ec A status code, zero on success, non-zero otherwise
+ */
+template <typename config>
+void connection<config>::send_http_response(lib::error_code & ec) {
+    {
+        scoped_lock_type lock(m_connection_state_lock);
+        if (!m_is_http || m_http_state != session::http_state::deferred) {
+            ec = error::make_error_code(error::invalid_state);
+            return;
+        }
+    
+        m_http_state = session::http_state::body_written;
+    }
+    
+    this->write_http_response(lib::error_code());
+    ec = lib::error_code();
+}
+
+template <typename config>
+lib::error_code connection<config>::accept_handshake() {
+    {
+        scoped_lock_type lock(m_connection_state_lock);
+        if (m_is_http || m_http_state != session::http_state::deferred ||
+            m_state != session::state::connecting)
+        {
+            return error::make_error_code(error::invalid_state);
+        }
+        m_http_state = session::http_state::body_written;
+    }
+
+    return transport_con_type::dispatch(lib::bind(
+        &type::handle_deferred_handshake,
+        type::get_shared(),
+        true,
+        http::status_code::switching_protocols
+    ));
+}
+
+template <typename config>
+lib::error_code connection<config>::reject_handshake(
+    http::status_code::value code)
+{
+    {
+        scoped_lock_type lock(m_connection_state_lock);
+        if (m_is_http || m_http_state != session::http_state::deferred ||
+            m_state != session::state::connecting)
+        {
+            return error::make_error_code(error::invalid_state);
+        }
+        m_http_state = session::http_state::body_written;
+    }
+
+    return transport_con_type::dispatch(lib::bind(
+        &type::handle_deferred_handshake,
+        type::get_shared(),
+        false,
+        code
+    ));
+}
+
+template <typename config>
+void connection<config>::handle_deferred_handshake(bool accept,
+    http::status_code::value code)
+{
+    m_alog->write(log::alevel::devel,"connection handle_deferred_handshake");
+
+    {
+        scoped_lock_type lock(m_connection_state_lock);
+        if (m_state != session::state::connecting) {
+            // the handshake timed out or the connection was terminated
+            // after accept_handshake or reject_handshake was called
+            m_alog->write(log::alevel::devel,
+                "handle_deferred_handshake: connection no longer connecting");
+            return;
+        }
+    }
+
+    if (accept) {
+        this->write_http_response(this->process_handshake_accept());
+    } else {
+        m_response.set_status(code);
+        this->write_http_response(this->process_handshake_reject());
+    }
+}
+
+template <typename config>
+void connection<config>::send_http_response() {
+    lib::error_code ec;
+    this->send_http_response(ec);
+    if (ec) {
+        throw exception(ec);
+    }
+}
+
+template <typename config>
+lib::error_code connection<config>::begin_http_body() {
+    {
+        scoped_lock_type lock(m_connection_state_lock);
+        if (!m_is_http || !m_response.get_body().empty() ||
+            (m_http_state != session::http_state::init &&
+             m_http_state != session::http_state::deferred))
+        {
+            return error::make_error_code(error::invalid_state);
+        }
+        m_http_state = session::http_state::headers_written;
+    }
+
+    if (m_response.get_status_code() == http::status_code::uninitialized) {
+        m_response.set_status(http::status_code::ok);
+    }
+    m_response.set_version("HTTP/1.1");
+
+    std::string const & length = m_response.get_header("Content-Length");
+    if (!length.empty()) {
+        m_http_body_chunked = false;
+        m_http_body_remaining = static_cast<int64_t>(
+            std::strtoul(length.c_str(),NULL,10));
+    } else if (m_request.get_version() == "HTTP/1.1") {
+        m_http_body_chunked = true;
+        m_http_body_remaining = -1;
+        m_response.replace_header("Transfer-Encoding","chunked");
+    } else {
+        // HTTP/1.0 clients read until the connection closes
+        m_http_body_chunked = false;
+        m_http_body_remaining = -1;
+    }
+
+    this->set_http_connection_headers(m_http_body_chunked ||
+        m_http_body_remaining >= 0);
+
+    // Set server header based on the user agent settings
+    if (m_response.get_header("Server").empty()) {
+        if (!m_user_agent.empty()) {
+            m_response.replace_header("Server",m_user_agent);
+        } else {
+            m_response.remove_header("Server");
+        }
+    }
+
+    http_body_piece head;
+    head.data = m_response.raw();
+    head.buffered = head.data.size();
+
+    if (m_alog->static_test(log::alevel::devel)) {
+        m_alog->write(log::alevel::devel,"Raw streamed response:\n"+head.data);
+    }
+
+    {
+        scoped_lock_type lock(m_write_lock);
+        m_http_body_ended = false;
+        m_send_buffer_size += head.buffered;
+        m_http_body_queue.push_back(head);
+    }
+
+    return transport_con_type::dispatch(lib::bind(
+        &type::handle_begin_http_body,
+        type::get_shared()
+    ));
+}
+
+template <typename config>
+lib::error_code connection<config>::send_http_body(std::string const & data)
+{
+    return this->send_http_body(data.data(),data.size());
+}
+
+template <typename config>
+lib::error_code connection<config>::send_http_body(void const * data,
+    size_t len)
+{
+    {
+        scoped_lock_type lock(m_connection_state_lock);
+        if (m_http_state != session::http_state::headers_written) {
+            return error::make_error_code(error::invalid_state);
+        }
+    }
+
+    // an empty chunk would end a chunked body
+    if (len == 0) {
+        return lib::error_code();
+    }
+
+    return this->queue_http_body(data,len,
+        lib::shared_ptr<std::string const>());
+}
+
 template <typename config>
-void connection<config>::replace_header(std::string const & key,
-    std::string const & val)
+lib::error_code connection<config>::send_http_body(
+    lib::shared_ptr<std::string const> data)
 {
-    if (m_is_server) {
-        if (m_internal_state == istate::PROCESS_HTTP_REQUEST) {
-            // we are setting response headers for an incoming server connection
-            m_response.replace_header(key,val);
-        } else {
-            throw exception("Call to replace_header from invalid state",
-                        error::make_error_code(error::invalid_state));
+    {
+        scoped_lock_type lock(m_connection_state_lock);
+        if (m_http_state != session::http_state::headers_written) {
+            return error::make_error_code(error::invalid_state);
         }
+    }
+
+    if (!data || data->empty()) {
+        return lib::error_code();
+    }
+
+    return this->queue_http_body(data->data(),data->size(),data);
+}
+
+template <typename config>
+lib::error_code connection<config>::queue_http_body(void const * data,
+    size_t len, lib::shared_ptr<std::string const> const & shared)
+{
+    http_body_piece piece;
+
+    if (shared && !m_http_body_chunked) {
+        piece.shared = shared;
+        piece.buffered = len;
+    } else if (m_http_body_chunked) {
+        std::stringstream s;
+        s << std::hex << len << "\r\n";
+        piece.data = s.str();
+        piece.data.append(static_cast<char const *>(data),len);
+        piece.data.append("\r\n");
+        piece.buffered = piece.data.size();
     } else {
-        if (m_internal_state == istate::USER_INIT) {
-            // we are setting initial headers for an outgoing client connection
-            m_request.replace_header(key,val);
-        } else {
-            throw exception("Call to replace_header from invalid state",
-                        error::make_error_code(error::invalid_state));
+        piece.data.assign(static_cast<char const *>(data),len);
+        piece.buffered = piece.data.size();
+    }
+
+    {
+        scoped_lock_type lock(m_write_lock);
+
+        if (m_http_body_remaining >= 0) {
+            if (static_cast<uint64_t>(m_http_body_remaining) < len) {
+                return error::make_error_code(error::invalid_http_body_length);
+            }
+            m_http_body_remaining -= static_cast<int64_t>(len);
         }
+
+        m_send_buffer_size += piece.buffered;
+        if (m_send_buffer_size >= m_send_buffer_watermark) {
+            m_send_blocked = true;
+        }
+        m_http_body_queue.push_back(piece);
     }
+
+    return transport_con_type::dispatch(lib::bind(
+        &type::write_http_body,
+        type::get_shared()
+    ));
 }
 
-// TODO: EXCEPTION_FREE
 template <typename config>
-void connection<config>::remove_header(std::string const & key)
+lib::error_code connection<config>::send_http_file(std::string const & path,
+    uint64_t offset, uint64_t len)
 {
-    if (m_is_server) {
-        if (m_internal_state == istate::PROCESS_HTTP_REQUEST) {
-            // we are setting response headers for an incoming server connection
-            m_response.remove_header(key);
-        } else {
-            throw exception("Call to remove_header from invalid state",
-                        error::make_error_code(error::invalid_state));
+    {
+        scoped_lock_type lock(m_connection_state_lock);
+        if (m_http_state != session::http_state::headers_written) {
+            return error::make_error_code(error::invalid_state);
         }
-    } else {
-        if (m_internal_state == istate::USER_INIT) {
-            // we are setting initial headers for an outgoing client connection
-            m_request.remove_header(key);
+    }
+
+    std::FILE * f = std::fopen(path.c_str(),"rb");
+    if (!f) {
+        m_elog->write(log::elevel::info,"send_http_file: unable to open "+path);
+        return error::make_error_code(error::http_body_file);
+    }
+
+    http_body_piece piece;
+    piece.file.reset(f,std::fclose);
+    piece.offset = offset;
+    piece.length = len;
+
+    if (len == 0) {
+        return lib::error_code();
+    }
+
+    {
+        scoped_lock_type lock(m_write_lock);
+
+        if (m_http_body_remaining >= 0) {
+            if (static_cast<uint64_t>(m_http_body_remaining) < len) {
+                return error::make_error_code(error::invalid_http_body_length);
+            }
+            m_http_body_remaining -= static_cast<int64_t>(len);
+        }
+
+        if (m_http_body_chunked) {
+            http_body_piece chunk_head;
+            std::stringstream s;
+            s << std::hex << len << "\r\n";
+            chunk_head.data = s.str();
+            chunk_head.buffered = chunk_head.data.size();
+
+            http_body_piece chunk_tail;
+            chunk_tail.data = "\r\n";
+            chunk_tail.buffered = chunk_tail.data.size();
+
+            m_send_buffer_size += chunk_head.buffered + chunk_tail.buffered;
+            m_http_body_queue.push_back(chunk_head);
+            m_http_body_queue.push_back(piece);
+            m_http_body_queue.push_back(chunk_tail);
         } else {
-            throw exception("Call to remove_header from invalid state",
-                        error::make_error_code(error::invalid_state));
+            m_http_body_queue.push_back(piece);
         }
     }
+
+    return transport_con_type::dispatch(lib::bind(
+        &type::write_http_body,
+        type::get_shared()
+    ));
 }
 
-/// Defer HTTP Response until later
-/**
- * Used in the http handler to defer the HTTP response for this connection
- * until later. Handshake timers will be canceled and the connection will be
- * left open until `send_http_response` or an equivalent is called.
- *
- * Warning: deferred connections won't time out and as a result can tie up
- * resources.
- *
- * @return A status code, zero on success, non-zero otherwise
- */
 template <typename config>
-lib::error_code connection<config>::defer_http_response() {
-    // Cancel handshake timer, otherwise the connection will time out and we'll
-    // close the connection before the app has a chance to send a response.
-    if (m_handshake_timer) {
-        m_handshake_timer->cancel();
-        m_handshake_timer.reset();
+lib::error_code connection<config>::send_http_file(std::string const & path)
+{
+    std::FILE * f = std::fopen(path.c_str(),"rb");
+    if (!f) {
+        m_elog->write(log::elevel::info,"send_http_file: unable to open "+path);
+        return error::make_error_code(error::http_body_file);
     }
-    
-    // Do something to signal deferral
-    m_http_state = session::http_state::deferred;
-    
-    return lib::error_code();
+
+    uint64_t size;
+    int result = lib::fsize64(f,size);
+    std::fclose(f);
+
+    if (result != 0) {
+        return error::make_error_code(error::http_body_file);
+    }
+
+    return this->send_http_file(path,0,size);
 }
 
-/// Send deferred HTTP Response (exception free)
-/**
- * Sends an http response to an HTTP connection that was deferred. This will
- * send a complete response including all headers, status line, and body
- * text. The connection will be closed afterwards.
- *
- * @since 0.6.0
- *
- * @param ec A status code, zero on success, non-zero otherwise
- */
 template <typename config>
-void connection<config>::send_http_response(lib::error_code & ec) {
+lib::error_code connection<config>::end_http_body() {
     {
         scoped_lock_type lock(m_connection_state_lock);
-        if (m_http_state != session::http_state::deferred) {
-            ec = error::make_error_code(error::invalid_state);
-            return;
+        if (m_http_state != session::http_state::headers_written) {
+            return error::make_error_code(error::invalid_state);
         }
-    
         m_http_state = session::http_state::body_written;
     }
-    
-    this->write_http_response(lib::error_code());
-    ec = lib::error_code();
-}
 
-template <typename config>
-void connection<config>::send_http_response() {
     lib::error_code ec;
-    this->send_http_response(ec);
-    if (ec) {
-        throw exception(ec);
+    bool done;
+
+    {
+        scoped_lock_type lock(m_write_lock);
+
+        if (m_http_body_remaining > 0) {
+            // The client is still waiting for the rest of the body. The only
+            // way to tell it that none is coming is to close the connection.
+            m_http_keep_alive = false;
+            ec = error::make_error_code(error::invalid_http_body_length);
+        }
+
+        if (m_http_body_chunked) {
+            http_body_piece last;
+            last.data = "0\r\n\r\n";
+            last.buffered = last.data.size();
+            m_send_buffer_size += last.buffered;
+            m_http_body_queue.push_back(last);
+        }
+
+        m_http_body_ended = true;
+        done = m_http_body_queue.empty() && !m_http_body_writing;
     }
+
+    // Finishing the body moves the connection on to the next request, which
+    // has to happen within the transport's event loop.
+    lib::error_code dispatch_ec = transport_con_type::dispatch(lib::bind(
+        &type::handle_end_http_body,
+        type::get_shared(),
+        done
+    ));
+    return ec ? ec : dispatch_ec;
 }
 
 
@@ -760,6 +1684,7 @@ void connection<config>::handle_transport_init(lib::error_code const & ec) {
     // At this point the transport is ready to read and write bytes.
     if (m_is_server) {
         m_internal_state = istate::READ_HTTP_REQUEST;
+        m_request.set_indexed_headers(true);
         this->read_handshake(1);
     } else {
         // We are a client. Set the processor to the version specified in the
@@ -873,6 +1798,17 @@ void connection<config>::handle_read_handshake(lib::error_code const & ec,
         m_alog->write(log::alevel::devel,s.str());
     }
 
+    // Hand the body bytes of this read to the application rather than
+    // buffering them
+    if (m_http_body_handler && !m_request.get_body().empty()) {
+        m_http_body_handler(m_connection_hdl,m_request.get_body());
+        m_request.clear_body();
+
+        if (m_state != session::state::connecting) {
+            return;
+        }
+    }
+
     if (m_request.ready()) {
         lib::error_code processor_ec = this->initialize_processor();
         if (processor_ec) {
@@ -916,12 +1852,19 @@ void connection<config>::handle_read_handshake(lib::error_code const & ec,
         m_internal_state = istate::PROCESS_HTTP_REQUEST;
         
         // We have the complete request. Process it.
+        size_t request_count = m_http_request_count;
         lib::error_code handshake_ec = this->process_handshake_request();
+
+        // The http handler may have written the whole response already, in
+        // which case the connection has moved on to the next request.
+        if (request_count != m_http_request_count) {
+            return;
+        }
         
-        // Write a response if this is a websocket connection or if it is an
-        // HTTP connection for which the response has not been deferred or
-        // started yet by a different system (i.e. still in init state).
-        if (!m_is_http || m_http_state == session::http_state::init) {
+        // Write a response unless it has been deferred or started already by
+        // a different system (i.e. no longer in init state). Only the http
+        // handler and the validate handler can change the state.
+        if (m_http_state == session::http_state::init) {
             this->write_http_response(handshake_ec);
         }
     } else {
@@ -959,6 +1902,103 @@ void connection<config>::write_http_response_error(lib::error_code const & ec) {
     this->write_http_response(ec);
 }
 
+template <typename config>
+bool connection<config>::http_keep_alive_allowed() const {
+    if (m_ec || m_state != session::state::connecting) {
+        return false;
+    }
+
+    // The application may close the connection by setting the header itself
+    std::string const & res_conn = m_response.get_header("Connection");
+    if (utility::ci_find_substr(res_conn,"close",5) != res_conn.end()) {
+        return false;
+    }
+
+    std::string const & req_conn = m_request.get_header("Connection");
+    if (m_request.get_version() == "HTTP/1.1") {
+        return utility::ci_find_substr(req_conn,"close",5) == req_conn.end();
+    } else if (m_request.get_version() == "HTTP/1.0") {
+        return utility::ci_find_substr(req_conn,"keep-alive",10) !=
+            req_conn.end();
+    }
+    return false;
+}
+
+template <typename config>
+void connection<config>::read_next_http_request() {
+    m_alog->write(log::alevel::devel,"connection read_next_http_request");
+
+    size_t max_body_size = m_request.get_max_body_size();
+    bool stream_body = m_request.get_stream_body();
+
+    m_request = request_type();
+    m_request.set_max_body_size(max_body_size);
+    m_request.set_stream_body(stream_body);
+    m_request.set_indexed_headers(true);
+    m_response = response_type();
+    m_uri.reset();
+
+    m_ec = lib::error_code();
+    m_is_http = false;
+    m_http_state = session::http_state::init;
+    m_http_keep_alive = false;
+    m_http_body_ended = false;
+    m_http_body_chunked = false;
+    m_http_body_remaining = -1;
+    m_response_modified = false;
+    m_raw_response_ready = false;
+    ++m_http_request_count;
+
+    m_internal_state = istate::READ_HTTP_REQUEST;
+
+    m_handshake_timer = transport_con_type::set_timer(
+        m_http_keep_alive_timeout_dur,
+        lib::bind(
+            &type::handle_http_keep_alive_timeout,
+            type::get_shared(),
+            lib::placeholders::_1
+        )
+    );
+
+    if (m_buf_cursor > 0) {
+        // A pipelined request was read along with the previous one. Process
+        // the bytes that are already buffered before reading more.
+        size_t buffered = m_buf_cursor;
+        m_buf_cursor = 0;
+        this->handle_read_handshake(lib::error_code(),buffered);
+        return;
+    }
+
+    transport_con_type::async_read_at_least(
+        1,
+        m_buf,
+        config::connection_read_buffer_size,
+        lib::bind(
+            &type::handle_read_handshake,
+            type::get_shared(),
+            lib::placeholders::_1,
+            lib::placeholders::_2
+        )
+    );
+}
+
+template <typename config>
+void connection<config>::set_http_connection_headers(bool framed) {
+    m_http_keep_alive = false;
+
+    if (m_http_keep_alive_timeout_dur <= 0) {
+        return;
+    }
+
+    m_http_keep_alive = framed && this->http_keep_alive_allowed();
+
+    if (!m_http_keep_alive) {
+        m_response.replace_header("Connection","close");
+    } else if (m_request.get_version() == "HTTP/1.0") {
+        m_response.replace_header("Connection","keep-alive");
+    }
+}
+
 // All exit paths for this function need to call write_http_response() or submit
 // a new read request with this function as the handler.
 template <typename config>
@@ -1021,7 +2061,23 @@ void connection<config>::handle_read_frame(lib::error_code const & ec,
         return;
     }*/
 
-    size_t p = 0;
+    process_read_frame(0, bytes_transferred);
+}
+
+/// Process read data from offset until it runs out or a read budget is hit
+template <typename config>
+void connection<config>::process_read_frame(size_t offset,
+    size_t bytes_transferred)
+{
+    if (offset > 0 && m_internal_state != istate::PROCESS_CONNECTION) {
+        // The connection was terminated while this handler was waiting
+        m_alog->write(log::alevel::devel,
+            "process_read_frame: connection no longer processing");
+        return;
+    }
+
+    size_t p = offset;
+    size_t messages = 0;
 
     if (m_alog->static_test(log::alevel::devel)) {
         std::stringstream s;
@@ -1058,6 +2114,9 @@ void connection<config>::handle_read_frame(lib::error_code const & ec,
         if (consume_ec) {
             log_err(log::elevel::rerror, "consume", consume_ec);
 
+            // messages completed before the error are still delivered
+            deliver_message_batch();
+
             if (config::drop_on_protocol_error) {
                 this->terminate(consume_ec);
                 return;
@@ -1093,18 +2152,82 @@ void connection<config>::handle_read_frame(lib::error_code const & ec,
                 // data message, dispatch to user
                 if (m_state != session::state::open) {
                     m_elog->write(log::elevel::warn, "got non-close frame while closing");
+                } else if (m_message_batch_handler) {
+                    m_read_batch.push_back(msg);
                 } else if (m_message_handler) {
                     m_message_handler(m_connection_hdl, msg);
                 }
             } else {
+                // keep data messages ordered ahead of the control frame that
+                // followed them
+                deliver_message_batch();
                 process_control_frame(msg);
             }
+
+            messages++;
+        }
+
+        if (p >= bytes_transferred) {
+            break;
+        }
+
+        // Yield the transport thread to other connections once this one has
+        // used up its budget and finish processing from a posted handler
+        bool byte_budget_hit = m_read_budget_bytes > 0 &&
+            p - offset >= m_read_budget_bytes;
+        bool message_budget_hit = m_read_budget_messages > 0 &&
+            messages >= m_read_budget_messages;
+
+        if (byte_budget_hit || message_budget_hit) {
+            deliver_message_batch();
+
+            if (byte_budget_hit) {
+                m_read_byte_budget_hits++;
+            }
+            if (message_budget_hit) {
+                m_read_message_budget_hits++;
+            }
+
+            if (m_alog->static_test(log::alevel::devel)) {
+                std::stringstream s;
+                s << "read budget hit, yielding with " << bytes_transferred-p
+                  << " bytes left";
+                m_alog->write(log::alevel::devel,s.str());
+            }
+
+            lib::error_code ec = transport_con_type::dispatch(lib::bind(
+                &type::process_read_frame,
+                type::get_shared(),
+                p,
+                bytes_transferred
+            ));
+            if (ec) {
+                log_err(log::elevel::rerror, "process_read_frame", ec);
+                this->terminate(ec);
+            }
+            return;
         }
     }
 
+    deliver_message_batch();
+
     read_frame();
 }
 
+template <typename config>
+void connection<config>::deliver_message_batch() {
+    if (m_read_batch.empty()) {
+        return;
+    }
+
+    if (m_message_batch_handler) {
+        m_message_batch_handler(m_connection_hdl, m_read_batch);
+    }
+
+    // clear keeps the capacity for the next batch
+    m_read_batch.clear();
+}
+
 /// Issue a new transport read unless reading is paused.
 template <typename config>
 void connection<config>::read_frame() {
@@ -1260,36 +2383,86 @@ lib::error_code connection<config>::process_handshake_request() {
     }
 
     // Ask application to validate the connection
-    if (!m_validate_handler || m_validate_handler(m_connection_hdl)) {
-        m_response.set_status(http::status_code::switching_protocols);
+    bool valid = true;
+    if (m_validate_handler) {
+        valid = m_validate_handler(m_connection_hdl);
+
+        // The application deferred its decision, and may already have made it
+        // by calling accept_handshake or reject_handshake.
+        if (m_http_state != session::http_state::init) {
+            return lib::error_code();
+        }
+    }
 
-        // Write the appropriate response headers based on request and
-        // processor version
-        ec = m_processor->process_handshake(m_request,m_subprotocol,m_response);
+    if (valid) {
+        return this->process_handshake_accept();
+    } else {
+        return this->process_handshake_reject();
+    }
+}
 
-        if (ec) {
-            std::stringstream s;
-            s << "Processing error: " << ec << "(" << ec.message() << ")";
-            m_alog->write(log::alevel::devel, s.str());
+template <typename config>
+lib::error_code connection<config>::process_handshake_accept() {
+    lib::error_code ec;
 
-            m_response.set_status(http::status_code::internal_server_error);
-            return ec;
-        }
-    } else {
-        // User application has rejected the handshake
-        m_alog->write(log::alevel::devel, "USER REJECT");
+    m_response.set_status(http::status_code::switching_protocols);
 
-        // Use Bad Request if the user handler did not provide a more
-        // specific http response error code.
-        // TODO: is there a better default?
-        if (m_response.get_status_code() == http::status_code::uninitialized) {
-            m_response.set_status(http::status_code::bad_request);
+    // If the application left the response alone, write it straight from
+    // the template. Otherwise, or if the processor doesn't support
+    // templates, write the appropriate response headers based on request
+    // and processor version.
+    bool use_template = m_response_template && !m_response_modified &&
+        m_response_template->get_server() == m_user_agent;
+
+    if (use_template) {
+        ec = m_processor->write_handshake_response(m_request,m_subprotocol,
+            m_response.get_header("Sec-WebSocket-Extensions"),
+            *m_response_template,m_handshake_buffer,m_response);
+
+        if (ec == processor::error::make_error_code(
+            processor::error::not_implemented))
+        {
+            use_template = false;
+        } else {
+            m_raw_response_ready = !ec;
+
+            // the response is not serialized but may still be inspected
+            if (m_raw_response_ready && !m_user_agent.empty()) {
+                m_response.replace_header("Server",m_user_agent);
+            }
         }
-        
-        return error::make_error_code(error::rejected);
     }
 
-    return lib::error_code();
+    if (!use_template) {
+        ec = m_processor->process_handshake(m_request,m_subprotocol,
+            m_response);
+    }
+
+    if (ec) {
+        std::stringstream s;
+        s << "Processing error: " << ec << "(" << ec.message() << ")";
+        m_alog->write(log::alevel::devel, s.str());
+
+        m_response.set_status(http::status_code::internal_server_error);
+        return ec;
+    }
+
+    return lib::error_code();
+}
+
+template <typename config>
+lib::error_code connection<config>::process_handshake_reject() {
+    // User application has rejected the handshake
+    m_alog->write(log::alevel::devel, "USER REJECT");
+
+    // Use Bad Request if the user handler did not provide a more
+    // specific http response error code.
+    // TODO: is there a better default?
+    if (m_response.get_status_code() == http::status_code::uninitialized) {
+        m_response.set_status(http::status_code::bad_request);
+    }
+    
+    return error::make_error_code(error::rejected);
 }
 
 template <typename config>
@@ -1310,21 +2483,42 @@ void connection<config>::write_http_response(lib::error_code const & ec) {
 
     m_response.set_version("HTTP/1.1");
 
-    // Set server header based on the user agent settings
-    if (m_response.get_header("Server").empty()) {
-        if (!m_user_agent.empty()) {
-            m_response.replace_header("Server",m_user_agent);
-        } else {
-            m_response.remove_header("Server");
+    if (m_is_http) {
+        this->set_http_connection_headers(true);
+
+        if (m_http_keep_alive) {
+            // The client finds the end of this response, and the start of the
+            // next one, from its length.
+            http::status_code::value code = m_response.get_status_code();
+            if (m_response.get_header("Content-Length").empty() &&
+                code >= 200 && code != http::status_code::no_content &&
+                code != http::status_code::not_modified)
+            {
+                std::stringstream len;
+                len << m_response.get_body().size();
+                m_response.replace_header("Content-Length",len.str());
+            }
         }
     }
 
-    // have the processor generate the raw bytes for the wire (if it exists)
-    if (m_processor) {
-        m_handshake_buffer = m_processor->get_raw(m_response);
-    } else {
-        // a processor wont exist for raw HTTP responses.
-        m_handshake_buffer = m_response.raw();
+    if (!m_raw_response_ready) {
+        // Set server header based on the user agent settings
+        if (m_response.get_header("Server").empty()) {
+            if (!m_user_agent.empty()) {
+                m_response.replace_header("Server",m_user_agent);
+            } else {
+                m_response.remove_header("Server");
+            }
+        }
+
+        // have the processor generate the raw bytes for the wire (if it
+        // exists)
+        if (m_processor) {
+            m_handshake_buffer = m_processor->get_raw(m_response);
+        } else {
+            // a processor wont exist for raw HTTP responses.
+            m_handshake_buffer = m_response.raw();
+        }
     }
 
     if (m_alog->static_test(log::alevel::devel)) {
@@ -1403,9 +2597,15 @@ void connection<config>::handle_write_http_response(lib::error_code const & ec)
             m_elog->write(log::elevel::rerror,s.str());
         } else {
             // if this was not a websocket connection, we have written
-            // the expected response and the connection can be closed.
+            // the expected response and the connection can be closed or
+            // reused for the next request.
             
             this->log_http_result();
+
+            if (m_http_keep_alive) {
+                this->read_next_http_request();
+                return;
+            }
             
             if (m_ec) {
                 m_alog->write(log::alevel::devel,
@@ -1430,6 +2630,170 @@ void connection<config>::handle_write_http_response(lib::error_code const & ec)
     this->handle_read_frame(lib::error_code(), m_buf_cursor);
 }
 
+template <typename config>
+void connection<config>::write_http_body() {
+    http_body_piece * piece;
+
+    {
+        scoped_lock_type lock(m_write_lock);
+        if (m_http_body_writing || m_http_body_queue.empty()) {
+            return;
+        }
+        m_http_body_writing = true;
+
+        // deque::push_back leaves references to existing elements valid, so
+        // the piece can be used after the lock is released.
+        piece = &m_http_body_queue.front();
+    }
+
+    if (piece->file && !piece->copy &&
+        piece->length <= static_cast<uint64_t>(static_cast<size_t>(-1)))
+    {
+#ifdef _WIN32
+        int fd = _fileno(piece->file.get());
+#else
+        int fd = fileno(piece->file.get());
+#endif
+        // the whole range is written unless the transport declines, and the
+        // handler may run before async_write_file returns
+        uint64_t length = piece->length;
+        piece->length = 0;
+
+        lib::error_code ec = transport_con_type::async_write_file(
+            fd,
+            piece->offset,
+            static_cast<size_t>(length),
+            lib::bind(
+                &type::handle_write_http_body,
+                type::get_shared(),
+                lib::placeholders::_1
+            )
+        );
+
+        if (!ec) {
+            return;
+        }
+
+        piece->length = length;
+        if (ec != transport::error::operation_not_supported) {
+            log_err(log::elevel::rerror,"write_http_body",ec);
+            this->terminate(ec);
+            return;
+        }
+        piece->copy = true;
+    }
+
+    if (piece->file) {
+        // Copy the next block of the file through memory
+        size_t const block_size = 65536;
+        size_t n = piece->length < block_size ?
+            static_cast<size_t>(piece->length) : block_size;
+
+        piece->data.resize(n);
+        if (lib::fseek64(piece->file.get(),piece->offset) != 0 ||
+            std::fread(&piece->data[0],1,n,piece->file.get()) != n)
+        {
+            m_elog->write(log::elevel::rerror,
+                "write_http_body: unable to read file");
+            this->terminate(error::make_error_code(error::http_body_file));
+            return;
+        }
+        piece->offset += n;
+        piece->length -= n;
+    }
+
+    std::string const & buffer = piece->shared ? *piece->shared : piece->data;
+
+    transport_con_type::async_write(
+        buffer.data(),
+        buffer.size(),
+        lib::bind(
+            &type::handle_write_http_body,
+            type::get_shared(),
+            lib::placeholders::_1
+        )
+    );
+}
+
+template <typename config>
+void connection<config>::handle_write_http_body(lib::error_code const & ec) {
+    if (ec) {
+        if (m_state == session::state::closed) {
+            m_alog->write(log::alevel::devel,
+                "handle_write_http_body invoked after connection was closed");
+            return;
+        }
+        log_err(log::elevel::rerror,"handle_write_http_body",ec);
+        this->terminate(ec);
+        return;
+    }
+
+    bool writable = false;
+    bool done;
+
+    {
+        scoped_lock_type lock(m_write_lock);
+
+        http_body_piece & piece = m_http_body_queue.front();
+        if (!piece.file || piece.length == 0) {
+            m_send_buffer_size -= piece.buffered;
+            m_http_body_queue.pop_front();
+        }
+        m_http_body_writing = false;
+
+        if (m_send_blocked && m_send_buffer_size < m_send_buffer_watermark) {
+            m_send_blocked = false;
+            writable = true;
+        }
+
+        done = m_http_body_ended && m_http_body_queue.empty();
+    }
+
+    if (writable && m_writable_handler) {
+        m_writable_handler(m_connection_hdl);
+    }
+
+    if (done) {
+        this->finish_http_body();
+    } else {
+        this->write_http_body();
+    }
+}
+
+template <typename config>
+void connection<config>::handle_begin_http_body() {
+    // A stream may legitimately stay open for a long time
+    if (m_handshake_timer) {
+        m_handshake_timer->cancel();
+        m_handshake_timer.reset();
+    }
+
+    this->write_http_body();
+}
+
+template <typename config>
+void connection<config>::handle_end_http_body(bool done) {
+    // otherwise the handler of the last write finishes the body
+    if (done) {
+        this->finish_http_body();
+    } else {
+        this->write_http_body();
+    }
+}
+
+template <typename config>
+void connection<config>::finish_http_body() {
+    this->log_http_result();
+
+    if (m_http_keep_alive) {
+        this->read_next_http_request();
+        return;
+    }
+
+    m_ec = make_error_code(error::http_connection_ended);
+    this->terminate(m_ec);
+}
+
 template <typename config>
 void connection<config>::send_http_request() {
     m_alog->write(log::alevel::devel,"connection send_http_request");
@@ -1678,6 +3042,21 @@ void connection<config>::handle_open_handshake_timeout(
     }
 }
 
+template <typename config>
+void connection<config>::handle_http_keep_alive_timeout(
+    lib::error_code const & ec)
+{
+    if (ec == transport::error::operation_aborted) {
+        m_alog->write(log::alevel::devel,"http keep-alive timer cancelled");
+    } else if (ec) {
+        m_alog->write(log::alevel::devel,
+            "handle_http_keep_alive_timeout error: "+ec.message());
+    } else {
+        m_alog->write(log::alevel::devel,"http keep-alive timer expired");
+        terminate(make_error_code(error::http_connection_ended));
+    }
+}
+
 template <typename config>
 void connection<config>::handle_close_handshake_timeout(
     lib::error_code const & ec)
@@ -1706,6 +3085,12 @@ void connection<config>::terminate(lib::error_code const & ec) {
         m_handshake_timer.reset();
     }
 
+    // Cancel write corking timer
+    if (m_cork_timer) {
+        m_cork_timer->cancel();
+        m_cork_timer.reset();
+    }
+
     terminate_status tstat = unknown;
     if (ec) {
         m_ec = ec;
@@ -1793,6 +3178,16 @@ template <typename config>
 void connection<config>::write_frame() {
     //m_alog->write(log::alevel::devel,"connection write_frame");
 
+    // The next fragment of a large message, if any, is written after the
+    // messages in m_current_msgs
+    char const * fragment_payload = NULL;
+    size_t fragment_len = 0;
+    bool start_cork_timer = false;
+
+    // Set while data is being held back by cork or the corking delay. Ping
+    // and pong frames are still written so that the peer does not time out.
+    bool control_only = false;
+
     {
         scoped_lock_type lock(m_write_lock);
 
@@ -1804,22 +3199,141 @@ void connection<config>::write_frame() {
             return;
         }
 
-        // pull off all the messages that are ready to write.
-        // stop if we get a message marked terminal
-        message_ptr next_message = write_pop();
-        while (next_message) {
-            m_current_msgs.push_back(next_message);
-            if (!next_message->get_terminal()) {
-                next_message = write_pop();
+        bool control_queued =
+            !m_send_queue[message_buffer::priority::control].empty();
+
+        if (close_queued()) {
+            // Nothing may be written after a close frame, so there is nothing
+            // left to gather. Flush everything held back along with it.
+        } else if (m_corked) {
+            // Data is held back until uncork is called
+            if (!control_queued) {
+                return;
+            }
+            control_only = true;
+        } else if (m_write_cork_delay > 0 && !m_cork_expired &&
+            !write_batch_full())
+        {
+            // Hold the write back for the corking delay to gather more
+            // messages unless enough are already queued to fill a batch.
+            if (control_queued) {
+                control_only = true;
+            } else if (m_cork_pending ||
+                (send_queue_empty() && !m_fragment_msg))
+            {
+                return;
             } else {
-                next_message = message_ptr();
+                m_cork_pending = true;
+                start_cork_timer = true;
+            }
+        }
+    }
+
+    if (start_cork_timer) {
+        // The bundled transports have millisecond timers, so the microsecond
+        // delay is rounded up to a whole millisecond.
+        m_cork_timer = transport_con_type::set_timer(
+            (m_write_cork_delay+999)/1000,
+            lib::bind(
+                &type::handle_cork_timeout,
+                type::get_shared(),
+                lib::placeholders::_1
+            )
+        );
+
+        // transports without timers write immediately
+        if (!m_cork_timer) {
+            handle_cork_timeout(lib::error_code());
+        }
+        return;
+    }
+
+    {
+        scoped_lock_type lock(m_write_lock);
+
+        if (m_write_flag ||
+            (m_corked && !control_only && !close_queued()))
+        {
+            return;
+        }
+
+        if (m_fragment_msg || control_only) {
+            // A large message is partway through being written. Control
+            // frames queued behind it may jump ahead of its next fragment,
+            // other data messages must wait until it is complete.
+            message_ptr next_message;
+            next_message = write_pop(message_buffer::priority::control);
+            while (next_message) {
+                m_current_msgs.push_back(next_message);
+                next_message = write_pop(message_buffer::priority::control);
+            }
+        } else {
+            // pull off all the messages that are ready to write.
+            // stop if we get a message marked terminal, one that needs to be
+            // fragmented, or one that would overflow the batch limits
+            size_t batch_bytes = 0;
+            message_ptr next_message = write_pop();
+            while (next_message) {
+                if (needs_fragmenting(next_message)) {
+                    m_fragment_msg = next_message;
+                    m_fragment_offset = 0;
+                    break;
+                }
+
+                m_current_msgs.push_back(next_message);
+                batch_bytes += next_message->get_header().size() +
+                               next_message->get_payload().size();
+
+                if (next_message->get_terminal()) {
+                    break;
+                }
+
+                message_ptr peek = write_peek();
+                if (!peek) {
+                    break;
+                }
+
+                if (m_max_write_batch_bytes > 0 && batch_bytes +
+                    peek->get_header().size() + peek->get_payload().size() >
+                    m_max_write_batch_bytes)
+                {
+                    break;
+                }
+
+                if (m_max_write_batch_buffers > 0 &&
+                    2*(m_current_msgs.size()+1) > m_max_write_batch_buffers)
+                {
+                    break;
+                }
+
+                next_message = write_pop();
             }
         }
+
+        // Take the next fragment unless data is held back or a terminal
+        // message is being written
+        if (m_fragment_msg && !control_only && (m_current_msgs.empty() ||
+            !m_current_msgs.back()->get_terminal()))
+        {
+            std::string const & payload = m_fragment_msg->get_payload();
+
+            fragment_len = (std::min)(payload.size()-m_fragment_offset,
+                m_max_outgoing_frame_size);
+            m_fragment_header = prepare_fragment_header(m_fragment_msg,
+                m_fragment_offset,fragment_len,fragment_payload);
+
+            m_fragment_offset += fragment_len;
+        }
         
-        if (m_current_msgs.empty()) {
+        if (m_current_msgs.empty() && !fragment_payload) {
             // there was nothing to send
             return;
         } else {
+            // the next write after this one waits out the corking delay again
+            if (!control_only) {
+                m_cork_expired = false;
+            }
+
             // At this point we own the next messages to be sent and are
             // responsible for holding the write flag until they are 
             // successfully sent or there is some error
@@ -1836,6 +3350,13 @@ void connection<config>::write_frame() {
         m_send_buffer.push_back(transport::buffer(payload.c_str(),payload.size()));   
     }
 
+    if (fragment_payload) {
+        m_send_buffer.push_back(transport::buffer(m_fragment_header.c_str(),
+            m_fragment_header.size()));
+        m_send_buffer.push_back(transport::buffer(fragment_payload,
+            fragment_len));
+    }
+
     // Print detailed send stats if those log levels are enabled
     if (m_alog->static_test(log::alevel::frame_header)) {
     if (m_alog->dynamic_test(log::alevel::frame_header)) {
@@ -1892,7 +3413,8 @@ void connection<config>::handle_write_frame(lib::error_code const & ec)
         m_alog->write(log::alevel::devel,"connection handle_write_frame");
     }
 
-    bool terminal = m_current_msgs.back()->get_terminal();
+    bool terminal = !m_current_msgs.empty() &&
+                    m_current_msgs.back()->get_terminal();
 
     m_send_buffer.clear();
     m_current_msgs.clear();
@@ -1910,13 +3432,35 @@ void connection<config>::handle_write_frame(lib::error_code const & ec)
     }
 
     bool needs_writing = false;
+    bool writable = false;
     {
         scoped_lock_type lock(m_write_lock);
 
         // release write flag
         m_write_flag = false;
 
-        needs_writing = !m_send_queue.empty();
+        // release a fragmented message once its last fragment is written
+        if (m_fragment_msg &&
+            m_fragment_offset == m_fragment_msg->get_payload().size())
+        {
+            m_fragment_msg = message_ptr();
+            m_fragment_offset = 0;
+        }
+
+        needs_writing = !send_queue_empty() || m_fragment_msg;
+
+        // messages queued during the last write have already had a chance to
+        // gather, write them without waiting for the corking delay
+        if (needs_writing) {
+            m_cork_expired = true;
+        }
+
+        // if the send buffer grew past the watermark and has since drained
+        // below it let the application know it can resume sending.
+        if (m_send_blocked && m_send_buffer_size < m_send_buffer_watermark) {
+            m_send_blocked = false;
+            writable = true;
+        }
     }
 
     if (needs_writing) {
@@ -1925,6 +3469,10 @@ void connection<config>::handle_write_frame(lib::error_code const & ec)
             type::get_shared()
         ));
     }
+
+    if (writable && m_writable_handler) {
+        m_writable_handler(m_connection_hdl);
+    }
 }
 
 template <typename config>
@@ -2108,8 +3656,12 @@ lib::error_code connection<config>::send_close_frame(close::status::value code,
         return error::make_error_code(error::no_outgoing_buffers);
     }
 
-    lib::error_code ec = m_processor->prepare_close(m_local_close_code,
-        m_local_close_reason,msg);
+    lib::error_code ec;
+    {
+        scoped_lock_type lock(m_rng_lock);
+        ec = m_processor->prepare_close(m_local_close_code,
+            m_local_close_reason,msg);
+    }
     if (ec) {
         return ec;
     }
@@ -2141,10 +3693,29 @@ lib::error_code connection<config>::send_close_frame(close::status::value code,
     }
 
     bool needs_writing = false;
+    bool start_offload = false;
     {
         scoped_lock_type lock(m_write_lock);
-        write_push(msg);
-        needs_writing = !m_write_flag && !m_send_queue.empty();
+
+        // messages already accepted by send are written before the close
+        if (config::enable_mpsc_send_queue) {
+            start_offload = drain_pending_sends();
+        }
+
+        if (!m_offload_queue.empty()) {
+            // keep behind messages still being compressed
+            m_offload_queue.push_back(msg);
+        } else {
+            write_push(msg);
+        }
+        needs_writing = !m_write_flag && !send_queue_empty();
+    }
+
+    if (start_offload) {
+        transport_con_type::dispatch(lib::bind(
+            &type::process_offload_queue,
+            type::get_shared()
+        ));
     }
 
     if (needs_writing) {
@@ -2202,6 +3773,11 @@ connection<config>::get_processor(int version) const {
     
     // Settings not configured by the constructor
     p->set_max_message_size(m_max_message_size);
+
+    // Processors that don't support extensions ignore them
+    for (size_t i = 0; i < m_extensions.size(); i++) {
+        p->add_extension(m_extensions[i]);
+    }
     
     return p;
 }
@@ -2213,40 +3789,211 @@ void connection<config>::write_push(typename config::message_type::ptr msg)
         return;
     }
 
-    m_send_buffer_size += msg->get_payload().size();
-    m_send_queue.push(msg);
+    unsigned int p = send_queue_index(msg);
+    size_t size = msg->get_payload().size();
+
+    m_send_buffer_size += size;
+    m_send_class_size[p] += size;
+    m_send_queue[p].push_back(msg);
+
+    if (m_send_buffer_size >= m_send_buffer_watermark) {
+        m_send_blocked = true;
+    }
 
     if (m_alog->static_test(log::alevel::devel)) {
         std::stringstream s;
-        s << "write_push: message count: " << m_send_queue.size()
-          << " buffer size: " << m_send_buffer_size;
+        s << "write_push: priority: " << p << " message count: "
+          << m_send_queue[p].size() << " buffer size: " << m_send_buffer_size;
         m_alog->write(log::alevel::devel,s.str());
     }
 }
 
 template <typename config>
-typename config::message_type::ptr connection<config>::write_pop()
+typename config::message_type::ptr connection<config>::write_pop(
+    message_buffer::priority::value lowest)
 {
     message_ptr msg;
 
-    if (m_send_queue.empty()) {
+    unsigned int p = 0;
+    while (p <= static_cast<unsigned int>(lowest) && m_send_queue[p].empty()) {
+        p++;
+    }
+
+    if (p > static_cast<unsigned int>(lowest)) {
         return msg;
     }
 
-    msg = m_send_queue.front();
+    msg = m_send_queue[p].front();
 
-    m_send_buffer_size -= msg->get_payload().size();
-    m_send_queue.pop();
+    size_t size = msg->get_payload().size();
+    m_send_buffer_size -= size;
+    m_send_class_size[p] -= size;
+    m_send_queue[p].pop_front();
 
     if (m_alog->static_test(log::alevel::devel)) {
         std::stringstream s;
-        s << "write_pop: message count: " << m_send_queue.size()
-          << " buffer size: " << m_send_buffer_size;
+        s << "write_pop: priority: " << p << " message count: "
+          << m_send_queue[p].size() << " buffer size: " << m_send_buffer_size;
         m_alog->write(log::alevel::devel,s.str());
     }
     return msg;
 }
 
+template <typename config>
+typename config::message_type::ptr connection<config>::write_peek() const
+{
+    for (unsigned int i = 0; i < message_buffer::priority::count; i++) {
+        if (!m_send_queue[i].empty()) {
+            return m_send_queue[i].front();
+        }
+    }
+    return message_ptr();
+}
+
+template <typename config>
+bool connection<config>::write_batch_full() const {
+    if (m_max_write_batch_bytes > 0 &&
+        m_send_buffer_size >= m_max_write_batch_bytes)
+    {
+        return true;
+    }
+
+    if (m_max_write_batch_buffers > 0) {
+        size_t count = 0;
+        for (unsigned int i = 0; i < message_buffer::priority::count; i++) {
+            count += m_send_queue[i].size();
+        }
+        if (2*count >= m_max_write_batch_buffers) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+template <typename config>
+void connection<config>::handle_cork_timeout(lib::error_code const & ec) {
+    if (ec == transport::error::operation_aborted) {
+        m_alog->write(log::alevel::devel,"write cork timer cancelled");
+        return;
+    } else if (ec) {
+        log_err(log::elevel::devel,"handle_cork_timeout",ec);
+    }
+
+    {
+        scoped_lock_type lock(m_write_lock);
+        m_cork_pending = false;
+        m_cork_expired = true;
+    }
+
+    write_frame();
+}
+
+template <typename config>
+bool connection<config>::close_queued() const {
+    // close frames are always queued last in the lowest class
+    std::deque<message_ptr> const & queue =
+        m_send_queue[message_buffer::priority::low];
+    return !queue.empty() &&
+        queue.back()->get_opcode() == frame::opcode::close;
+}
+
+template <typename config>
+bool connection<config>::send_queue_empty() const {
+    for (unsigned int i = 0; i < message_buffer::priority::count; i++) {
+        if (!m_send_queue[i].empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename config>
+unsigned int connection<config>::send_queue_index(message_ptr msg) const {
+    frame::opcode::value op = msg->get_opcode();
+
+    if (op == frame::opcode::close) {
+        // Nothing may be written after a close frame so it always goes
+        // behind everything that is already queued.
+        return message_buffer::priority::low;
+    } else if (frame::opcode::is_control(op)) {
+        return message_buffer::priority::control;
+    }
+
+    // The control class is reserved for control frames. Data frames in it
+    // could be interleaved with the fragments of another message.
+    unsigned int p = msg->get_priority();
+    if (p == message_buffer::priority::control) {
+        return message_buffer::priority::high;
+    } else if (p >= message_buffer::priority::count) {
+        return message_buffer::priority::low;
+    }
+    return p;
+}
+
+template <typename config>
+bool connection<config>::needs_fragmenting(message_ptr msg) const {
+    // hybi00 frames have no fragmentation support
+    if (m_max_outgoing_frame_size == 0 || !m_processor ||
+        m_processor->get_version() == 0)
+    {
+        return false;
+    }
+
+    return !frame::opcode::is_control(msg->get_opcode()) &&
+           !msg->get_terminal() &&
+           msg->get_payload().size() > m_max_outgoing_frame_size;
+}
+
+template <typename config>
+std::string connection<config>::prepare_fragment_header(message_ptr msg,
+    size_t offset, size_t len, char const *& payload)
+{
+    std::string const & header = msg->get_header();
+    std::string const & original = msg->get_payload();
+    frame::basic_header h(header[0],header[1]);
+
+    bool first = (offset == 0);
+    bool last = (offset+len == original.size());
+    bool masked = frame::get_masked(h);
+
+    frame::basic_header fh(
+        first ? frame::get_opcode(h) : frame::opcode::continuation,
+        len,
+        last && frame::get_fin(h),
+        masked,
+        first && frame::get_rsv1(h),
+        first && frame::get_rsv2(h),
+        first && frame::get_rsv3(h)
+    );
+
+    if (masked) {
+        // The masking key of the prepared message is the last four bytes of
+        // its header. Every frame needs a key of its own so the fragment is
+        // unmasked and masked again with a new one.
+        frame::masking_key_type old_key;
+        std::copy(header.end()-4,header.end(),old_key.c);
+
+        frame::masking_key_type key;
+        {
+            scoped_lock_type lock(m_rng_lock);
+            key.i = m_rng();
+        }
+
+        m_fragment_payload.resize(len);
+        for (size_t i = 0; i < len; ++i) {
+            m_fragment_payload[i] = original[offset+i] ^
+                old_key.c[(offset+i) % 4] ^ key.c[i % 4];
+        }
+
+        payload = m_fragment_payload.data();
+        return frame::prepare_header(fh,frame::extended_header(len,key.i));
+    } else {
+        payload = original.data()+offset;
+        return frame::prepare_header(fh,frame::extended_header(len));
+    }
+}
+
 template <typename config>
 void connection<config>::log_open_result()
 {
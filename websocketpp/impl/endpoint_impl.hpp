@@ -64,8 +64,20 @@ endpoint<connection,config>::create_connection() {
     con->set_pong_timeout_handler(m_pong_timeout_handler);
     con->set_interrupt_handler(m_interrupt_handler);
     con->set_http_handler(m_http_handler);
+    con->set_http_body_handler(m_http_body_handler);
     con->set_validate_handler(m_validate_handler);
     con->set_message_handler(m_message_handler);
+    con->set_message_batch_handler(m_message_batch_handler);
+    con->set_writable_handler(m_writable_handler);
+    con->set_compression_executor(m_compression_executor);
+
+    if (m_is_server) {
+        con->set_response_template(m_response_template);
+    }
+
+    for (size_t i = 0; i < m_extension_factories.size(); i++) {
+        con->add_extension(m_extension_factories[i]());
+    }
 
     if (m_open_handshake_timeout_dur != config::timeout_open_handshake) {
         con->set_open_handshake_timeout(m_open_handshake_timeout_dur);
@@ -76,10 +88,39 @@ endpoint<connection,config>::create_connection() {
     if (m_pong_timeout_dur != config::timeout_pong) {
         con->set_pong_timeout(m_pong_timeout_dur);
     }
+    if (m_http_keep_alive_timeout_dur != config::timeout_http_keep_alive) {
+        con->set_http_keep_alive_timeout(m_http_keep_alive_timeout_dur);
+    }
     if (m_max_message_size != config::max_message_size) {
         con->set_max_message_size(m_max_message_size);
     }
     con->set_max_http_body_size(m_max_http_body_size);
+    if (m_send_buffer_watermark != config::send_buffer_watermark) {
+        con->set_send_buffer_watermark(m_send_buffer_watermark);
+    }
+    if (m_max_outgoing_frame_size != config::max_outgoing_frame_size) {
+        con->set_max_outgoing_frame_size(m_max_outgoing_frame_size);
+    }
+    if (m_max_write_batch_bytes != config::max_write_batch_bytes) {
+        con->set_max_write_batch_bytes(m_max_write_batch_bytes);
+    }
+    if (m_max_write_batch_buffers != config::max_write_batch_buffers) {
+        con->set_max_write_batch_buffers(m_max_write_batch_buffers);
+    }
+    if (m_write_cork_delay != config::write_cork_delay) {
+        con->set_write_cork_delay(m_write_cork_delay);
+    }
+    if (m_read_budget_bytes != config::read_budget_bytes) {
+        con->set_read_budget_bytes(m_read_budget_bytes);
+    }
+    if (m_read_budget_messages != config::read_budget_messages) {
+        con->set_read_budget_messages(m_read_budget_messages);
+    }
+    if (m_compression_offload_threshold !=
+        config::compression_offload_threshold)
+    {
+        con->set_compression_offload_threshold(m_compression_offload_threshold);
+    }
 
     lib::error_code ec;
 
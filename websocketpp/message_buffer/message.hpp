@@ -29,13 +29,35 @@
 #define WEBSOCKETPP_MESSAGE_BUFFER_MESSAGE_HPP
 
 #include <websocketpp/common/memory.hpp>
+#include <websocketpp/common/stdint.hpp>
+#include <websocketpp/common/thread.hpp>
 #include <websocketpp/frame.hpp>
 
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace websocketpp {
 namespace message_buffer {
 
+/// Priority classes for outgoing messages
+/**
+ * Each connection keeps one send queue per priority class. Queues are drained
+ * highest priority (lowest value) first and each queue is FIFO. Ping and pong
+ * frames always use the control class regardless of the priority set on them.
+ */
+namespace priority {
+    enum value {
+        control = 0,
+        high = 1,
+        normal = 2,
+        low = 3
+    };
+
+    /// Number of priority classes
+    static unsigned int const count = 4;
+} // namespace priority
+
 /* # message:
  * object that stores a message while it is being sent or received. Contains
  * the message payload itself, the message header, the extension data, and the
@@ -98,7 +120,8 @@ public:
       , m_prepared(false)
       , m_fin(true)
       , m_terminal(false)
-      , m_compressed(false) {}
+      , m_compressed(false)
+      , m_priority(priority::normal) {}
 
     /// Construct a message and fill in some values
     /**
@@ -111,6 +134,7 @@ public:
       , m_fin(true)
       , m_terminal(false)
       , m_compressed(false)
+      , m_priority(priority::normal)
     {
         m_payload.reserve(size);
     }
@@ -181,6 +205,28 @@ public:
     void set_terminal(bool value) {
         m_terminal = value;
     }
+
+    /// Get the send priority of the message
+    /**
+     * The priority determines which of the connection's send queues the
+     * message is written from. Messages with a higher priority are written
+     * before any queued messages with lower priority. The default is normal.
+     *
+     * @return The priority class of this message
+     */
+    priority::value get_priority() const {
+        return m_priority;
+    }
+
+    /// Set the send priority of the message
+    /**
+     * @see get_priority()
+     *
+     * @param value The priority class to send this message with.
+     */
+    void set_priority(priority::value value) {
+        m_priority = value;
+    }
     /// Read the fin bit
     /**
      * A message with the fin bit set will be sent as the last message of its
@@ -263,6 +309,7 @@ public:
      */
     void set_payload(std::string const & payload) {
         m_payload = payload;
+        clear_compressed_cache();
     }
 
     /// Set payload data
@@ -276,6 +323,7 @@ public:
         m_payload.reserve(len);
         char const * pl = static_cast<char const *>(payload);
         m_payload.assign(pl, pl + len);
+        clear_compressed_cache();
     }
 
     /// Append payload data
@@ -286,6 +334,7 @@ public:
      */
     void append_payload(std::string const & payload) {
         m_payload.append(payload);
+        clear_compressed_cache();
     }
 
     /// Append payload data
@@ -298,6 +347,74 @@ public:
     void append_payload(void const * payload, size_t len) {
         m_payload.reserve(m_payload.size()+len);
         m_payload.append(static_cast<char const *>(payload),len);
+        clear_compressed_cache();
+    }
+
+    /// Look up a compressed copy of the payload
+    /**
+     * When the same message is sent to many connections whose compressors
+     * reset their context for every message, connections with the same
+     * compression parameters produce identical output. The first such
+     * connection stores its output here and the rest copy it instead of
+     * compressing again.
+     *
+     * This method is thread safe. The cache is allocated by the first call to
+     * set_compressed_cache and dropped by set_payload and append_payload but
+     * not by changes made through get_raw_payload.
+     *
+     * @since 0.9.0
+     *
+     * @param key An identifier for the compression parameters
+     * @param out String to append the cached bytes to
+     * @return Whether a copy for key was found
+     */
+    bool get_compressed_cache(uint32_t key, std::string & out) const {
+        compressed_cache_ptr cache = lib::atomic_load(&m_compressed_cache);
+        if (!cache) {
+            return false;
+        }
+
+        lib::lock_guard<lib::mutex> guard(cache->lock);
+
+        for (size_t i = 0; i < cache->entries.size(); i++) {
+            if (cache->entries[i].first == key) {
+                out.append(cache->entries[i].second);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// Store a compressed copy of the payload
+    /**
+     * @see get_compressed_cache
+     *
+     * @since 0.9.0
+     *
+     * @param key An identifier for the compression parameters
+     * @param data The compressed payload
+     */
+    void set_compressed_cache(uint32_t key, std::string const & data) {
+        compressed_cache_ptr cache = lib::atomic_load(&m_compressed_cache);
+        if (!cache) {
+            // Another connection may be installing one at the same time, use
+            // whichever gets there first.
+            compressed_cache_ptr created = lib::make_shared<compressed_cache>();
+            if (lib::atomic_compare_exchange_strong(&m_compressed_cache,&cache,
+                created))
+            {
+                cache = created;
+            }
+        }
+
+        lib::lock_guard<lib::mutex> guard(cache->lock);
+
+        for (size_t i = 0; i < cache->entries.size(); i++) {
+            if (cache->entries[i].first == key) {
+                return;
+            }
+        }
+        cache->entries.push_back(std::make_pair(key,data));
     }
 
     /// Recycle the message
@@ -323,6 +440,22 @@ public:
         }
     }
 private:
+    /// Compressed copies of the payload keyed by compression parameters
+    struct compressed_cache {
+        lib::mutex lock;
+        std::vector<std::pair<uint32_t,std::string> > entries;
+    };
+
+    typedef lib::shared_ptr<compressed_cache> compressed_cache_ptr;
+
+    // The payload must not be changed while the message is being sent so
+    // there is nobody to race with here.
+    void clear_compressed_cache() {
+        if (m_compressed_cache) {
+            m_compressed_cache.reset();
+        }
+    }
+
     con_msg_man_weak_ptr        m_manager;
     std::string                 m_header;
     std::string                 m_extension_data;
@@ -332,6 +465,10 @@ private:
     bool                        m_fin;
     bool                        m_terminal;
     bool                        m_compressed;
+    priority::value             m_priority;
+
+    /// Allocated by the first set_compressed_cache, null until then
+    compressed_cache_ptr        m_compressed_cache;
 };
 
 } // namespace message_buffer
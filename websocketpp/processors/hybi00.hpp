@@ -321,6 +321,9 @@ public:
         return ret;
     }
 
+    // hybi00 does not mask, the keyed overload falls back to this one
+    using base::prepare_data_frame;
+
     /// Prepare a message for writing
     /**
      * Performs validation, masking, compression, etc. will return an error if
@@ -37,8 +37,11 @@
 #include <websocketpp/sha1/sha1.hpp>
 #include <websocketpp/base64/base64.hpp>
 
+#include <websocketpp/common/chrono.hpp>
 #include <websocketpp/common/network.hpp>
 #include <websocketpp/common/platforms.hpp>
+#include <websocketpp/extensions/chain.hpp>
+#include <websocketpp/extensions/permessage_deflate/adaptive_policy.hpp>
 
 #include <algorithm>
 #include <cassert>
@@ -73,6 +76,8 @@ public:
       : processor<config>(secure, p_is_server)
       , m_msg_manager(manager)
       , m_rng(rng)
+      , m_compression_policy(config::adaptive_compression_min_size,
+            config::adaptive_compression_time_budget)
     {
         reset_headers();
     }
@@ -85,6 +90,14 @@ public:
         return m_permessage_deflate.is_implemented();
     }
 
+    lib::error_code add_extension(extensions::extension::ptr ext) {
+        if (!config::enable_extensions) {
+            return make_error_code(error::extensions_disabled);
+        }
+        m_extension_chain.add(ext);
+        return lib::error_code();
+    }
+
     err_str_pair negotiate_extensions(request_type const & request) {
         return negotiate_extensions_helper(request);
     }
@@ -174,10 +187,21 @@ public:
             }
         }
 
-        // support for future extensions would go here. Should check the value of 
-        // ret.first before continuing. Might need to consider whether failure of
-        // negotiation of an earlier extension should stop negotiation of subsequent
-        // ones
+        // Other extensions. Their transforms run before compression on send
+        // so they are listed first in the response.
+        if (!ret.first && !m_extension_chain.empty()) {
+            err_str_pair chain_ret = m_extension_chain.negotiate(p,
+                base::m_server);
+
+            if (chain_ret.first) {
+                ret.first = chain_ret.first;
+            } else if (!chain_ret.second.empty()) {
+                if (!ret.second.empty()) {
+                    chain_ret.second += ", ";
+                }
+                ret.second = chain_ret.second + ret.second;
+            }
+        }
 
         return ret;
     }
@@ -228,6 +252,32 @@ public:
         return lib::error_code();
     }
 
+    lib::error_code write_handshake_response(request_type const & request,
+        std::string const & subprotocol, std::string const & extensions,
+        response_template const & tmpl, std::string & out,
+        response_type & response) const
+    {
+        std::string server_key = request.get_header("Sec-WebSocket-Key");
+
+        lib::error_code ec = process_handshake_key(server_key);
+
+        if (ec) {
+            return ec;
+        }
+
+        tmpl.write(out,server_key,extensions,subprotocol);
+
+        response.replace_header("Sec-WebSocket-Accept",server_key);
+        response.replace_header("Upgrade",constants::upgrade_token);
+        response.replace_header("Connection",constants::connection_token);
+
+        if (!subprotocol.empty()) {
+            response.replace_header("Sec-WebSocket-Protocol",subprotocol);
+        }
+
+        return lib::error_code();
+    }
+
     /// Fill in a set of request headers for a client connection request
     /**
      * @param [out] req  Set of headers to fill in
@@ -268,11 +318,18 @@ public:
 
         req.replace_header("Sec-WebSocket-Key",base64_encode(raw_key, 16));
 
+        std::string offer = m_extension_chain.generate_offer();
+
         if (m_permessage_deflate.is_implemented()) {
-            std::string offer = m_permessage_deflate.generate_offer();
-            if (!offer.empty()) {
-                req.replace_header("Sec-WebSocket-Extensions",offer);
+            std::string deflate_offer = m_permessage_deflate.generate_offer();
+            if (!deflate_offer.empty() && !offer.empty()) {
+                offer += ", ";
             }
+            offer += deflate_offer;
+        }
+
+        if (!offer.empty()) {
+            req.replace_header("Sec-WebSocket-Extensions",offer);
         }
 
         return lib::error_code();
@@ -449,6 +506,9 @@ public:
                         if (m_permessage_deflate.is_enabled()) {
                             m_data_msg.msg_ptr->set_compressed(frame::get_rsv1(m_basic_header));
                         }
+
+                        m_data_msg.extension_rsv = m_basic_header.b0 &
+                            m_extension_chain.get_rsv_bits();
                     } else {
                         // Fetch the underlying payload buffer from the data message we
                         // are writing into.
@@ -517,6 +577,7 @@ public:
      */
     lib::error_code finalize_message() {
         std::string & out = m_current_msg->msg_ptr->get_raw_payload();
+        size_t offset = out.size();
 
         // if the frame is compressed, append the compression
         // trailer and flush the compression buffer.
@@ -527,10 +588,36 @@ public:
 
             // Decompress current buffer into the message buffer
             lib::error_code ec;
-            ec = m_permessage_deflate.decompress(trailer,4,out);
+            ec = m_permessage_deflate.decompress(trailer,4,out,
+                base::m_max_message_size);
+            m_permessage_deflate.end_decompress();
+            if (ec) {
+                return ec;
+            }
+            if (out.size() > base::m_max_message_size) {
+                return make_error_code(error::message_too_big);
+            }
+        }
+
+        // let the extension chain flush anything it held back
+        if (m_extension_chain.is_enabled() &&
+            !frame::opcode::is_control(m_current_msg->msg_ptr->get_opcode()))
+        {
+            lib::error_code ec = m_extension_chain.decode(out,offset,true,
+                m_current_msg->extension_rsv);
             if (ec) {
                 return ec;
             }
+            if (out.size() > base::m_max_message_size) {
+                return make_error_code(error::message_too_big);
+            }
+        }
+
+        // validate any bytes produced while finishing the message
+        if (m_current_msg->msg_ptr->get_opcode() == frame::opcode::TEXT &&
+            !m_current_msg->validator.decode(out.begin()+offset,out.end()))
+        {
+            return make_error_code(error::invalid_utf8);
         }
 
         // ensure that text messages end on a valid UTF8 code point
@@ -603,6 +690,28 @@ public:
      * @return error code
      */
     virtual lib::error_code prepare_data_frame(message_ptr in, message_ptr out)
+    {
+        frame::masking_key_type key;
+
+        if (!base::m_server) {
+            // Generate masking key.
+            key.i = m_rng();
+        } else {
+            key.i = 0;
+        }
+
+        return prepare_data_frame(in,out,key);
+    }
+
+    /// Prepare a user data message for writing with a given masking key
+    /**
+     * @param in An unprepared message to prepare
+     * @param out A message to be overwritten with the prepared message
+     * @param key The masking key to use, ignored by servers
+     * @return error code
+     */
+    virtual lib::error_code prepare_data_frame(message_ptr in, message_ptr out,
+        frame::masking_key_type key)
     {
         if (!in || !out) {
             return make_error_code(error::invalid_arguments);
@@ -618,31 +727,87 @@ public:
         std::string& i = in->get_raw_payload();
         std::string& o = out->get_raw_payload();
 
-        // validate payload utf8
-        if (op == frame::opcode::TEXT && !utf8_validator::validate(i)) {
-            return make_error_code(error::invalid_payload);
-        }
-
-        frame::masking_key_type key;
         bool masked = !base::m_server;
         bool compressed = m_permessage_deflate.is_enabled()
                           && in->get_compressed();
         bool fin = in->get_fin();
 
-        if (masked) {
-            // Generate masking key.
-            key.i = m_rng();
-        } else {
+        if (compressed && config::enable_adaptive_compression) {
+            int level;
+            compressed = m_compression_policy.decide(i,level);
+            if (compressed) {
+                m_permessage_deflate.set_compression_level(level);
+            }
+        }
+
+        // validate payload utf8. The first fragment of a text message may end
+        // partway through a code point, the rest is checked by the caller.
+        if (op == frame::opcode::TEXT) {
+            if (fin && !utf8_validator::validate(i)) {
+                return make_error_code(error::invalid_payload);
+            }
+
+            utf8_validator::validator v;
+            if (!fin && !v.decode(i.begin(),i.end())) {
+                return make_error_code(error::invalid_payload);
+            }
+        }
+
+        if (!masked) {
             key.i = 0;
         }
 
+        // Run the payload through the extension chain. The transforms work
+        // in place, on the output buffer if nothing else needs to be done or
+        // on a scratch copy that is then compressed.
+        bool const chained = m_extension_chain.is_enabled();
+        std::string encoded;
+        std::string const * src = &i;
+
+        if (chained) {
+            std::string & target = compressed ? encoded : o;
+            target = i;
+
+            lib::error_code ec = m_extension_chain.encode(target,0,fin);
+            if (ec) {
+                return ec;
+            }
+            src = &target;
+        }
+
         // prepare payload
         if (compressed) {
+            // A complete message compressed without context takeover can be
+            // reused by every connection with the same deflate parameters.
+            // Per connection extension state makes the output unique.
+            uint32_t cache_key;
+            bool shared = !chained && fin && op != frame::opcode::CONTINUATION
+                && m_permessage_deflate.get_shared_compression_key(cache_key);
+
             // compress and store in o after header.
-            m_permessage_deflate.compress(i,o);
+            if (shared && in->get_compressed_cache(cache_key,o)) {
+                // another connection already compressed this payload
+            } else {
+                if (config::enable_adaptive_compression) {
+                    lib::chrono::steady_clock::time_point start =
+                        lib::chrono::steady_clock::now();
 
-            if (o.size() < 4) {
-                return make_error_code(error::general);
+                    m_permessage_deflate.compress(*src,o);
+
+                    m_compression_policy.record(src->size(), o.size(),
+                        lib::chrono::duration_cast<lib::chrono::nanoseconds>(
+                            lib::chrono::steady_clock::now() - start).count());
+                } else {
+                    m_permessage_deflate.compress(*src,o);
+                }
+
+                if (o.size() < 4) {
+                    return make_error_code(error::general);
+                }
+
+                if (shared) {
+                    in->set_compressed_cache(cache_key,o);
+                }
             }
 
             // Strip trailing 4 0x00 0x00 0xff 0xff bytes before writing to the
@@ -653,6 +818,11 @@ public:
             if (masked) {
                 this->masked_copy(o,o,key);
             }
+        } else if (chained) {
+            // the extension chain already wrote the payload to o
+            if (masked) {
+                this->masked_copy(o,o,key);
+            }
         } else {
             // no compression, just copy data into the output buffer
             o.resize(i.size());
@@ -667,8 +837,16 @@ public:
             }
         }
 
+        // Extensions that use an RSV bit mark the first frame of the message
+        uint8_t ext_rsv = 0;
+        if (op != frame::opcode::CONTINUATION) {
+            ext_rsv = m_extension_chain.get_rsv_bits();
+        }
+
         // generate header
-        frame::basic_header h(op,o.size(),fin,masked,compressed);
+        frame::basic_header h(op,o.size(),fin,masked,compressed,
+            (ext_rsv & frame::BHB0_RSV2) != 0,
+            (ext_rsv & frame::BHB0_RSV3) != 0);
 
         if (masked) {
             frame::extended_header e(o.size(),key.i);
@@ -731,11 +909,26 @@ public:
 protected:
     /// Convert a client handshake key into a server response key in place
     lib::error_code process_handshake_key(std::string & key) const {
-        key.append(constants::handshake_guid);
-
         unsigned char message_digest[20];
-        sha1::calc(key.c_str(),key.length(),message_digest);
-        key = base64_encode(message_digest,20);
+
+        // A valid key is always 24 characters which, with the GUID, is the
+        // fixed size sha1::calc_60 handles.
+        size_t const guid_len = sizeof(constants::handshake_guid) - 1;
+
+        if (key.size() + guid_len == 60) {
+            char buf[60];
+            std::copy(key.begin(),key.end(),buf);
+            std::copy(constants::handshake_guid,
+                constants::handshake_guid+guid_len,buf+key.size());
+            sha1::calc_60(buf,message_digest);
+        } else {
+            key.append(constants::handshake_guid);
+            sha1::calc(key.c_str(),key.length(),message_digest);
+        }
+
+        char accept[28];
+        base64_encode_sha1(message_digest,accept);
+        key.assign(accept,28);
 
         return lib::error_code();
     }
@@ -812,16 +1005,38 @@ protected:
         if (m_permessage_deflate.is_enabled()
             && m_current_msg->msg_ptr->get_compressed())
         {
-            // Decompress current buffer into the message buffer
-            ec = m_permessage_deflate.decompress(buf,len,out);
+            // Decompress current buffer into the message buffer. Inflation
+            // stops as soon as the message grows past the size limit so a
+            // small frame can't expand into an arbitrarily large buffer.
+            ec = m_permessage_deflate.decompress(buf,len,out,
+                base::m_max_message_size);
             if (ec) {
                 return 0;
             }
+            if (out.size() > base::m_max_message_size) {
+                ec = make_error_code(error::message_too_big);
+                return 0;
+            }
         } else {
             // No compression, straight copy
             out.append(reinterpret_cast<char *>(buf),len);
         }
 
+        // run the new bytes back through the extension chain
+        if (m_extension_chain.is_enabled() &&
+            !frame::opcode::is_control(m_current_msg->msg_ptr->get_opcode()))
+        {
+            ec = m_extension_chain.decode(out,offset,false,
+                m_current_msg->extension_rsv);
+            if (ec) {
+                return 0;
+            }
+            if (out.size() > base::m_max_message_size) {
+                ec = make_error_code(error::message_too_big);
+                return 0;
+            }
+        }
+
         // validate unmasked, decompressed values
         if (m_current_msg->msg_ptr->get_opcode() == frame::opcode::TEXT) {
             if (!m_current_msg->validator.decode(out.begin()+offset,out.end())) {
@@ -869,7 +1084,12 @@ protected:
             return make_error_code(error::invalid_rsv_bit);
         }
 
-        if (frame::get_rsv2(h) || frame::get_rsv3(h)) {
+        // RSV2 and RSV3 may be used by negotiated extensions on the first
+        // frame of a data message.
+        uint8_t ext_rsv = h.b0 & (frame::BHB0_RSV2 | frame::BHB0_RSV3);
+        if (ext_rsv && ((ext_rsv & ~m_extension_chain.get_rsv_bits()) ||
+            frame::opcode::is_control(op) || !new_msg))
+        {
             return make_error_code(error::invalid_rsv_bit);
         }
 
@@ -1029,15 +1249,18 @@ protected:
     /// the buffer it is being written to, its masking key, its UTF8 validation
     /// state, and sometimes its compression state.
     struct msg_metadata {
-        msg_metadata() {}
-        msg_metadata(message_ptr m, size_t p) : msg_ptr(m),prepared_key(p) {}
+        msg_metadata() : extension_rsv(0) {}
+        msg_metadata(message_ptr m, size_t p)
+          : msg_ptr(m),prepared_key(p),extension_rsv(0) {}
         msg_metadata(message_ptr m, frame::masking_key_type p)
           : msg_ptr(m)
-          , prepared_key(prepare_masking_key(p)) {}
+          , prepared_key(prepare_masking_key(p))
+          , extension_rsv(0) {}
 
         message_ptr msg_ptr;        // pointer to the message data buffer
         size_t      prepared_key;   // prepared masking key
         utf8_validator::validator validator; // utf8 validation state
+        uint8_t     extension_rsv;  // extension chain RSV bits of first frame
     };
 
     // Basic header of the frame being read
@@ -1070,6 +1293,10 @@ protected:
 
     // Extensions
     permessage_deflate_type m_permessage_deflate;
+    extensions::chain m_extension_chain;
+
+    // Per message compression decisions
+    extensions::permessage_deflate::adaptive_policy m_compression_policy;
 };
 
 } // namespace processor
@@ -29,9 +29,12 @@
 #define WEBSOCKETPP_PROCESSOR_HPP
 
 #include <websocketpp/processors/base.hpp>
+#include <websocketpp/processors/response_template.hpp>
 #include <websocketpp/common/system_error.hpp>
 
 #include <websocketpp/close.hpp>
+#include <websocketpp/frame.hpp>
+#include <websocketpp/extensions/extension.hpp>
 #include <websocketpp/utilities.hpp>
 #include <websocketpp/uri.hpp>
 
@@ -213,6 +216,20 @@ public:
         return false;
     }
 
+    /// Add an extension to be negotiated for this connection
+    /**
+     * Must be called before extensions are negotiated. Processors that don't
+     * support extensions return extensions_disabled.
+     *
+     * @since 0.9.0
+     *
+     * @param ext The extension to add
+     * @return A status code, zero on success, non-zero otherwise
+     */
+    virtual lib::error_code add_extension(extensions::extension::ptr) {
+        return make_error_code(error::extensions_disabled);
+    }
+
     /// Initializes extensions based on the Sec-WebSocket-Extensions header
     /**
      * Reads the Sec-WebSocket-Extensions header and determines if any of the
@@ -264,6 +281,33 @@ public:
     virtual lib::error_code process_handshake(request_type const & req,
         std::string const & subprotocol, response_type& res) const = 0;
 
+    /// Write the complete response for this websocket request from a template
+    /**
+     * An alternative to process_handshake followed by get_raw for processors
+     * whose successful responses fit a response_template. Processors that
+     * don't support templates return error::not_implemented and the caller
+     * falls back to process_handshake.
+     *
+     * The headers process_handshake would have added are also stored in res
+     * so that they can still be read after the response has been written.
+     *
+     * @since 0.9.0
+     *
+     * @param req The request to process
+     * @param subprotocol The subprotocol in use
+     * @param extensions The negotiated Sec-WebSocket-Extensions value
+     * @param tmpl The template holding the fixed parts of the response
+     * @param [out] out Buffer to write the raw response to
+     * @param [out] res The response to store the handshake headers in
+     * @return An error code, 0 on success, non-zero for other errors
+     */
+    virtual lib::error_code write_handshake_response(request_type const &,
+        std::string const &, std::string const &, response_template const &,
+        std::string &, response_type &) const
+    {
+        return error::make_error_code(error::not_implemented);
+    }
+
     /// Fill in an HTTP request for an outgoing connection handshake
     /**
      * @param req The request to process.
@@ -357,6 +401,26 @@ public:
      */
     virtual lib::error_code prepare_data_frame(message_ptr in, message_ptr out) = 0;
 
+    /// Prepare a data message for writing with a given masking key
+    /**
+     * Like prepare_data_frame(in,out) but masks with key rather than drawing
+     * a new key from the random number generator. This allows a caller to
+     * generate the key under a lock and do the rest of the work without it.
+     * The key is ignored by processors that do not mask.
+     *
+     * @since 0.9.0
+     *
+     * @param in An unprepared message to prepare
+     * @param out A message to be overwritten with the prepared message
+     * @param key The masking key to use
+     * @return error code
+     */
+    virtual lib::error_code prepare_data_frame(message_ptr in, message_ptr out,
+        frame::masking_key_type key)
+    {
+        return prepare_data_frame(in,out);
+    }
+
     /// Prepare a ping frame
     /**
      * Ping preparation is entirely state free. There is no payload validation
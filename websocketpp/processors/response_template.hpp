@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2020, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef WEBSOCKETPP_PROCESSOR_RESPONSE_TEMPLATE_HPP
+#define WEBSOCKETPP_PROCESSOR_RESPONSE_TEMPLATE_HPP
+
+#include <websocketpp/common/memory.hpp>
+#include <websocketpp/http/constants.hpp>
+#include <websocketpp/processors/base.hpp>
+
+#include <string>
+
+namespace websocketpp {
+namespace processor {
+
+/// Precomputed server handshake response
+/**
+ * A successful opening handshake response is the same for every connection
+ * of an endpoint apart from Sec-WebSocket-Accept and the negotiated
+ * subprotocol and extensions. response_template serializes the fixed parts
+ * once. A processor then writes a complete response by copying those parts
+ * around the per-connection values into one buffer. This skips filling an
+ * http::parser::response and serializing its header map.
+ *
+ * The output is byte for byte what http::parser::response::raw produces for
+ * the same headers.
+ *
+ * @since 0.9.0
+ */
+class response_template {
+public:
+    typedef lib::shared_ptr<response_template const> ptr;
+
+    /// Build the template for a server identifier
+    /**
+     * @param server Value of the Server header. If empty the header is left
+     * out.
+     */
+    explicit response_template(std::string const & server) : m_server(server)
+    {
+        m_head.append("HTTP/1.1 101 ");
+        m_head.append(http::status_code::get_string(
+            http::status_code::switching_protocols));
+        m_head.append("\r\nConnection: ");
+        m_head.append(constants::connection_token);
+        m_head.append("\r\n");
+
+        if (!server.empty()) {
+            m_tail.append("Server: ");
+            m_tail.append(server);
+            m_tail.append("\r\n");
+        }
+        m_tail.append("Upgrade: ");
+        m_tail.append(constants::upgrade_token);
+        m_tail.append("\r\n\r\n");
+    }
+
+    /// Get the Server header value the template was built with
+    std::string const & get_server() const {
+        return m_server;
+    }
+
+    /// Write a complete handshake response
+    /**
+     * @param [out] out Buffer to write to. Its previous contents are replaced.
+     * @param accept Value of the Sec-WebSocket-Accept header
+     * @param extensions Value of the Sec-WebSocket-Extensions header, or empty
+     * to leave it out
+     * @param subprotocol Value of the Sec-WebSocket-Protocol header, or empty
+     * to leave it out
+     */
+    void write(std::string & out, std::string const & accept,
+        std::string const & extensions, std::string const & subprotocol) const
+    {
+        static char const accept_name[] = "Sec-WebSocket-Accept: ";
+        static char const extensions_name[] = "Sec-WebSocket-Extensions: ";
+        static char const protocol_name[] = "Sec-WebSocket-Protocol: ";
+
+        size_t size = m_head.size() + sizeof(accept_name) + 1 + accept.size()
+            + m_tail.size();
+        if (!extensions.empty()) {
+            size += sizeof(extensions_name) + 1 + extensions.size();
+        }
+        if (!subprotocol.empty()) {
+            size += sizeof(protocol_name) + 1 + subprotocol.size();
+        }
+
+        out.clear();
+        out.reserve(size);
+
+        // headers appear in the same case insensitive order as in raw()
+        out.append(m_head);
+        out.append(accept_name,sizeof(accept_name)-1);
+        out.append(accept);
+        out.append("\r\n",2);
+        if (!extensions.empty()) {
+            out.append(extensions_name,sizeof(extensions_name)-1);
+            out.append(extensions);
+            out.append("\r\n",2);
+        }
+        if (!subprotocol.empty()) {
+            out.append(protocol_name,sizeof(protocol_name)-1);
+            out.append(subprotocol);
+            out.append("\r\n",2);
+        }
+        out.append(m_tail);
+    }
+private:
+    std::string m_server;
+    std::string m_head;
+    std::string m_tail;
+};
+
+} // namespace processor
+} // namespace websocketpp
+
+#endif // WEBSOCKETPP_PROCESSOR_RESPONSE_TEMPLATE_HPP
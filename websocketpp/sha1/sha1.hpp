@@ -36,6 +36,10 @@ under the same license as the original, which is listed below.
 #ifndef SHA1_DEFINED
 #define SHA1_DEFINED
 
+#include <websocketpp/sha1/sha1_ni.hpp>
+
+#include <cstddef>
+
 namespace websocketpp {
 namespace sha1 {
 
@@ -117,14 +121,18 @@ inline void innerHash(unsigned int * result, unsigned int * w)
 
 } // namespace
 
-/// Calculate a SHA1 hash
+/// Calculate a SHA1 hash with the portable implementation
 /**
+ * @since 0.9.0 (previously `calc`)
+ *
  * @param src points to any kind of data to be hashed.
  * @param bytelength the number of bytes to hash from the src pointer.
  * @param hash should point to a buffer of at least 20 bytes of size for storing
  * the sha1 result in.
  */
-inline void calc(void const * src, size_t bytelength, unsigned char * hash) {
+inline void calc_portable(void const * src, size_t bytelength,
+    unsigned char * hash)
+{
     // Init the result array.
     unsigned int result[5] = { 0x67452301, 0xefcdab89, 0x98badcfe,
                                0x10325476, 0xc3d2e1f0 };
@@ -183,6 +191,85 @@ inline void calc(void const * src, size_t bytelength, unsigned char * hash) {
     }
 }
 
+/// Calculate a SHA1 hash
+/**
+ * Uses the x86 SHA extensions if the CPU supports them and the portable
+ * implementation otherwise.
+ *
+ * @param src points to any kind of data to be hashed.
+ * @param bytelength the number of bytes to hash from the src pointer.
+ * @param hash should point to a buffer of at least 20 bytes of size for storing
+ * the sha1 result in.
+ */
+inline void calc(void const * src, size_t bytelength, unsigned char * hash) {
+#ifdef _WEBSOCKETPP_SHA_NI_
+    if (shani::supported()) {
+        shani::calc(src, bytelength, hash);
+        return;
+    }
+#endif
+    calc_portable(src, bytelength, hash);
+}
+
+/// Calculate the SHA1 hash of exactly 60 bytes
+/**
+ * A WebSocket handshake hashes the 24 character Sec-WebSocket-Key followed by
+ * the 36 character GUID. Sixty bytes always pad to the same two blocks, the
+ * second of which only holds the length, so the blocks are built directly
+ * without the general tail handling.
+ *
+ * @since 0.9.0
+ *
+ * @param src points to the 60 bytes to be hashed.
+ * @param hash should point to a buffer of at least 20 bytes of size for storing
+ * the sha1 result in.
+ */
+inline void calc_60(void const * src, unsigned char * hash) {
+    unsigned char const * sarray = static_cast<unsigned char const *>(src);
+
+#ifdef _WEBSOCKETPP_SHA_NI_
+    if (shani::supported()) {
+        uint32_t state[5] = { 0x67452301, 0xefcdab89, 0x98badcfe,
+                              0x10325476, 0xc3d2e1f0 };
+
+        unsigned char blocks[128] = {0};
+        std::memcpy(blocks, sarray, 60);
+        blocks[60] = 0x80;
+        blocks[126] = 0x01; // 480 bits, big endian
+        blocks[127] = 0xe0;
+
+        shani::process_blocks(state, blocks, 2);
+
+        for (int i = 0; i < 20; i++) {
+            hash[i] = static_cast<unsigned char>(state[i >> 2] >>
+                ((3 - (i & 3)) << 3));
+        }
+        return;
+    }
+#endif
+
+    unsigned int result[5] = { 0x67452301, 0xefcdab89, 0x98badcfe,
+                               0x10325476, 0xc3d2e1f0 };
+    unsigned int w[80];
+
+    for (int i = 0; i < 15; i++) {
+        w[i] = (unsigned int) sarray[i*4 + 3]
+                | (((unsigned int) sarray[i*4 + 2]) << 8)
+                | (((unsigned int) sarray[i*4 + 1]) << 16)
+                | (((unsigned int) sarray[i*4]) << 24);
+    }
+    w[15] = 0x80000000;
+    innerHash(result, w);
+
+    clearWBuffert(w);
+    w[15] = 60 << 3;
+    innerHash(result, w);
+
+    for (int hashByte = 20; --hashByte >= 0;) {
+        hash[hashByte] = (result[hashByte >> 2] >> (((3 - hashByte) & 0x3) << 3)) & 0xff;
+    }
+}
+
 } // namespace sha1
 } // namespace websocketpp
 
@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2020, Peter Thorson. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the WebSocket++ Project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PETER THORSON BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef WEBSOCKETPP_SHA1_NI_HPP
+#define WEBSOCKETPP_SHA1_NI_HPP
+
+#include <websocketpp/common/stdint.hpp>
+
+#include <cstddef>
+#include <cstring>
+
+// The SHA extensions are used on x86 when the compiler can target them for a
+// single function. Whether the CPU has them is checked at runtime. Define
+// _WEBSOCKETPP_NO_SHA_NI_ to always use the portable implementation.
+#if !defined(_WEBSOCKETPP_NO_SHA_NI_) && !defined(_WEBSOCKETPP_SHA_NI_)
+    #if (defined(__x86_64__) || defined(__i386__)) && \
+        (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+        #define _WEBSOCKETPP_SHA_NI_
+        #define _WEBSOCKETPP_SHA_NI_TARGET_ \
+            __attribute__((target("sha,sse4.1,ssse3")))
+        #include <cpuid.h>
+    #elif (defined(_M_X64) || defined(_M_IX86)) && defined(_MSC_VER) && \
+        _MSC_VER >= 1900
+        #define _WEBSOCKETPP_SHA_NI_
+        #define _WEBSOCKETPP_SHA_NI_TARGET_
+        #include <intrin.h>
+    #endif
+#endif
+
+#ifdef _WEBSOCKETPP_SHA_NI_
+    #include <immintrin.h>
+#endif
+
+namespace websocketpp {
+namespace sha1 {
+
+/// SHA-1 using the x86 SHA extensions
+/**
+ * @since 0.9.0
+ */
+namespace shani {
+
+#ifdef _WEBSOCKETPP_SHA_NI_
+
+/// Check whether the CPU supports the SHA extensions, SSSE3 and SSE4.1
+inline bool detect() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool const sse = (info[2] & (1 << 9)) && (info[2] & (1 << 19));
+    __cpuidex(info, 7, 0);
+    return sse && (info[1] & (1 << 29));
+#else
+    unsigned int a, b, c, d;
+    if (__get_cpuid_max(0, 0) < 7 || !__get_cpuid(1, &a, &b, &c, &d)) {
+        return false;
+    }
+    bool const sse = (c & (1u << 9)) && (c & (1u << 19));
+    __cpuid_count(7, 0, a, b, c, d);
+    return sse && (b & (1u << 29));
+#endif
+}
+
+/// Whether the accelerated implementation can be used on this CPU
+inline bool supported() {
+    static bool const value = detect();
+    return value;
+}
+
+/// Hash whole 64 byte blocks into state
+/**
+ * Four rounds are done per instruction. The message schedule for later
+ * rounds is computed while earlier rounds run, following Intel's reference
+ * implementation.
+ *
+ * @param state The five word SHA-1 state
+ * @param data Pointer to `blocks` 64 byte blocks
+ * @param blocks Number of blocks to hash
+ */
+_WEBSOCKETPP_SHA_NI_TARGET_
+inline void process_blocks(uint32_t * state, unsigned char const * data,
+    size_t blocks)
+{
+    __m128i const mask = _mm_set_epi64x(0x0001020304050607LL,
+        0x08090a0b0c0d0e0fLL);
+
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(
+        reinterpret_cast<__m128i const *>(state)), 0x1b);
+    __m128i e0 = _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0);
+    __m128i e1;
+
+    // One group of four rounds. `f` selects the round function and constant.
+    // m0 feeds this group, m1..m3 are updated for the groups that follow.
+    #define WEBSOCKETPP_SHA1_ROUNDS(ea, eb, f, m0, m1, m2, m3) \
+        ea = _mm_sha1nexte_epu32(ea, m0); \
+        eb = abcd; \
+        m1 = _mm_sha1msg2_epu32(m1, m0); \
+        abcd = _mm_sha1rnds4_epu32(abcd, ea, f); \
+        m3 = _mm_sha1msg1_epu32(m3, m0); \
+        m2 = _mm_xor_si128(m2, m0);
+
+    while (blocks--) {
+        __m128i const abcd_save = abcd;
+        __m128i const e0_save = e0;
+        __m128i msg0, msg1, msg2, msg3;
+
+        // rounds 0-15 load the message
+        msg0 = _mm_shuffle_epi8(_mm_loadu_si128(
+            reinterpret_cast<__m128i const *>(data)), mask);
+        e0 = _mm_add_epi32(e0, msg0);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+        msg1 = _mm_shuffle_epi8(_mm_loadu_si128(
+            reinterpret_cast<__m128i const *>(data + 16)), mask);
+        e1 = _mm_sha1nexte_epu32(e1, msg1);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+        msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+        msg2 = _mm_shuffle_epi8(_mm_loadu_si128(
+            reinterpret_cast<__m128i const *>(data + 32)), mask);
+        e0 = _mm_sha1nexte_epu32(e0, msg2);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+        msg0 = _mm_xor_si128(msg0, msg2);
+
+        msg3 = _mm_shuffle_epi8(_mm_loadu_si128(
+            reinterpret_cast<__m128i const *>(data + 48)), mask);
+        e1 = _mm_sha1nexte_epu32(e1, msg3);
+        e0 = abcd;
+        msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+        msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+        msg1 = _mm_xor_si128(msg1, msg3);
+
+        // rounds 16-67
+        WEBSOCKETPP_SHA1_ROUNDS(e0, e1, 0, msg0, msg1, msg2, msg3)
+        WEBSOCKETPP_SHA1_ROUNDS(e1, e0, 1, msg1, msg2, msg3, msg0)
+        WEBSOCKETPP_SHA1_ROUNDS(e0, e1, 1, msg2, msg3, msg0, msg1)
+        WEBSOCKETPP_SHA1_ROUNDS(e1, e0, 1, msg3, msg0, msg1, msg2)
+        WEBSOCKETPP_SHA1_ROUNDS(e0, e1, 1, msg0, msg1, msg2, msg3)
+        WEBSOCKETPP_SHA1_ROUNDS(e1, e0, 1, msg1, msg2, msg3, msg0)
+        WEBSOCKETPP_SHA1_ROUNDS(e0, e1, 2, msg2, msg3, msg0, msg1)
+        WEBSOCKETPP_SHA1_ROUNDS(e1, e0, 2, msg3, msg0, msg1, msg2)
+        WEBSOCKETPP_SHA1_ROUNDS(e0, e1, 2, msg0, msg1, msg2, msg3)
+        WEBSOCKETPP_SHA1_ROUNDS(e1, e0, 2, msg1, msg2, msg3, msg0)
+        WEBSOCKETPP_SHA1_ROUNDS(e0, e1, 2, msg2, msg3, msg0, msg1)
+        WEBSOCKETPP_SHA1_ROUNDS(e1, e0, 3, msg3, msg0, msg1, msg2)
+        WEBSOCKETPP_SHA1_ROUNDS(e0, e1, 3, msg0, msg1, msg2, msg3)
+
+        // rounds 68-79 finish the schedule
+        e1 = _mm_sha1nexte_epu32(e1, msg1);
+        e0 = abcd;
+        msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+        msg3 = _mm_xor_si128(msg3, msg1);
+
+        e0 = _mm_sha1nexte_epu32(e0, msg2);
+        e1 = abcd;
+        msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+        e1 = _mm_sha1nexte_epu32(e1, msg3);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+        e0 = _mm_sha1nexte_epu32(e0, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+
+        data += 64;
+    }
+
+    #undef WEBSOCKETPP_SHA1_ROUNDS
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(state),
+        _mm_shuffle_epi32(abcd, 0x1b));
+    state[4] = static_cast<uint32_t>(_mm_extract_epi32(e0, 3));
+}
+
+/// Calculate a SHA1 hash with the SHA extensions
+/**
+ * Must only be called if supported() returns true.
+ *
+ * @param src points to any kind of data to be hashed.
+ * @param bytelength the number of bytes to hash from the src pointer.
+ * @param hash should point to a buffer of at least 20 bytes of size for
+ * storing the sha1 result in.
+ */
+inline void calc(void const * src, size_t bytelength, unsigned char * hash) {
+    uint32_t state[5] = { 0x67452301, 0xefcdab89, 0x98badcfe,
+                          0x10325476, 0xc3d2e1f0 };
+
+    unsigned char const * data = static_cast<unsigned char const *>(src);
+    size_t const full = bytelength / 64;
+
+    process_blocks(state, data, full);
+
+    // pad the remaining bytes into one or two final blocks
+    unsigned char tail[128] = {0};
+    size_t const rest = bytelength - full * 64;
+
+    std::memcpy(tail, data + full * 64, rest);
+    tail[rest] = 0x80;
+
+    size_t const tail_blocks = (rest < 56) ? 1 : 2;
+    uint64_t const bits = static_cast<uint64_t>(bytelength) << 3;
+
+    for (int i = 0; i < 8; i++) {
+        tail[tail_blocks * 64 - 1 - i] = static_cast<unsigned char>(
+            bits >> (i * 8));
+    }
+
+    process_blocks(state, tail, tail_blocks);
+
+    for (int i = 0; i < 20; i++) {
+        hash[i] = static_cast<unsigned char>(state[i >> 2] >>
+            ((3 - (i & 3)) << 3));
+    }
+}
+
+#else
+
+inline bool supported() {
+    return false;
+}
+
+#endif // _WEBSOCKETPP_SHA_NI_
+
+} // namespace shani
+} // namespace sha1
+} // namespace websocketpp
+
+#endif // WEBSOCKETPP_SHA1_NI_HPP
@@ -51,6 +51,22 @@
 #include <string>
 #include <vector>
 
+// Files are written with sendfile on Linux. Waiting for the socket to become
+// writable needs socket::async_wait, which arrived in Asio 1.11 / Boost 1.66.
+// Define _WEBSOCKETPP_NO_SENDFILE_ to always copy files through user space.
+#if !defined(_WEBSOCKETPP_NO_SENDFILE_) && defined(__linux__) && \
+    ((defined(ASIO_STANDALONE) && ASIO_VERSION >= 101100) || \
+     (!defined(ASIO_STANDALONE) && BOOST_VERSION >= 106600))
+    #ifndef _WEBSOCKETPP_SENDFILE_
+        #define _WEBSOCKETPP_SENDFILE_
+    #endif
+#endif
+
+#ifdef _WEBSOCKETPP_SENDFILE_
+    #include <sys/sendfile.h>
+    #include <cerrno>
+#endif
+
 namespace websocketpp {
 namespace transport {
 namespace asio {
@@ -1028,6 +1044,142 @@ protected:
         return lib::error_code();
     }
 
+    /// Enable or disable kernel level coalescing of writes
+    /**
+     * While corked the socket holds back partially filled packets so that
+     * several writes issued back to back go out in as few segments as
+     * possible. Uses TCP_CORK where it is available.
+     *
+     * @param value Whether to cork (true) or uncork (false) the socket
+     * @return A status code, operation_not_supported if the platform has no
+     * corking support.
+     */
+    lib::error_code set_cork(bool value) {
+#ifdef TCP_CORK
+        lib::asio::error_code ec;
+        socket_con_type::get_raw_socket().set_option(
+            lib::asio::detail::socket_option::boolean<IPPROTO_TCP,TCP_CORK>(
+                value),
+            ec
+        );
+        if (ec) {
+            log_err(log::elevel::info,"asio set_cork",ec);
+            return make_error_code(transport::error::pass_through);
+        }
+        return lib::error_code();
+#else
+        (void)value;
+        return make_error_code(transport::error::operation_not_supported);
+#endif
+    }
+
+    /// Write part of a file without copying it through user space
+    /**
+     * Uses sendfile on the raw socket where it is available. Data written to
+     * a TLS connection has to be encrypted first, so secure connections
+     * always report operation_not_supported.
+     *
+     * @param fd The file to read from
+     * @param offset Offset of the first byte to write
+     * @param len Number of bytes to write
+     * @param handler Called once all bytes have been written or on error
+     * @return A status code, operation_not_supported if the file must be
+     * written with async_write instead. `handler` is only called if this is
+     * zero.
+     */
+    lib::error_code async_write_file(int fd, uint64_t offset, size_t len,
+        write_handler handler)
+    {
+#ifdef _WEBSOCKETPP_SENDFILE_
+        if (socket_con_type::is_secure()) {
+            return make_error_code(transport::error::operation_not_supported);
+        }
+
+        lib::asio::error_code ec;
+        socket_con_type::get_raw_socket().native_non_blocking(true,ec);
+        if (ec) {
+            log_err(log::elevel::info,"asio async_write_file",ec);
+            return make_error_code(transport::error::operation_not_supported);
+        }
+
+        // Start from the event loop so that the handler is never called
+        // before this returns.
+        return dispatch(lib::bind(
+            &type::handle_write_file,
+            get_shared(),
+            fd,
+            offset,
+            len,
+            handler,
+            lib::asio::error_code()
+        ));
+#else
+        (void)fd; (void)offset; (void)len; (void)handler;
+        return make_error_code(transport::error::operation_not_supported);
+#endif
+    }
+
+#ifdef _WEBSOCKETPP_SENDFILE_
+    /// Write as much of a file as the socket accepts, then wait for more room
+    void handle_write_file(int fd, uint64_t offset, size_t len,
+        write_handler handler, lib::asio::error_code const & ec)
+    {
+        lib::asio::ip::tcp::socket::lowest_layer_type & socket =
+            socket_con_type::get_raw_socket();
+
+        if (ec) {
+            log_err(log::elevel::info,"asio async_write_file",ec);
+            handler(make_error_code(transport::error::pass_through));
+            return;
+        }
+
+        while (len > 0) {
+            // off_t is 32 bits wide on 32 bit builds without large file
+            // support, sendfile64 takes a 64 bit offset regardless.
+#ifdef _LARGEFILE64_SOURCE
+            off64_t off = static_cast<off64_t>(offset);
+            ssize_t n = ::sendfile64(socket.native_handle(),fd,&off,len);
+#else
+            off_t off = static_cast<off_t>(offset);
+            ssize_t n = ::sendfile(socket.native_handle(),fd,&off,len);
+#endif
+
+            if (n > 0) {
+                offset += static_cast<uint64_t>(n);
+                len -= static_cast<size_t>(n);
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                lib::function<void(lib::asio::error_code const &)> next =
+                    lib::bind(
+                        &type::handle_write_file, get_shared(),
+                        fd, offset, len, handler,
+                        lib::placeholders::_1
+                    );
+                if (config::enable_multithreading) {
+                    socket.async_wait(lib::asio::socket_base::wait_write,
+                        m_strand->wrap(next));
+                } else {
+                    socket.async_wait(lib::asio::socket_base::wait_write,
+                        next);
+                }
+                return;
+            } else {
+                // an error, or the file ended before len bytes were sent
+                m_elog->write(log::elevel::info,
+                    "asio async_write_file: sendfile failed");
+                handler(make_error_code(transport::error::pass_through));
+                return;
+            }
+        }
+
+        lib::asio::error_code nb_ec;
+        socket.native_non_blocking(false,nb_ec);
+
+        handler(lib::error_code());
+    }
+#endif
+
     /*void handle_interrupt(interrupt_handler handler) {
         handler();
     }*/
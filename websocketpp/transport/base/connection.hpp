@@ -110,6 +110,22 @@ namespace websocketpp {
  * **async_shutdown**\n
  * `void async_shutdown(shutdown_handler handler)`\n
  * Perform any cleanup necessary (if any). Call `handler` when complete.
+ *
+ * **set_cork**\n
+ * `lib::error_code set_cork(bool value)`\n
+ * Ask the transport to hold back partially filled packets until uncorked
+ * (TCP_CORK or equivalent). Optional, transports that cannot do this should
+ * return `operation_not_supported`.
+ *
+ * **async_write_file**\n
+ * `lib::error_code async_write_file(int fd, uint64_t offset, size_t len,
+ * write_handler handler)`\n
+ * Start a write of `len` bytes of the file `fd` beginning at `offset`
+ * without copying them through user space (sendfile or equivalent). The file
+ * position of `fd` is not used or changed. Optional, transports that cannot
+ * do this return `operation_not_supported` and do not call `handler`; the
+ * caller then reads the file and uses async_write instead. This counts as
+ * the one async_write in flight.
  */
 namespace transport {
 
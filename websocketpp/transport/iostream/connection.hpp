@@ -566,6 +566,28 @@ protected:
         m_connection_hdl = hdl;
     }
 
+    /// Enable or disable corking of writes
+    /**
+     * Not supported by this transport.
+     *
+     * @return operation_not_supported
+     */
+    lib::error_code set_cork(bool) {
+        return make_error_code(transport::error::operation_not_supported);
+    }
+
+    /// Write part of a file without copying it
+    /**
+     * Not supported by this transport.
+     *
+     * @return operation_not_supported
+     */
+    lib::error_code async_write_file(int, uint64_t, size_t,
+        transport::write_handler)
+    {
+        return make_error_code(transport::error::operation_not_supported);
+    }
+
     /// Call given handler back within the transport's event system (if present)
     /**
      * Invoke a callback within the transport's event system if it has one. If